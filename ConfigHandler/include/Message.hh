@@ -17,6 +17,10 @@
 
 /** @class Message
     @brief Thread-safe streaming utility with settable threshold
+
+    If no messenger would print a message at this level, nothing is
+    allocated or formatted and the message is never posted, so debug
+    messages left in hot loops cost only a level comparison.
     @ingroup ConfigHandler
 */
 class Message {
@@ -24,9 +28,11 @@ public:
   /// Default constructor
   /// @parameter level the importance of this message
   Message(MESSAGE_LEVEL level=INFO) : _level(level),
-				      _stream(new std::ostringstream) {}
+    _stream(MessageHandler::GetInstance()->IsActive(level) ? 
+	    new std::ostringstream : 0) {}
   /// Destructor; sends the message to the stream handler
-  ~Message() throw(){ MessageHandler::GetInstance()->Post(_stream,_level); }
+  ~Message() throw()
+  { if(_stream) MessageHandler::GetInstance()->Post(_stream,_level); }
   //Note it's up to the MessageHandler to delete the stream!
   
   
@@ -34,18 +40,22 @@ public:
   //The last three are necessary to catch things like std::endl
   
   /// Redirect any stream output to the internal stringstream
-  template<class T> std::ostream& operator<< (const T& t){ return *_stream<<t;}
-  std::ostream& operator<< (std::ostream& ( *pf )(std::ostream&))
-  { return *_stream<<pf; }
-  std::ostream& operator<< (std::ios& ( *pf )(std::ios&)){return *_stream<<pf; }
-  std::ostream& operator<< (std::ios_base& ( *pf )(std::ios_base&))
-  { return *_stream<<pf; }
+  template<class T> Message& operator<< (const T& t)
+  { if(_stream) *_stream<<t; return *this; }
+  Message& operator<< (std::ostream& ( *pf )(std::ostream&))
+  { if(_stream) *_stream<<pf; return *this; }
+  Message& operator<< (std::ios& ( *pf )(std::ios&))
+  { if(_stream) *_stream<<pf; return *this; }
+  Message& operator<< (std::ios_base& ( *pf )(std::ios_base&))
+  { if(_stream) *_stream<<pf; return *this; }
   
   ///Get the string used in the message
-  std::string str(){ return _stream->str(); }
+  std::string str(){ return _stream ? _stream->str() : std::string(); }
+  /// Will this message be delivered anywhere?
+  bool IsActive() const { return _stream != 0; }
 private:
   MESSAGE_LEVEL _level;         ///< The importance of this message
-  std::ostringstream* _stream;  ///< Internal stream holder
+  std::ostringstream* _stream;  ///< Internal stream holder, 0 if inactive
     
   /// Copy operator private
   Message(const Message& right) :  _level(right._level), 
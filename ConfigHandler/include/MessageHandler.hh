@@ -65,6 +65,7 @@ public:
   { 
     VMessenger* m = new Messenger<MsgAction>(thresh,act);
     _messengers.insert(m); 
+    UpdateMinThreshold();
     return m; 
   } 
   /// Remove an already registered messenger
@@ -75,6 +76,9 @@ public:
   void UpdateThreshold(){ SetThreshold(_default_threshold); }
   /// Get the default message threshold
   MESSAGE_LEVEL GetDefaultMessageThreshold(){return _default_threshold;}
+  /// Would a message at this level be delivered by any messenger?
+  bool IsActive(MESSAGE_LEVEL level) const 
+  { return level >= LoadMinThreshold() || level >= EXCEPTION; }
 
   /** @class PrintToStream
       @brief A useful message function for cout, fstream
@@ -106,6 +110,7 @@ private:
     virtual ~VMessenger() {}
     virtual void Deliver(std::ostringstream*, MESSAGE_LEVEL, time_t) = 0;
     void SetThreshold(MESSAGE_LEVEL thresh){ _thresh = thresh; }
+    MESSAGE_LEVEL GetThreshold() const { return _thresh; }
   protected:
     MESSAGE_LEVEL _thresh;
   };
@@ -121,9 +126,23 @@ private:
     MsgAction _action;
   };
   
+  /// Recalculate the lowest threshold of any messenger
+  void UpdateMinThreshold();
+  /// Read _min_threshold atomically, without taking a lock
+  int LoadMinThreshold() const
+  {
+#if defined(__ATOMIC_RELAXED) && !defined(SINGLETHREAD)
+    return __atomic_load_n(&_min_threshold, __ATOMIC_RELAXED);
+#else
+    return _min_threshold; //aligned int loads are atomic where we run
+#endif
+  }
+  
   std::set<VMessenger*> _messengers;
   static MessageHandler _instance;
   MESSAGE_LEVEL _default_threshold;
+  /// messages below this go nowhere; read from any thread without the lock
+  volatile int _min_threshold; 
 
   //special members only needed for threading
 private:
@@ -129,7 +129,8 @@ void PrintToStream::operator()(const std::string& s, MESSAGE_LEVEL level,
     _stream<<set_norm<<std::flush;
 }
   
-MessageHandler::MessageHandler() : _default_threshold(INFO)
+MessageHandler::MessageHandler() : _default_threshold(INFO), 
+				   _min_threshold(N_MESSAGE_LEVELS)
 {
   AddMessenger(INFO,PrintToStream());
 #ifndef SINGLETHREAD
@@ -174,6 +175,7 @@ MessageHandler::~MessageHandler()
       it!=_messengers.end(); ++it)
     delete *it;
   _messengers.clear();
+  _min_threshold = N_MESSAGE_LEVELS;
 }
 
 void MessageHandler::RemoveMessenger(void* messenger)
@@ -181,6 +183,7 @@ void MessageHandler::RemoveMessenger(void* messenger)
   VMessenger* m = (VMessenger*)messenger;
   if(_messengers.erase(m))
     delete m;
+  UpdateMinThreshold();
 }
 
 void MessageHandler::SetThreshold(MESSAGE_LEVEL thresh, void* messenger)
@@ -199,6 +202,24 @@ void MessageHandler::SetThreshold(MESSAGE_LEVEL thresh, void* messenger)
       (*it)->SetThreshold(thresh);
     }
   }
+  UpdateMinThreshold();
+}
+
+void MessageHandler::UpdateMinThreshold()
+{
+  MESSAGE_LEVEL thresh = N_MESSAGE_LEVELS;
+  for(std::set<VMessenger*>::iterator it = _messengers.begin();
+      it != _messengers.end(); ++it){
+    if( *it != 0 && (*it)->GetThreshold() < thresh)
+      thresh = (*it)->GetThreshold();
+  }
+#if defined(__ATOMIC_RELAXED) && !defined(SINGLETHREAD)
+  __atomic_store_n(&_min_threshold, (int)thresh, __ATOMIC_RELAXED);
+#elif !defined(SINGLETHREAD)
+  __sync_lock_test_and_set(&_min_threshold, (int)thresh);
+#else
+  _min_threshold = thresh;
+#endif
 }
 
 void MessageHandler::Deliver(std::ostringstream* msg, MESSAGE_LEVEL level,
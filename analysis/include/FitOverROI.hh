@@ -8,6 +8,7 @@
 #define FITOVERROI_h
 #include <vector>
 #include <string>
+#include <map>
 
 #include "TFitResultPtr.h"
 #include "FitTH1F.hh"
@@ -41,6 +42,14 @@ Double_t sigma_n(const Double_t* params);
 Double_t response_multi(Double_t* x, Double_t* params);
 Double_t SPEFunc(Double_t* x, Double_t* params);
 TFitResultPtr FitSPE(FitTH1F* spe, ChanFitSettings& CFS, int ntriggers, bool allow_bg = true, bool force_old = false);
+/** Fit every spectrum like FitSPE, with the settings CFS[channel id].
+    The full fits run in nthreads threads (with ROOT 6) and nothing is
+    drawn, so draw the spectra afterwards.
+    @return the number of fits that failed
+*/
+int FitSPEs(std::map<int,FitTH1F*>& spectra, ChanFitSettings CFS[], int ntriggers, int nthreads = 1, bool allow_bg = true);
+/// Use the fitted parameters of spe as the start values of the next fit
+void SetStartValues(FitTH1F* spe, ChanFitSettings& CFS);
 double pdfmean_error_corr(TFitResultPtr& fitresult);
     
 };
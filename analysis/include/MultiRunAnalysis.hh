@@ -0,0 +1,109 @@
+/** @file MultiRunAnalysis.hh
+    @brief Defines MultiRunAnalysis, which fills histograms from many runs
+    @author bloer
+    @ingroup daqroot
+*/
+
+#ifndef MULTIRUNANALYSIS_h
+#define MULTIRUNANALYSIS_h
+
+#include "Rtypes.h"
+#include <string>
+#include <vector>
+class TH1;
+
+/// @addtogroup daqroot
+/** 
+ *  @class MultiRunAnalysis
+ *  @brief Fill the same histograms from the Events trees of many runs
+ *
+ *  Histograms are defined like TTree::Draw, with an x (and optionally y)
+ *  expression and a cut, which is used as the weight.  Process() reads the
+ *  files on several threads, each file by one thread.  All expressions are
+ *  compiled once per thread with EventFormula, grouped so that terms and
+ *  cuts shared by several histograms are evaluated once per entry, and
+ *  evaluated directly on the EventData read from the tree.  Only the
+ *  branches read by the expressions are enabled.
+ *
+ *  A histogram is kept for each file, e.g. to fit the light yield of each
+ *  run, along with the sum over all files.
+ *
+ *  @ingroup daqroot
+ */
+class MultiRunAnalysis{
+public:
+  MultiRunAnalysis();
+  virtual ~MultiRunAnalysis();
+  
+  /// Add a file to process; returns its index
+  int AddFile(const char* filename);
+  /// Add a run by number, using the file pattern; returns its index
+  int AddRun(int run);
+  /// Add a vector of runs by number
+  int AddRuns(const std::vector<int>& runs);
+  /// Set the printf pattern making a filename from a run number
+  void SetFilePattern(const char* pattern){ _file_pattern = pattern; }
+  
+  /// Define a 1D histogram of xvar with weight cut; returns its index
+  int AddHistogram(const char* name, const char* xvar, const char* cut,
+		   int nbinsx, double xmin, double xmax);
+  /// Define a 2D histogram of yvar vs xvar with weight cut
+  int AddHistogram2D(const char* name, const char* xvar, const char* yvar,
+		     const char* cut, int nbinsx, double xmin, double xmax,
+		     int nbinsy, double ymin, double ymax);
+  
+  /// Fill all histograms from all files, using up to nthreads threads
+  int Process(int nthreads = 1);
+  
+  /// Get the number of files added
+  int GetNFiles() const { return _files.size(); }
+  /// Get the name of a file
+  const std::string& GetFilename(int file) const { return _files[file]; }
+  /// Get the number of entries read from a file, or -1 if it failed
+  Long64_t GetEntries(int file) const { return _entries[file]; }
+  /// Get a histogram summed over all files, or 0 if not processed
+  TH1* GetHistogram(const char* name) const;
+  /// Get a histogram of one file, or 0 if not processed
+  TH1* GetHistogram(const char* name, int file) const;
+  
+  /// Delete the histograms filled by Process
+  void ClearResults();
+  
+private:
+  /// Definition of one histogram
+  struct HistDef{
+    std::string name;
+    std::string xvar;
+    std::string yvar;   ///< empty for 1D histograms
+    std::string cut;    ///< empty for no cut
+    int nbinsx;
+    double xmin, xmax;
+    int nbinsy;
+    double ymin, ymax;
+  };
+  struct Worker;
+  
+  std::vector<HistDef> _defs;         ///< histograms to fill
+  std::vector<std::string> _files;    ///< files to read
+  std::string _file_pattern;          ///< used by AddRun
+  std::vector<std::vector<TH1*> > _results; ///< histograms by file, def
+  std::vector<TH1*> _merged;          ///< histograms summed over files
+  std::vector<Long64_t> _entries;     ///< entries read from each file
+  
+  /// Create an empty histogram for definition def
+  TH1* MakeHistogram(size_t def, const std::string& name) const;
+  /// Find the index of a histogram definition, or -1
+  int FindDef(const char* name) const;
+  /// Take files until none are left; run by each thread
+  void ProcessFiles(Worker* worker);
+  /// Fill the histograms of one file
+  void ProcessFile(size_t file, Worker* worker);
+  
+  //not copyable
+  MultiRunAnalysis(const MultiRunAnalysis&);
+  MultiRunAnalysis& operator=(const MultiRunAnalysis&);
+  
+  ClassDef(MultiRunAnalysis,0);
+};
+
+#endif
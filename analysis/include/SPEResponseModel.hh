@@ -0,0 +1,79 @@
+/** @file SPEResponseModel.hh
+    @brief Defines SPEResponseModel, the binned single pe response kernel
+    @author bloer
+    @ingroup daqroot
+*/
+
+#ifndef SPERESPONSEMODEL_h
+#define SPERESPONSEMODEL_h
+
+#include <vector>
+class TH1;
+
+/** @class SPEResponseModel
+    @brief Evaluate FitOverROI::SPEFunc on every bin of a spectrum at once
+
+    The response is a sum of shapes in x, each depending on only a few of
+    the parameters, times Poisson weights and the constant.  The shapes are
+    computed for all bin centers in one pass and kept, together with the
+    parameters they were computed for, so a minimiser step that changes
+    only e.g. LAMBDA or CONSTANT recomputes no shape at all, and one that
+    changes AMP_E recomputes only the shapes containing it.
+
+    Chi2() matches TH1::Fit's default chi-square: bins with centers in the
+    fit range and non-zero error, compared to the function at the bin
+    center.
+
+    A model holds only the state of one spectrum, so different spectra can
+    be fit simultaneously from different threads with one model each.
+    @ingroup daqroot
+*/
+class SPEResponseModel{
+public:
+  /// Use the bins of spe within the axis range and [xmin, xmax]
+  SPEResponseModel(const TH1* spe, double xmin, double xmax, int npeaks = 7);
+
+  /// Number of bins in the fit
+  int GetNBins() const { return _x.size(); }
+  /// Number of bins entering Chi2(), i.e. with non-zero error
+  int GetNChi2Bins() const { return _nchi2bins; }
+  /// Center of the fit bins
+  const std::vector<double>& GetX() const { return _x; }
+
+  /// Evaluate the response at the center of each fit bin
+  const std::vector<double>& Evaluate(const double* params);
+  /// Chi-square of the bin contents for the given parameters
+  double Chi2(const double* params);
+
+private:
+  /// Shapes sharing the same parameters, and the values they were made for
+  struct Cache{
+    unsigned deps;                  ///< bit mask of parameters used
+    bool valid;                     ///< have the shapes been computed?
+    std::vector<double> par;        ///< parameters at the last computation
+    std::vector<std::vector<double> > shapes; ///< each shape at each bin
+
+    Cache(unsigned mask, int nshapes, int nbins);
+    /// Is the cache out of date for params? Remembers params if so
+    bool Update(const double* params);
+  };
+
+  int _npeaks;                      ///< highest number of pe in the sum
+  int _nchi2bins;                   ///< bins with non-zero error
+  std::vector<double> _x;           ///< bin centers
+  std::vector<double> _y;           ///< bin contents
+  std::vector<double> _err;         ///< bin errors
+  std::vector<double> _model;       ///< response at each bin center
+  std::vector<double> _poisson;     ///< Poisson weight of each number of pe
+  double _lambda;                   ///< occupancy used for _poisson
+
+  Cache _pedestal;                  ///< 0 pe gaussian
+  Cache _exponential;               ///< terms with only the exponential
+  Cache _gaussian;                  ///< terms with only the gaussian
+  Cache _mixed;                     ///< exponential convolved with gaussian
+  Cache _multi;                     ///< gaussian for each of 3..npeaks pe
+
+  void UpdatePoisson(double lambda);
+};
+
+#endif
@@ -0,0 +1,81 @@
+/** @file SpectrumCache.hh
+    @brief Defines SpectrumCache, which keeps per-channel spectra on disk
+    @author bloer
+    @ingroup daqroot
+*/
+
+#ifndef SPECTRUMCACHE_h
+#define SPECTRUMCACHE_h
+
+#include "Rtypes.h"
+#include <map>
+#include <string>
+#include <vector>
+class FitTH1F;
+
+/// @addtogroup daqroot
+/** 
+ *  @class SpectrumCache
+ *  @brief Per-channel spectra of a processed file, filled once and cached
+ *
+ *  Each requested spectrum is a histogram per channel of an expression
+ *  looping over channels, e.g. -channels.regions[0].integral, filled
+ *  where the cut is non-zero, as with TTree::Draw.  Fill() loads the
+ *  spectra already in the cache file and fills all the others in a single
+ *  pass over the tree, reading only the branches they need, then stores
+ *  them in the cache.
+ *
+ *  The cache file is a sidecar next to the input, so the input is never
+ *  modified.  Spectra are stored under a key made of their expressions and
+ *  binning, and the whole cache is discarded when the fingerprint of the
+ *  input file (size, modification time, and checksum of its first and
+ *  last megabyte) changes, e.g. after reprocessing with genroot.
+ *
+ *  @ingroup daqroot
+ */
+class SpectrumCache{
+public:
+  /// Cache spectra of filename; the cache defaults to <file>.spectra.root
+  SpectrumCache(const char* filename, const char* cachefile = 0);
+  virtual ~SpectrumCache(){}
+  
+  /// Request a spectrum per channel; histograms are named <name><id>
+  int AddSpectrum(const char* name, const char* xvar, const char* cut, 
+		  int nbins, double xmin, double xmax);
+  /// Set the largest channel id to make spectra for (default 99); Fill
+  /// warns if the file has entries in higher channels
+  void SetMaxChannelID(int id){ _max_channel_id = id; }
+  
+  /// Load or fill all requested spectra; refill ignores the cache
+  int Fill(bool refill = false);
+  /// Get the spectra of a request by channel id; they belong to the caller
+  const std::map<int, FitTH1F*>& GetSpectra(int index) const
+  { return _requests[index].spectra; }
+  /// Get the number of entries in the input tree
+  Long64_t GetEntries() const { return _entries; }
+  
+  /// Describe a file's size, modification time, and checksum of its ends
+  static std::string GetFingerprint(const char* filename);
+  
+private:
+  /// One requested spectrum
+  struct Request{
+    std::string name;
+    std::string xvar;
+    std::string cut;
+    int nbins;
+    double xmin, xmax;
+    std::string key;        ///< all of the above, identifying the cache
+    std::string dirname;    ///< directory holding it in the cache file
+    std::map<int, FitTH1F*> spectra; ///< result for each channel
+  };
+  std::string _filename;    ///< processed input file
+  std::string _cachefile;   ///< sidecar file holding the cached spectra
+  int _max_channel_id;      ///< largest channel id to make spectra for
+  Long64_t _entries;        ///< entries in the input tree
+  std::vector<Request> _requests;
+  
+  ClassDef(SpectrumCache,0);
+};
+
+#endif
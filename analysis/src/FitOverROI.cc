@@ -22,10 +22,20 @@
 #include <sstream>
 #include "TMatrixDSym.h"
 #include "TGraph.h"
+#include "RVersion.h"
+#include "Fit/Fitter.h"
+#include "Math/Functor.h"
+#include "SPEResponseModel.hh"
 #include <fstream>
 
+#ifndef SINGLETHREAD
+#include "boost/thread.hpp"
+#include "boost/bind.hpp"
+#endif
+
 
 using namespace std;
+using namespace FitOverROI;
 
 #define HISTOGRAMWIDTH 7
 #define NPEAKS 7
@@ -152,13 +162,17 @@ Double_t FitOverROI::sigma_n(const  Double_t* params)
 Double_t FitOverROI::response_multi(Double_t* x, Double_t* params)
 {	
     double y = x[0] - mPDM;
-	
+    //the single pe mean and width are the same for every peak
+    const double mean = m_n(params);
+    const double sigma = sigma_n(params);
+    double poisson = TMath::Poisson(3,mLAM);
 		
     double response=0;
 	
     for(int i=3; i<=NPEAKS; i++)
     {
-	response += TMath::Poisson(i,mLAM) *TMath::Gaus(y,m_n(params)*i,sqrt(i*sigma_n(params)*sigma_n(params)+TMath::Power(mSHT,2)),true);
+	response += poisson*TMath::Gaus(y,mean*i,sqrt(i*sigma*sigma+mSHT*mSHT),true);
+	poisson *= mLAM/(i+1);
     }
     return mCON*response;
 }	
@@ -173,17 +187,113 @@ Double_t FitOverROI::SPEFunc(Double_t* x, Double_t* params)
 
 }
 
-TFitResultPtr FitOverROI::FitSPE(FitTH1F* spe, ChanFitSettings& CFS, int ntriggers,
-				 bool allow_bg,
-				 bool force_old)
-{
+namespace{
+  /// One spectrum with its fit function ready to fit
+  struct SPEFit{
+    FitTH1F* spe;
+    TF1* spefunc;
+    double fitmin, fitmax;
+  };
+
+  /// Fit the full response to the spectrum and store the result as TH1::Fit
+  /// with options "QMRES" would.  The chi-square is computed for all bins at
+  /// once by SPEResponseModel rather than by calling spefunc for each bin.
+  /// With threadsafe, use Minuit2 instead of TMinuit, which has globals.
+  void FitPrepared(SPEFit& fit, bool threadsafe = false)
+  {
+    TF1* spefunc = fit.spefunc;
+    SPEResponseModel model(fit.spe, fit.fitmin, fit.fitmax, NPEAKS);
+    ROOT::Math::Functor fcn(&model, &SPEResponseModel::Chi2, NPAR);
+    ROOT::Fit::Fitter fitter;
+    ROOT::Fit::FitConfig& config = fitter.Config();
+    config.SetParamsSettings(NPAR, spefunc->GetParameters());
+    //fixed parameters, limits and step sizes as in TH1::Fit
+    for(int i=0; i<NPAR; i++){
+      ROOT::Fit::ParameterSettings& par = config.ParSettings(i);
+      par.SetName(spefunc->GetParName(i));
+      double low, high;
+      spefunc->GetParLimits(i, low, high);
+      if(low*high != 0 && low >= high){
+	par.Fix();
+	continue;
+      }
+      if(low < high)
+	par.SetLimits(low, high);
+      if(spefunc->GetParError(i) > 0)
+	par.SetStepSize(spefunc->GetParError(i));
+      else if(low < high){
+	double step = 0.1*(high - low);
+	if(par.Value() < high && high - par.Value() < 2*step)
+	  step = (high - par.Value())/2;
+	else if(par.Value() > low && par.Value() - low < 2*step)
+	  step = (par.Value() - low)/2;
+	par.SetStepSize(step);
+      }
+    }
+    if(threadsafe)
+      config.SetMinimizer("Minuit2","Migrad");
+    else
+      config.SetMinimizer("Minuit","MigradImproved");
+    config.SetMinosErrors(true);
+    fitter.FitFCN(fcn, 0, model.GetNChi2Bins(), true);
+
+    const ROOT::Fit::FitResult& result = fitter.Result();
+    spefunc->SetParameters(result.GetParams());
+    spefunc->SetParErrors(result.GetErrors());
+    spefunc->SetChisquare(result.Chi2());
+    spefunc->SetNDF(result.Ndf());
+    spefunc->SetNumberFitPoints(result.Ndf() + result.NFreeParameters());
+    fit.spe->fitResult = TFitResultPtr(new TFitResult(result));
     
+    //replace the last fit stored with the histogram
+    TList* funclist = fit.spe->GetListOfFunctions();
+    TObject* old = funclist->FindObject(spefunc->GetName());
+    if(old){
+      funclist->Remove(old);
+      delete old;
+    }
+    TF1* stored = new TF1;
+    spefunc->Copy(*stored);
+    stored->SetParent(fit.spe);
+    funclist->Add(stored);
+  }
+
+#ifndef SINGLETHREAD
+  /// Fits shared by the threads of FitSPEs
+  struct FitQueue{
+    std::vector<SPEFit>* fits;
+    size_t next;
+    boost::mutex mutex;
+  };
+
+  /// Take fits from the queue until it is empty
+  void FitQueued(FitQueue* queue)
+  {
+    while(true){
+      size_t i;
+      {
+	boost::mutex::scoped_lock lock(queue->mutex);
+	if(queue->next >= queue->fits->size())
+	  return;
+	i = queue->next++;
+      }
+      FitPrepared(queue->fits->at(i), true);
+    }
+  }
+#endif
+}
+
+/// Fit the pedestal and create the response function with its start values
+/// and limits, but do not fit the full spectrum yet
+static TF1* PrepareSPEFit(FitTH1F* spe, ChanFitSettings& CFS, 
+			  bool allow_bg, bool force_old,
+			  double& fitmin, double& fitmax)
+{
     TF1* spefunc = (TF1*)gROOT->GetFunction("spefunc");
     int nEvtsInRange = (int)spe->Integral(0,spe->GetNbinsX()+1,"width");
 	
     spe->GetXaxis()->SetRangeUser(CFS.range_min, CFS.range_max);
 	
-    double fitmin, fitmax;
     fitmin = spe->GetBinLowEdge(spe->GetXaxis()->GetFirst());
     fitmax = 0;
     //find the last non-zero bin
@@ -278,22 +388,22 @@ TFitResultPtr FitOverROI::FitSPE(FitTH1F* spe, ChanFitSettings& CFS, int ntrigge
     spefunc->FixParameter(PEDMEAN, pedmean);
         
     spe->GetXaxis()->SetRangeUser(fitmin, fitmax);
-    
-    spe->Draw();
-    spefunc->Draw("same");
-
-    //spe->Fit(spefunc,"MRES");
-    //spe->Fit(spefunc,"MRL");
-    std::cout<<std::endl<<"Fitting entire spectrum"<<std::endl;
-    TFitResultPtr fitResult = spe->Fit(spefunc,"QMRES");
-    spe->fitResult= fitResult;
+    return spefunc;
+}
 
+/// Add the components of a finished fit to the spectrum and print a summary
+static void FinishSPEFit(SPEFit& fit, int ntriggers)
+{
     //spefunc->DrawCopy("same");
+    TF1* spefunc = fit.spefunc;
+    FitTH1F* spe = fit.spe;
+    const double fitmin = fit.fitmin, fitmax = fit.fitmax;
     std::cout<<endl<<"Fit Results: "<<endl
 	     <<"Fit Status: "<<spe->fitResult<<endl 
 	     <<"Chi2/NDF = "<<spefunc->GetChisquare()<<"/"<<spefunc->GetNDF()<<endl
 	     <<"Prob = "<<spefunc->GetProb()<<std::endl<<std::endl;
 
+    double params[NPAR];
     for(int i=0; i<NPAR; i++){	params[i] = spefunc->GetParameter(i);}
     TList* funclist = spe->GetListOfFunctions();
 
@@ -377,8 +487,91 @@ TFitResultPtr FitOverROI::FitSPE(FitTH1F* spe, ChanFitSettings& CFS, int ntrigge
     //			     + 2*(mAMP-mMEAN)*mPE*cov[P_E][AMP_E] 
     //			     + 2*(1-mPE)*mPE*cov[MEAN][AMP_E]);
     cout<<"Approximated pdfmean (using corr): "<<pdfmean_approx
-	<<" +- "<<pdfmean_error_corr(fitResult)<<endl;
-    return fitResult;
+	<<" +- "<<pdfmean_error_corr(spe->fitResult)<<endl;
+}
+
+TFitResultPtr FitOverROI::FitSPE(FitTH1F* spe, ChanFitSettings& CFS, int ntriggers,
+				 bool allow_bg,
+				 bool force_old)
+{
+    SPEFit fit;
+    fit.spe = spe;
+    fit.spefunc = PrepareSPEFit(spe, CFS, allow_bg, force_old, 
+				fit.fitmin, fit.fitmax);
+    
+    spe->Draw();
+    fit.spefunc->Draw("same");
+
+    //spe->Fit(spefunc,"MRES");
+    //spe->Fit(spefunc,"MRL");
+    std::cout<<std::endl<<"Fitting entire spectrum"<<std::endl;
+    FitPrepared(fit);
+    FinishSPEFit(fit, ntriggers);
+    return spe->fitResult;
+}
+
+int FitOverROI::FitSPEs(std::map<int,FitTH1F*>& spectra, ChanFitSettings CFS[],
+			int ntriggers, int nthreads, bool allow_bg)
+{
+    //the pedestal fits and function setup use ROOT's globals; do them here
+    std::vector<SPEFit> fits;
+    for(std::map<int,FitTH1F*>::iterator it = spectra.begin();
+	it != spectra.end(); it++){
+	SPEFit fit;
+	fit.spe = it->second;
+	fit.spefunc = PrepareSPEFit(fit.spe, CFS[it->first], allow_bg, false,
+				    fit.fitmin, fit.fitmax);
+	fits.push_back(fit);
+    }
+    nthreads = std::max(1, std::min(nthreads, (int)fits.size()));
+#if defined(SINGLETHREAD) || ROOT_VERSION_CODE < ROOT_VERSION(6,0,0)
+    if(nthreads > 1)
+	cerr<<"FitSPEs: fitting is not thread safe in this build; "
+	    <<"fitting with 1 thread instead of "<<nthreads<<endl;
+    nthreads = 1;
+#endif
+
+    std::cout<<std::endl<<"Fitting "<<fits.size()<<" spectra with "
+	     <<nthreads<<" threads"<<std::endl;
+    if(nthreads == 1){
+	for(size_t i=0; i<fits.size(); ++i)
+	    FitPrepared(fits[i]);
+    }
+#if !defined(SINGLETHREAD) && ROOT_VERSION_CODE >= ROOT_VERSION(6,0,0)
+    else{
+	ROOT::EnableThreadSafety();
+	FitQueue queue;
+	queue.fits = &fits;
+	queue.next = 0;
+	boost::thread_group threads;
+	for(int t=1; t<nthreads; ++t)
+	    threads.create_thread(boost::bind(FitQueued, &queue));
+	FitQueued(&queue);
+	threads.join_all();
+    }
+#endif
+
+    int nfailed = 0;
+    for(size_t i=0; i<fits.size(); ++i){
+	std::cout<<std::endl<<"Results for "<<fits[i].spe->GetName()<<std::endl;
+	FinishSPEFit(fits[i], ntriggers);
+	if(!fits[i].spe->fitResult.Get() || (int)(fits[i].spe->fitResult) != 0)
+	    ++nfailed;
+    }
+    return nfailed;
+}
+
+void FitOverROI::SetStartValues(FitTH1F* spe, ChanFitSettings& CFS)
+{
+    TF1* spefunc = spe->GetFunction("spefunc");
+    if(!spefunc)
+	return;
+    CFS.lambda_start_value = spefunc->GetParameter(LAMBDA);
+    CFS.mean_start_value = spefunc->GetParameter(MEAN);
+    CFS.sigma_start_value = spefunc->GetParameter(SIGMA);
+    CFS.amp_E_start_value = spefunc->GetParameter(AMP_E);
+    CFS.p_E_start_value = spefunc->GetParameter(P_E);
+    CFS.shotnoise_start_value = spefunc->GetParameter(SHOTNOISE);
 }
 
 double FitOverROI::pdfmean_error_corr(TFitResultPtr& fitresult)
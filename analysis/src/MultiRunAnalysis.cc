@@ -0,0 +1,380 @@
+#include "MultiRunAnalysis.hh"
+#include "EventData.hh"
+#include "EventFormula.hh"
+
+#include "TFile.h"
+#include "TTree.h"
+#include "TH1D.h"
+#include "TH2D.h"
+#include "TThread.h"
+#include "TROOT.h"
+#include "RVersion.h"
+
+#include "boost/shared_ptr.hpp"
+#ifndef SINGLETHREAD
+#include "boost/thread.hpp"
+#include "boost/bind.hpp"
+#endif
+
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <set>
+
+using namespace std;
+
+namespace{
+  /// Histograms whose terms are compiled into the same formula
+  struct Group{
+    string signature;           ///< EventFormula::GetLoopSignature()
+    EventFormula* formula;
+    vector<int> defs;           ///< index of each histogram definition
+    vector<int> xterms, yterms, cutterms; ///< term of each, or -1
+    vector<double> values;      ///< storage reused from entry to entry
+  };
+}
+
+/// State shared by the threads, and each thread's compiled expressions
+struct MultiRunAnalysis::Worker{
+  size_t* next_file;            ///< next file for a thread to take
+#ifndef SINGLETHREAD
+  boost::mutex* mutex;          ///< protects next_file and ROOT file access
+#endif
+  vector<Group> groups;
+  set<string> branches;         ///< branches read by the expressions
+  string error;
+  
+  Worker() : next_file(0)
+  {
+#ifndef SINGLETHREAD
+    mutex = 0;
+#endif
+  }
+  
+  ~Worker()
+  {
+    for(size_t g=0; g<groups.size(); ++g)
+      delete groups[g].formula;
+  }
+  
+  /// Add one term to formula, or set the error
+  int AddTerm(EventFormula& formula, const string& expr)
+  {
+    if(expr.empty())
+      return -1;
+    const int term = formula.AddTerm(expr);
+    if(term < 0)
+      error = formula.GetError();
+    return term;
+  }
+  
+  /// Compile the definitions into groups with common loops
+  bool Compile(const vector<HistDef>& defs)
+  {
+    for(size_t d=0; d<defs.size(); ++d){
+      const HistDef& def = defs[d];
+      EventFormula alone;
+      if(AddTerm(alone, def.xvar) < 0 || 
+	 (!def.yvar.empty() && AddTerm(alone, def.yvar) < 0) ||
+	 (!def.cut.empty() && AddTerm(alone, def.cut) < 0)){
+	error = def.name + ": " + error;
+	return false;
+      }
+      const string signature = alone.GetLoopSignature();
+      size_t g = 0;
+      while(g < groups.size() && groups[g].signature != signature)
+	++g;
+      if(g == groups.size()){
+	groups.push_back(Group());
+	groups.back().signature = signature;
+	groups.back().formula = new EventFormula;
+      }
+      Group& group = groups[g];
+      group.defs.push_back(d);
+      group.xterms.push_back(AddTerm(*group.formula, def.xvar));
+      group.yterms.push_back(AddTerm(*group.formula, def.yvar));
+      group.cutterms.push_back(AddTerm(*group.formula, def.cut));
+    }
+    for(size_t g=0; g<groups.size(); ++g)
+      groups[g].formula->GetBranchNames(branches);
+    return true;
+  }
+  
+private:
+  //owns the formulas, so not copyable
+  Worker(const Worker&);
+  Worker& operator=(const Worker&);
+};
+
+MultiRunAnalysis::MultiRunAnalysis() :
+  _file_pattern("/data/test_processing/single_pe/Run%06d.root")
+{}
+
+MultiRunAnalysis::~MultiRunAnalysis()
+{
+  ClearResults();
+}
+
+int MultiRunAnalysis::AddFile(const char* filename)
+{
+  _files.push_back(filename);
+  return _files.size() - 1;
+}
+
+int MultiRunAnalysis::AddRun(int run)
+{
+  char filename[1000];
+  snprintf(filename, sizeof(filename), _file_pattern.c_str(), run);
+  return AddFile(filename);
+}
+
+int MultiRunAnalysis::AddRuns(const vector<int>& runs)
+{
+  for(size_t i=0; i<runs.size(); ++i)
+    AddRun(runs[i]);
+  return runs.size();
+}
+
+int MultiRunAnalysis::AddHistogram(const char* name, const char* xvar, 
+				   const char* cut, int nbinsx, 
+				   double xmin, double xmax)
+{
+  return AddHistogram2D(name, xvar, "", cut, nbinsx, xmin, xmax, 0, 0, 0);
+}
+
+int MultiRunAnalysis::AddHistogram2D(const char* name, const char* xvar, 
+				     const char* yvar, const char* cut, 
+				     int nbinsx, double xmin, double xmax,
+				     int nbinsy, double ymin, double ymax)
+{
+  if(FindDef(name) >= 0){
+    cerr<<"MultiRunAnalysis: a histogram named "<<name
+	<<" is already defined"<<endl;
+    return -1;
+  }
+  HistDef def;
+  def.name = name;
+  def.xvar = xvar;
+  def.yvar = yvar ? yvar : "";
+  def.cut = cut ? cut : "";
+  def.nbinsx = nbinsx;
+  def.xmin = xmin;
+  def.xmax = xmax;
+  def.nbinsy = nbinsy;
+  def.ymin = ymin;
+  def.ymax = ymax;
+  _defs.push_back(def);
+  return _defs.size() - 1;
+}
+
+int MultiRunAnalysis::FindDef(const char* name) const
+{
+  for(size_t d=0; d<_defs.size(); ++d)
+    if(_defs[d].name == name)
+      return d;
+  return -1;
+}
+
+TH1* MultiRunAnalysis::MakeHistogram(size_t d, const string& name) const
+{
+  const HistDef& def = _defs[d];
+  TH1* hist = 0;
+  if(def.yvar.empty())
+    hist = new TH1D(name.c_str(), def.xvar.c_str(), 
+		    def.nbinsx, def.xmin, def.xmax);
+  else
+    hist = new TH2D(name.c_str(), (def.yvar + " vs " + def.xvar).c_str(),
+		    def.nbinsx, def.xmin, def.xmax,
+		    def.nbinsy, def.ymin, def.ymax);
+  hist->SetDirectory(0);
+  hist->Sumw2();
+  return hist;
+}
+
+void MultiRunAnalysis::ClearResults()
+{
+  for(size_t f=0; f<_results.size(); ++f)
+    for(size_t d=0; d<_results[f].size(); ++d)
+      delete _results[f][d];
+  _results.clear();
+  for(size_t d=0; d<_merged.size(); ++d)
+    delete _merged[d];
+  _merged.clear();
+  _entries.clear();
+}
+
+TH1* MultiRunAnalysis::GetHistogram(const char* name) const
+{
+  const int d = FindDef(name);
+  return (d < 0 || (size_t)d >= _merged.size()) ? 0 : _merged[d];
+}
+
+TH1* MultiRunAnalysis::GetHistogram(const char* name, int file) const
+{
+  const int d = FindDef(name);
+  if(d < 0 || file < 0 || (size_t)file >= _results.size())
+    return 0;
+  return _results[file][d];
+}
+
+void MultiRunAnalysis::ProcessFile(size_t file, Worker* worker)
+{
+  TFile* f = 0;
+  TTree* Events = 0;
+  {
+    //opening and closing files changes ROOT's global lists
+#ifndef SINGLETHREAD
+    boost::mutex::scoped_lock lock(*(worker->mutex));
+#endif
+    f = new TFile(_files[file].c_str());
+    if(f->IsOpen() && !f->IsZombie())
+      Events = (TTree*)(f->Get("Events"));
+  }
+  if(!Events){
+    cerr<<"Unable to open Events tree from file "<<_files[file]<<endl;
+#ifndef SINGLETHREAD
+    boost::mutex::scoped_lock lock(*(worker->mutex));
+#endif
+    delete f;
+    return;
+  }
+  
+  EventData* event = 0;
+  Events->SetBranchAddress(EventData::GetBranchName(), &event);
+  //only read what the expressions need
+  Events->SetBranchStatus("*", 0);
+  for(set<string>::iterator it = worker->branches.begin(); 
+      it != worker->branches.end(); ++it){
+    UInt_t found = 0;
+    Events->SetBranchStatus(("*" + *it).c_str(), 1, &found);
+  }
+  vector<TH1*>& hists = _results[file];
+  const Long64_t nentries = Events->GetEntries();
+  for(Long64_t entry = 0; entry < nentries; ++entry){
+    Events->GetEntry(entry);
+    for(size_t g=0; g<worker->groups.size(); ++g){
+      Group& group = worker->groups[g];
+      const int ninstances = group.formula->Evaluate(event, group.values);
+      const int nterms = group.formula->GetNTerms();
+      for(int i=0; i<ninstances; ++i){
+	const double* vals = &(group.values[i*nterms]);
+	for(size_t m=0; m<group.defs.size(); ++m){
+	  const double weight = group.cutterms[m] < 0 ? 1 : 
+	    vals[group.cutterms[m]];
+	  if(weight == 0)
+	    continue;
+	  TH1* hist = hists[group.defs[m]];
+	  if(group.yterms[m] < 0)
+	    hist->Fill(vals[group.xterms[m]], weight);
+	  else
+	    ((TH2D*)hist)->Fill(vals[group.xterms[m]], 
+				vals[group.yterms[m]], weight);
+	}
+      }
+    }
+  }
+  _entries[file] = nentries;
+  
+  {
+#ifndef SINGLETHREAD
+    boost::mutex::scoped_lock lock(*(worker->mutex));
+#endif
+    Events->ResetBranchAddresses();
+    delete event;
+    delete f;
+  }
+}
+
+void MultiRunAnalysis::ProcessFiles(Worker* worker)
+{
+  while(true){
+    size_t next;
+    {
+#ifndef SINGLETHREAD
+      boost::mutex::scoped_lock lock(*(worker->mutex));
+#endif
+      next = (*(worker->next_file))++;
+    }
+    if(next >= _files.size())
+      return;
+    ProcessFile(next, worker);
+  }
+}
+
+int MultiRunAnalysis::Process(int nthreads)
+{
+  ClearResults();
+  if(_defs.empty() || _files.empty()){
+    cerr<<"MultiRunAnalysis: define histograms and add files first"<<endl;
+    return 1;
+  }
+  nthreads = max(1, min(nthreads, (int)_files.size()));
+#ifdef SINGLETHREAD
+  if(nthreads > 1)
+    cerr<<"MultiRunAnalysis: compiled without threads; "
+	<<"processing with 1 thread instead of "<<nthreads<<endl;
+  nthreads = 1;
+#endif
+  
+  //each thread evaluates its own copy of the expressions
+  vector<boost::shared_ptr<Worker> > workers;
+  size_t next_file = 0;
+#ifndef SINGLETHREAD
+  boost::mutex mutex;
+#endif
+  for(int t=0; t<nthreads; ++t){
+    workers.push_back(boost::shared_ptr<Worker>(new Worker));
+    Worker& worker = *workers.back();
+    worker.next_file = &next_file;
+#ifndef SINGLETHREAD
+    worker.mutex = &mutex;
+#endif
+    if(!worker.Compile(_defs)){
+      cerr<<"MultiRunAnalysis: "<<worker.error<<endl;
+      return 1;
+    }
+  }
+  
+  //create all histograms here so the threads only fill them
+  _results.resize(_files.size());
+  _entries.assign(_files.size(), -1);
+  for(size_t f=0; f<_files.size(); ++f){
+    for(size_t d=0; d<_defs.size(); ++d){
+      stringstream name;
+      name<<_defs[d].name<<"_file"<<f;
+      _results[f].push_back(MakeHistogram(d, name.str()));
+    }
+  }
+  
+#ifndef SINGLETHREAD
+  if(nthreads > 1){
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,0,0)
+    ROOT::EnableThreadSafety();
+#else
+    TThread::Initialize();
+#endif
+  }
+  boost::thread_group threads;
+  for(int t=1; t<nthreads; ++t)
+    threads.create_thread(boost::bind(&MultiRunAnalysis::ProcessFiles, this,
+				      workers[t].get()));
+  ProcessFiles(workers[0].get());
+  threads.join_all();
+#else
+  ProcessFiles(workers[0].get());
+#endif
+  
+  //sum over the files
+  for(size_t d=0; d<_defs.size(); ++d){
+    _merged.push_back(MakeHistogram(d, _defs[d].name));
+    for(size_t f=0; f<_files.size(); ++f)
+      _merged[d]->Add(_results[f][d]);
+  }
+  int nfailed = count(_entries.begin(), _entries.end(), -1);
+  if(nfailed)
+    cerr<<"MultiRunAnalysis: "<<nfailed<<" of "<<_files.size()
+	<<" files could not be read"<<endl;
+  return nfailed;
+}
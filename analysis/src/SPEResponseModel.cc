@@ -0,0 +1,192 @@
+#include "SPEResponseModel.hh"
+#include "FitOverROI.hh"
+
+#include "TH1.h"
+#include "TAxis.h"
+#include "TMath.h"
+#include <cmath>
+
+using namespace FitOverROI;
+
+namespace{
+  /// Bit for a parameter in a Cache's mask
+  unsigned Bit(int par){ return 1u << par; }
+
+  /// TMath::Gaus(x, mean, sigma, true), without the function call
+  inline double NormGaus(double x, double mean, double sigma)
+  {
+    if(sigma == 0)
+      return 1.e30;
+    const double z = (x - mean)/sigma;
+    return std::exp(-0.5*z*z) / (std::sqrt(2*TMath::Pi())*sigma);
+  }
+}
+
+SPEResponseModel::Cache::Cache(unsigned mask, int nshapes, int nbins) :
+  deps(mask), valid(false), par(NPAR, 0),
+  shapes(nshapes, std::vector<double>(nbins, 0))
+{}
+
+bool SPEResponseModel::Cache::Update(const double* params)
+{
+  bool changed = !valid;
+  for(int i=0; i<NPAR; ++i){
+    if((deps & Bit(i)) && par[i] != params[i]){
+      changed = true;
+      par[i] = params[i];
+    }
+  }
+  valid = true;
+  return changed;
+}
+
+SPEResponseModel::SPEResponseModel(const TH1* spe, double xmin, double xmax,
+				   int npeaks) :
+  _npeaks(npeaks), _nchi2bins(0), _lambda(-1),
+  _pedestal(Bit(PEDMEAN) | Bit(SHOTNOISE), 1, 0),
+  _exponential(Bit(PEDMEAN) | Bit(SHOTNOISE) | Bit(AMP_E), 2, 0),
+  _gaussian(Bit(PEDMEAN) | Bit(SHOTNOISE) | Bit(MEAN) | Bit(SIGMA), 2, 0),
+  _mixed(Bit(PEDMEAN) | Bit(SHOTNOISE) | Bit(MEAN) | Bit(SIGMA) | Bit(AMP_E),
+	 1, 0),
+  _multi(Bit(PEDMEAN) | Bit(SHOTNOISE) | Bit(MEAN) | Bit(SIGMA) |
+	 Bit(AMP_E) | Bit(P_E), (npeaks > 2 ? npeaks-2 : 0), 0)
+{
+  const TAxis* axis = spe->GetXaxis();
+  for(int bin = axis->GetFirst(); bin <= axis->GetLast(); ++bin){
+    const double x = axis->GetBinCenter(bin);
+    if(x < xmin || x > xmax)
+      continue;
+    _x.push_back(x);
+    _y.push_back(spe->GetBinContent(bin));
+    _err.push_back(spe->GetBinError(bin));
+    if(_err.back() > 0)
+      ++_nchi2bins;
+  }
+  const int nbins = _x.size();
+  _model.resize(nbins);
+  Cache* caches[] = { &_pedestal, &_exponential, &_gaussian, &_mixed, &_multi };
+  for(int c=0; c<5; ++c){
+    for(size_t s=0; s<caches[c]->shapes.size(); ++s)
+      caches[c]->shapes[s].resize(nbins);
+  }
+  _poisson.resize(npeaks+1);
+}
+
+void SPEResponseModel::UpdatePoisson(double lambda)
+{
+  if(lambda == _lambda)
+    return;
+  _lambda = lambda;
+  double weight = TMath::Poisson(0, lambda);
+  for(int i=0; i<=_npeaks; ++i){
+    _poisson[i] = weight;
+    weight *= lambda/(i+1);
+  }
+}
+
+const std::vector<double>& SPEResponseModel::Evaluate(const double* params)
+{
+  const int nbins = _x.size();
+  const double pdm = params[PEDMEAN], sht = params[SHOTNOISE];
+  const double amp = params[AMP_E], pe = params[P_E];
+  const double mean = params[MEAN], sig = params[SIGMA];
+  const double sqrt2 = std::sqrt(2.);
+
+  //each block below is the part of response_0, 1, 2 or multi in FitOverROI
+  //depending only on that cache's parameters
+  if(_pedestal.Update(params)){
+    std::vector<double>& g0 = _pedestal.shapes[0];
+    for(int i=0; i<nbins; ++i)
+      g0[i] = NormGaus(_x[i] - pdm, 0, sht);
+  }
+
+  if(_exponential.Update(params)){
+    std::vector<double>& e1 = _exponential.shapes[0];
+    std::vector<double>& e2 = _exponential.shapes[1];
+    for(int i=0; i<nbins; ++i){
+      const double y = _x[i] - pdm;
+      const double e = std::exp((-2*amp*y + sht*sht)/(2.*amp*amp));
+      e1[i] = e*(1 + TMath::Erf(((amp*y)/sht - sht)/(sqrt2*amp)))/(2.*amp);
+      e2[i] = e*(amp*y - sht*sht)/(amp*amp*amp);
+    }
+  }
+
+  if(_gaussian.Update(params)){
+    std::vector<double>& g1 = _gaussian.shapes[0];
+    std::vector<double>& g2 = _gaussian.shapes[1];
+    const double sigma_1 = std::sqrt(sht*sht + sig*sig);
+    const double cutoff = 1 + TMath::Erf(mean/(sqrt2*sig));
+    const double var2 = sht*sht + 2*sig*sig;
+    const double norm2 = 2*std::sqrt(2/TMath::Pi()) /
+      (sht*std::sqrt(2/(sht*sht) + 1/(sig*sig))*sig*cutoff*cutoff);
+    for(int i=0; i<nbins; ++i){
+      const double y = _x[i] - pdm;
+      g1[i] = std::exp(-(mean-y)*(mean-y)/(2*sigma_1*sigma_1)) *
+	(1 + TMath::Erf((mean*sht*sht + sig*sig*y)/
+			(sqrt2*sig*sht*sigma_1))) /
+	(std::sqrt(2*TMath::Pi())*sigma_1*cutoff);
+      g2[i] = norm2 * std::exp(-(y - 2*mean)*(y - 2*mean)/(2.*var2));
+    }
+  }
+
+  if(_mixed.Update(params)){
+    std::vector<double>& m2 = _mixed.shapes[0];
+    const double cutoff = 1 + TMath::Erf(mean/(sqrt2*sig));
+    const double var = sht*sht + sig*sig;
+    for(int i=0; i<nbins; ++i){
+      const double y = _x[i] - pdm;
+      m2[i] = 2*std::exp((2*amp*mean - 2*amp*y + var)/(2.*amp*amp)) *
+	(-1 + TMath::Erf((amp*(mean - y) + var)/(amp*std::sqrt(2*var)))) /
+	(amp*cutoff);
+    }
+  }
+
+  if(_multi.Update(params)){
+    const double m = m_n(params);
+    const double s = sigma_n(params);
+    for(int n=3; n<=_npeaks; ++n){
+      std::vector<double>& gn = _multi.shapes[n-3];
+      const double width = std::sqrt(n*s*s + sht*sht);
+      for(int i=0; i<nbins; ++i)
+	gn[i] = NormGaus(_x[i] - pdm, m*n, width);
+    }
+  }
+
+  //combine the shapes with the scalar parameters
+  UpdatePoisson(params[LAMBDA]);
+  const double con = params[CONSTANT];
+  const double c0 = con*_poisson[0];
+  const double c1e = con*_poisson[1]*pe, c1g = con*_poisson[1]*(1-pe);
+  const double c2e = con*_poisson[2]*pe*pe;
+  const double c2g = con*_poisson[2]*(pe-1)*(pe-1);
+  const double c2m = con*_poisson[2]*(pe-1)*pe;
+  const std::vector<double>& g0 = _pedestal.shapes[0];
+  const std::vector<double>& e1 = _exponential.shapes[0];
+  const std::vector<double>& e2 = _exponential.shapes[1];
+  const std::vector<double>& g1 = _gaussian.shapes[0];
+  const std::vector<double>& g2 = _gaussian.shapes[1];
+  const std::vector<double>& m2 = _mixed.shapes[0];
+  for(int i=0; i<nbins; ++i)
+    _model[i] = c0*g0[i] + c1e*e1[i] + c1g*g1[i] +
+      c2e*e2[i] + c2g*g2[i] + c2m*m2[i];
+  for(int n=3; n<=_npeaks; ++n){
+    const double cn = con*_poisson[n];
+    const std::vector<double>& gn = _multi.shapes[n-3];
+    for(int i=0; i<nbins; ++i)
+      _model[i] += cn*gn[i];
+  }
+  return _model;
+}
+
+double SPEResponseModel::Chi2(const double* params)
+{
+  const std::vector<double>& model = Evaluate(params);
+  double chi2 = 0;
+  for(size_t i=0; i<model.size(); ++i){
+    if(_err[i] <= 0)
+      continue;
+    const double r = (_y[i] - model[i])/_err[i];
+    chi2 += r*r;
+  }
+  return chi2;
+}
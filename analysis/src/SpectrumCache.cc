@@ -0,0 +1,225 @@
+#include "SpectrumCache.hh"
+#include "MultiRunAnalysis.hh"
+#include "FitTH1F.hh"
+
+#include "TFile.h"
+#include "TDirectory.h"
+#include "TKey.h"
+#include "TList.h"
+#include "TNamed.h"
+#include "TH2D.h"
+
+#include <zlib.h>
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+SpectrumCache::SpectrumCache(const char* filename, const char* cachefile) :
+  _filename(filename), _max_channel_id(99), _entries(-1)
+{
+  if(cachefile)
+    _cachefile = cachefile;
+  else{
+    _cachefile = _filename;
+    const size_t pos = _cachefile.rfind(".root");
+    if(pos != string::npos && pos + 5 == _cachefile.size())
+      _cachefile.erase(pos);
+    _cachefile += ".spectra.root";
+  }
+}
+
+int SpectrumCache::AddSpectrum(const char* name, const char* xvar, 
+			       const char* cut, int nbins, 
+			       double xmin, double xmax)
+{
+  Request req;
+  req.name = name;
+  req.xvar = xvar;
+  req.cut = cut ? cut : "";
+  req.nbins = nbins;
+  req.xmin = xmin;
+  req.xmax = xmax;
+  stringstream key;
+  key.precision(17);
+  key<<req.name<<"|"<<req.xvar<<"|"<<req.cut<<"|"<<nbins<<"|"<<xmin<<"|"<<xmax;
+  req.key = key.str();
+  char dirname[100];
+  sprintf(dirname, "spectra_%08lx", 
+	  adler32(1, (const Bytef*)(req.key.c_str()), req.key.size()));
+  req.dirname = dirname;
+  _requests.push_back(req);
+  return _requests.size() - 1;
+}
+
+string SpectrumCache::GetFingerprint(const char* filename)
+{
+  struct stat info;
+  if(stat(filename, &info))
+    return "";
+  const long chunk = 1<<20;
+  unsigned long checksum = adler32(0, 0, 0);
+  FILE* f = fopen(filename, "rb");
+  if(f){
+    vector<unsigned char> buf(chunk);
+    size_t n = fread(&buf[0], 1, chunk, f);
+    checksum = adler32(checksum, &buf[0], n);
+    if(info.st_size > 2*chunk && !fseek(f, -chunk, SEEK_END)){
+      n = fread(&buf[0], 1, chunk, f);
+      checksum = adler32(checksum, &buf[0], n);
+    }
+    fclose(f);
+  }
+  stringstream s;
+  s<<"size="<<info.st_size<<";mtime="<<info.st_mtime<<";adler32="
+   <<hex<<checksum;
+  return s.str();
+}
+
+int SpectrumCache::Fill(bool refill)
+{
+  const string fingerprint = GetFingerprint(_filename.c_str());
+  if(fingerprint.empty()){
+    cerr<<"Unable to open file "<<_filename<<endl;
+    return -1;
+  }
+  
+  //drop the cache if the input has changed since it was filled
+  TDirectory* olddir = gDirectory;
+  TFile* cache = new TFile(_cachefile.c_str(), "UPDATE");
+  if(!cache->IsOpen() || cache->IsZombie()){
+    cerr<<"Unable to open spectrum cache "<<_cachefile
+	<<"; spectra will not be saved"<<endl;
+    delete cache;
+    cache = 0;
+  }
+  else{
+    TNamed* stored = (TNamed*)(cache->Get("fingerprint"));
+    if(!stored || fingerprint != stored->GetTitle()){
+      //the T prefix also removes the spectra_* subdirectories
+      cache->Delete("T*;*");
+      TNamed("fingerprint", fingerprint.c_str()).Write();
+    }
+    delete stored;
+    TNamed* entries = (TNamed*)(cache->Get("entries"));
+    if(entries)
+      istringstream(entries->GetTitle()) >> _entries;
+    delete entries;
+  }
+  
+  vector<size_t> missing;
+  for(size_t i=0; i<_requests.size(); ++i){
+    Request& req = _requests[i];
+    req.spectra.clear();
+    TDirectory* dir = cache ? cache->GetDirectory(req.dirname.c_str()) : 0;
+    TNamed* key = dir ? (TNamed*)(dir->Get("key")) : 0;
+    if(refill || !key || req.key != key->GetTitle() || _entries < 0){
+      missing.push_back(i);
+      delete key;
+      continue;
+    }
+    delete key;
+    TIter next(dir->GetListOfKeys());
+    while(TKey* objkey = (TKey*)next()){
+      string name = objkey->GetName();
+      if(name.compare(0, 2, "ch") != 0)
+	continue;
+      FitTH1F* hist = (FitTH1F*)(objkey->ReadObj());
+      hist->SetDirectory(0);
+      hist->SetName((req.name + name.substr(2)).c_str());
+      req.spectra[atoi(name.c_str() + 2)] = hist;
+    }
+    cout<<"Loaded cached spectra "<<req.name<<" for "<<req.spectra.size()
+	<<" channels"<<endl;
+  }
+  
+  if(!missing.empty()){
+    //one pass over the tree for everything not cached, by channel id
+    MultiRunAnalysis filler;
+    filler.AddFile(_filename.c_str());
+    for(size_t m=0; m<missing.size(); ++m){
+      const Request& req = _requests[missing[m]];
+      filler.AddHistogram2D(req.dirname.c_str(), req.xvar.c_str(), 
+			    "channels.channel_id", req.cut.c_str(),
+			    req.nbins, req.xmin, req.xmax,
+			    _max_channel_id+1, -0.5, _max_channel_id+0.5);
+    }
+    cout<<"Filling "<<missing.size()<<" spectra from "<<_filename<<endl;
+    if(filler.Process(1)){
+      if(cache)
+	cache->Close();
+      delete cache;
+      olddir->cd();
+      return -1;
+    }
+    _entries = filler.GetEntries(0);
+    
+    for(size_t m=0; m<missing.size(); ++m){
+      Request& req = _requests[missing[m]];
+      TH2D* filled = (TH2D*)(filler.GetHistogram(req.dirname.c_str(), 0));
+      double dropped = 0;
+      for(int bin=0; bin <= req.nbins+1; ++bin)
+	dropped += filled->GetBinContent(bin, _max_channel_id+2);
+      if(dropped > 0)
+	cerr<<"Warning: "<<req.name<<" has "<<dropped<<" entries in channels "
+	    <<"above "<<_max_channel_id<<", which are not kept; "
+	    <<"raise SetMaxChannelID"<<endl;
+      for(int id=0; id <= _max_channel_id; ++id){
+	const int ybin = id+1;
+	double total = 0;
+	for(int bin=0; bin <= req.nbins+1; ++bin)
+	  total += filled->GetBinContent(bin, ybin);
+	if(total == 0)
+	  continue;
+	stringstream name;
+	name<<req.name<<id;
+	FitTH1F* hist = new FitTH1F(name.str().c_str(), name.str().c_str(), 
+				    req.nbins, req.xmin, req.xmax);
+	hist->SetDirectory(0);
+	hist->Sumw2();
+	for(int bin=0; bin <= req.nbins+1; ++bin){
+	  hist->SetBinContent(bin, filled->GetBinContent(bin, ybin));
+	  hist->SetBinError(bin, filled->GetBinError(bin, ybin));
+	}
+	hist->SetEntries(total);
+	req.spectra[id] = hist;
+      }
+      
+      if(cache){
+	//replace the whole directory of an outdated entry
+	cache->Delete((req.dirname + ";*").c_str());
+	TDirectory* dir = cache->mkdir(req.dirname.c_str());
+	if(!dir){
+	  cerr<<"Unable to create "<<req.dirname<<" in "<<_cachefile
+	      <<"; "<<req.name<<" will not be cached"<<endl;
+	  continue;
+	}
+	dir->cd();
+	TNamed("key", req.key.c_str()).Write();
+	for(map<int, FitTH1F*>::iterator it = req.spectra.begin();
+	    it != req.spectra.end(); ++it){
+	  stringstream name;
+	  name<<"ch"<<it->first;
+	  dir->WriteTObject(it->second, name.str().c_str());
+	}
+	cache->cd();
+      }
+    }
+    if(cache){
+      stringstream entries;
+      entries<<_entries;
+      TNamed("entries", entries.str().c_str()).Write("", TObject::kOverwrite);
+    }
+  }
+  
+  if(cache){
+    cache->Close();
+    delete cache;
+  }
+  olddir->cd();
+  return 0;
+}
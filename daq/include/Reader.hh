@@ -9,6 +9,7 @@
 
 #include <zlib.h>
 #include <string>
+#include <vector>
 #include "RawEvent.hh"
 #include "VParameterNode.hh"
 
@@ -28,6 +29,8 @@ public:
   bool IsOk(){ return _ok; } 
   ///Check if we've reached the end of the file
   bool eof(){ return _end_last_file || ( gzeof(_fin) && OpenNextFile() ); }
+  /// Is the current file gzip-compressed? Seeking in it inflates from the start
+  bool IsCompressed(){ return _fin && !gzdirect(_fin); }
   //All event getters return null pointer if error
   /// Get the next event in the file
   RawEventPtr GetNextEvent(bool read_header = true);   
@@ -39,6 +42,20 @@ public:
   RawEventPtr GetLastEvent();
   /// Return the index of the current event in the file
   int GetCurrentIndex(){ return _current_index; }
+  /** Scan the headers of every event in the file set and record where each
+      event starts.  Afterwards GetEventWithID and GetEventWithIndex seek
+      directly to the event instead of skipping through the file.
+      @return the number of events found, or -1 on error
+  */
+  int BuildIndex();
+  /// Use the index built by <other> for the same file set, without rescanning
+  void CopyIndex(const Reader& other);
+  /// Has BuildIndex been called?
+  bool HasIndex() const { return _indexed; }
+  /// Get the number of indexed events
+  int GetNIndexed() const { return _index.size(); }
+  /// Get the id of the event at index <index>, found by BuildIndex
+  uint32_t GetIndexedID(int index) const { return _index.at(index).event_id; }
   /// Load the parameter <par> from the saved config file
   bool GetAssociatedParameter(VParameterNode* par, 
 			      std::string key="");
@@ -90,6 +107,13 @@ public:
     uint32_t timestamp;
   };
 
+  /// Location of one event, found by BuildIndex
+  struct index_entry{
+    uint32_t event_id;    ///< id of the event
+    uint32_t file_index;  ///< index of the file in the series
+    z_off_t offset;       ///< position of the event header in that file
+  };
+
 private:
   const std::string _filename; ///< raw filename
   gzFile _fin; ///< gzip file that we are reading from 
@@ -103,6 +127,11 @@ private:
   std::string _current_file_name; ///< Name of current file in series
   static const uint32_t _unset_file_index = 0xFFFFFFFF;
   bool _end_last_file; ///< have we reached the end of the last file?
+  std::vector<index_entry> _index; ///< location of every event, in order
+  bool _indexed; ///< has the index been built?
+  bool _index_sorted; ///< are the indexed ids increasing?
+  bool _header_pending; ///< _ehead was read, but not its event
+  uint32_t _pending_after; ///< id of the event before the pending header
   
   /// See if the last read operation completed successfully
   bool ErrorCheck(int bytes_read, int bytes_requested); 
@@ -113,6 +142,8 @@ private:
   int ReadNextHeader();
   /// Skip over this event to the next one
   z_off_t SkipNextEvent(bool skip_header = true);
+  /// Seek to and read the event at position <index> in the index
+  RawEventPtr ReadIndexedEvent(size_t index);
   
   /// Open the next file in the series
   int OpenNextFile();
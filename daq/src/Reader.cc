@@ -5,12 +5,22 @@
 #include <fstream>
 #include <stdexcept>
 #include <iomanip>
+#include <algorithm>
+
+namespace{
+  /// Order index entries by event id, for binary searches
+  struct IdBefore{
+    bool operator()(const Reader::index_entry& entry, uint32_t id) const
+    { return entry.event_id < id; }
+  };
+}
 
 Reader::Reader(const std::string& filename) : 
   _filename(filename), _fin(0),  _ok(true),
   _current_index(-1), _current_event(), _current_file_index(_unset_file_index),
   _current_file_name(""),
-  _end_last_file(false)
+  _end_last_file(false), _indexed(false), _index_sorted(false),
+  _header_pending(false), _pending_after(0)
 {
   
   if(!OpenNextFile()){
@@ -77,6 +87,11 @@ int Reader::ReadNextHeader()
     Message(ERROR)<<"Attempt to read from file in bad state.\n";
     return 1;
   }
+  //a search by id may have stopped just after reading this header
+  if(_header_pending){
+    _header_pending = false;
+    return 0;
+  }
   //see if we need to open the next file
   if(eof()){
     Message(DEBUG)<<"Reached end of files to search.\n";
@@ -114,6 +129,11 @@ int Reader::ReadNextHeader()
 
 z_off_t Reader::SkipNextEvent(bool skip_header)
 {
+  if(_header_pending){
+    //only the rest of the event is left to skip
+    _header_pending = false;
+    skip_header = false;
+  }
   //see if we need to open the next file
   if(gzeof(_fin) && OpenNextFile()){
     Message(DEBUG)<<"Reached end of files to search.\n";
@@ -244,6 +264,79 @@ RawEventPtr Reader::GetLastEvent()
 }
  
 
+int Reader::BuildIndex()
+{
+  if(!_ok){
+    Message(ERROR)<<"Attempt to read from file in bad state.\n";
+    return -1;
+  }
+  _index.clear();
+  _indexed = false;
+  if(Reset())
+    return -1;
+  _index_sorted = true;
+  while(!ReadNextHeader()){
+    index_entry entry;
+    entry.event_id = _ehead.event_id;
+    entry.file_index = _current_file_index;
+    entry.offset = gztell(_fin) - (_ghead.event_header_version == 0 ? 
+				   sizeof(event_header_v0) : 
+				   sizeof(event_header));
+    if(!_index.empty() && entry.event_id <= _index.back().event_id)
+      _index_sorted = false;
+    _index.push_back(entry);
+    if(SkipNextEvent(false) < 0){
+      Message(ERROR)<<"Unable to skip over event "<<entry.event_id<<"\n";
+      _ok = false;
+    }
+  }
+  if(!_ok){
+    _index.clear();
+    return -1;
+  }
+  if(!_index_sorted)
+    Message(WARNING)<<"Event ids in "<<_filename<<" are not increasing; "
+		    <<"events will be searched for by id.\n";
+  Message(DEBUG)<<"Indexed "<<_index.size()<<" events in "<<_filename<<"\n";
+  _indexed = true;
+  Reset();
+  return _index.size();
+}
+
+void Reader::CopyIndex(const Reader& other)
+{
+  _index = other._index;
+  _indexed = other._indexed;
+  _index_sorted = other._index_sorted;
+}
+
+RawEventPtr Reader::ReadIndexedEvent(size_t index)
+{
+  const index_entry& entry = _index[index];
+  //files can only be opened in sequence, so go back to the start if needed
+  if(!_fin || _end_last_file || entry.file_index < _current_file_index){
+    if(Reset())
+      return RawEventPtr();
+  }
+  while(_current_file_index != entry.file_index){
+    if(OpenNextFile()){
+      Message(ERROR)<<"Unable to reopen file "<<entry.file_index
+		    <<" of the series.\n";
+      return RawEventPtr();
+    }
+  }
+  if(gzseek(_fin, entry.offset, SEEK_SET) < 0){
+    Message(ERROR)<<"Unable to seek to event "<<entry.event_id<<"\n";
+    _ok = false;
+    return RawEventPtr();
+  }
+  _current_index = (long)index - 1;
+  _header_pending = false;
+  if(ReadNextHeader())
+    return RawEventPtr();
+  return GetNextEvent(false);
+}
+
 RawEventPtr Reader::GetEventWithIndex(int index)
 {
   if(!_ok){
@@ -252,6 +345,13 @@ RawEventPtr Reader::GetEventWithIndex(int index)
   }
   if(index == _current_index) 
     return _current_event;
+  if(_indexed){
+    if(index < 0 || index >= (int)_index.size()){
+      Message(ERROR)<<"There is no event with index "<<index<<"\n";
+      return RawEventPtr();
+    }
+    return ReadIndexedEvent(index);
+  }
   //we can't read backward one event at a time, so if requested index
   //is lower than current, we have to rewind the whole file
   if(index < _current_index){
@@ -285,8 +385,23 @@ RawEventPtr Reader::GetEventWithID(uint32_t id)
     Reset();
     return GetNextEvent();
   }
-  if(id == _ehead.event_id)
+  if(id == _ehead.event_id && !_header_pending)
     return _current_event;
+  if(_indexed && _index_sorted){
+    std::vector<index_entry>::iterator it = 
+      std::lower_bound(_index.begin(), _index.end(), id, IdBefore());
+    if(it == _index.end() || it->event_id != id){
+      Message(ERROR)<<"Event with id "<<id
+		    <<" is not present in this file set.\n";
+      return RawEventPtr();
+    }
+    return ReadIndexedEvent(it - _index.begin());
+  }
+  //after a missing id, ids between it and the next event are missing too
+  if(_header_pending && id > _pending_after && id < _ehead.event_id){
+    Message(ERROR)<<"Event with id "<<id<<" is not present in this file.\n";
+    return RawEventPtr();
+  }
   //we can't read backward one event at a time, so if requested id
   //is lower than current, we have to rewind the whole file
   if(id != 0 && id < _ehead.event_id ){
@@ -305,6 +420,7 @@ RawEventPtr Reader::GetEventWithID(uint32_t id)
   }
   
   while(_ok && !_end_last_file ){
+    const uint32_t previous_id = _ehead.event_id;
     //read in the current header so we know how long to seek
     if(ReadNextHeader())
       return RawEventPtr();
@@ -313,6 +429,9 @@ RawEventPtr Reader::GetEventWithID(uint32_t id)
     }
     else if(_ehead.event_id > id){
       Message(ERROR)<<"Event with id "<<id<<" is not present in this file.\n";
+      //keep the header, so the next search continues from this event
+      _header_pending = true;
+      _pending_after = previous_id;
       return RawEventPtr();
     }
     //still deeper in the file; skip to next
@@ -472,6 +591,7 @@ int Reader::OpenNextFile()
   }
   
   _ehead.reset();
+  _header_pending = false;
   //read in the global file header
   //assume we're using the latest header, then check to make sure
   gzread(_fin, &_ghead, _ghead.global_header_size);
@@ -54,7 +54,7 @@ Finally, to actually take data, you'll use the daqman executable.  All the execu
     - daqview: view events one-by-one from a data file. Each channel has an ID (0-7 are PMTs, -2 is the sum). If you use the --cfg option to provide a configuration file, you can have peak finders and other nice things
     - ascii_dump: write pulses to text files
     - boardcheck: checks digitizers' status
-    - genroot: creates ROOT tree from raw data file
+    - genroot: creates ROOT tree from raw data file; --jobs processes each file with several parallel jobs and merges their output. Seeking in a gzip-compressed raw file decompresses it from the start, so compressed files are always processed with a single job
     - laserrun: takes a processes ROOT file and fits the single photon response of each channel; optionally saves the result to the database.
     - run_info: given a raw data file, prints out the run information
     - updatefile: modifies a raw data file according to command-line options and cfg file
@@ -26,6 +26,7 @@
 #include "Integrator.hh"
 #include "EvalRois.hh"
 #include "SpectrumMaker.hh"
+#include "SpectrumManager.hh"
 #include "ConvertData.hh"
 #include "SumChannels.hh"
 #include "TriggerHistory.hh"
@@ -136,6 +137,9 @@ int main(int argc, char** argv)
   //keep this for backward compatibility
   modules->RegisterReadFunction("add_spectrum", SpectrumAdder(spectra),
 				"Add a new real-time spectrum to display");
+  //the spectra are evaluated together by one manager
+  SpectrumManager* spectrum_manager = new SpectrumManager;
+  modules->RegisterParameter(spectrum_manager->GetName(), *spectrum_manager);
 
     
   //initialize some options for command switches
@@ -201,8 +205,12 @@ int main(int argc, char** argv)
   if(spectra.size() > 0){
     //for right now, put the spectra all on one thread
     thread1.AddReceiver(&thread3);
-    for(size_t i=0; i<spectra.size(); ++i)
-      thread3.AddModule((spectra[i]), true, false);
+    //the spectra are only initialized; the manager fills them
+    for(size_t i=0; i<spectra.size(); ++i){
+      modules->AddModule(spectra[i], false, false);
+      spectrum_manager->AddSpectrum(spectra[i]);
+    }
+    thread3.AddModule(spectrum_manager, true, false);
     async_threads.push_back(&thread3);
   }
   
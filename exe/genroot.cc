@@ -16,10 +16,25 @@
 #include "FParameter.hh"
 #include "Fitter.hh"
 #include "SpeFinder.hh"
+#include "SpectrumMaker.hh"
+#include "SpectrumManager.hh"
+#include "eTrainFinder.hh"
 #include "PulseFinder.hh"
 #include "RootWriter.hh"
 #include "ConvertData.hh"
+#include "TFile.h"
+#include "TTree.h"
+#include "TChain.h"
+#include "TList.h"
 #include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/wait.h>
 
 
 
@@ -43,16 +58,53 @@ void SetOutputFile(RootWriter* writer, const char* inputfile){
   }
 }
 
-/// Fully process a single raw data file
-int ProcessOneFile(const char* filename, std::string event_file, int max_event=-1, int min_event=0)
+/// Read the ids in event_file within [min_event, max_event), sorted and unique
+int ReadEventList(const std::string& event_file, int min_event, int max_event,
+		  std::vector<uint32_t>& ids)
+{
+  std::ifstream eventlist(event_file.c_str());
+  if (!eventlist.is_open()){
+    Message(ERROR)<<"Unable to open event-list file "<<event_file<<endl;
+    return 1;
+  }
+  int id;
+  while(eventlist>>id){
+    if(id < min_event || (max_event > 0 && id >= max_event))
+      continue;
+    ids.push_back(id);
+  }
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  return 0;
+}
+
+/** Pass only the headers of event id through ConvertData, to set the run 
+    start time and the time of the last event without decoding waveforms
+*/
+int ConvertHeaders(Reader& reader, ConvertData* converter, uint32_t id)
+{
+  RawEventPtr raw = reader.GetEventWithID(id);
+  if(!raw){
+    Message(ERROR)<<"Problem encountered reading event "<<id<<std::endl;
+    return 1;
+  }
+  const bool headers_only = converter->GetHeadersOnly();
+  converter->SetHeadersOnly(true);
+  EventPtr evt(new Event(raw));
+  int err = converter->Process(evt);
+  converter->SetHeadersOnly(headers_only);
+  return err;
+}
+
+/** Process the events of reader from min_event to max_event, or only those
+    in ids if use_elist is set, through the module chain
+*/
+int ProcessEvents(Reader& reader, const std::vector<uint32_t>& ids,
+		  bool use_elist, int min_event, int max_event)
 {
-  Message(INFO)<<"\n***************************************\n"
-	       <<"  Processing File "<<filename
-	       <<"\n***************************************\n";
   EventHandler* modules = EventHandler::GetInstance();
-  Reader reader(filename);
-  if(!reader.IsOk())
-    return 2;
+  if(use_elist)
+    min_event = ids[0];
   if(modules->Initialize()){
     Message(ERROR)<<"Unable to initialize all modules.\n";
     return 1;
@@ -62,103 +114,318 @@ int ProcessOneFile(const char* filename, std::string event_file, int max_event=-
   time_t start_time = time(0);
   RawEventPtr raw;
   
-  //if the first event is not 0, read it to get start of run info
-  if(min_event != 0){
-    ConvertData* converter = modules->GetModule<ConvertData>();
-    if(converter){ 
-      raw = reader.GetEventWithID(0);
-      if(!raw){
-	Message(ERROR)<<"Problem encountered reading event "<<min_event
-		      <<std::endl;
-	return 1;
+  //if the first event is not 0, read its headers to get start of run info
+  ConvertData* converter = modules->GetModule<ConvertData>();
+  if(min_event != 0 && converter){
+    if(ConvertHeaders(reader, converter, 0))
+      return 1;
+  }
+  
+  int evtnum = 0;
+  int status = 0;
+  if (use_elist) {
+    size_t nmissing = 0;
+    for(size_t i=0; i<ids.size(); ++i){
+      //read the event immediately before to get dt, unless just processed
+      if(converter && ids[i] > 1 && (i == 0 || ids[i-1] != ids[i]-1)){
+	if(ConvertHeaders(reader, converter, ids[i]-1))
+	  Message(WARNING)<<"dt will be wrong for event "<<ids[i]<<"\n";
       }
-      EventPtr evt(new Event(raw));
-      converter->Process(evt);
-      //if the first event is not 1, read the event immediately before to get dt
-      if(min_event > 1){
-	raw = reader.GetEventWithID(min_event-1);
-	if(!raw){
-	  Message(ERROR)<<"Problem encountered reading event "<<min_event
-			<<std::endl;
-	  return 1;
+      raw = reader.GetEventWithID(ids[i]);
+      if(!raw){
+	if(!reader.IsOk()){
+	  Message(ERROR)<<"Problem encountered reading event "<<ids[i]<<"\n";
+	  status = 1;
+	  break;
 	}
-	evt.reset(new Event(raw));
-	converter->Process(evt);
+	++nmissing;
+	continue;
+      }
+      Message(INFO)<<"Processing event "<<raw->GetID()<<std::endl;
+      ++evtnum;
+      if(modules->Process(raw)){
+	if(raw)
+	  Message(ERROR)<<"Error processing event "<<raw->GetID()<<"\n";
+	status = 1;
+	break;
       }
     }
+    Message(INFO)<<"Reached end event-list file.\n";
+    if(nmissing)
+      Message(WARNING)<<nmissing<<" of "<<ids.size()<<" listed events "
+		      <<"were not found in the file.\n";
   }
+  else {
+    //if the first event is not 1, read the event immediately before to get dt
+    if(min_event > 1 && converter){
+      if(ConvertHeaders(reader, converter, min_event-1))
+	return 1;
+    }
+    //Get the first event by ID
+    raw = reader.GetEventWithID(min_event);
+    if(!raw){
+      Message(ERROR)<<"Problem encountered reading event "<<min_event<<std::endl;
+      return 1;
+    }
+    while(raw){
+      if(max_event > 0 && raw->GetID() >= (uint32_t)max_event) 
+	break;
+      //Message(DEBUG)<<"*************Event "<<evtnum<<"**************\n";
+      if(evtnum%5000 == 0)
+	Message(INFO)<<"Processing event "<<raw->GetID()<<std::endl;
+      ++evtnum;
+      if(modules->Process(raw)){
+	if(raw)
+	  Message(ERROR)<<"Error processing event "<<raw->GetID()<<"\n";
+	status = 1;
+	break;
+      }
+      raw = reader.GetNextEvent();
+    }
+  }
+
+  //finish up
+  modules->Finalize();
+  Message(INFO)<<"Processed "<<evtnum<<" events in "
+	       <<time(0) - start_time<<" seconds. \n";
+  return status;
+}
+
+
+/** Find an enabled module which writes histograms or run info when it is
+    finalized. Each job would hold only its share of that output.
+*/
+BaseModule* FindFinalizeWriter()
+{
+  std::vector<BaseModule*>* mods = 
+    EventHandler::GetInstance()->GetListOfModules();
+  for(size_t i=0; i<mods->size(); ++i){
+    BaseModule* mod = mods->at(i);
+    if(mod->enabled && (dynamic_cast<AverageWaveforms*>(mod) ||
+			dynamic_cast<SpeFinder*>(mod) ||
+			dynamic_cast<SpectrumMaker*>(mod) ||
+			dynamic_cast<SpectrumManager*>(mod) ||
+			dynamic_cast<eTrainFinder*>(mod)))
+      return mod;
+  }
+  return 0;
+}
+
+/** Concatenate the Events trees of parts, in order, into output.  The run
+    totals, metadata and configuration are taken from the last part, which 
+    saw the last event.  Only the trees are merged, so the jobs must not run
+    any module found by FindFinalizeWriter.
+*/
+int MergeParts(const std::vector<std::string>& parts, const std::string& output)
+{
+  TFile* last = TFile::Open(parts.back().c_str());
+  if(!last || !last->IsOpen() || last->IsZombie()){
+    Message(ERROR)<<"Unable to open "<<parts.back()<<" for merging.\n";
+    delete last;
+    return 1;
+  }
+  TTree* lasttree = (TTree*)(last->Get("Events"));
+  TTree* lastmeta = (TTree*)(last->Get("metadata"));
   
-  //Get the first event by ID
-  raw = reader.GetEventWithID(min_event);
+  TFile out(output.c_str(), "RECREATE");
+  if(!out.IsOpen() || out.IsZombie()){
+    Message(ERROR)<<"Unable to open ROOT file "<<output<<" for writing.\n";
+    delete last;
+    return 1;
+  }
+  TChain chain("Events");
+  for(size_t i=0; i<parts.size(); ++i)
+    chain.Add(parts[i].c_str());
+  out.cd();
+  TTree* tree = chain.CloneTree(-1, "fast");
+  if(!tree){
+    Message(ERROR)<<"Unable to merge the Events trees into "<<output<<"\n";
+    delete last;
+    return 1;
+  }
+  //the friend and run info cloned with the tree are those of the first part
+  if(tree->GetListOfFriends())
+    tree->GetListOfFriends()->Delete();
+  tree->GetUserInfo()->Delete();
+  if(lasttree && lasttree->GetUserInfo()->At(0))
+    tree->GetUserInfo()->Add(lasttree->GetUserInfo()->At(0)->Clone());
+  Message(INFO)<<"Constructing tree index...\n";
+  tree->BuildIndex("run_id","event_id");
+  if(lastmeta){
+    out.cd();
+    TTree* friendtree = lastmeta->CloneTree(-1, "fast");
+    tree->AddFriend(friendtree);
+    friendtree->Write();
+  }
+  tree->Write();
+  const char* macros[] = { "Configuration", "DAQConfiguration" };
+  for(int i=0; i<2; ++i){
+    TObject* macro = last->Get(macros[i]);
+    if(macro){
+      out.cd();
+      macro->Write(macros[i]);
+    }
+  }
+  out.Close();
+  last->Close();
+  delete last;
+  return 0;
+}
 
+/** Split ids into njobs consecutive parts and process each in a forked copy
+    of this process, writing its own ROOT file, then merge the files.
+    Every worker has its own Reader and its own copy of the module chain and
+    of the singletons holding it, so nothing is shared between workers.
+*/
+int ProcessInParallel(const Reader& reader, const char* filename, 
+		      const std::vector<uint32_t>& ids, bool use_elist, 
+		      int max_event, int njobs)
+{
+  RootWriter* writer = EventHandler::GetInstance()->GetModule<RootWriter>();
+  if(!writer || !writer->enabled){
+    Message(ERROR)<<"Processing with several jobs needs the RootWriter.\n";
+    return 1;
+  }
+  if(njobs > (int)ids.size())
+    njobs = ids.size();
+  const std::string output = writer->GetOutputPath();
+  const std::string base = output.substr(0, output.rfind(".root"));
+  time_t start_time = time(0);
+  
+  std::vector<std::string> parts;
+  std::vector<pid_t> pids;
+  std::cout.flush();
+  std::cerr.flush();
+  for(int job=0; job<njobs; ++job){
+    const size_t first = ids.size()*job/njobs;
+    const size_t last = ids.size()*(job+1)/njobs;
+    std::stringstream part;
+    part<<base<<"_j"<<std::setw(2)<<std::setfill('0')<<job<<".root";
+    parts.push_back(part.str());
+    Message(INFO)<<"Job "<<job<<" processes events "<<ids[first]
+		 <<" to "<<ids[last-1]<<" into "<<parts.back()<<"\n";
+    pid_t pid = fork();
+    if(pid < 0){
+      Message(ERROR)<<"Unable to start job "<<job<<"\n";
+      break;
+    }
+    if(pid == 0){
+      int ret;
+      {
+	Reader part_reader(filename);
+	part_reader.CopyIndex(reader);
+	writer->SetFilename(parts.back());
+	std::vector<uint32_t> part_ids(ids.begin()+first, ids.begin()+last);
+	//the range ends where the next job's starts
+	int part_max = (use_elist || job == njobs-1 ? max_event : ids[last]);
+	ret = ProcessEvents(part_reader, part_ids, use_elist, 
+			    part_ids.front(), part_max);
+      }
+      std::cout.flush();
+      exit(ret);
+    }
+    pids.push_back(pid);
+  }
+  
+  int nfailed = njobs - pids.size();
+  for(size_t job=0; job<pids.size(); ++job){
+    int status;
+    if(waitpid(pids[job], &status, 0) < 0 || 
+       !WIFEXITED(status) || WEXITSTATUS(status) != 0){
+      Message(ERROR)<<"Job "<<job<<" failed.\n";
+      ++nfailed;
+    }
+  }
+  if(nfailed){
+    Message(ERROR)<<nfailed<<" of "<<njobs<<" jobs failed; their output is "
+		  <<"left in "<<base<<"_j*.root\n";
+    return 1;
+  }
+  
+  Message(INFO)<<"Merging the output of "<<njobs<<" jobs into "<<output<<"\n";
+  if(MergeParts(parts, output))
+    return 1;
+  for(size_t i=0; i<parts.size(); ++i)
+    std::remove(parts[i].c_str());
+  Message(INFO)<<"Processed "<<ids.size()<<" events with "<<njobs
+	       <<" jobs in "<<time(0) - start_time<<" seconds. \n";
+  return 0;
+}
 
-  //if using event list, open the event list file
-  std::ifstream eventlist;
+/// Fully process a single raw data file
+int ProcessOneFile(const char* filename, std::string event_file, 
+		   int max_event=-1, int min_event=0, int njobs=1)
+{
+  Message(INFO)<<"\n***************************************\n"
+	       <<"  Processing File "<<filename
+	       <<"\n***************************************\n";
+  Reader reader(filename);
+  if(!reader.IsOk())
+    return 2;
+  
+  //if using event list, read all of it so the file is read in one pass
+  std::vector<uint32_t> ids;
   bool use_elist = false;
   if (event_file!="") {
-    eventlist.open(event_file.c_str());
-    if (!eventlist.is_open()){
-      Message(ERROR)<<"Unable to open event-list file "<<event_file<<endl;
+    if(ReadEventList(event_file, min_event, max_event, ids))
+      return 1;
+    if (ids.empty()) {
+      Message(INFO)<<"No events to process!"<<std::endl;
       return 1;
     }
     use_elist = true;
   }
-  if (use_elist) {
-    //find first event in list greater than min_event
-    int tmp_event;
-    eventlist>>tmp_event;
-    while (min_event > tmp_event && !eventlist.eof())
-      eventlist>>tmp_event;
-    if (eventlist.eof()) {
-      Message(INFO)<<"No events to process!"<<std::endl;
-      return 1;
+  
+  if(njobs > 1){
+    BaseModule* finalize_writer = FindFinalizeWriter();
+    if(finalize_writer){
+      Message(WARNING)<<"The output of "<<finalize_writer->GetName()
+		      <<" cannot be merged between jobs; "
+		      <<"processing with a single job.\n";
+      njobs = 1;
     }
-    min_event = tmp_event;
-    raw = reader.GetEventWithID(min_event);
   }
-
-  if(!raw){
-    Message(ERROR)<<"Problem encountered reading event "<<min_event<<std::endl;
-    return 1;
+  //gzseek in a compressed file inflates it again from the start, so every
+  //job would decompress all of the file before its share of the events
+  if(njobs > 1 && reader.IsCompressed()){
+    Message(WARNING)<<filename<<" is compressed and cannot be split between "
+		    <<"jobs; processing with a single job.\n";
+    njobs = 1;
   }
-  int evtnum = 0;
-  while(raw){
-    if(max_event > 0 && raw->GetID() >= (uint32_t)max_event) 
-      break;
-    //Message(DEBUG)<<"*************Event "<<evtnum<<"**************\n";
-    if(evtnum%5000 == 0 && !use_elist)
-	Message(INFO)<<"Processing event "<<raw->GetID()<<std::endl;
-    else if (use_elist)
-        Message(INFO)<<"Processing event "<<raw->GetID()<<std::endl;
-    ++evtnum;
-    if(modules->Process(raw)){
-      if(raw)
-	Message(ERROR)<<"Error processing event "<<raw->GetID()<<"\n";
-      break;
+  
+  //jobs seek to their share of the events through the index; a single job
+  //reads the sorted event list in one pass, skipping the unlisted events
+  if(njobs > 1){
+    if(reader.BuildIndex() < 0)
+      return 1;
+  }
+  
+  if(njobs > 1 && !use_elist){
+    //split every event in [min_event, max_event) between the jobs
+    for(int i=0; i<reader.GetNIndexed(); ++i){
+      const uint32_t id = reader.GetIndexedID(i);
+      if(id >= (uint32_t)min_event && (max_event <= 0 || id < (uint32_t)max_event))
+	ids.push_back(id);
     }
-
-    //if using event list, read next event number to process
-    if (use_elist) {
-      int next_event;
-      if (eventlist>>next_event) {
-        raw = reader.GetEventWithID(next_event);
-      }
-      else {
-        Message(INFO)<<"Reached end event-list file.\n";
-        break;
-      }
+    if(ids.empty()){
+      Message(INFO)<<"No events to process!"<<std::endl;
+      return 1;
     }
-    else {
-      raw = reader.GetNextEvent();
+    //jobs are given ranges of ids, so they must increase through the file
+    for(size_t i=1; i<ids.size(); ++i){
+      if(ids[i] <= ids[i-1]){
+	Message(WARNING)<<"Event ids in "<<filename<<" are not increasing; "
+			<<"processing with a single job.\n";
+	njobs = 1;
+	break;
+      }
     }
   }
-  eventlist.close();
-
-  //finish up
-  modules->Finalize();
-  Message(INFO)<<"Processed "<<evtnum<<" events in "
-	       <<time(0) - start_time<<" seconds. \n";
-  return 0;
+  
+  if(njobs > 1)
+    return ProcessInParallel(reader, filename, ids, use_elist, 
+			     max_event, njobs);
+  return ProcessEvents(reader, ids, use_elist, min_event, max_event);
 }
 
 int main(int argc, char** argv)
@@ -176,6 +443,10 @@ int main(int argc, char** argv)
   config->AddCommandSwitch(' ',"event-list","read events to process from <file>",
                            CommandSwitch::DefaultRead<std::string>(event_file),
                            "file");
+  int njobs = 1;
+  config->AddCommandSwitch('j',"jobs","process each file with <n> parallel jobs, merging their output",
+			   CommandSwitch::DefaultRead<int>(njobs),
+			   "n");
   
   EventHandler* modules = EventHandler::GetInstance();
   modules->AddCommonModules();
@@ -196,7 +467,7 @@ int main(int argc, char** argv)
     if(i > 1)
       writer->SetFilename(writer->GetDefaultFilename());
     SetOutputFile(writer, argv[i] );
-    if(ProcessOneFile(argv[i], event_file, max_event, min_event)){
+    if(ProcessOneFile(argv[i], event_file, max_event, min_event, njobs)){
       Message(ERROR)<<"Error processing file "<<argv[i]<<"; aborting.\n";
       return 1;
     }
@@ -10,6 +10,7 @@
 #include "utilities.hh"
 #include "RootGraphix.hh"
 #include "ChanFitSettings.hh"
+#include "SpectrumCache.hh"
 #include <sstream>
 #include <fstream>
 #include <map>
@@ -23,6 +24,8 @@
 #include "TF1.h"
 
 #define mNCHANS 14
+/// Fit results saved with 'w', used as start values with --warm-start
+const char* warmstart_file = "cfg/LaserCFSWarmStart.cfg";
 
 using namespace std;
 using namespace FitOverROI;
@@ -173,6 +176,65 @@ it != spectra->end(); it++){
 }
 */
 
+/// Register the fit settings of every channel in one list for config files
+void RegisterSettings(ParameterList* list, ChanFitSettings settings[])
+{
+  for(int j=0; j< mNCHANS; j++){
+    stringstream name;
+    stringstream help;
+    name<<"chan"<<j;
+    help<<"Fit settings for channel "<<j;
+    list->RegisterParameter(name.str(),settings[j], help.str());
+  }
+}
+
+/// Start the fits from the results last saved, keeping the configured bounds
+void LoadWarmStart(ChanFitSettings settings[])
+{
+  ifstream fin(warmstart_file);
+  if(!fin.is_open()){
+    cout<<"No saved results in "<<warmstart_file
+	<<"; using the configured start values."<<endl;
+    return;
+  }
+  ParameterList list("ChannelsSettings","Start values from the last results");
+  ChanFitSettings saved[mNCHANS];
+  RegisterSettings(&list, saved);
+  list.ReadFrom(fin);
+  for(int j=0; j< mNCHANS; j++){
+    settings[j].lambda_start_value = saved[j].lambda_start_value;
+    settings[j].mean_start_value = saved[j].mean_start_value;
+    settings[j].sigma_start_value = saved[j].sigma_start_value;
+    settings[j].amp_E_start_value = saved[j].amp_E_start_value;
+    settings[j].p_E_start_value = saved[j].p_E_start_value;
+    settings[j].shotnoise_start_value = saved[j].shotnoise_start_value;
+  }
+  cout<<"Starting the fits from the results saved in "<<warmstart_file<<endl;
+}
+
+/// Save the fitted parameters as start values for the next run
+void SaveWarmStart(map<int, FitTH1F*>* spectra, ChanFitSettings settings[])
+{
+  ParameterList list("ChannelsSettings","Start values from the last results");
+  ChanFitSettings saved[mNCHANS];
+  RegisterSettings(&list, saved);
+  for(int j=0; j< mNCHANS; j++){
+    saved[j].lambda_start_value = settings[j].lambda_start_value;
+    saved[j].mean_start_value = settings[j].mean_start_value;
+    saved[j].sigma_start_value = settings[j].sigma_start_value;
+    saved[j].amp_E_start_value = settings[j].amp_E_start_value;
+    saved[j].p_E_start_value = settings[j].p_E_start_value;
+    saved[j].shotnoise_start_value = settings[j].shotnoise_start_value;
+  }
+  for(map<int, FitTH1F*>::iterator it = spectra->begin(); 
+      it != spectra->end(); it++){
+    if(it->first >= 0 && it->first < mNCHANS)
+      SetStartValues(it->second, saved[it->first]);
+  }
+  if(list.SaveToFile(warmstart_file))
+    cout<<"Saved the results as start values in "<<warmstart_file<<endl;
+}
+
 void RefitChannel(FitTH1F* h, int entries, TCanvas* c, ChanFitSettings& CFS)
 {
   c->Clear();
@@ -258,7 +320,7 @@ void RefitChannel(FitTH1F* h, int entries, TCanvas* c, ChanFitSettings& CFS)
 }    
   
 
-void QueryUser(map<int, FitTH1F*>* spectra, TTree* Events, RootGraphix* root, ChanFitSettings ChannelSettings[], 
+void QueryUser(map<int, FitTH1F*>* spectra, Long64_t entries, RootGraphix* root, ChanFitSettings ChannelSettings[], 
 	       TCanvas* c = 0)
 {
   if(!c)
@@ -283,6 +345,7 @@ void QueryUser(map<int, FitTH1F*>* spectra, TTree* Events, RootGraphix* root, Ch
     }
     if(response == "w"){
       //UpdateDatabase(spectra, Events, ChannelSettings);
+      SaveWarmStart(spectra, ChannelSettings);
       break;
     }
     bool remove = false;
@@ -312,7 +375,7 @@ void QueryUser(map<int, FitTH1F*>* spectra, TTree* Events, RootGraphix* root, Ch
     else{
       RootGraphix::Lock lock = root->AcquireLock();
       FitTH1F* h = (it->second);
-      RefitChannel(h,Events->GetEntries(),c,ChannelSettings[it->first]);
+      RefitChannel(h,entries,c,ChannelSettings[it->first]);
       showresults=true;
       c->Update();
       continue;
@@ -321,191 +384,74 @@ void QueryUser(map<int, FitTH1F*>* spectra, TTree* Events, RootGraphix* root, Ch
   if(c) delete c;
 }
 
-int ProcessLaserRun(const char* fname, unsigned region=0,bool rehist=false,bool min=false)
+int ProcessLaserRun(const char* fname, unsigned region=0,bool rehist=false,bool min=false,
+		    int nthreads=1, bool warmstart=false)
 {
 	ParameterList* ChanSettingsHandler = new ParameterList("ChannelsSettings","Stores 8 channels of fit settings");
 	ChanFitSettings ChannelsSettings[ mNCHANS ];
 	
 	
-	for(int j=0; j< mNCHANS; j++){
-		stringstream name;
-		stringstream help;
-		name<<"chan"<<j;
-		help<<"Fit settings for channel "<<j;
-		ChanSettingsHandler->RegisterParameter(name.str(),ChannelsSettings[j], help.str());
-		}
+	RegisterSettings(ChanSettingsHandler, ChannelsSettings);
 	ifstream CFSConfig("cfg/LaserCFSConfig.cfg");
 	ChanSettingsHandler->ReadFrom(CFSConfig);
 	CFSConfig.close();
+	if(warmstart)
+	  LoadWarmStart(ChannelsSettings);
 	
   const int nbins=315;
   const double start=-30, end=600; 
-  std::map<int,FitTH1F*> spectra;
-  std::map<int,FitTH1F*> spectra2; //historgram of amplitude (min)
   RootGraphix root;
   root.Initialize();
-  TFile *f= OpenFile(fname,"UPDATE");
-  if(!f){cout<<"File not opened!"<<endl;}
-  TTree* Events = GetEventsTree(fname);
-  if(!Events) {cout<< "!Events"<<endl; return -1;}
-
-	
-  EventData* event=0;
-  Events->SetBranchAddress("event",&event);
-  Events->GetEntry(0);
-  cout<<"There are "<<Events->GetEntries()<<" entries in this tree."<<endl;
-
-   //check for cached histograms
-	bool found_all=true;
-
-	//if(event->channels.size() > 10){cout<< "channels.size() >10"<<endl;    return -2;}
-	if(!rehist){
-		for(size_t j=0; j < event->channels.size(); j++){
-			TString name = "channel";
-			ChannelData* channel = &(event->channels.at(j));
-			name += channel->channel_id;
-			FitTH1F *histo= new FitTH1F();
-			int read= histo->Read(name);
-			cout<<"readvar" << read<<endl;
-			if (read==0) { found_all = false; delete histo; break; }
-
-			if(found_all){
-				cout<<"Loaded cached histogram "<<name<<endl;
-				std::map<int,FitTH1F*>::iterator mapit = spectra.find(channel->channel_id);
-
-				if(mapit == spectra.end()){
-					spectra.insert( std::make_pair(channel->channel_id, histo) );	  }
-				  else{
-					histo = (mapit->second);
-				  }
-				}
-		}
-	}
-  //Create histograms of amplitude (min) (by Xiaoyang)
-	if(min){
-     for(int i=0; i < Events->GetEntries(); i++){
-		if(i%5000 == 0) cout<<"Processing Entry "<<i<<endl;
-		
-			Events->GetEntry(i);
-			//iterate over all channels
-			
-			
-			for(size_t j=0; j < event->channels.size(); j++){
-			  ChannelData* channel = &(event->channels.at(j));
-			  if(channel->channel_id < 0){
-				cout<<"channel->channel_id < 0"<<endl;
-				continue;
-				}
-			  std::map<int,FitTH1F*>::iterator mapit = spectra2.find(channel->channel_id);
-			  FitTH1F* histo=0;
-			  if(mapit == spectra2.end()){
-				TString name = "channel";
-				name += channel->channel_id;
-				cout<<"Creating new histogram with name "<<name<<endl;
-				histo = new FitTH1F(name,name,nbins,start,end);
-				spectra2.insert( std::make_pair(channel->channel_id, histo) );
-			  }
-			  else{
-				histo = (mapit->second);
-			  }
-		
-			  //fill the histogram
-			  if(!histo){
-			cerr<<"Null pointer passed!\n";
-			return -2;
-			  }
-
-			if( channel->regions.size() > region){	
-				histo->Fill( -channel->regions.at(region).min);
-			}
-		}
-	}
-
-	
-  //Draw all the histograms
-  TCanvas* cmin = new TCanvas("cmin",fname);
-  cmin->SetLogy();
-  for( std::map<int,FitTH1F*>::iterator it = spectra2.begin();
-       it != spectra2.end(); it++){
-    RootGraphix::Lock lock = root.AcquireLock();
-    FitTH1F* hist = (it->second);
-    hist->Draw();
-	if(rehist||!found_all){	hist->Write(hist->GetName(),TObject::kOverwrite);}
-	cout<<"about to fit"<<endl;
-	//FitSPE(hist, ChannelsSettings[it->first], Events->GetEntries());
-	cout<<"done fitting"<<endl;
-	 cmin->Update();
-  }
- DrawSpectra(&spectra2,cmin);
-	}
-
-	//create historgams of integrals
-  if(!found_all||rehist){
-  	  //process the tree line by line, and create histograms for each channel
-	  for(int i=0; i < Events->GetEntries(); i++){
-		if(i%5000 == 0) cout<<"Processing Entry "<<i<<endl;
-		
-			Events->GetEntry(i);
-			//iterate over all channels
-			/*
-			  if(event->channels.size() > 10){    
-				cout<<"channels.size()>10"<<endl;
-				return -2;}
-			*/
-			for(size_t j=0; j < event->channels.size(); j++){
-			  ChannelData* channel = &(event->channels.at(j));
-			  if(channel->channel_id < 0){
-				cout<<"channel->channel_id < 0"<<endl;
-				continue;
-				}
-        if(!channel->baseline.found_baseline){
-				if (i==0){cout<<"channel "<<channel->channel_id<<": no baseline found, skipping"<<endl;}
-				continue;
-				}
-			  std::map<int,FitTH1F*>::iterator mapit = spectra.find(channel->channel_id);
-			  FitTH1F* histo=0;
-			  if(mapit == spectra.end()){
-				TString name = "channel";
-				name += channel->channel_id;
-				cout<<"Creating new histogram with name "<<name<<endl;
-				histo = new FitTH1F(name,name,nbins,start,end);
-				spectra.insert( std::make_pair(channel->channel_id, histo) );
-			  }
-			  else{
-				histo = (mapit->second);
-			  }
-		
-			  //fill the histogram
-			  if(!histo){
-			cerr<<"Null pointer passed!\n";
-			return -2;
-			  }
-			//if(channel->pulses.size() > region)	histo->Fill( -channel->pulses.at(region).integral);
-			if( channel->regions.size() > region){	
-			    histo->Fill( -channel->regions.at(region).integral);
-			}
-		}
-	}
+  
+  //build the spectra in one pass over the tree, or load them if cached
+  SpectrumCache cache(fname);
+  stringstream integral, amplitude;
+  integral<<"-channels.regions["<<region<<"].integral";
+  amplitude<<"-channels.regions["<<region<<"].min";
+  int integral_index = cache.AddSpectrum("channel", integral.str().c_str(),
+					 "channels.channel_id >= 0 && "
+					 "channels.baseline.found_baseline",
+					 nbins, start, end);
+  //histograms of amplitude (min) (by Xiaoyang)
+  int amplitude_index = -1;
+  if(min)
+    amplitude_index = cache.AddSpectrum("amplitude_channel", 
+					amplitude.str().c_str(),
+					"channels.channel_id >= 0",
+					nbins, start, end);
+  if(cache.Fill(rehist))
+    return -1;
+  const Long64_t entries = cache.GetEntries();
+  cout<<"There are "<<entries<<" entries in this tree."<<endl;
+  std::map<int,FitTH1F*> spectra = cache.GetSpectra(integral_index);
+  
+  if(min){
+    std::map<int,FitTH1F*> spectra2 = cache.GetSpectra(amplitude_index);
+    //Draw all the histograms
+    TCanvas* cmin = new TCanvas("cmin",fname);
+    cmin->SetLogy();
+    for( std::map<int,FitTH1F*>::iterator it = spectra2.begin();
+	 it != spectra2.end(); it++){
+      RootGraphix::Lock lock = root.AcquireLock();
+      FitTH1F* hist = (it->second);
+      hist->Draw();
+      cmin->Update();
+    }
+    DrawSpectra(&spectra2,cmin);
   }
 	
-  //Draw all the histograms
+  //fit all the channels together, then draw them
   TCanvas* c = new TCanvas("c",fname);
   c->SetLogy();
-  for( std::map<int,FitTH1F*>::iterator it = spectra.begin();
-       it != spectra.end(); it++){
+  {
     RootGraphix::Lock lock = root.AcquireLock();
-    FitTH1F* hist = (it->second);
-    hist->Draw();
-	if(rehist||!found_all){	hist->Write(hist->GetName(),TObject::kOverwrite);}
-	cout<<endl<<"About to fit channel: "<<it->first<<endl<<endl;
-	FitSPE(hist, ChannelsSettings[it->first], Events->GetEntries());
-	cout<<endl<<"Done fitting channel: "<<it->first<<endl<<endl;
-    c->Update();
-  } 
+    int nfailed = FitSPEs(spectra, ChannelsSettings, entries, nthreads);
+    if(nfailed)
+      cout<<nfailed<<" of "<<spectra.size()<<" fits did not converge"<<endl;
+  }
   
   
-  QueryUser(&spectra, Events, &root, ChannelsSettings, c);
-  f->Close();
+  QueryUser(&spectra, entries, &root, ChannelsSettings, c);
   return spectra.size();
   
 }
@@ -516,6 +462,8 @@ int main(int argc, char** argv)
   bool reprocess=false;
   bool min = false; //amplitude switch
   bool mc=false;
+  bool warmstart=false;
+  int nthreads=1;
 
   ConfigHandler* config = ConfigHandler::GetInstance();
   config->AddCommandSwitch('m',"amplitude","generate histogram of amplitude",
@@ -528,6 +476,12 @@ int main(int argc, char** argv)
   config->AddCommandSwitch('s',"mc",
 			   "Data is MC simulation",
 			   CommandSwitch::SetValue<bool>(mc,true));
+  config->AddCommandSwitch('j',"jobs","fit <jobs> channels at once",
+			   CommandSwitch::DefaultRead<int>(nthreads),
+			   "jobs");
+  config->AddCommandSwitch('w',"warm-start",
+			   "start the fits from the last saved results",
+			   CommandSwitch::SetValue<bool>(warmstart,true));
 
   config->SetProgramUsageString("laserrun [options] <run number>");
   if(config->ProcessCommandLine(argc,argv))
@@ -576,5 +530,5 @@ int main(int argc, char** argv)
     }
   }
   fin.close();
-  return ProcessLaserRun(rootfile.str().c_str(),0,rehist,min);
+  return ProcessLaserRun(rootfile.str().c_str(),0,rehist,min,nthreads,warmstart);
 }
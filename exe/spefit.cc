@@ -14,6 +14,7 @@ Fit SPE spectra on individual channels and upload results to scenedb
 #include "RootGraphix.hh"
 #include "CommandSwitchFunctions.hh"
 #include "ChanFitSettings.hh"
+#include "SpectrumCache.hh"
 #include <sstream>
 #include <fstream>
 #include <map>
@@ -191,45 +192,20 @@ int ProcessRun(const char* fname){
   const double start=-40, end=200; 
   std::map<int,TH1F*> spectra;
   
-  // Populate histograms
-  for(int i=0; i < Events->GetEntries(); i++){
-    if(i%5000 == 0) cout<<"Processing Entry "<<i<<endl;
-    Events->GetEntry(i);
-    // Loop over all pmt channels
-    for(int j=0; j < mNCHANS; j++){
-      ChannelData* channel = &(event->channels.at(j));
-      if(channel->channel_id < 0){
-	cout<<"channel->channel_id < 0"<<endl;
-	continue;
-      }
-      if(!channel->baseline.found_baseline){
-	continue;
-      }
-      std::map<int,TH1F*>::iterator mapit = spectra.find(channel->channel_id);
-      TH1F* histo=0;
-      if(mapit == spectra.end()){
-	TString name = "channel";
-	name += channel->channel_id;
-	cout<<"Creating new histogram with name "<<name<<endl;
-	histo = new TH1F(name,name,nbins,start,end);
-	spectra.insert(std::make_pair(channel->channel_id, histo));
-      }
-      else{
-	histo = (mapit->second);
-      }
-      //fill the histogram
-      if(!histo){
-	cerr<<"Null pointer passed!\n";
-	return -2;
-      }
-      for(size_t n=0; n<channel->single_pe.size(); n++){
-	//Cuts
-	if (channel->single_pe[n].length>max_spe_length) continue;
-	// passing all cuts
-	histo->Fill(channel->single_pe[n].integral);
-      }
-    }
-  }
+  // Populate histograms in one pass, or load them from the cache file
+  SpectrumCache cache(fname);
+  stringstream cut;
+  cut<<"channels.channel_id >= 0 && channels.channel_id < "<<mNCHANS
+     <<" && channels.baseline.found_baseline"
+     <<" && channels.single_pe.length <= "<<max_spe_length;
+  int index = cache.AddSpectrum("channel", "channels.single_pe.integral",
+				cut.str().c_str(), nbins, start, end);
+  if(cache.Fill())
+    return -2;
+  const std::map<int,FitTH1F*>& cached = cache.GetSpectra(index);
+  for(std::map<int,FitTH1F*>::const_iterator it = cached.begin(); 
+      it != cached.end(); it++)
+    spectra.insert(std::make_pair(it->first, (TH1F*)(it->second)));
   cout<<endl<<"About to fit"<<endl;
   //Draw all the histograms
   root.AcquireLock();
@@ -8,16 +8,25 @@
 #define AVERAGE_WAVEFORMS_h
 
 #include "BaseModule.hh"
+#ifndef SINGLETHREAD
+#include "boost/thread/mutex.hpp"
+#include "boost/thread/thread.hpp"
+#endif
 #include <map>
 #include <string>
+#include <vector>
 //#include <iostream>
 #include <fstream>
 using namespace std;
 
-class TGraphErrors;
-
 /** @class AverageWaveforms
     @brief Averages the signals for each channel over an entire run (with some basic cuts)
+
+    Each processing thread adds into its own compensated (Kahan) sums, which
+    are merged when the graphs are written at Finalize, so the module can be
+    shared by threads processing different events.  If snapshot_file is
+    set, the merged sums so far are rewritten to it as text every
+    snapshot_interval accepted events.
     @ingroup modules
 */
 class AverageWaveforms : public BaseModule{
@@ -48,14 +57,44 @@ public:
   double max_s2_start_time;
   int number_of_base_groups;
 
-  int current_event;
-  int current_run;
-  ifstream txt;
+  string snapshot_file;
+  int snapshot_interval;
 
 private:
+  /// Running sums for one channel
+  struct ChannelSum{
+    int nevents;                ///< number of events added
+    std::pair<int,int> first_event; ///< (run, event) whose alignment defines x
+    std::vector<double> x;      ///< time of each bin
+    std::vector<double> y;      ///< sum of each bin
+    std::vector<double> y_comp; ///< Kahan compensation for y
+    std::vector<double> var;    ///< sum of variances of each bin
+    std::vector<double> var_comp; ///< Kahan compensation for var
+    ChannelSum() : nevents(0), first_event(-1,-1) {}
+  };
+  /// All of the sums filled by one thread
+  struct Accumulator{
+    std::map<int, ChannelSum> channels;
+#ifndef SINGLETHREAD
+    boost::mutex mutex;         ///< held while adding or merging
+#endif
+  };
+
   void Cleanup();
-  std::map<int,int> _num_event;
-  std::map<int,TGraphErrors*> _plots;
+  /// Get the accumulator belonging to the calling thread
+  Accumulator* GetAccumulator();
+  /// Combine the sums from every thread into total
+  void Merge(std::map<int, ChannelSum>& total);
+  /// Rewrite snapshot_file with the current sums
+  void WriteSnapshot(int nevents);
+
+  std::vector<std::pair<int,int> > _event_list; ///< sorted (run, event) list
+  std::vector<Accumulator*> _accumulators;      ///< one per thread
+  int _accepted;          ///< number of events added so far
+#ifndef SINGLETHREAD
+  std::map<boost::thread::id, Accumulator*> _thread_accumulators;
+  boost::mutex _accumulators_mutex; ///< protects the above and _accepted
+#endif
 };
 
 #endif
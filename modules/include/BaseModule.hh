@@ -75,6 +75,12 @@ public:
   virtual int Initialize() {return 0;};
   /// Process a single event. Must be overridden. Return 0 if no error
   virtual int Process(EventPtr event)=0;
+  /** Complete work that Process left running in the background.  Called
+      for every module at the end of a run before any module is finalized,
+      so that Finalize of earlier modules never races with it.  Return 0 
+      if no error
+  */
+  virtual int FinishProcessing() {return 0;};
   /// Finalize state after a run has processed. Return 0 if no error
   virtual int Finalize() {return 0;};
   
@@ -106,6 +112,11 @@ public:
   /// Check whether <event> passes all defined cuts
   bool CheckCuts(EventPtr event);
   
+  /// Does this module read the raw waveform of channel_id? 
+  /// ConvertData only decodes up front the channels some module asks for
+  virtual bool UsesWaveform(int channel_id) const
+  { return _skip_channels.find(channel_id) == _skip_channels.end(); }
+  
   /** @typedef ChannelSkipper
       @brief Allows one to skip processing some channels
   */
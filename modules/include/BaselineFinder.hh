@@ -10,6 +10,8 @@
 #include "ChannelModule.hh"
 
 #include <vector>
+class Integrator;
+
 /** @class BaselineFinder
     @brief searches the beginning of a channel's waveform to determine baseline
     @ingroup modules
@@ -32,6 +34,10 @@
        from the nearest good points. 
     5) Finally we subtract the moving baseline from the signal and store it
        in the subtracted_waveform
+    
+    If the Integrator is enabled with fuse_with_baseline, step 5 also
+    fills the integral and its extrema for the channels the Integrator
+    would process, saving the Integrator another pass over the samples.
 */
 class BaselineFinder : public ChannelModule
 {
@@ -77,7 +83,15 @@ public:
   
 private:
   int FixedBaseline(ChannelData* chdata);
-  int DriftingBaseline(ChannelData* chdata);
+  /// Drifting baseline search on samples of any type
+  template<class Sample>
+  int DriftingBaseline(ChannelData* chdata, const Sample* wave);
+  /// Subtract the drifting baseline and integrate in one pass
+  template<class Sample>
+  void SubtractAndIntegrate(ChannelData* chdata, const Sample* wave,
+			    int last_good_samp);
+  
+  Integrator* _fused_integrator; ///< integrator to do the work for, if any
 
 };
 
@@ -21,8 +21,10 @@
 #include "Unspikes.hh"
 #include "Roi.hh"
 #include "TOF.hh"
+#include "WindowQuery.hh"
 
 class TGraph;
+class WaveformDecoder;
 //notice: members with comment starting with ! are not saved
 /** @class ChannelData
     @brief processed information for each channel and pointers to raw data
@@ -35,6 +37,8 @@ public:
   ChannelData() { Clear(); }
   virtual ~ChannelData(){}
   void Clear(); ///< reset all members
+  /// Take over the (cleared) vector storage of a discarded channel
+  void TakeBuffers(ChannelData& other);
   /// Get a TGraph for drawing.  Needs to be deleted
   TGraph* GetTGraph(bool baseline_subtracted = false, int downsample=1) const; 
   /// Draw the channel on the current canvas
@@ -47,16 +51,27 @@ public:
   int TimeToSample(double time, bool checkrange=false);
   /// Convert a sample index to time in us
   double SampleToTime(int sample){ return (sample - trigger_index)/sample_rate;}
-  /// Get a pointer to the channel's waveform data, preserver const-ness
-  const double* GetWaveform() const { return &(waveform[0]); }
+  /// Get a pointer to the channel's waveform data, preserver const-ness;
+  /// NULL if the channel has no samples
+  const double* GetWaveform() const 
+  { LoadWaveform(); return waveform.empty() ? NULL : &(waveform[0]); }
   /// Get a pointer to the channel's waveform data non-constly
-  double* GetWaveform() { return &(waveform[0]); }
+  double* GetWaveform() 
+  { LoadWaveform(); return waveform.empty() ? NULL : &(waveform[0]); }
+  /// Decode the waveform from the raw data if it hasn't been done yet.
+  /// Only the thread processing the event may do this, see WaveformDecoder
+  void LoadWaveform() const 
+  { if(waveform_decoder) const_cast<ChannelData*>(this)->RunDecoder(); }
+  /// Get a single raw sample, read in its native type if possible
+  double GetSample(int index) const;
   /// Get a pointer to the waveform data after baseline subtraction constly
   const double* GetBaselineSubtractedWaveform() const 
   { return &(subtracted_waveform[0]); }
   /// Get a pointer to the waveform data after baseline subtraction
   double* GetBaselineSubtractedWaveform()
   { return &(subtracted_waveform[0]); }
+  /// Get fast min/max lookups over windows of the subtracted waveform
+  const WindowQuery& GetSubtractedQuery();
   /// Get a pointer to the waveform data after integration
   const double* GetIntegralWaveform() const 
   { return &(integral[0]); }
@@ -66,6 +81,9 @@ public:
   
   /// Get the maximum vertical range of the digitizer
   double GetVerticalRange() const { return ((uint64_t)1<<sample_bits) - 1; } 
+private:
+  void RunDecoder(); ///< hand ourselves to the waveform_decoder once
+  WindowQuery _subtracted_query; //! built on demand by GetSubtractedQuery
 public:
   /// Define some 'fake' channel types
   enum ID_TYPES { CH_INVALID=-1, CH_SUM=-2 };
@@ -92,9 +110,15 @@ public:
   double min_time; ///< time in us at which signal first achieved min
   const char* channel_start; //!< pointer to start of waveform
   const char* channel_end;   //!< pointer to end of waveform
+  const WaveformDecoder* waveform_decoder; //!< fills waveform on first access
+  int native_sample_bytes; //!< 1 or 2 if channel_start holds plain samples
+  bool zero_suppressed; //!< channel_start holds zero length encoded blocks
+  bool invert_samples; //!< the waveform_decoder inverts the samples
   double spe_mean;     ///< mean photoelectron response read from database
   double spe_sigma;
   //vector waveforms
+  //only the raw samples can be read in their native type (GetSample and
+  //native_sample_bytes); waveform and every derived series are double
   std::vector<double> waveform; //!< Raw waveform as a double array
   std::vector<std::pair<int,int> > unsuppressed_regions; //!< list of begin,end sample of non-zero-suppressed regions in the waveform
   
@@ -113,11 +137,14 @@ public:
   std::vector<double> derivative; //!< Derivative of channel's waveform
   //smoothed data
   std::vector<double> smoothed_data; //!< data smoothed over moving average 
+  //fft filter
+  std::vector<double> filtered_waveform; //!< output of the FFTFilter module
   std::vector<Spe> single_pe; ///< vector of single photoelectron responses
   std::vector<Unspikes> unspikes; ///< number rising edges found by eTrainFinder
 
   //integrator
   std::vector<double> integral; //!< Integral of the channel's waveform
+  bool integral_fused; //!< integral was filled by BaselineFinder's subtraction
   double integral_max;      ///< maximum value of integral along entire trigger
   double integral_min;      ///< minimum value of integral along entire trigger
   int integral_max_index;   ///< sample index at which max integral occurs
@@ -151,20 +178,31 @@ inline void ChannelData::Clear()
   generic.clear();
   channel_start = NULL;
   channel_end = NULL;
+  waveform_decoder = NULL;
+  native_sample_bytes = 0;
+  zero_suppressed = false;
+  invert_samples = false;
   spe_mean = 1.;
   spe_sigma = 0.;
+  waveform.clear();
+  unsuppressed_regions.clear();
 
   baseline.Clear();
   tof.Clear();
   subtracted_waveform.clear();
+  _subtracted_query.Reset();
   npulses=0;
   pulses.clear();
+  regions.clear();
   single_pe.clear();
+  unspikes.clear();
   derivative.clear();
   smoothed_data.clear();
+  filtered_waveform.clear();
   smoothed_min = -1; 
   smoothed_max = -1;
   integral.clear();
+  integral_fused = false;
   integral_max = -1;
   integral_min = -1;
   integral_max_index = -1;
@@ -177,6 +215,18 @@ inline void ChannelData::Clear()
   s2_fixed = 0;
 }
 
+inline double ChannelData::GetSample(int index) const
+{
+  switch(native_sample_bytes){
+  case 1:
+    return ((const uint8_t*)channel_start)[index];
+  case 2:
+    return ((const uint16_t*)channel_start)[index];
+  default:
+    return GetWaveform()[index];
+  }
+}
+
 inline int ChannelData::TimeToSample(double time, bool checkrange)
 { 
   int samp = (int)(time*sample_rate + trigger_index);
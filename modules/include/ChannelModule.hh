@@ -24,8 +24,17 @@ public:
   
   /// See if this channel passes cuts
   bool CheckCuts(ChannelData* chdata);
+  /// Would Process(EventPtr) hand this channel to Process(ChannelData*)?
+  bool WillProcess(ChannelData* chdata)
+  { return !SkipsChannel(chdata->channel_id) && CheckCuts(chdata); }
+  
+  /// Only channels we would process need their waveforms decoded
+  virtual bool UsesWaveform(int channel_id) const;
   
 protected:
+  /// Is this channel excluded by the skip_channels, skip_sum or sum_only?
+  bool SkipsChannel(int channel_id) const;
+  
   EventPtr _current_event;  ///< Pointer to current event
   bool _skip_sum;    ///< Do we skip processing the special sum channel?
   bool _sum_only;    ///< Do we process the sum channel only (and not others?)
@@ -8,6 +8,7 @@
 #define CONVERTDATA_h
 
 #include "BaseModule.hh"
+#include "WaveformDecoder.hh"
 #include <map>
 
 class V172X_Params;
@@ -17,7 +18,7 @@ class V172X_Params;
 */
 
 class runinfo;
-class ConvertData : public BaseModule
+class ConvertData : public BaseModule, public WaveformDecoder
 {
 public:
   ConvertData();
@@ -35,10 +36,15 @@ public:
   void SetChOffset(int chan, double offset){ _offsets[chan] = offset; }
   double GetChOffset(int chan){ return _offsets[chan]; }
   std::map<int,double>* GetChOffsetMap(){ return &_offsets;}
+  
+  /// Unpack a channel's samples from the raw data and find its extrema
+  void DecodeWaveform(ChannelData* chdata) const;
 
 private:
   int DecodeV172XData(const unsigned char* rawdata, uint32_t datasize, 
 		       EventDataPtr data);
+  /// Must the waveform of this channel be decoded before other modules run?
+  bool WaveformNeeded(int channel_id);
   
   uint64_t start_time;           ///< start time of the run
   uint64_t previous_event_time;  ///< time at which the previous event occurred
@@ -49,6 +55,8 @@ private:
   long _id_mismatches;             ///< Number of events with ID mismatch
   bool _headers_only;              ///< Only process data headers, not the bulk
   std::set<int> _invert_channels;  ///< Invert converted data for a channel?
+  bool _decode_all;                ///< Decode waveforms nobody asked for?
+  std::map<int,bool> _decode_now;  ///< Cached result of WaveformNeeded
 public:
 
 };
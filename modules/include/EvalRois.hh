@@ -26,6 +26,8 @@ public:
   int Initialize();
   int Finalize();
   int Process(ChannelData* chdata);
+  /// Only needs the integral, not the raw waveform
+  bool UsesWaveform(int) const { return false; }
   
   static const std::string GetDefaultName(){ return "EvalRois"; }
   
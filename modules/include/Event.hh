@@ -30,6 +30,10 @@ public:
   RawEventPtr GetRawEvent(){ return _raw_event; }
   /// Get a pointer to the processed data portion
   EventDataPtr GetEventData(){ return _event_data; }
+  /// Reuse this event for a new raw event, recycling the processed data
+  void Reset(RawEventPtr raw);
+  /// Does anyone besides this event hold on to the processed data?
+  bool IsDataShared() const { return _event_data && !_event_data.unique(); }
       
 private:
   RawEventPtr _raw_event;       ///< pointer to raw data segment
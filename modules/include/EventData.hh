@@ -32,6 +32,14 @@ public:
   virtual ~EventData() {} //anything need cleaning up?
   /// Reset all variables to defaults
   void Clear(); //inlined below
+  /// Reset all variables, but keep the channels' buffers for reuse
+  void Recycle();
+  /// Empty the channels list, keeping their buffers for reuse
+  void RecycleChannels();
+  /// Append a cleared channel, reusing recycled buffers if available
+  ChannelData& AddChannel();
+  /// Decode the waveforms not yet decoded and forget where the raw data is
+  void ReleaseRawData();
   static const char* GetBranchName(){ return "event"; }
   void Print (int verbosity);
 public:
@@ -111,6 +119,10 @@ public:
     return 0;
   }
   
+private:
+  std::vector<ChannelData> _spare_channels; //! recycled channel storage
+  
+public:
   ClassDef(EventData,14)
 };
 
@@ -132,6 +144,9 @@ inline void EventData::Clear()
   s1_valid = false;
   s2_valid = false;
   s1s2_valid = false;
+  s1_fixed_valid = false;
+  s2_fixed_valid = false;
+  s1s2_fixed_valid = false;
   s1_start_time = 0;
   s1_end_time = 0;
   s2_start_time = 0;
@@ -157,5 +172,7 @@ inline void EventData::Clear()
   bary_x = 0;
   bary_y = 0;
   channels.clear();
+  sum_of_int.clear();
+  roi_sum_of_int.clear();
 }
 #endif
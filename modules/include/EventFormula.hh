@@ -0,0 +1,100 @@
+/** @file EventFormula.hh
+    @brief Defines the EventFormula expression evaluator
+    @author bloer
+    @ingroup modules
+*/
+
+#ifndef EVENTFORMULA_h
+#define EVENTFORMULA_h
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+class EventData;
+
+/** @class EventFormula
+    @brief Evaluate TTree::Draw style expressions directly on an EventData
+
+    Expressions are compiled once into a tree of nodes which read the
+    members of EventData, ChannelData, Pulse, etc. through member pointers,
+    so evaluating them needs no TTree and copies nothing.  The syntax is the
+    part of TTreeFormula's used by spectra and cuts:
+    - stored members by name, with an optional leading "event.", e.g.
+      channels[0].regions[1].integral
+    - vectors indexed by a constant, or by [] (or no index at all) to loop
+      over every element.  The n-th loop of every member in the formula
+      runs together, up to the length of the shortest vector, as in
+      TTreeFormula
+    - @path.size() for the length of a vector
+    - + - * / % ^, comparisons, && || and !
+    - common math functions, also under their TMath:: names
+    - Sum$, Min$, Max$ and Length$ over all instances of their argument
+
+    Several terms, such as the x, y and cut of a spectrum, are compiled
+    into the same formula so that they loop together.  Identical
+    subexpressions within a formula are compiled once and evaluated once
+    per instance, and adding a term identical to an existing one returns
+    the existing index.
+    @ingroup modules
+*/
+class EventFormula{
+public:
+  enum { MAX_DIMS = 8 };  ///< maximum number of loops in one formula
+
+  //implementation classes, defined in EventFormula.cc
+  struct Instance;
+  class Node;
+  class Path;
+  class Parser;
+
+  EventFormula();
+  ~EventFormula();
+
+  /// Compile expr as the next term; returns its index, or -1 on error
+  int AddTerm(const std::string& expr);
+  /// Get the number of terms compiled so far
+  int GetNTerms() const { return _terms.size(); }
+  /// Get a description of the last compilation error
+  const std::string& GetError() const { return _error; }
+  /// Remove all terms
+  void Clear();
+  /** Get a description of the vectors deciding the loops.  Formulas with
+      the same signature always have the same instances, so their terms
+      can be compiled into one formula without changing their values.
+  */
+  std::string GetLoopSignature() const;
+  /** Add the names of the tree branches read by the terms, e.g.
+      channels.regions.integral, and of every branch containing them
+  */
+  void GetBranchNames(std::set<std::string>& names) const;
+
+  /** Evaluate every term for each instance of the loops.
+      values is filled with GetNTerms() values for each instance in turn.
+      @return the number of instances
+  */
+  int Evaluate(const EventData* event, std::vector<double>& values) const;
+
+private:
+  friend class Parser;
+  std::map<std::string, Node*> _nodes; ///< every node, by canonical text
+  std::vector<Node*> _terms;  ///< compiled tree of each term
+  std::vector<Path*> _paths;  ///< every member read by the terms
+  std::set<std::string> _branches; ///< branches read, see GetBranchNames
+  int _ndims;                 ///< number of loops over vectors
+  mutable unsigned long _stamp; ///< count of instances evaluated
+  std::string _error;         ///< description of the last error
+
+  /// Take ownership of a compiled term and the paths it reads
+  void AddNode(Node* node, const std::vector<Path*>& paths);
+  /// Recursively loop over dimension dim and deeper, filling values
+  void Enumerate(Instance& inst, int* index, int dim,
+		 std::vector<double>& values, int& ninstances) const;
+
+  //not copyable
+  EventFormula(const EventFormula&);
+  EventFormula& operator=(const EventFormula&);
+};
+
+#endif
@@ -9,6 +9,7 @@
 
 #include "ParameterList.hh"
 #include "Event.hh"
+#include "EventPool.hh"
 #include "runinfo.hh"
 #include "DatabaseConfigurator.hh"
 #include <string>
@@ -61,6 +62,9 @@ public:
   { if(handler) _async_receivers.push_back(handler); }
   /// Clear all async receivers
   void ClearAsyncReceivers(){ _async_receivers.clear(); }
+  /// Are events handed to other threads for processing?
+  bool IsAsynchronous() const 
+  { return _run_parallel || !_async_receivers.empty(); }
   
   //public interface functions
   //return 0 if no errors
@@ -75,6 +79,8 @@ public:
   
   /// Get a pointer to the current event being processed
   EventPtr GetCurrentEvent(){ return _current_event; }
+  /// Get the pool which recycles the events created from raw data
+  EventPool* GetEventPool(){ return &_event_pool; }
   /// Get the list of all defined modules const-ly
   const std::vector<BaseModule*>* GetListOfModules() const{ return &_modules; }
   /// Get the list of all defined modules
@@ -105,6 +111,8 @@ private:
   std::vector<BaseModule*> _modules;
   std::vector<BaseModule*> _processing_modules;
   std::vector<AsyncEventHandler*> _async_receivers;
+  EventPool _event_pool; ///< recycles events created from raw data
+  int _event_pool_size;  ///< max number of released events to keep for reuse
   EventPtr _current_event;
   bool _is_initialized;  ///< are the modules initialized?
   int run_id;
@@ -0,0 +1,60 @@
+/** @file EventPool.hh
+    @brief Defines the EventPool class which recycles processed events
+    @author bloer
+    @ingroup modules
+*/
+
+#ifndef EVENTPOOL_h
+#define EVENTPOOL_h
+
+#include "Event.hh"
+#include <boost/shared_ptr.hpp>
+
+/** @class EventPool
+    @brief Hands out Events whose storage is reused once all users release them
+
+    Events obtained from GetEvent() are returned to the pool automatically
+    when the last EventPtr referring to them goes away (which may happen on
+    any thread).  The raw event is dropped at that point, but the EventData
+    and its channels keep their vector capacities, so the next event wrapped
+    does not have to reallocate waveform, baseline, or integral buffers.
+    
+    If someone still holds the EventData, waveforms not yet decoded would
+    have to be decoded from the raw event before it is dropped.  Such
+    events are held until the next GetEvent() or Clear(), so the decoding
+    happens on the thread that processes events.
+
+    At most GetMaxSize() released events are kept; any others are deleted
+    as usual. A max size of 0 disables recycling altogether.
+    @ingroup modules
+*/
+class EventPool{
+public:
+  /// Constructor takes the maximum number of released events to keep
+  EventPool(size_t max_size = 8);
+  /// Destructor; events still in use are deleted normally when released
+  ~EventPool();
+
+  /// Get an event wrapping raw, reusing a released one if available
+  EventPtr GetEvent(RawEventPtr raw);
+
+  /// Set the maximum number of released events to hold on to
+  void SetMaxSize(size_t max_size);
+  /// Get the maximum number of released events to hold on to
+  size_t GetMaxSize() const;
+  /// Get the number of released events waiting to be reused
+  size_t GetNAvailable() const;
+  /// Delete all released events
+  void Clear();
+
+private:
+  struct Storage;
+  class Recycler;
+  boost::shared_ptr<Storage> _storage; ///< shared with the outstanding events
+
+  //copying not allowed
+  EventPool(const EventPool& right);
+  EventPool& operator=(const EventPool& right);
+};
+
+#endif
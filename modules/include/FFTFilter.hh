@@ -0,0 +1,91 @@
+/** @file FFTFilter.hh
+    @brief Defines the FFTFilter module
+    @author bloer
+    @ingroup modules
+*/
+
+#ifndef FFTFILTER_h
+#define FFTFILTER_h
+
+#include "ChannelModule.hh"
+#include <map>
+#include <set>
+#include <vector>
+
+class TH1F;
+class RealFFT;
+
+/** @class FFTFilter
+    @brief Filter or deconvolve each channel's baseline-subtracted waveform
+    in the frequency domain
+
+    The result is stored in ChannelData::filtered_waveform.  The available
+    filters are
+    - LOWPASS: gaussian low pass with width cutoff_freq
+    - MATCHED: correlation with the channel's template pulse
+    - WIENER: Wiener deconvolution of the template, with noise_power
+      regularizing frequencies where the template has little power
+    - DECONVOLVE: plain division by the template spectrum
+
+    If cutoff_freq is positive, the gaussian low pass is applied in all
+    modes, which is strongly recommended for DECONVOLVE.  Templates are
+    read from template_file as histograms named <template_hist>_<channel_id>
+    (and _-2 for the sum channel), in the same way as PulseShapeEval.  They
+    are normalized to unit area and their time axis is relative to the
+    pulse, so filtered pulses stay aligned with the raw ones.  Channels
+    without a usable template are skipped with a warning.
+
+    Waveforms are zero padded to a power of 2 long enough to avoid
+    wrap-around.  FFT plans are kept per padded length and filter spectra
+    per channel and length, so after the first event no tables are rebuilt
+    and no buffers are allocated.
+    @ingroup modules
+*/
+class FFTFilter : public ChannelModule{
+public:
+  FFTFilter();
+  ~FFTFilter();
+
+  int Initialize();
+  int Process(ChannelData* chdata);
+  int Finalize();
+
+  /// Only needs the baseline-subtracted waveform, not the raw one
+  bool UsesWaveform(int) const { return false; }
+
+  static const std::string GetDefaultName(){ return "FFTFilter"; }
+
+  enum FILTER_MODE { LOWPASS, MATCHED, WIENER, DECONVOLVE };
+
+private:
+  //parameters
+  FILTER_MODE mode;           ///< Which filter to apply
+  double cutoff_freq;         ///< Width of gaussian low pass in MHz; <=0 off
+  double noise_power;         ///< Wiener noise to signal power ratio
+  std::string template_file;  ///< File containing template pulse shapes
+  std::string template_hist;  ///< Base name of the template histograms
+
+  typedef std::pair<int,int> FilterKey;  ///< channel id, padded length
+
+  std::map<int, TH1F*> _templates;         ///< template pulse per channel
+  std::map<int, RealFFT*> _plans;          ///< FFT plan per padded length
+  std::map<FilterKey, std::vector<double> > _filters; ///< filter spectra
+  std::set<int> _skipped;                  ///< channels without a template
+  std::vector<double> _padded;             ///< zero padded input/output
+  std::vector<double> _spectrum;           ///< spectrum of the waveform
+
+  /// Does the current mode need a template pulse?
+  bool UsesTemplate() const { return mode != LOWPASS; }
+  int LoadTemplates();
+  /// Number of samples to pad each waveform with to avoid wrap-around
+  int GetPadding(const ChannelData* chdata) const;
+  RealFFT* GetPlan(int size);
+  /// Filter spectrum for this channel and plan, with 1/n folded in
+  const std::vector<double>* GetFilter(const ChannelData* chdata,
+				       RealFFT* plan);
+};
+
+std::istream& operator>>(std::istream& in, FFTFilter::FILTER_MODE& m);
+std::ostream& operator<<(std::ostream& out, const FFTFilter::FILTER_MODE& m);
+
+#endif
@@ -7,10 +7,19 @@
 #define FITTER_h
 
 #include "ChannelModule.hh"
+#include "WorkerPool.hh"
+#ifndef SINGLETHREAD
+#include "boost/thread/mutex.hpp"
+#endif
 
 #include <vector>
+class Pulse;
 /** @class Fitter
     @brief Fit a pulse with some PDF
+
+    Pulses from all channels of an event are collected first and then fit
+    with PulseFitEngine, optionally split over a pool of threads that is
+    started in Initialize and kept for the whole run.
     @ingroup modules
 */
 class Fitter : public ChannelModule
@@ -21,6 +30,8 @@ public:
   
   int Initialize();
   int Finalize();
+  /// Collect the pulses of every channel, then fit them all
+  int Process(EventPtr event);
   int Process(ChannelData* chdata);
   
   static const std::string GetDefaultName(){ return "Fitter";}
@@ -30,9 +41,29 @@ public:
   int end_fit;                   ///< last sample in fit range
   int slow_sample_rate;          
   int start_slow_sample_rate;
+  int max_iterations;            ///< maximum Levenberg-Marquardt iterations
+  int num_threads;               ///< number of threads to fit pulses with
   
 private:
+  /// One pulse waiting to be fit
+  struct FitTask{
+    Pulse* pulse;               ///< pulse to store the result in
+    double baseline;            ///< fixed baseline of the channel
+    std::vector<double> x;      ///< sample indices to fit
+    std::vector<double> y;      ///< raw waveform at those samples
+  };
+  std::vector<FitTask> _tasks;  ///< storage is reused from event to event
+  size_t _ntasks;               ///< number of tasks queued for this event
+  size_t _next_task;            ///< next task for a thread to take
+  WorkerPool _pool;             ///< threads that share the tasks
+#ifndef SINGLETHREAD
+  boost::mutex _task_mutex;     ///< protects _next_task
+#endif
   
+  /// Take tasks until none are left; run by each thread
+  void FitTasks();
+  /// Fit a single pulse
+  void FitPulse(FitTask& task);
 };
 
 
@@ -20,10 +20,21 @@ public:
   int Initialize();
   int Finalize();
   int Process(ChannelData* chdata);
+  /// Only needs the baseline-subtracted waveform
+  bool UsesWaveform(int) const { return false; }
   
   static const std::string GetDefaultName(){ return "Integrator"; }
+  
+  /// Does BaselineFinder integrate while it subtracts the baseline?
+  bool IsFusedWithBaseline() const { return fuse_with_baseline; }
+  /// Get the minimum value about baseline to count towards the integral
+  double GetThreshold() const { return threshold; }
+  /// Store the integral extrema at the given indices in chdata
+  static void SetIntegralExtrema(ChannelData* chdata, int max_index,
+				 int min_index);
 private:
   double threshold; ///< minimum value about baseline to count integral
+  bool fuse_with_baseline; ///< let BaselineFinder do the integration
   
 };
 
@@ -86,6 +86,12 @@ private:
   {
     return fprompt*(1.-exp(-(t-t0)/tau1)) + (1-fprompt)*(1.-exp(-(t-t0)/tau2));
   }
+  
+  //scratch buffers reused between calls to the search functions
+  std::vector<int> _drop_run;      ///< consecutive dropping samples
+  std::vector<double> _smoothed;   ///< down-sampled integral
+  std::vector<double> _diff;       ///< first difference of _smoothed
+  std::vector<double> _curve;      ///< second difference of _smoothed
 
 };
 
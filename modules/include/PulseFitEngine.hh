@@ -0,0 +1,76 @@
+/** @file PulseFitEngine.hh
+    @brief Defines the PulseFitEngine least squares fitter
+    @author rsaldanha
+    @ingroup modules
+*/
+
+#ifndef PULSEFITENGINE_h
+#define PULSEFITENGINE_h
+
+class PulseFit;
+
+/** @class PulseFitEngine
+    @brief Levenberg-Marquardt least squares fit of the PulseFit model
+
+    Evaluates the same function as PulseFit::operator(), together with its
+    analytic derivatives with respect to all parameters, so no numerical
+    differentiation or MINUIT is needed.  Parameters are indexed as in
+    PulseFit: amplitude, c1, tau1, tau2, sigma, decay, baseline, t0, rc.
+    Parameters can be fixed or given limits, like TF1 parameters.
+
+    An engine holds only the state of one fit, so independent pulses can be
+    fit simultaneously from different threads with one engine each.
+    @ingroup modules
+*/
+class PulseFitEngine{
+public:
+  enum { NPARAMS = 9 };   ///< number of parameters in the model
+  /// Status returned by Fit
+  enum FIT_STATUS { CONVERGED = 0, TOO_FEW_POINTS = 1, MAX_ITERATIONS = 4,
+		    DIVERGED = 5, SINGULAR = 6 };
+
+  PulseFitEngine();
+
+  /// Set the starting value of a parameter
+  void SetParameter(int i, double val){ _par[i] = val; }
+  /// Set the starting values of all parameters
+  void SetParameters(const double* par);
+  /// Get the current value of a parameter
+  double GetParameter(int i) const { return _par[i]; }
+  /// Fix a parameter at the given value
+  void FixParameter(int i, double val){ _par[i] = val; _fixed[i] = true; }
+  /// Let a previously fixed parameter vary again
+  void ReleaseParameter(int i){ _fixed[i] = false; }
+  /// Keep a parameter within [low, high] during the fit
+  void SetParLimits(int i, double low, double high)
+  { _low[i] = low; _high[i] = high; }
+  /// Give up after this many iterations
+  void SetMaxIterations(int n){ _max_iterations = n; }
+
+  /// Fit npts points (x,y) with equal weights; returns a FIT_STATUS
+  int Fit(const double* x, const double* y, int npts);
+  /// Sum of squared residuals after the last fit
+  double GetChi2() const { return _chi2; }
+  /// Number of points minus number of free parameters in the last fit
+  int GetNDF() const { return _ndf; }
+  /// Copy the parameters into a PulseFit
+  void StoreParams(PulseFit& fit) const;
+
+  /// Evaluate the model at t, and its gradient if grad is not 0
+  static double Eval(double t, const double* par, double* grad = 0);
+
+private:
+  double _par[NPARAMS];   ///< current parameter values
+  double _low[NPARAMS];   ///< lower limit of each parameter
+  double _high[NPARAMS];  ///< upper limit of each parameter
+  bool _fixed[NPARAMS];   ///< is each parameter fixed?
+  int _max_iterations;    ///< maximum number of iterations in Fit
+  double _chi2;           ///< sum of squared residuals of last fit
+  int _ndf;               ///< degrees of freedom of last fit
+
+  /// Sum of squared residuals for the given parameters
+  static double Chi2(const double* x, const double* y, int npts,
+		     const double* par);
+};
+
+#endif
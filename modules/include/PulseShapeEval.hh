@@ -9,11 +9,12 @@
 
 #include "BaseModule.hh"
 #include <map>
+#include <vector>
 /** @class PulseShapeEval
     @brief PulseShapeEval processes ...
     @ingroup modules
 */
-class TH1F;
+class TFile;
 class PulseShapeEval : public BaseModule
 {
 public:
@@ -22,15 +23,33 @@ public:
   int Initialize();
   int Finalize();
   int Process(EventPtr evt);
+  /// Only needs the processed data, not the raw waveform
+  bool UsesWaveform(int) const { return false; }
   static const std::string GetDefaultName(){ return "PulseShapeEval"; }
 
 private:
-    TH1F* event_shape;
+    /// Binned weights for one channel, with the samples falling in each bin
+    struct ShapeTable
+    {
+	/// Low edges of the bins, plus the upper edge of the last one
+	std::vector<double> edges;
+	/// gatti, ll_ele, ll_nuc, ll_r weights for each bin, bin-major
+	std::vector<double> weights;
+	/// Sample rate the offsets below were computed for
+	double sample_rate;
+	/// First sample in each bin, relative to the pulse peak
+	std::vector<int> bin_begin;
+	/// One past the last sample in each bin, relative to the pulse peak
+	std::vector<int> bin_end;
 
-    std::map<int, TH1F*> gatti_weights;
-    std::map<int, TH1F*> ll_ele_weights;
-    std::map<int, TH1F*> ll_nuc_weights;
-    std::map<int, TH1F*> ll_r_weights;
+	ShapeTable() : sample_rate(-1) {}
+	int GetNBins() const { return (int)edges.size() - 1; }
+	/// Recompute bin_begin and bin_end for a new sample rate
+	void SetSampleRate(double rate);
+    };
+
+    std::map<int, ShapeTable> shape_tables;
+    std::vector<double> event_shape; ///< binned shape of the current pulse
 
     std::string pulse_shape_file;
     std::string gatti_weights_hist;
@@ -39,6 +58,8 @@ private:
     std::string ll_r_weights_hist;
     
     int LoadWeights();
+    /// Load the four weight histograms for one channel; false if missing
+    bool LoadTable(TFile* f, const std::string& suffix, ShapeTable& table);
 };
 
 #endif
@@ -24,6 +24,8 @@ public:
   //module functions
   int Initialize();
   int Process(EventPtr event);
+  /// Writes the raw data blocks, not the decoded waveform
+  bool UsesWaveform(int) const { return false; }
   int Finalize();
   static const std::string GetDefaultName(){ return "RawWriter"; }
   //access functions
@@ -0,0 +1,59 @@
+/** @file RealFFT.hh
+    @brief Defines the RealFFT class for transforms of real waveforms
+    @author bloer
+    @ingroup modules
+*/
+
+#ifndef REALFFT_h
+#define REALFFT_h
+
+#include <vector>
+
+/** @class RealFFT
+    @brief Forward and inverse discrete Fourier transforms of real data
+
+    A RealFFT is a plan for one power-of-two length: the bit reversal and
+    twiddle tables are computed once by the constructor and reused by every
+    transform, so a plan should be kept for as long as its length is needed.
+    The length n real transform is done as a length n/2 complex transform
+    of the even and odd samples, which halves the work.
+
+    Spectra hold the n/2+1 non-negative frequencies as interleaved (re, im)
+    pairs, so they are 2*(n/2+1) doubles long.  Backward is not normalized:
+    Backward(Forward(x)) returns n*x.
+
+    Transforms use an internal work buffer, so a plan must not be shared
+    between threads.
+    @ingroup modules
+*/
+class RealFFT{
+public:
+  /// Build a plan for length n, which must be a power of 2 and at least 4
+  RealFFT(int n);
+
+  /// Number of real samples transformed
+  int GetSize() const { return _n; }
+  /// Number of complex bins in a spectrum
+  int GetNBins() const { return _n/2 + 1; }
+
+  /// Transform n real samples into n/2+1 complex bins
+  void Forward(const double* in, double* spectrum);
+  /// Transform n/2+1 complex bins into n real samples, scaled by n
+  void Backward(const double* spectrum, double* out);
+
+  /// Smallest power of 2 which is at least n (and at least 4)
+  static int GoodSize(int n);
+
+private:
+  int _n;                      ///< number of real samples
+  int _half;                   ///< size of the complex transform, n/2
+  std::vector<int> _bitrev;    ///< bit reversed index for each of _half
+  std::vector<double> _twiddle;///< exp(-2 pi i k/_half), k<_half/2, re,im
+  std::vector<double> _split;  ///< exp(-2 pi i k/_n), k<=_half, re,im
+  std::vector<double> _work;   ///< complex work buffer of _half entries
+
+  /// In-place complex transform of _work; inverse uses conjugate twiddles
+  void Transform(bool inverse);
+};
+
+#endif
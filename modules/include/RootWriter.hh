@@ -10,6 +10,14 @@
 #include "BaseModule.hh"
 #include <iostream>
 #include <string>
+#include <deque>
+#include <map>
+#ifndef SINGLETHREAD
+#include "boost/thread/mutex.hpp"
+#include "boost/thread/condition_variable.hpp"
+#include "boost/shared_ptr.hpp"
+namespace boost{ class thread; }
+#endif
 
 //forward declarations
 class TFile;
@@ -38,6 +46,28 @@ public:
 
 /** @class RootWriter
     @brief Store processed EventData objects for each trigger into a ROOT tree
+
+    Unless queue_size is 0, Process only queues the event; the tree is
+    filled, and its baskets compressed and written, by a separate writer
+    thread.  The queue holds at most queue_size events, after which Process
+    waits for the writer to catch up.  The EventHandler drains the queue
+    through FinishProcessing before finalizing any module, so modules which
+    write to the output file at Finalize never do so while the tree is
+    being filled.  Queued events are shared, not copied,
+    so no module after RootWriter may modify the event data.
+
+    The event branch is split into one leaf per member (split_level 99),
+    with vectors of objects stored as jagged arrays.  Which members are
+    stored is chosen by profile:
+    - full: every persistent member
+    - pulses: without generic vectors, f_param, baseline interpolations,
+      single_pe and unspikes
+    - summary: also without pulses and sums of integrals, leaving the
+      event and channel scalars, baselines, regions and tof
+    enable_branch and disable_branch adjust the profile member by member.
+    The profile is saved in the run metadata as rootwriter_profile.  As
+    ROOT fixes the stored members of a class the first time it is
+    written, the profile must be the same for all files in one process.
     @ingroup modules
 */
 class RootWriter : public BaseModule{
@@ -51,15 +81,21 @@ public:
   int Initialize();
   int Finalize();
   int Process(EventPtr evt);
+  /// Write out the queued events and end the writer thread
+  int FinishProcessing();
+  /// The raw waveform is never written to the tree
+  bool UsesWaveform(int) const { return false; }
   
   /// Get the output ROOT filename
   const std::string GetFilename(){ return _filename; }
   /// Set the output ROOT filename
   void SetFilename(const std::string& name){ _filename=name; }
+  /// Get the file Initialize will open, with the suffix and directory added
+  std::string GetOutputPath() const;
   /// Get the default ROOT output filename
   static const std::string GetDefaultFilename(){ return "out.root"; }
   
-  /// Enable a given branch in the stored tree
+  /// Enable a given branch in the stored tree, overriding the profile
   void EnableBranch(const char* classname, const char* branchname,
 		    bool enable=true);
   /// Disable a given branch in the stored tree
@@ -69,6 +105,14 @@ public:
   TTree* BuildMetadataTree(runinfo* info);
 private:
   void SaveConfig();
+  /// Store or drop the members listed by the profile, then the overrides
+  int ApplyProfile();
+  /// Fill one event into the tree
+  void FillTree(EventPtr event);
+  /// Fill the queued events until told to stop; run by the writer thread
+  void WriteQueue();
+  /// Write out everything queued and end the writer thread
+  void StopWriter();
   std::string _filename;
   std::string _directory;
   std::string _mode;
@@ -77,6 +121,25 @@ private:
   bool default_saveall;
   BranchEnabler enabler;
   BranchDisabler disabler;
+  int _compression_algorithm; ///< ROOT compression algorithm, 0 for default
+  int _compression_level;     ///< ROOT compression level, <0 for default
+  int _basket_size;           ///< buffer size of each branch in bytes
+  long long _auto_flush;      ///< see TTree::SetAutoFlush
+  int _queue_size;            ///< maximum events waiting to be written
+  int _imt_threads;           ///< threads compressing baskets with ROOT IMT
+  std::string _profile;       ///< named set of members to store
+  int _split_level;           ///< split level of the event branch
+  /// enable_branch and disable_branch settings by CLASS.BRANCH
+  std::map<std::string, bool> _branch_overrides;
+  
+  std::deque<EventPtr> _queue;  ///< events waiting for the writer thread
+  bool _stop_writer;            ///< tell the writer to finish the queue
+#ifndef SINGLETHREAD
+  boost::mutex _queue_mutex;    ///< protects _queue and _stop_writer
+  boost::condition_variable _queue_filled;  ///< an event or stop was queued
+  boost::condition_variable _queue_drained; ///< an event was taken
+  boost::shared_ptr<boost::thread> _writer; ///< the writer thread
+#endif
 };
 
 /// Overload istream to call BranchEnabler from config file
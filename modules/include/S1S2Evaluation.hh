@@ -23,6 +23,8 @@ public:
   int Initialize();
   int Finalize();
   int Process(EventPtr evt);
+  /// Only needs the pulses, not the raw waveform
+  bool UsesWaveform(int) const { return false; }
   
   static std::string GetDefaultName(){ return "S1S2Evaluation"; }
 private:
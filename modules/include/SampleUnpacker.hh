@@ -0,0 +1,64 @@
+/** @file SampleUnpacker.hh
+    @brief Fused conversion kernels for raw digitizer samples
+    @author bloer
+    @ingroup modules
+*/
+
+#ifndef SAMPLEUNPACKER_h
+#define SAMPLEUNPACKER_h
+
+#include <stdint.h>
+
+/** @struct SampleExtrema
+    @brief Smallest and largest values found while unpacking samples
+
+    Indices refer to the first occurrence of each value, matching
+    std::min_element and std::max_element. They are -1 if no samples were
+    unpacked.
+    @ingroup modules
+*/
+struct SampleExtrema{
+  double minimum;   ///< smallest (possibly inverted) sample value
+  double maximum;   ///< largest (possibly inverted) sample value
+  int min_index;    ///< index of the first sample equal to minimum
+  int max_index;    ///< index of the first sample equal to maximum
+  SampleExtrema() : minimum(0), maximum(0), min_index(-1), max_index(-1) {}
+};
+
+/** @namespace SampleUnpacker
+    @brief Convert raw samples to double, optionally inverting them as
+    (range - sample), and find the extrema in the same pass.
+
+    If dest is 0 only the extrema are evaluated.  The 8 and 16 bit kernels
+    use AVX2 or SSE4.1 when the cpu supports them (checked once at run
+    time) and fall back to plain loops otherwise; results are identical.
+
+    AddScaled accumulates weighted channels, as for the sum channel.  Its
+    AVX2 kernels multiply and add separately rather than with FMA, so the
+    sum does not depend on the machine it was computed on.
+    @ingroup modules
+*/
+namespace SampleUnpacker{
+  /// Unpack n 8-bit samples
+  SampleExtrema Unpack(const uint8_t* src, int n, double* dest,
+		       bool invert=false, double range=0);
+  /// Unpack n 16-bit samples
+  SampleExtrema Unpack(const uint16_t* src, int n, double* dest,
+		       bool invert=false, double range=0);
+  /// Unpack n 32-bit samples
+  SampleExtrema Unpack(const uint32_t* src, int n, double* dest,
+		       bool invert=false, double range=0);
+  /// Unpack 10-bit samples packed up to 3 per word in [begin, end)
+  SampleExtrema UnpackPacked10(const uint32_t* begin, const uint32_t* end,
+			       double* dest, bool invert=false, double range=0);
+  /// Add n 8-bit samples, multiplied by scale, to dest
+  void AddScaled(const uint8_t* src, int n, double* dest, double scale);
+  /// Add n 16-bit samples, multiplied by scale, to dest
+  void AddScaled(const uint16_t* src, int n, double* dest, double scale);
+  /// Add n converted samples, multiplied by scale, to dest
+  void AddScaled(const double* src, int n, double* dest, double scale);
+  /// Name of the instruction set used by the 8 and 16 bit kernels
+  const char* GetInstructionSet();
+}
+
+#endif
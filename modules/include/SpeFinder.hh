@@ -8,9 +8,25 @@
 #define SPEFINDER_h
 
 #include "ChannelModule.hh"
+#include <map>
+#include <vector>
+
+class Spe;
 
 /** @class SpeFinder
     @brief Search for single-photoelectron events in the tails of scintillation
+
+    Only samples where the waveform drops by rough_threshold over 2 samples
+    are examined in detail; they are flagged in one pass over the waveform
+    before the search begins.
+
+    The integral and amplitude of every photoelectron found are also
+    histogrammed per channel while processing, with a running mean and
+    sigma of the integral.  At Finalize the spectra are written to the open
+    ROOT file, the gain estimates are stored in the channel metadata of the
+    runinfo as spe_finder_mean, spe_finder_sigma, spe_finder_entries and
+    spe_finder_occupancy (mean number found per search), and, if
+    write_database is set, in the database calibration table.
     @ingroup modules
 */
 class SpeFinder : public ChannelModule
@@ -22,6 +38,8 @@ public:
   int Initialize();
   int Finalize();
   int Process(ChannelData* chdata);
+  /// Only needs the baseline-subtracted waveform
+  bool UsesWaveform(int) const { return false; }
   
   static const std::string GetDefaultName(){ return "SpeFinder";}
   
@@ -37,5 +55,32 @@ public:
   double pulse_window; ///< Window to integrate around found pulse
   int max_photons; ///< maximum number of photons to find before exiting
   bool debug; ///< debug mode; useful for graphics
+  int hist_bins; ///< number of bins in the online spectra
+  double integral_max; ///< upper edge of the online integral spectrum
+  double amplitude_max; ///< upper edge of the online amplitude spectrum
+  int min_entries; ///< minimum number of photons to report a gain
+  bool write_database; ///< store the gains in the database at Finalize
+
+private:
+  /// Online spectra and running statistics for one channel
+  struct SpeStats{
+    long nsearched; ///< number of waveforms searched
+    long nfound;    ///< number of photoelectrons found
+    double mean;    ///< running mean of the integral
+    double sumsq;   ///< sum of squared deviations from the mean
+    std::vector<double> integral_hist;  ///< with underflow and overflow
+    std::vector<double> amplitude_hist; ///< with underflow and overflow
+    SpeStats() : nsearched(0), nfound(0), mean(0), sumsq(0) {}
+  };
+
+  std::map<int, SpeStats> _stats;  ///< statistics for each channel
+  std::vector<char> _candidates;   ///< is each sample a candidate start?
+
+  /// Get the statistics for a channel, creating them if needed
+  SpeStats& GetStats(int channel_id);
+  /// Add a found photoelectron to the statistics
+  void Fill(SpeStats& stats, const Spe& spe) const;
+  /// Write the spectra and store the gains
+  int StoreStats();
 };
 #endif
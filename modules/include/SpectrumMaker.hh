@@ -4,14 +4,24 @@
 #include "BaseModule.hh"
 #include "RootGraphix.hh"
 #include "phrase.hh"
+#include "EventFormula.hh"
+#include <vector>
 
 class TH1;
 class TCanvas;
-class TTree;
-class TBranch;
-class TTreeFormula;
 class RootGraphix; 
 
+/** @class SpectrumMaker
+    @brief Fill a histogram of variables from each event, like TTree::Draw
+
+    xvar, yvar and cut use TTree::Draw syntax and are compiled into one
+    EventFormula at Initialize, which is evaluated on the in-memory
+    EventData.  As with TTree::Draw, each instance is filled with the value
+    of cut as its weight, and skipped where the cut is 0.
+
+    A SpectrumManager may evaluate the expressions instead, together with
+    those of all other spectra, and fill the spectrum through FillPending.
+*/
 class SpectrumMaker : public BaseModule{
 public:
   SpectrumMaker(const std::string& name = GetDefaultName());
@@ -22,16 +32,29 @@ public:
   int Process(EventPtr evt);
   
   static std::string GetDefaultName(){ return "SpectrumMaker"; }
+
+  /// Get the expression plotted on the x axis
+  const std::string& GetXVar() const { return _xvar; }
+  /// Get the expression plotted on the y axis, empty for 1D spectra
+  const std::string& GetYVar() const { return _yvar; }
+  /// Get the cut expression, empty if there is none
+  const std::string& GetCut() const { return _cut; }
+  
+  /// Fill one instance into the pending histogram; needs no lock
+  void FillPending(double x, double y, double weight);
+  /// Add the pending entries to the displayed histogram; hold the graphix lock
+  void MergePending();
+  
 private:
 
   TH1* _histo;            ///< Underlying histogram object
+  TH1* _pending;          ///< Entries filled since the last MergePending
   TCanvas* _canvas;       ///< Canvas on which the histogram is drawn
-  TTree* _tree;           ///< Dummy tree used to parse variables
-  TBranch* _branch;
-  //TTreeFormula* _xform;
-  //TTreeFormula* _yform;
-  //TTreeFormula* _cutform;
-  std::string _draw_cmd;   ///<actual draw command passed to tree
+  EventFormula _formula;  ///< Compiled xvar, yvar and cut
+  int _xterm;             ///< Index of xvar in _formula
+  int _yterm;             ///< Index of yvar in _formula, or -1
+  int _cutterm;           ///< Index of cut in _formula, or -1
+  std::vector<double> _values; ///< Values of the terms for each instance
 
   phrase _cut;            ///< cut determines whether to draw
   phrase _xvar;           ///< What to plot on the x axis?
@@ -0,0 +1,97 @@
+/** @file SpectrumManager.hh
+    @brief Defines the SpectrumManager module
+    @author bloer
+    @ingroup modules
+*/
+
+#ifndef SPECTRUMMANAGER_h
+#define SPECTRUMMANAGER_h
+
+#include "BaseModule.hh"
+#include "WorkerPool.hh"
+#include <string>
+#include <vector>
+#ifndef SINGLETHREAD
+#include "boost/thread/mutex.hpp"
+#endif
+
+class SpectrumMaker;
+class EventFormula;
+class RootGraphix;
+
+/** @class SpectrumManager
+    @brief Evaluate the expressions of many SpectrumMakers together
+
+    Each SpectrumMaker evaluating its own xvar, yvar and cut reads the same
+    members and recomputes the same subexpressions many times per event.
+    The manager instead compiles the expressions of all spectra whose
+    loops run over the same vectors into one EventFormula, so identical
+    terms, cuts and subexpressions are evaluated once per event.
+
+    The groups of spectra are evaluated by a pool of num_threads threads
+    kept from Initialize to Finalize, and each
+    instance is filled into the spectrum's private pending histogram, so
+    no lock is needed while processing.  Every merge_interval events the
+    pending histograms are added to the displayed ones while holding the
+    graphix lock once.
+
+    The spectra must be registered with the EventHandler so that they are
+    initialized, but must not process events themselves.
+    @ingroup modules
+*/
+class SpectrumManager : public BaseModule{
+public:
+  SpectrumManager(const std::string& name = GetDefaultName());
+  ~SpectrumManager();
+  
+  int Initialize();
+  int Finalize();
+  int Process(EventPtr evt);
+  
+  static std::string GetDefaultName(){ return "SpectrumManager"; }
+  
+  /// Evaluate and fill spec from now on; call before Initialize
+  void AddSpectrum(SpectrumMaker* spec){ _spectra.push_back(spec); }
+  
+  //parameters
+  int num_threads;      ///< number of threads evaluating groups of spectra
+  int merge_interval;   ///< events between updates of the displayed spectra
+  
+private:
+  /// Indices of one spectrum's terms in its group's formula
+  struct Member{
+    SpectrumMaker* spectrum;
+    int xterm;
+    int yterm;    ///< -1 for 1D spectra
+    int cutterm;  ///< -1 if there is no cut
+  };
+  /// Spectra whose expressions loop over the same vectors
+  struct Group{
+    std::string signature;      ///< EventFormula::GetLoopSignature()
+    EventFormula* formula;      ///< terms of all members
+    std::vector<Member> members;
+    std::vector<double> values; ///< storage reused from event to event
+  };
+  
+  std::vector<SpectrumMaker*> _spectra; ///< every spectrum added
+  std::vector<Group> _groups;           ///< enabled spectra by loops
+  RootGraphix* _graphix;                ///< owner of the graphics lock
+  int _unmerged;                        ///< events since the last merge
+  EventData* _event;                    ///< event being processed
+  size_t _next_group;                   ///< next group for a thread to take
+  WorkerPool _pool;                     ///< threads that share the groups
+#ifndef SINGLETHREAD
+  boost::mutex _group_mutex;            ///< protects _next_group
+#endif
+  
+  /// Add the expressions of spec to the group with the same loops
+  int AddToGroup(SpectrumMaker* spec);
+  /// Take groups until none are left; run by each thread
+  void ProcessGroups();
+  /// Evaluate one group and fill its spectra
+  void ProcessGroup(Group& group);
+  /// Merge the pending entries of every spectrum
+  void MergeAll();
+};
+
+#endif
@@ -8,9 +8,17 @@
 #define SUMCHANNELS_h
 
 #include "BaseModule.hh"
+#include <map>
+#include <vector>
 
 /** @class SumChannels
     @brief Creates an extra 'channel' which is the sum of all channels 
+
+    Each channel is weighted by its gain (channel_gains, default 1) divided
+    by its spe_mean, and shifted by its entry in channel_time_offsets so
+    that a signal arriving that much later lines up with the others.  The
+    sum covers the window in which every channel has data, and is
+    accumulated directly into the sum channel's waveform.
     @ingroup modules
 */
 class SumChannels : public BaseModule
@@ -25,6 +33,12 @@ public:
   
   static const std::string GetDefaultName(){ return "SumChannels";}
   
+private:
+  std::map<int,double> channel_gains;        ///< extra weight by channel id
+  std::map<int,double> channel_time_offsets; ///< delay in us by channel id
+
+  std::vector<int> _summed;   ///< index of each channel in this event's sum
+  std::vector<int> _aligned;  ///< trigger index of each, after its offset
 };
 
 #endif
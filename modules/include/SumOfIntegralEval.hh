@@ -21,6 +21,8 @@ public:
   int Initialize();
   int Finalize();
   int Process(EventPtr evt);
+  /// Only needs the pulses, not the raw waveform
+  bool UsesWaveform(int) const { return false; }
   static const std::string GetDefaultName(){ return "SumOfIntegralEval"; }
 
 private:
@@ -19,6 +19,8 @@ public:
   
   int Initialize();
   int Process(EventPtr evt);
+  /// Only needs the event headers
+  bool UsesWaveform(int) const { return false; }
   int Finalize();
   
 private:
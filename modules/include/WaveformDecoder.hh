@@ -0,0 +1,36 @@
+/** @file WaveformDecoder.hh
+    @brief Defines the WaveformDecoder interface
+    @author bloer
+    @ingroup modules
+*/
+
+#ifndef WAVEFORMDECODER_h
+#define WAVEFORMDECODER_h
+
+class ChannelData;
+
+/** @class WaveformDecoder
+    @brief Interface for objects which fill a channel's waveform on demand
+    
+    ConvertData only reads the headers of channels no module asked for, and
+    registers itself as the channel's decoder. The samples are then unpacked
+    from the raw data the first time ChannelData::GetWaveform() is called.
+    If the EventData outlives its Event, the Event decodes what is left with
+    EventData::ReleaseRawData() before letting go of the raw data.
+    
+    Everything a decoder needs is stored in the channel, so decoding still
+    works after ConvertData is finalized.  Decoding writes to the channel
+    without locking, so it must only happen on the thread which processes
+    the event: when events are handed to other threads, ConvertData decodes
+    the waveforms their modules use first, and the EventPool releases raw
+    events on the processing thread.
+    @ingroup modules
+*/
+class WaveformDecoder{
+public:
+  virtual ~WaveformDecoder(){}
+  /// Fill chdata's waveform, extrema, and saturation from its raw data
+  virtual void DecodeWaveform(ChannelData* chdata) const = 0;
+};
+
+#endif
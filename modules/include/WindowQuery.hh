@@ -0,0 +1,60 @@
+/** @file WindowQuery.hh
+    @brief Defines the WindowQuery class for fast range min/max lookups
+    @author bloer
+    @ingroup modules
+*/
+
+#ifndef WINDOWQUERY_h
+#define WINDOWQUERY_h
+
+#include <vector>
+
+/** @class WindowQuery
+    @brief Answers argmin/argmax over any window of a waveform
+
+    The waveform is split into blocks of BLOCK samples, and a sparse table
+    holds the position of the extremum over every power-of-two run of whole
+    blocks.  A query scans at most two partial blocks and combines two
+    table entries, so evaluating many regions or pulses on a channel
+    costs little more than evaluating one.  Ties resolve to the earliest
+    sample, matching std::min_element and std::max_element; an empty window
+    returns its end index, as they do.
+
+    Window integrals need no special structure, as ChannelData::integral
+    is already a running sum.
+
+    The query keeps a pointer to the waveform, so it must be rebuilt if the
+    waveform changes.
+    @ingroup modules
+*/
+class WindowQuery{
+public:
+  WindowQuery() : _wave(0), _nsamps(0), _nblocks(0) {}
+
+  /// Build the tables for nsamps samples starting at wave
+  void Build(const double* wave, int nsamps);
+  /// Forget the current waveform; tables keep their storage
+  void Reset(){ _wave = 0; _nsamps = 0; _nblocks = 0; }
+  /// Was the query last built for this waveform?
+  bool IsBuiltFor(const double* wave, int nsamps) const
+  { return _wave && _wave == wave && _nsamps == nsamps; }
+
+  /// Index of the first minimum sample in [begin, end)
+  int ArgMin(int begin, int end) const;
+  /// Index of the first maximum sample in [begin, end)
+  int ArgMax(int begin, int end) const;
+
+private:
+  enum { BLOCK = 64 };    ///< samples per block; partial blocks are scanned
+  const double* _wave;    ///< waveform the tables were built for
+  int _nsamps;            ///< number of samples in _wave
+  int _nblocks;           ///< number of whole blocks
+  std::vector<int> _min_table; ///< argmin of 2^level blocks, level-major
+  std::vector<int> _max_table; ///< argmax of 2^level blocks, level-major
+
+  template<class Compare> int Query(int begin, int end,
+				    const std::vector<int>& table) const;
+  template<class Compare> void BuildTable(std::vector<int>& table);
+};
+
+#endif
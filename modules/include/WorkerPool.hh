@@ -0,0 +1,72 @@
+/** @file WorkerPool.hh
+    @brief Defines the WorkerPool class of persistent helper threads
+    @ingroup modules
+*/
+
+#ifndef WORKERPOOL_h
+#define WORKERPOOL_h
+
+#ifndef SINGLETHREAD
+#include "boost/thread/condition_variable.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/thread.hpp"
+#include "boost/function.hpp"
+#include "boost/shared_ptr.hpp"
+#endif
+#include <vector>
+
+/** @class WorkerPool
+    @brief Helper threads that live for a whole run and share work per event
+
+    Modules that split one event over several threads start the pool in
+    Initialize and stop it in Finalize, instead of creating and joining
+    threads for every event.  Run() hands the same job to every helper and
+    to the calling thread, and returns once all of them have finished it;
+    the job itself takes items from a shared queue until none are left.
+    Without threads Run() just calls the job.
+    @ingroup modules
+*/
+class WorkerPool{
+public:
+#ifndef SINGLETHREAD
+  typedef boost::function<void()> Job;
+#endif
+  WorkerPool();
+  ~WorkerPool();
+  
+  /// Start nthreads-1 helper threads; the caller of Run is the last one
+  void Start(int nthreads);
+  /// Stop and join all helper threads
+  void Stop();
+  /// Number of threads that Run() uses, including the caller
+  int GetNThreads() const;
+  
+#ifndef SINGLETHREAD
+  /// Run job on every thread of the pool and wait for all to finish
+  void Run(const Job& job);
+#else
+  /// Run job in the calling thread
+  template<class Job> void Run(const Job& job){ job(); }
+#endif
+
+private:
+#ifndef SINGLETHREAD
+  /// Wait for and run jobs until Stop() is called; run by each helper
+  void HelperLoop(unsigned long generation);
+  
+  std::vector<boost::shared_ptr<boost::thread> > _threads; ///< the helpers
+  Job _job;                        ///< job of the current Run()
+  unsigned long _generation;       ///< number of jobs handed out so far
+  int _busy;                       ///< helpers still running the current job
+  bool _stop;                      ///< tell the helpers to exit
+  boost::mutex _mutex;             ///< protects all of the above
+  boost::condition_variable _job_ready;  ///< signals a new job or stop
+  boost::condition_variable _job_done;   ///< signals that _busy reached 0
+#endif
+  
+  //not copyable
+  WorkerPool(const WorkerPool&);
+  WorkerPool& operator=(const WorkerPool&);
+};
+
+#endif
@@ -9,6 +9,7 @@
 #include "eTrainFinder.hh"
 #include "SumChannels.hh"
 #include "Smoother.hh"
+#include "FFTFilter.hh"
 #include "EvalRois.hh"
 #include "Integrator.hh"
 #include "AverageWaveforms.hh"
@@ -28,6 +29,7 @@ int EventHandler::AddCommonModules()
   //AddModule<FParameter>();
   AddModule<PulseFinder>();
   //AddModule<Smoother>();
+  //AddModule<FFTFilter>();
   AddModule<EvalRois>();
   AddModule<S1S2Evaluation>();
   AddModule<eTrainFinder>();
@@ -15,10 +15,13 @@
 #include <fstream>
 #include <string>
 #include <sstream>
+#include <cstdio>
+#include <cmath>
 using namespace std;
 
 AverageWaveforms::AverageWaveforms() : 
-    BaseModule(GetDefaultName(), "Average the waveform for each channel over the entire run and save to the output root file")
+    BaseModule(GetDefaultName(), "Average the waveform for each channel over the entire run and save to the output root file"),
+    _accepted(0)
 {
     AddDependency<ConvertData>();
     AddDependency<SumChannels>();
@@ -56,6 +59,10 @@ AverageWaveforms::AverageWaveforms() :
     RegisterParameter("min_s2_start_time", min_s2_start_time = 40, "");
     RegisterParameter("max_s2_start_time", max_s2_start_time = 300, "");
     RegisterParameter("number_of_base_groups", number_of_base_groups = 2, "");
+    RegisterParameter("snapshot_file", snapshot_file = "",
+		      "If not empty, periodically write the sums so far to this text file");
+    RegisterParameter("snapshot_interval", snapshot_interval = 1000,
+		      "Number of accepted events between snapshots");
 }
 
 AverageWaveforms::~AverageWaveforms()
@@ -63,67 +70,177 @@ AverageWaveforms::~AverageWaveforms()
     Cleanup();
 }
 
+/// Add value to sum, carrying the lost low-order bits in comp
+static inline void KahanAdd(double& sum, double& comp, double value)
+{
+    const double y = value - comp;
+    const double t = sum + y;
+    comp = (t - sum) - y;
+    sum = t;
+}
+
 void AverageWaveforms::Cleanup()
 {
-    std::map<int,TGraphErrors*>::iterator mapit = _plots.begin();
-    for( ; mapit != _plots.end() ; mapit++){
-	delete mapit->second;
+    for (size_t i = 0; i < _accumulators.size(); i++)
+	delete _accumulators[i];
+    _accumulators.clear();
+#ifndef SINGLETHREAD
+    _thread_accumulators.clear();
+#endif
+    _event_list.clear();
+    _accepted = 0;
+}
+
+AverageWaveforms::Accumulator* AverageWaveforms::GetAccumulator()
+{
+#ifdef SINGLETHREAD
+    if (_accumulators.empty())
+	_accumulators.push_back(new Accumulator);
+    return _accumulators[0];
+#else
+    boost::mutex::scoped_lock lock(_accumulators_mutex);
+    const boost::thread::id id = boost::this_thread::get_id();
+    std::map<boost::thread::id, Accumulator*>::iterator it = 
+	_thread_accumulators.find(id);
+    if (it != _thread_accumulators.end())
+	return it->second;
+    Accumulator* acc = new Accumulator;
+    _accumulators.push_back(acc);
+    _thread_accumulators.insert(std::make_pair(id, acc));
+    return acc;
+#endif
+}
+
+void AverageWaveforms::Merge(std::map<int, ChannelSum>& total)
+{
+    total.clear();
+    for (size_t a = 0; a < _accumulators.size(); a++)
+    {
+#ifndef SINGLETHREAD
+	boost::mutex::scoped_lock lock(_accumulators[a]->mutex);
+#endif
+	std::map<int, ChannelSum>& channels = _accumulators[a]->channels;
+	std::map<int, ChannelSum>::iterator it = channels.begin();
+	for ( ; it != channels.end(); it++)
+	{
+	    const ChannelSum& part = it->second;
+	    ChannelSum& sum = total[it->first];
+	    const size_t nsamps = part.y.size();
+	    if (sum.nevents == 0)
+	    {
+		sum.y.assign(nsamps, 0);
+		sum.y_comp.assign(nsamps, 0);
+		sum.var.assign(nsamps, 0);
+		sum.var_comp.assign(nsamps, 0);
+	    }
+	    else if (sum.y.size() != nsamps)
+	    {
+		Message(ERROR)<<"Uneven number of samples between two events "
+			      <<"for channel "<<it->first<<std::endl;
+		continue;
+	    }
+	    //x comes from the earliest event, as when processed in order
+	    if (sum.nevents == 0 || part.first_event < sum.first_event)
+	    {
+		sum.x = part.x;
+		sum.first_event = part.first_event;
+	    }
+	    sum.nevents += part.nevents;
+	    for (size_t i = 0; i < nsamps; i++)
+	    {
+		KahanAdd(sum.y[i], sum.y_comp[i], part.y[i]);
+		KahanAdd(sum.y[i], sum.y_comp[i], -part.y_comp[i]);
+		KahanAdd(sum.var[i], sum.var_comp[i], part.var[i]);
+		KahanAdd(sum.var[i], sum.var_comp[i], -part.var_comp[i]);
+	    }
+	}
     }
-    _plots.clear();
-    _num_event.clear();
 }
 
+void AverageWaveforms::WriteSnapshot(int nevents)
+{
+    std::map<int, ChannelSum> total;
+    Merge(total);
+    //write to a temporary file and rename, so readers never see half a file
+    const std::string tempname = snapshot_file + ".tmp";
+    std::ofstream out(tempname.c_str());
+    if (!out.is_open())
+    {
+	Message(WARNING)<<"Unable to open snapshot file "<<tempname<<std::endl;
+	return;
+    }
+    out<<"# AverageWaveforms snapshot after "<<nevents<<" events\n";
+    std::map<int, ChannelSum>::iterator it = total.begin();
+    for ( ; it != total.end(); it++)
+    {
+	const ChannelSum& sum = it->second;
+	out<<"# channel "<<it->first<<" events "<<sum.nevents<<"\n";
+	for (size_t i = 0; i < sum.y.size(); i++)
+	    out<<sum.x[i]<<" "<<sum.y[i] - sum.y_comp[i]<<" "
+	       <<sqrt(sum.var[i] - sum.var_comp[i])<<"\n";
+    }
+    out.close();
+    if (rename(tempname.c_str(), snapshot_file.c_str()) != 0)
+	Message(WARNING)<<"Unable to write snapshot file "<<snapshot_file
+			<<std::endl;
+}
 
 int AverageWaveforms::Initialize()
 { 
-    // opens file stream, takes first event
+    Cleanup();
+    // load the whole event list once, sorted for binary searches
     if (use_event_list)
     {
-	string line;
-	current_event = -1;
-	current_run = -1;
-	txt.open(event_list_location.c_str());
-	if (txt.is_open() && txt.good())
+	ifstream txt(event_list_location.c_str());
+	if (!txt.is_open())
 	{
-	    getline(txt,line);
-	    istringstream ss1(line);
-	    string temp;
-	    getline(ss1, temp, ' ');
-	    istringstream ss2(temp);
-	    ss2 >> current_run;
-	    getline(ss1, temp, ' ');
-	    istringstream ss3(temp);
-	    ss3 >> current_event;
+	    Message(ERROR)<<"Unable to open event list "<<event_list_location
+			  <<std::endl;
+	    return 1;
 	}
+	int run, event;
+	while (txt >> run >> event)
+	    _event_list.push_back(std::make_pair(run, event));
+	std::sort(_event_list.begin(), _event_list.end());
+	_event_list.erase(std::unique(_event_list.begin(), _event_list.end()),
+			  _event_list.end());
+	Message(DEBUG)<<"AverageWaveforms: loaded "<<_event_list.size()
+		      <<" events from "<<event_list_location<<std::endl;
     }
     return 0; 
 }
 
 int AverageWaveforms::Finalize()
 {
+    std::map<int, ChannelSum> total;
+    Merge(total);
     if(gFile && gFile->IsOpen()){
-	std::map<int,TGraphErrors*>::iterator mapit = _plots.begin();
-	for( ; mapit != _plots.end(); mapit++){
-	    TGraphErrors* graph = mapit->second;
-	    //double* y = graph->GetY();
-	    double* ey = graph->GetEY();
-
-	    for(int i=0; i < graph->GetN(); i++){
-		// ey stored sum of variances
-		ey[i] = sqrt(ey[i]);
+	std::map<int, ChannelSum>::iterator mapit = total.begin();
+	for( ; mapit != total.end(); mapit++){
+	    const ChannelSum& sum = mapit->second;
+	    const int nsamps = sum.y.size();
+	    TGraphErrors graph(nsamps);
+	    char name[25];
+	    sprintf(name,"average_channel%d",mapit->first);
+	    graph.SetName(name);
+	    graph.SetTitle(name);
+	    for(int i=0; i < nsamps; i++){
+		graph.SetPoint(i, sum.x[i], sum.y[i] - sum.y_comp[i]);
+		// var stored sum of variances
+		graph.SetPointError(i, 0, sqrt(sum.var[i] - sum.var_comp[i]));
 	    }
-	    graph->SetFillStyle(3002);
-	    graph->SetFillColor(kRed);
-	    graph->Write();
+	    graph.SetFillStyle(3002);
+	    graph.SetFillColor(kRed);
+	    graph.Write();
 	}
     }
-    std::map<int, int>::iterator numOfEvents = _num_event.begin();
-    for ( ; numOfEvents != _num_event.end(); numOfEvents++){
+    std::map<int, ChannelSum>::iterator numOfEvents = total.begin();
+    for ( ; numOfEvents != total.end(); numOfEvents++){
 	Message(INFO)<<"<Module> AverageWaveforms: Channel "<< numOfEvents->first
-		     <<" includes "<< numOfEvents->second <<" events"<<std::endl;
+		     <<" includes "<< numOfEvents->second.nevents <<" events"<<std::endl;
     }
-    if (txt.is_open())
-	txt.close();
+    if (!snapshot_file.empty() && _accepted > 0)
+	WriteSnapshot(_accepted);
     Cleanup();
     return 0;
 }
@@ -169,28 +286,16 @@ int AverageWaveforms::Process(EventPtr evt)
 
     else
     {//Select only events that appear in event list
-      
-	// Move to the correct run number
-	while (event->run_id != current_run && txt.is_open() && txt.good())
-	{
-	    string line;
-	    getline(txt,line);
-	    istringstream ss1(line);
-	    string temp;
-	    getline(ss1, temp, ' ');
-	    istringstream ss2(temp);
-	    ss2 >> current_run;
-	    getline(ss1, temp, ' ');
-	    istringstream ss3(temp);
-	    ss3 >> current_event;
-	}
-      
-	// Check for event in text file
-	if (event->event_id != current_event)
+	if (!std::binary_search(_event_list.begin(), _event_list.end(),
+				std::make_pair(event->run_id, event->event_id)))
 	    return 0;
     }
   
     
+    Accumulator* acc = GetAccumulator();
+#ifndef SINGLETHREAD
+    boost::mutex::scoped_lock lock(acc->mutex);
+#endif
     //Loop over individual channels
     for (size_t ch = 0; ch < event->channels.size(); ch++)
     {
@@ -214,7 +319,6 @@ int AverageWaveforms::Process(EventPtr evt)
       //debug
       //Message(INFO) << "Processing run: " << event->run_id << " Event: " << event->event_id <<" Channel: "<<ch<<endl;
 
-	_num_event[chdata.channel_id]++;
 	const double* wave = chdata.GetBaselineSubtractedWaveform();
 	int start_samp; 
 	int end_samp; 
@@ -230,100 +334,74 @@ int AverageWaveforms::Process(EventPtr evt)
 	    end_samp = chdata.TimeToSample(sum_end_time, true);
 	}
 	const int nsamps = (end_samp - start_samp + 1) / bin_size;
+	if (nsamps <= 0)
+	    continue;
 
-	std::map<int,TGraphErrors*>::iterator prev = _plots.find(chdata.channel_id); 
-	if(prev == _plots.end())
+	ChannelSum& sum = acc->channels[chdata.channel_id];
+	if (sum.nevents == 0)
 	{ // first event
-	    double* x_ray = new double[nsamps];
-	    double* y_ray = new double[nsamps];
-	    double* ey_ray = new double[nsamps];
-	    TGraphErrors* avg = new TGraphErrors(nsamps, x_ray, y_ray, 0, ey_ray);
-	    char name[25];
-	    sprintf(name,"average_channel%d",chdata.channel_id);
-	    avg->SetName(name);
-	    avg->SetTitle(name);
-    
-	    double* x = avg->GetX();
-	    double* y = avg->GetY();
-	    double* ey = avg->GetEY();
-	    int index;
-	    double yj;
-	    int j;
-	    //Loop over samples in average waveform
+	    sum.y.assign(nsamps, 0);
+	    sum.y_comp.assign(nsamps, 0);
+	    sum.var.assign(nsamps, 0);
+	    sum.var_comp.assign(nsamps, 0);
+	}
+	else if ((int)sum.y.size() != nsamps)
+	{
+	    Message(ERROR)<<"Uneven number of samples between two events "
+			  <<"for channel "<<chdata.channel_id<<std::endl;
+	    return 1;
+	}
+	// the time axis is taken from the earliest event of the earliest run
+	const std::pair<int,int> this_event(event->run_id, event->event_id);
+	if (sum.nevents == 0 || this_event < sum.first_event)
+	{
+	    sum.first_event = this_event;
+	    sum.x.resize(nsamps);
 	    for(int i=0; i < nsamps; i++)
-	    {
-		index = start_samp+i*bin_size;
-		yj = 0;
-		x[i]=chdata.SampleToTime(index);
-		y[i]=0;
-		ey[i]=0;
-		//Loop over corresponding samples in channel waveform (possibly finer binning than average waveform)
-		for (j=0; j<bin_size; j++)
-		{
-		    if (chdata.channel_id >= 0)
-			yj = yj - wave[index+j]/(chdata.spe_mean);
-		    else
-			yj = yj - wave[index+j];
-		}
-		y[i] += yj;
-
-		// Add variances, taking overall sqrt when finalize 
-		ey[i] = fabs(y[i]); //*pow(chdata.spe_sigma/chdata.spe_mean,2);
-	    }
-	    _plots.insert(std::make_pair(chdata.channel_id,avg));
+		sum.x[i] = chdata.SampleToTime(start_samp+i*bin_size);
 	}
-	else
+	sum.nevents++;
+
+	double* y = &(sum.y[0]);
+	double* y_comp = &(sum.y_comp[0]);
+	double* var = &(sum.var[0]);
+	double* var_comp = &(sum.var_comp[0]);
+	int index;
+	double yj;
+	int j;
+	//Loop over samples in average waveform
+	for(int i=0; i < nsamps; i++)
 	{
-	    TGraphErrors* avg = prev->second;
-	    if(avg->GetN() != nsamps)
+	    index = start_samp+i*bin_size;
+	    yj=0;
+	    //Loop over corresponding samples in channel waveform (possibly finer binning than average waveform)
+	    for (j=0; j<bin_size; j++)
 	    {
-		Message(ERROR)<<"Uneven number of samples between two events "
-			      <<"for channel "<<chdata.channel_id<<std::endl;
-		return 1;
+		if (chdata.channel_id >= 0)
+		    yj = yj - wave[index+j]/(chdata.spe_mean);
+		else
+		    yj = yj - wave[index+j];
 	    }
-    
-	    double* y = avg->GetY();
-	    double* ey = avg->GetEY();
-	    int index;
-	    double yj;
-	    int j;
-	    //Loop over samples in average waveform
-	    for(int i=0; i < nsamps; i++)
-	    {
-		index = start_samp+i*bin_size;
-		yj=0;
-		//Loop over corresponding samples in channel waveform (possibly finer binning than average waveform)
-		for (j=0; j<bin_size; j++)
-		{
-		   if (chdata.channel_id >= 0)
-			yj = yj - wave[index+j]/(chdata.spe_mean);
-		    else
-			yj = yj - wave[index+j];
-		}
-		y[i] += yj;
+	    KahanAdd(y[i], y_comp[i], yj);
 
-		// Add variances, taking overall sqrt when finalize 
-		ey[i] += fabs(yj); //*pow(chdata.spe_sigma/chdata.spe_mean,2);;
-	    }
+	    // Add variances, taking overall sqrt when finalize 
+	    KahanAdd(var[i], var_comp[i], fabs(yj)); //*pow(chdata.spe_sigma/chdata.spe_mean,2);
 	}
     }
 
-    // move to next event in the event list
-    if (use_event_list && txt.is_open() && txt.good())
+#ifndef SINGLETHREAD
+    lock.unlock();
+#endif
+    if (!snapshot_file.empty() && snapshot_interval > 0)
     {
-	string line;
-	getline(txt,line);
-	istringstream ss1(line);
-	string temp;
-	getline(ss1, temp, ' ');
-	istringstream ss2(temp);
-	ss2 >> current_run;
-	getline(ss1, temp, ' ');
-	istringstream ss3(temp);
-	ss3 >> current_event;
+	//the lock also keeps two threads from writing snapshots at once
+#ifndef SINGLETHREAD
+	boost::mutex::scoped_lock count_lock(_accumulators_mutex);
+#endif
+	if (++_accepted % snapshot_interval == 0)
+	    WriteSnapshot(_accepted);
     }
 
-
     return 0;
 }
 
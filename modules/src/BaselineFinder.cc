@@ -2,6 +2,8 @@
 #include "BaselineFinder.hh"
 #include "ConvertData.hh"
 #include "SumChannels.hh"
+#include "Integrator.hh"
+#include "EventHandler.hh"
 #include "intarray.hh"
 #include "RootWriter.hh"
 #include "TGraph.h"
@@ -18,7 +20,8 @@ BaselineFinder::BaselineFinder():
   ChannelModule(GetDefaultName(), "Find the baseline (zero) of the channel in the samples read before the trigger"),
   fixed_params("fixed_params","Parameters for fixed baseline search mode"),
   interp_params("interp_params","Parameters for linear interpolation mode"),
-  drifting_params("drifting params","Parameters for drifting baseline search")
+  drifting_params("drifting params","Parameters for drifting baseline search"),
+  _fused_integrator(0)
 {
   AddDependency<ConvertData>();
   
@@ -92,6 +95,11 @@ BaselineFinder::~BaselineFinder()
 
 int BaselineFinder::Initialize()
 {
+  //see if we should also do the integration for the Integrator
+  _fused_integrator = EventHandler::GetInstance()->GetModule<Integrator>();
+  if(_fused_integrator && !(_fused_integrator->enabled && 
+			    _fused_integrator->IsFusedWithBaseline()))
+    _fused_integrator = 0;
   return 0;
 }
 
@@ -103,13 +111,21 @@ int BaselineFinder::Finalize()
 int BaselineFinder::Process(ChannelData* chdata)
 {
   if(fixed_baseline) return FixedBaseline(chdata);
-  else return DriftingBaseline(chdata);
+  //plain 8 and 16 bit samples are read in place without a double copy
+  switch(chdata->native_sample_bytes){
+  case 1:
+    return DriftingBaseline(chdata, (const uint8_t*)chdata->channel_start);
+  case 2:
+    return DriftingBaseline(chdata, (const uint16_t*)chdata->channel_start);
+  default:
+    return DriftingBaseline(chdata, (const double*)chdata->GetWaveform());
+  }
 }
 
-int BaselineFinder::DriftingBaseline(ChannelData* chdata)
+template<class Sample>
+int BaselineFinder::DriftingBaseline(ChannelData* chdata, const Sample* wave)
 {
   Baseline& baseline = chdata->baseline;
-  double* wave = chdata->GetWaveform();
   std::vector<double>& baseform = chdata->subtracted_waveform;
   const int nsamps = chdata->nsamps;
   baseform.resize(nsamps);
@@ -204,8 +220,10 @@ int BaselineFinder::DriftingBaseline(ChannelData* chdata)
 	  baseline.length = window_samps;
 	  //calculate the variance
 	  double sum2 = 0;
-	  for(int backsamp = samp-window_samps+1; backsamp<=samp; backsamp++)
-	    sum2 += wave[backsamp]*wave[backsamp];
+	  for(int backsamp = samp-window_samps+1; backsamp<=samp; backsamp++){
+	    double val = wave[backsamp]; //integer samples could overflow
+	    sum2 += val*val;
+	  }
 	  baseline.variance = sum2/window_samps - mean*mean;
 	}
       }
@@ -221,6 +239,11 @@ int BaselineFinder::DriftingBaseline(ChannelData* chdata)
       //continue;
     }
   } // end loop over samples
+  if(_fused_integrator && baseline.found_baseline && 
+     _fused_integrator->WillProcess(chdata)){
+    SubtractAndIntegrate(chdata, wave, last_good_samp);
+    return 0;
+  }
   //fill in the missing part at the end
   for(samp = last_good_samp+1; samp<nsamps; samp++){
     baseform[samp] = baseform[last_good_samp];
@@ -233,6 +256,37 @@ int BaselineFinder::DriftingBaseline(ChannelData* chdata)
   return 0;
 }
 
+template<class Sample>
+void BaselineFinder::SubtractAndIntegrate(ChannelData* chdata, 
+					  const Sample* wave,
+					  int last_good_samp)
+{
+  //same arithmetic as the separate fill, subtract and Integrator loops
+  std::vector<double>& baseform = chdata->subtracted_waveform;
+  std::vector<double>& integral = chdata->integral;
+  const int nsamps = chdata->nsamps;
+  const double threshold = _fused_integrator->GetThreshold();
+  const double end_base = baseform[last_good_samp];
+  integral.resize(nsamps);
+  int max_index = 0, min_index = 0;
+  double sum = 0;
+  for(int samp=0; samp<nsamps; samp++){
+    const double onestep = 
+      wave[samp] - (samp > last_good_samp ? end_base : baseform[samp]);
+    baseform[samp] = onestep;
+    if(samp == 0)
+      sum = onestep;
+    else
+      sum += ( std::abs(onestep) > threshold ? onestep : 0 );
+    integral[samp] = sum;
+    //keep the first occurrence, like std::max_element and min_element
+    if(sum > integral[max_index]) max_index = samp;
+    if(sum < integral[min_index]) min_index = samp;
+  }
+  Integrator::SetIntegralExtrema(chdata, max_index, min_index);
+  chdata->integral_fused = true;
+}
+
 //search for a flat baseline in the pre-trigger window
 int BaselineFinder::FixedBaseline(ChannelData* chdata){
 	
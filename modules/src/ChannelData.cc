@@ -13,6 +13,7 @@
 #include <cmath>
 
 #include "intarray.hh"
+#include "WaveformDecoder.hh"
 #include "EvalTGraphPoint.C"
 
 class Scale{
@@ -25,6 +26,7 @@ public:
 
 TGraph* ChannelData::GetTGraph(bool baseline_subtracted, int downsample) const
 {
+  LoadWaveform();
   if( nsamps < 2 || waveform.empty())
     return 0;
   if( baseline_subtracted && subtracted_waveform.empty())
@@ -368,3 +370,40 @@ void ChannelData::Print(int verbosity)
     }
 }
     	
+
+void ChannelData::TakeBuffers(ChannelData& other)
+{
+  //swapping leaves the other channel's storage with us, keeping its capacity
+  generic.swap(other.generic);
+  waveform.swap(other.waveform);
+  unsuppressed_regions.swap(other.unsuppressed_regions);
+  baseline.interpolations.swap(other.baseline.interpolations);
+  subtracted_waveform.swap(other.subtracted_waveform);
+  pulses.swap(other.pulses);
+  regions.swap(other.regions);
+  derivative.swap(other.derivative);
+  smoothed_data.swap(other.smoothed_data);
+  filtered_waveform.swap(other.filtered_waveform);
+  single_pe.swap(other.single_pe);
+  unspikes.swap(other.unspikes);
+  integral.swap(other.integral);
+  Clear();
+}
+
+const WindowQuery& ChannelData::GetSubtractedQuery()
+{
+  //rebuild if the subtracted waveform was (re)allocated since last time
+  const int n = subtracted_waveform.size();
+  const double* wave = n ? GetBaselineSubtractedWaveform() : 0;
+  if(!_subtracted_query.IsBuiltFor(wave, n))
+    _subtracted_query.Build(wave, n);
+  return _subtracted_query;
+}
+
+void ChannelData::RunDecoder()
+{
+  //clear the decoder first, so it may call GetWaveform itself
+  const WaveformDecoder* decoder = waveform_decoder;
+  waveform_decoder = NULL;
+  decoder->DecodeWaveform(this);
+}
@@ -23,15 +23,8 @@ int ChannelModule::Process(EventPtr event)
   EventDataPtr data = event->GetEventData();
   for(size_t ch=0; ch < data->channels.size(); ch++){
     ChannelData* chdata = &(data->channels[ch]);
-    // did we ask to skip this channel manually?
-    if( _skip_channels.find( chdata->channel_id ) != _skip_channels.end())
-      continue;
-    if( _skip_sum && chdata->channel_id == ChannelData::CH_SUM)
-      continue;
-    if( _sum_only && chdata->channel_id != ChannelData::CH_SUM)
-      continue;
-    // Does this channel pass all cuts?
-    if(CheckCuts(chdata)){
+    // did we ask to skip this channel, and does it pass all cuts?
+    if(WillProcess(chdata)){
       returnval += Process(chdata);
     }
   }
@@ -47,3 +40,19 @@ bool ChannelModule::CheckCuts(ChannelData* chdata)
   }
   return true;
 }
+
+bool ChannelModule::SkipsChannel(int channel_id) const
+{
+  if( _skip_channels.find(channel_id) != _skip_channels.end())
+    return true;
+  if( _skip_sum && channel_id == ChannelData::CH_SUM)
+    return true;
+  if( _sum_only && channel_id != ChannelData::CH_SUM)
+    return true;
+  return false;
+}
+
+bool ChannelModule::UsesWaveform(int channel_id) const
+{
+  return !SkipsChannel(channel_id);
+}
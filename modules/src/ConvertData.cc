@@ -1,4 +1,5 @@
 #include "ConvertData.hh"
+#include "SampleUnpacker.hh"
 #include "V172X_Event.hh"
 #include "V172X_Params.hh"
 #include "RootWriter.hh"
@@ -6,6 +7,7 @@
 #include "runinfo.hh"
 #include "ConfigHandler.hh"
 #include <vector>
+#include <algorithm>
 
   
 ConvertData::ConvertData():
@@ -16,6 +18,8 @@ ConvertData::ConvertData():
 		    "map of channelid:offset time to apply for analysis");
   RegisterParameter("invert_channels",_invert_channels ,
 		    "Multiply the converted data by -1 for a channel?");
+  RegisterParameter("decode_all",_decode_all = false,
+		    "Decode all waveforms up front, even if no module uses them");
   _v172X_params = 0;
   _headers_only = false;
 }
@@ -30,6 +34,7 @@ int ConvertData::Initialize()
   start_time = 0;
   previous_event_time = 0;
   _id_mismatches = 0;
+  _decode_now.clear();
   ConfigHandler* config = ConfigHandler::GetInstance();
 
   //initialize stuff for decoding V172X events
@@ -67,6 +72,8 @@ int ConvertData::Initialize()
     if((it->second).count("spe_mean"))
       _spemeans[it->first] = atof((it->second)["spe_mean"].c_str());
   }
+  Message(DEBUG)<<"Unpacking samples using "
+		<<SampleUnpacker::GetInstructionSet()<<" instructions\n";
  
   return 0;
 }
@@ -81,15 +88,19 @@ int ConvertData::Finalize()
   return 0;
 }
 
-class InvertData{
-private:
-  double _max, _min;
-public:
-  InvertData(double max, double min=0) : _max(max), _min(min) {}
-  double operator()(double a){ return _max - (a-_min); }
-};
-
-static double invert(double a){ return -a; }
+/// Copy the extrema found while unpacking into the channel
+static void SetExtrema(ChannelData& chdata, const SampleExtrema& ext)
+{
+  if(ext.min_index < 0)
+    return;
+  //data is saturated if it hit 0 or maximum range
+  chdata.saturated = (ext.minimum == 0 || 
+		      ext.maximum == chdata.GetVerticalRange());
+  chdata.maximum = ext.maximum;
+  chdata.minimum = ext.minimum;
+  chdata.max_time = chdata.SampleToTime(ext.max_index);
+  chdata.min_time = chdata.SampleToTime(ext.min_index);
+}
 
 
 
@@ -109,7 +120,7 @@ int ConvertData::Process(EventPtr event)
   //set the most basic first, other decoders can override
   data->event_time = 1000000000*(data->timestamp-start_time);
   //get the real data from datablocks
-  data->channels.clear();
+  data->RecycleChannels();
   for(size_t blocknum=0; blocknum<raw->GetNumDataBlocks(); blocknum++){
     switch(raw->GetDataBlockType(blocknum)){
     case RawEvent::CAEN_V172X :
@@ -127,25 +138,21 @@ int ConvertData::Process(EventPtr event)
   
   if(!_headers_only){
     data->nchans = data->channels.size();
-    //find the max and min of each channel
     for(int ch=0; ch<data->nchans; ch++)
       {
 	ChannelData& chdata = data->channels[ch];
-	double* wave = chdata.GetWaveform();
-	if(_invert_channels.count(chdata.channel_id) )
-	  std::transform(wave, wave+chdata.nsamps, wave,
-			 InvertData(chdata.GetVerticalRange()) );
-	
-	double* max_samp = std::max_element(wave, wave+chdata.nsamps);
-	double* min_samp = std::min_element(wave, wave+chdata.nsamps);
-	//data is saturated if it hit 0 or maximum range
-	chdata.saturated = (*min_samp == 0 || 
-			    *max_samp == chdata.GetVerticalRange());
+	//the extrema and saturation are stored even if nobody reads the
+	//waveform. Plain samples are scanned without building the double 
+	//copy, anything else has to be decoded to find them
+	if(WaveformNeeded(chdata.channel_id) || !chdata.native_sample_bytes)
+	  chdata.LoadWaveform();
+	else if(chdata.native_sample_bytes == 1)
+	  SetExtrema(chdata, SampleUnpacker::Unpack(
+	    (const uint8_t*)chdata.channel_start, chdata.nsamps, 0));
+	else
+	  SetExtrema(chdata, SampleUnpacker::Unpack(
+	    (const uint16_t*)chdata.channel_start, chdata.nsamps, 0));
 	if(chdata.saturated) data->saturated = true;
-	chdata.maximum = *max_samp;
-	chdata.minimum = *min_samp;
-	chdata.max_time = chdata.SampleToTime(max_samp - wave);
-	chdata.min_time = chdata.SampleToTime(min_samp - wave);
 	//find the single photoelectron peak for this channel
 	
 	chdata.spe_mean = _spemeans[chdata.channel_id];
@@ -245,8 +252,7 @@ int ConvertData::DecodeV172XData(const unsigned char* rawdata,
       if( _skip_channels.find(channel_id) != _skip_channels.end())
 	continue;
       const V172X_ChannelParams& ch_params = board_params.channel[j];
-      data->channels.push_back(ChannelData());
-      ChannelData& chdata = data->channels.back();
+      ChannelData& chdata = data->AddChannel();
       chdata.board_id = board_data.board_id;
       chdata.board_num = i;
       chdata.channel_num = j;
@@ -258,34 +264,24 @@ int ConvertData::DecodeV172XData(const unsigned char* rawdata,
       chdata.trigger_index = board_params.GetTriggerIndex() - 
 	(int)(GetChOffset(channel_id) * chdata.sample_rate);
       
-      //copy over the actual waveform information
+      //locate the raw samples; they are decoded when first needed
       if(_headers_only) continue;
       chdata.channel_start = (char*)(board_data.channel_start[j]);
       chdata.channel_end = (char*)(board_data.channel_end[j]);
       if(board_params.zs_type != ZLE){
-	// copy the data as a double 
 	if(chdata.sample_bits < 9)
-	  chdata.waveform.assign((uint8_t*)chdata.channel_start,
-				 (uint8_t*)chdata.channel_end);
+	  chdata.nsamps = chdata.channel_end - chdata.channel_start;
         else if (chdata.sample_bits == 10) {
-          chdata.waveform.clear ();
-          for (uint32_t* ptr = (uint32_t*)chdata.channel_start; 
-	       ptr < (uint32_t*)chdata.channel_end; ptr ++) {
-            uint32_t raw_v = *ptr;
-	    const int ns = (raw_v>>30)&3;
-            for (int i = 0; i < ns; i++) {
-              uint16_t sample = raw_v & 0x3ff;
-              raw_v = raw_v >> 10;
-              chdata.waveform.push_back (sample);
-	    }
-	  }
+	  //up to 3 samples are packed per word, count is in the top 2 bits
+	  chdata.nsamps = 0;
+          for (const uint32_t* ptr = (const uint32_t*)chdata.channel_start; 
+	       ptr < (const uint32_t*)chdata.channel_end; ptr ++)
+	    chdata.nsamps += (*ptr>>30)&3;
 	}
 	else if(chdata.sample_bits < 17)
-	  chdata.waveform.assign((uint16_t*)chdata.channel_start,
-				 (uint16_t*)chdata.channel_end);
+	  chdata.nsamps = (chdata.channel_end - chdata.channel_start)/2;
 	else
-	  chdata.waveform.assign((uint32_t*)chdata.channel_start,
-				 (uint32_t*)chdata.channel_end);
+	  chdata.nsamps = (chdata.channel_end - chdata.channel_start)/4;
       }
       else{
 	//we need to evaluate the zero skipped data
@@ -293,7 +289,6 @@ int ConvertData::DecodeV172XData(const unsigned char* rawdata,
 	uint32_t nwords = *((uint32_t*)(chdata.channel_start));
 	chdata.nsamps = 0;
 	uint32_t offset = 1;
-	std::vector<const char*> data_blocks;
 	while(offset < nwords){
 	  //get the control word
 	  uint32_t control = *( ((uint32_t*)(chdata.channel_start)) + offset);
@@ -302,7 +297,6 @@ int ConvertData::DecodeV172XData(const unsigned char* rawdata,
 	  bool good = control & 0x80000000;
 	  
 	  if(good){
-	    data_blocks.push_back( chdata.channel_start + 4*(offset+1) );
 	    std::pair<int,int> region(chdata.nsamps,
 				      chdata.nsamps + subsamps);
 	    chdata.unsuppressed_regions.push_back(region);
@@ -312,48 +306,20 @@ int ConvertData::DecodeV172XData(const unsigned char* rawdata,
 	  chdata.nsamps += subsamps;
 	  offset += 1;
 	}
-	//assign all the value of 1 by default so it doesn't show as saturated
-	chdata.waveform.assign(chdata.nsamps, 1);
-	std::vector<double>& wave = chdata.waveform;
-	//now try to fill all the valid samples
-	for(size_t block=0; block < data_blocks.size(); block++){
-	  int subsamps = chdata.unsuppressed_regions[block].second - 
-	      chdata.unsuppressed_regions[block].first;
-	  if(chdata.sample_bits < 9){
-	    std::copy( (uint8_t*)data_blocks[block],
-		       ((uint8_t*)data_blocks[block]) + subsamps,
-		       &(wave[chdata.unsuppressed_regions[block].first]) );
-	  }
-	  else if (chdata.sample_bits < 17){
-	    std::copy( (uint16_t*)data_blocks[block],
-		       ((uint16_t*)data_blocks[block]) + subsamps,
-		       &(wave[chdata.unsuppressed_regions[block].first]) );
-	  }
-	  else {
-	    std::copy( (uint32_t*)data_blocks[block],
-		       ((uint32_t*)data_blocks[block]) + subsamps,
-		       &(wave[chdata.unsuppressed_regions[block].first]) );
-	  }
-	}
-	//finally set the baseline to the nearest sample
-	for(size_t block=0; block < data_blocks.size(); block++){
-	  std::pair<int,int> region = chdata.unsuppressed_regions[block];
-	  int fill_start = (block > 0 ? 
-			    chdata.unsuppressed_regions[block-1].second : 0 );
-	  int fill_end = region.first;
-	  if(fill_end > fill_start)
-	    std::fill( &(wave[fill_start]), &(wave[fill_end]), wave[fill_end]);
-	}
-	//check the last region
-	if( !chdata.unsuppressed_regions.empty() && 
-	    chdata.unsuppressed_regions.back().second < chdata.nsamps){
-	  std::fill( &(wave[chdata.unsuppressed_regions.back().second]),
-		     &(wave[chdata.nsamps]), 
-		     wave[chdata.unsuppressed_regions.back().second-1] );
-	}
       }// end check for zero suppressed data
       
-      chdata.nsamps = chdata.waveform.size();
+      //the decoder reads the format from the channel, so it still works
+      //after this module is finalized
+      chdata.waveform_decoder = this;
+      chdata.zero_suppressed = (board_params.zs_type == ZLE);
+      chdata.invert_samples = _invert_channels.count(channel_id);
+      //let modules read 8 and 16 bit samples directly from the raw buffer
+      if(!chdata.zero_suppressed && !chdata.invert_samples){
+	if(chdata.sample_bits < 9)
+	  chdata.native_sample_bytes = 1;
+	else if(chdata.sample_bits != 10 && chdata.sample_bits < 17)
+	  chdata.native_sample_bytes = 2;
+      }
     }
   }
   if(id_mismatch){
@@ -370,3 +336,114 @@ int ConvertData::DecodeV172XData(const unsigned char* rawdata,
   return 0;
 }
 
+void ConvertData::DecodeWaveform(ChannelData* chdata) const
+{
+  std::vector<double>& wave = chdata->waveform;
+  const bool invert = chdata->invert_samples;
+  const double range = chdata->GetVerticalRange();
+  if(chdata->nsamps <= 0){
+    wave.clear();
+    return;
+  }
+  if(!chdata->zero_suppressed){
+    //convert, invert and find the extrema in a single pass
+    wave.resize(chdata->nsamps);
+    double* dest = &(wave[0]);
+    SampleExtrema ext;
+    if(chdata->sample_bits < 9)
+      ext = SampleUnpacker::Unpack((const uint8_t*)chdata->channel_start,
+				   chdata->nsamps, dest, invert, range);
+    else if (chdata->sample_bits == 10)
+      ext = SampleUnpacker::UnpackPacked10(
+	(const uint32_t*)chdata->channel_start,
+	(const uint32_t*)chdata->channel_end, dest, invert, range);
+    else if(chdata->sample_bits < 17)
+      ext = SampleUnpacker::Unpack((const uint16_t*)chdata->channel_start,
+				   chdata->nsamps, dest, invert, range);
+    else
+      ext = SampleUnpacker::Unpack((const uint32_t*)chdata->channel_start,
+				   chdata->nsamps, dest, invert, range);
+    SetExtrema(*chdata, ext);
+    return;
+  }
+  
+  //assign all the value of 1 by default so it doesn't show as saturated
+  wave.assign(chdata->nsamps, invert ? range - 1 : 1);
+  const std::vector<std::pair<int,int> >& regions = 
+    chdata->unsuppressed_regions;
+  //walk the control words again to find the stored blocks
+  uint32_t nwords = *((uint32_t*)(chdata->channel_start));
+  uint32_t offset = 1;
+  size_t block = 0;
+  while(offset < nwords && block < regions.size()){
+    uint32_t control = *( ((uint32_t*)(chdata->channel_start)) + offset);
+    uint32_t subwords = control & 0x1FFFFF;
+    bool good = control & 0x80000000;
+    if(good){
+      const char* block_start = chdata->channel_start + 4*(offset+1);
+      int subsamps = regions[block].second - regions[block].first;
+      double* dest = &(wave[regions[block].first]);
+      if(chdata->sample_bits < 9)
+	SampleUnpacker::Unpack((const uint8_t*)block_start, subsamps, dest,
+			       invert, range);
+      else if (chdata->sample_bits < 17)
+	SampleUnpacker::Unpack((const uint16_t*)block_start, subsamps, dest,
+			       invert, range);
+      else
+	SampleUnpacker::Unpack((const uint32_t*)block_start, subsamps, dest,
+			       invert, range);
+      ++block;
+      offset += subwords;
+    }
+    offset += 1;
+  }
+  //finally set the baseline to the nearest sample
+  for(block=0; block < regions.size(); block++){
+    std::pair<int,int> region = regions[block];
+    int fill_start = (block > 0 ? regions[block-1].second : 0 );
+    int fill_end = region.first;
+    if(fill_end > fill_start)
+      std::fill( &(wave[fill_start]), &(wave[fill_end]), wave[fill_end]);
+  }
+  //check the last region
+  if( !regions.empty() && regions.back().second < chdata->nsamps){
+    std::fill( &(wave[regions.back().second]),
+	       &(wave[chdata->nsamps]), 
+	       wave[regions.back().second-1] );
+  }
+  
+  //the suppressed gaps take their values from the stored blocks
+  double* begin = &(wave[0]);
+  double* end = begin + wave.size();
+  double* max_samp = std::max_element(begin, end);
+  double* min_samp = std::min_element(begin, end);
+  SampleExtrema ext;
+  ext.maximum = *max_samp;
+  ext.minimum = *min_samp;
+  ext.max_index = max_samp - begin;
+  ext.min_index = min_samp - begin;
+  SetExtrema(*chdata, ext);
+}
+
+bool ConvertData::WaveformNeeded(int channel_id)
+{
+  std::map<int,bool>::iterator it = _decode_now.find(channel_id);
+  if(it != _decode_now.end())
+    return it->second;
+  bool needed = _decode_all;
+  //decoding on first access is not thread safe, so when other threads may
+  //read the event, decode everything they use before handing it over
+  EventHandler* handler = EventHandler::GetInstance();
+  const std::vector<BaseModule*>* modules = handler->GetListOfModules();
+  for(size_t i=0; i<modules->size() && !needed; ++i){
+    BaseModule* mod = modules->at(i);
+    if(mod != this && mod->enabled && mod->UsesWaveform(channel_id) &&
+       handler->IsAsynchronous())
+      needed = true;
+  }
+  if(!needed)
+    Message(DEBUG)<<"No module needs the waveform of channel "<<channel_id
+		  <<"; it will only be decoded on request.\n";
+  _decode_now[channel_id] = needed;
+  return needed;
+}
@@ -56,11 +56,12 @@ int EvalRois::Process(ChannelData* chdata)
     
     //double* wave = chdata->GetWaveform();
     double* subtractedwave = chdata->GetBaselineSubtractedWaveform();
-    double* min_iter = std::min_element(subtractedwave+roi.start_index, subtractedwave+roi.end_index);
-    double* max_iter = std::max_element(subtractedwave+roi.start_index, subtractedwave+roi.end_index);
-    roi.max = *(max_iter);
-    roi.min = *(min_iter);
-    roi.min_index = min_iter-subtractedwave;
+    const WindowQuery& query = chdata->GetSubtractedQuery();
+    int min_index = query.ArgMin(roi.start_index, roi.end_index);
+    int max_index = query.ArgMax(roi.start_index, roi.end_index);
+    roi.max = subtractedwave[max_index];
+    roi.min = subtractedwave[min_index];
+    roi.min_index = min_index;
     
     if(! chdata->integral.empty()){
       roi.integral = chdata->integral[roi.end_index] - 
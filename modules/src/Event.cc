@@ -5,5 +5,20 @@ Event::Event(RawEventPtr raw) :  _raw_event(raw),
 {}
 
 Event::~Event() 
-{ }
+{
+  //whoever still holds the data can no longer read the raw event
+  if(_event_data && !_event_data.unique())
+    _event_data->ReleaseRawData();
+}
 
+void Event::Reset(RawEventPtr raw)
+{
+  //only recycle the data if no one else is still holding on to it
+  if(_event_data.unique())
+    _event_data->Recycle();
+  else{
+    _event_data->ReleaseRawData();
+    _event_data.reset(new EventData);
+  }
+  _raw_event = raw;
+}
@@ -101,3 +101,41 @@ void EventData::Print(int verbosity)
 	}
     }
 }
+
+void EventData::Recycle()
+{
+  RecycleChannels();
+  Clear();
+}
+
+void EventData::ReleaseRawData()
+{
+  for(size_t i=0; i<channels.size(); ++i){
+    ChannelData& chdata = channels[i];
+    chdata.LoadWaveform();
+    chdata.native_sample_bytes = 0;
+    chdata.channel_start = NULL;
+    chdata.channel_end = NULL;
+  }
+}
+
+void EventData::RecycleChannels()
+{
+  //hand the channel buffers to the spare list before clearing
+  _spare_channels.reserve(_spare_channels.size() + channels.size());
+  for(size_t i=0; i<channels.size(); ++i){
+    _spare_channels.push_back(ChannelData());
+    _spare_channels.back().TakeBuffers(channels[i]);
+  }
+  channels.clear();
+}
+
+ChannelData& EventData::AddChannel()
+{
+  channels.push_back(ChannelData());
+  if(!_spare_channels.empty()){
+    channels.back().TakeBuffers(_spare_channels.back());
+    _spare_channels.pop_back();
+  }
+  return channels.back();
+}
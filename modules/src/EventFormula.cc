@@ -0,0 +1,1112 @@
+#include "EventFormula.hh"
+#include "EventData.hh"
+#include <map>
+#include <set>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cctype>
+#include <sstream>
+
+namespace{
+  class ClassInfo;
+
+  /// Description of one stored data member of a class
+  class FieldInfo{
+  public:
+    FieldInfo(const ClassInfo* t, bool vec) : type(t), is_vector(vec) {}
+    virtual ~FieldInfo(){}
+    const ClassInfo* type;  ///< class of the member, or 0 for numbers
+    bool is_vector;         ///< is the member a std::vector?
+    /// Numeric value of the member, or of element i of a vector
+    virtual double Value(const void*, size_t) const { return 0; }
+    /// Address of the member object, or of element i of a vector
+    virtual const void* Object(const void*, size_t) const { return 0; }
+    /// Length of a vector member
+    virtual size_t Size(const void*) const { return 0; }
+  };
+
+  template<class C, class T> class NumberField : public FieldInfo{
+    T C::* _ptr;
+  public:
+    NumberField(T C::* ptr) : FieldInfo(0, false), _ptr(ptr) {}
+    double Value(const void* obj, size_t) const
+    { return (double)(((const C*)obj)->*_ptr); }
+  };
+
+  template<class C, class T> class ObjectField : public FieldInfo{
+    T C::* _ptr;
+  public:
+    ObjectField(T C::* ptr, const ClassInfo* t) : FieldInfo(t, false),
+						  _ptr(ptr) {}
+    const void* Object(const void* obj, size_t) const
+    { return &(((const C*)obj)->*_ptr); }
+  };
+
+  template<class C, class T> class NumberVectorField : public FieldInfo{
+    std::vector<T> C::* _ptr;
+  public:
+    NumberVectorField(std::vector<T> C::* ptr) : FieldInfo(0, true),
+						 _ptr(ptr) {}
+    double Value(const void* obj, size_t i) const
+    { return (double)((((const C*)obj)->*_ptr)[i]); }
+    size_t Size(const void* obj) const
+    { return (((const C*)obj)->*_ptr).size(); }
+  };
+
+  template<class C, class T> class ObjectVectorField : public FieldInfo{
+    std::vector<T> C::* _ptr;
+  public:
+    ObjectVectorField(std::vector<T> C::* ptr, const ClassInfo* t) :
+      FieldInfo(t, true), _ptr(ptr) {}
+    const void* Object(const void* obj, size_t i) const
+    { return &((((const C*)obj)->*_ptr)[i]); }
+    size_t Size(const void* obj) const
+    { return (((const C*)obj)->*_ptr).size(); }
+  };
+
+  /// The stored members of a class, by name
+  class ClassInfo{
+  public:
+    explicit ClassInfo(const std::string& n) : name(n) {}
+    ~ClassInfo()
+    {
+      for(std::map<std::string, FieldInfo*>::iterator it = _fields.begin();
+	  it != _fields.end(); ++it)
+	delete it->second;
+    }
+    const std::string name;
+
+    const FieldInfo* Find(const std::string& field) const
+    {
+      std::map<std::string, FieldInfo*>::const_iterator it =
+	_fields.find(field);
+      return it == _fields.end() ? 0 : it->second;
+    }
+
+    template<class C, class T> void Number(const std::string& n, T C::* p)
+    { _fields[n] = new NumberField<C,T>(p); }
+    template<class C, class T> void Object(const std::string& n, T C::* p,
+					   const ClassInfo* t)
+    { _fields[n] = new ObjectField<C,T>(p, t); }
+    template<class C, class T>
+    void NumberVector(const std::string& n, std::vector<T> C::* p)
+    { _fields[n] = new NumberVectorField<C,T>(p); }
+    template<class C, class T>
+    void ObjectVector(const std::string& n, std::vector<T> C::* p,
+		      const ClassInfo* t)
+    { _fields[n] = new ObjectVectorField<C,T>(p, t); }
+
+  private:
+    std::map<std::string, FieldInfo*> _fields;
+    //not copyable
+    ClassInfo(const ClassInfo&);
+    ClassInfo& operator=(const ClassInfo&);
+  };
+
+  /// Descriptions of the members saved in the Events tree
+  class Dictionary{
+  public:
+    ClassInfo event, channel, baseline, pulse, fit, roi, spe, tof, unspikes,
+      sum_of_int;
+    Dictionary();
+  };
+
+#define NUMBER(info, cls, member) info.Number(#member, &cls::member)
+
+  Dictionary::Dictionary() :
+    event("EventData"), channel("ChannelData"), baseline("Baseline"),
+    pulse("Pulse"), fit("PulseFit"), roi("Roi"), spe("Spe"), tof("TOF"),
+    unspikes("Unspikes"), sum_of_int("SumOfIntegral")
+  {
+    NUMBER(event, EventData, run_id);
+    NUMBER(event, EventData, event_id);
+    NUMBER(event, EventData, status);
+    NUMBER(event, EventData, trigger_count);
+    NUMBER(event, EventData, timestamp);
+    NUMBER(event, EventData, dt);
+    NUMBER(event, EventData, event_time);
+    NUMBER(event, EventData, nchans);
+    NUMBER(event, EventData, saturated);
+    NUMBER(event, EventData, pulses_aligned);
+    event.NumberVector("generic", &EventData::generic);
+    event.ObjectVector("channels", &EventData::channels, &channel);
+    event.ObjectVector("sum_of_int", &EventData::sum_of_int, &sum_of_int);
+    event.ObjectVector("roi_sum_of_int", &EventData::roi_sum_of_int, &roi);
+    NUMBER(event, EventData, s1_valid);
+    NUMBER(event, EventData, s1_fixed_valid);
+    NUMBER(event, EventData, s2_valid);
+    NUMBER(event, EventData, s2_fixed_valid);
+    NUMBER(event, EventData, s1s2_valid);
+    NUMBER(event, EventData, s1s2_fixed_valid);
+    NUMBER(event, EventData, s1_start_time);
+    NUMBER(event, EventData, s1_end_time);
+    NUMBER(event, EventData, s2_start_time);
+    NUMBER(event, EventData, s2_end_time);
+    NUMBER(event, EventData, drift_time);
+    NUMBER(event, EventData, s1_full);
+    NUMBER(event, EventData, s2_full);
+    NUMBER(event, EventData, s1_fixed);
+    NUMBER(event, EventData, s2_fixed);
+    NUMBER(event, EventData, max_s1);
+    NUMBER(event, EventData, max_s2);
+    NUMBER(event, EventData, max_s1_chan);
+    NUMBER(event, EventData, max_s2_chan);
+    NUMBER(event, EventData, f90_full);
+    NUMBER(event, EventData, f90_fixed);
+    NUMBER(event, EventData, gatti);
+    NUMBER(event, EventData, ll_r);
+    NUMBER(event, EventData, position_valid);
+    NUMBER(event, EventData, x);
+    NUMBER(event, EventData, y);
+    NUMBER(event, EventData, z);
+    NUMBER(event, EventData, bary_valid);
+    NUMBER(event, EventData, bary_x);
+    NUMBER(event, EventData, bary_y);
+
+    NUMBER(channel, ChannelData, board_id);
+    NUMBER(channel, ChannelData, channel_num);
+    NUMBER(channel, ChannelData, channel_id);
+    NUMBER(channel, ChannelData, timestamp);
+    NUMBER(channel, ChannelData, sample_rate);
+    NUMBER(channel, ChannelData, trigger_index);
+    NUMBER(channel, ChannelData, smoothed_min);
+    NUMBER(channel, ChannelData, smoothed_max);
+    channel.NumberVector("generic", &ChannelData::generic);
+    NUMBER(channel, ChannelData, saturated);
+    NUMBER(channel, ChannelData, maximum);
+    NUMBER(channel, ChannelData, minimum);
+    NUMBER(channel, ChannelData, max_time);
+    NUMBER(channel, ChannelData, min_time);
+    NUMBER(channel, ChannelData, spe_mean);
+    NUMBER(channel, ChannelData, spe_sigma);
+    channel.Object("baseline", &ChannelData::baseline, &baseline);
+    NUMBER(channel, ChannelData, npulses);
+    channel.ObjectVector("pulses", &ChannelData::pulses, &pulse);
+    channel.ObjectVector("regions", &ChannelData::regions, &roi);
+    channel.Object("tof", &ChannelData::tof, &tof);
+    channel.ObjectVector("single_pe", &ChannelData::single_pe, &spe);
+    channel.ObjectVector("unspikes", &ChannelData::unspikes, &unspikes);
+    NUMBER(channel, ChannelData, integral_max);
+    NUMBER(channel, ChannelData, integral_min);
+    NUMBER(channel, ChannelData, integral_max_index);
+    NUMBER(channel, ChannelData, integral_min_index);
+    NUMBER(channel, ChannelData, integral_max_time);
+    NUMBER(channel, ChannelData, integral_min_time);
+    NUMBER(channel, ChannelData, s1_full);
+    NUMBER(channel, ChannelData, s2_full);
+    NUMBER(channel, ChannelData, s1_fixed);
+    NUMBER(channel, ChannelData, s2_fixed);
+
+    NUMBER(baseline, Baseline, found_baseline);
+    NUMBER(baseline, Baseline, mean);
+    NUMBER(baseline, Baseline, variance);
+    NUMBER(baseline, Baseline, search_start_index);
+    NUMBER(baseline, Baseline, length);
+    NUMBER(baseline, Baseline, saturated);
+    NUMBER(baseline, Baseline, laserskip);
+    NUMBER(baseline, Baseline, ninterpolations);
+    baseline.ObjectVector("interpolations", &Baseline::interpolations, &spe);
+
+    NUMBER(pulse, Pulse, found_start);
+    NUMBER(pulse, Pulse, found_end);
+    NUMBER(pulse, Pulse, found_peak);
+    NUMBER(pulse, Pulse, peak_saturated);
+    NUMBER(pulse, Pulse, start_index);
+    NUMBER(pulse, Pulse, start_time);
+    NUMBER(pulse, Pulse, end_index);
+    NUMBER(pulse, Pulse, end_time);
+    NUMBER(pulse, Pulse, peak_index);
+    NUMBER(pulse, Pulse, peak_time);
+    NUMBER(pulse, Pulse, peak_amplitude);
+    NUMBER(pulse, Pulse, integral);
+    NUMBER(pulse, Pulse, npe);
+    pulse.NumberVector("f_param", &Pulse::f_param);
+    NUMBER(pulse, Pulse, f90);
+    NUMBER(pulse, Pulse, t05);
+    NUMBER(pulse, Pulse, t10);
+    NUMBER(pulse, Pulse, t90);
+    NUMBER(pulse, Pulse, t95);
+    NUMBER(pulse, Pulse, fixed_int1);
+    NUMBER(pulse, Pulse, fixed_int2);
+    NUMBER(pulse, Pulse, fixed_int1_valid);
+    NUMBER(pulse, Pulse, fixed_int2_valid);
+    pulse.Object("fit", &Pulse::fit, &fit);
+    NUMBER(pulse, Pulse, is_s1);
+    NUMBER(pulse, Pulse, dt);
+    NUMBER(pulse, Pulse, start_clean);
+    NUMBER(pulse, Pulse, end_clean);
+    NUMBER(pulse, Pulse, is_clean);
+    NUMBER(pulse, Pulse, ratio1);
+    NUMBER(pulse, Pulse, ratio2);
+    NUMBER(pulse, Pulse, ratio3);
+    NUMBER(pulse, Pulse, gatti);
+    NUMBER(pulse, Pulse, ll_ele);
+    NUMBER(pulse, Pulse, ll_nuc);
+    NUMBER(pulse, Pulse, ll_r);
+    NUMBER(pulse, Pulse, pulse_shape_int);
+
+    NUMBER(fit, PulseFit, fit_done);
+    NUMBER(fit, PulseFit, fit_result);
+    NUMBER(fit, PulseFit, chi2);
+    NUMBER(fit, PulseFit, ndf);
+    NUMBER(fit, PulseFit, start_index);
+    NUMBER(fit, PulseFit, end_index);
+    NUMBER(fit, PulseFit, range_low);
+    NUMBER(fit, PulseFit, range_high);
+    NUMBER(fit, PulseFit, amplitude);
+    NUMBER(fit, PulseFit, c1);
+    NUMBER(fit, PulseFit, tau1);
+    NUMBER(fit, PulseFit, tau2);
+    NUMBER(fit, PulseFit, sigma);
+    NUMBER(fit, PulseFit, decay);
+    NUMBER(fit, PulseFit, baseline);
+    NUMBER(fit, PulseFit, t0);
+    NUMBER(fit, PulseFit, rc);
+
+    NUMBER(roi, Roi, start_time);
+    NUMBER(roi, Roi, end_time);
+    NUMBER(roi, Roi, start_index);
+    NUMBER(roi, Roi, end_index);
+    NUMBER(roi, Roi, max);
+    NUMBER(roi, Roi, min);
+    NUMBER(roi, Roi, integral);
+    NUMBER(roi, Roi, npe);
+    NUMBER(roi, Roi, min_index);
+
+    NUMBER(spe, Spe, integral);
+    NUMBER(spe, Spe, start_time);
+    NUMBER(spe, Spe, amplitude);
+    NUMBER(spe, Spe, peak_time);
+    NUMBER(spe, Spe, local_baseline);
+    NUMBER(spe, Spe, length);
+
+    NUMBER(tof, TOF, found_pulse);
+    NUMBER(tof, TOF, integral);
+    NUMBER(tof, TOF, start_time);
+    NUMBER(tof, TOF, amplitude);
+    NUMBER(tof, TOF, peak_time);
+    NUMBER(tof, TOF, length);
+    NUMBER(tof, TOF, constant_fraction_time);
+
+    NUMBER(unspikes, Unspikes, nbad);
+
+    NUMBER(sum_of_int, SumOfIntegral, start_index);
+    NUMBER(sum_of_int, SumOfIntegral, start_time);
+    NUMBER(sum_of_int, SumOfIntegral, end_index);
+    NUMBER(sum_of_int, SumOfIntegral, end_time);
+    NUMBER(sum_of_int, SumOfIntegral, start_clean);
+    NUMBER(sum_of_int, SumOfIntegral, end_clean);
+    NUMBER(sum_of_int, SumOfIntegral, dt);
+    NUMBER(sum_of_int, SumOfIntegral, saturated);
+    NUMBER(sum_of_int, SumOfIntegral, npe);
+    sum_of_int.NumberVector("f_param", &SumOfIntegral::f_param);
+    NUMBER(sum_of_int, SumOfIntegral, f90);
+    NUMBER(sum_of_int, SumOfIntegral, f90_fixed);
+    NUMBER(sum_of_int, SumOfIntegral, fixed_npe1);
+    NUMBER(sum_of_int, SumOfIntegral, fixed_npe2);
+    NUMBER(sum_of_int, SumOfIntegral, fixed_npe1_valid);
+    NUMBER(sum_of_int, SumOfIntegral, fixed_npe2_valid);
+    NUMBER(sum_of_int, SumOfIntegral, max_chan);
+    NUMBER(sum_of_int, SumOfIntegral, max_chan_npe);
+    NUMBER(sum_of_int, SumOfIntegral, is_s1);
+    NUMBER(sum_of_int, SumOfIntegral, is_s2);
+    NUMBER(sum_of_int, SumOfIntegral, gatti);
+    NUMBER(sum_of_int, SumOfIntegral, ll_ele);
+    NUMBER(sum_of_int, SumOfIntegral, ll_nuc);
+    NUMBER(sum_of_int, SumOfIntegral, ll_r);
+  }
+
+#undef NUMBER
+
+  const Dictionary& GetDictionary()
+  {
+    static Dictionary dict;
+    return dict;
+  }
+
+  //math functions, wrapped to resolve the std overloads
+  double Abs(double x){ return std::fabs(x); }
+  double Sqrt(double x){ return std::sqrt(x); }
+  double Exp(double x){ return std::exp(x); }
+  double Log(double x){ return std::log(x); }
+  double Log10(double x){ return std::log10(x); }
+  double Sin(double x){ return std::sin(x); }
+  double Cos(double x){ return std::cos(x); }
+  double Tan(double x){ return std::tan(x); }
+  double ASin(double x){ return std::asin(x); }
+  double ACos(double x){ return std::acos(x); }
+  double ATan(double x){ return std::atan(x); }
+  double Floor(double x){ return std::floor(x); }
+  double Ceil(double x){ return std::ceil(x); }
+  double Power(double x, double y){ return std::pow(x, y); }
+  double ATan2(double y, double x){ return std::atan2(y, x); }
+  double Min(double x, double y){ return x < y ? x : y; }
+  double Max(double x, double y){ return x > y ? x : y; }
+  double Mod(double x, double y){ return std::fmod(x, y); }
+
+  struct Function1{ const char* name; double (*func)(double); };
+  struct Function2{ const char* name; double (*func)(double, double); };
+
+  const Function1 functions1[] = {
+    {"abs", Abs}, {"fabs", Abs}, {"TMath::Abs", Abs},
+    {"sqrt", Sqrt}, {"TMath::Sqrt", Sqrt},
+    {"exp", Exp}, {"TMath::Exp", Exp},
+    {"log", Log}, {"TMath::Log", Log},
+    {"log10", Log10}, {"TMath::Log10", Log10},
+    {"sin", Sin}, {"TMath::Sin", Sin},
+    {"cos", Cos}, {"TMath::Cos", Cos},
+    {"tan", Tan}, {"TMath::Tan", Tan},
+    {"asin", ASin}, {"TMath::ASin", ASin},
+    {"acos", ACos}, {"TMath::ACos", ACos},
+    {"atan", ATan}, {"TMath::ATan", ATan},
+    {"floor", Floor}, {"TMath::Floor", Floor},
+    {"ceil", Ceil}, {"TMath::Ceil", Ceil},
+    {0, 0}
+  };
+
+  const Function2 functions2[] = {
+    {"pow", Power}, {"TMath::Power", Power},
+    {"atan2", ATan2}, {"TMath::ATan2", ATan2},
+    {"min", Min}, {"TMath::Min", Min},
+    {"max", Max}, {"TMath::Max", Max},
+    {"fmod", Mod},
+    {0, 0}
+  };
+}
+
+/// One instance of the loops being evaluated
+struct EventFormula::Instance{
+  const EventData* event;
+  const int* index;     ///< element of each loop
+  unsigned long stamp;  ///< different for every instance evaluated
+};
+
+/// Base of the compiled expression tree
+class EventFormula::Node{
+public:
+  Node() : shared(false), _stamp(0), _cache(0) {}
+  virtual ~Node(){}
+  std::string key;  ///< canonical text, equal for identical subexpressions
+  bool shared;      ///< used in several places, so remember the value
+
+  /// Get the value for an instance; shared nodes are only evaluated once
+  double Get(const Instance& inst) const
+  {
+    if(!shared)
+      return Eval(inst);
+    if(_stamp != inst.stamp){
+      _cache = Eval(inst);
+      _stamp = inst.stamp;
+    }
+    return _cache;
+  }
+
+protected:
+  /// Evaluate for the instance
+  virtual double Eval(const Instance& inst) const = 0;
+
+private:
+  mutable unsigned long _stamp;  ///< instance for which _cache is valid
+  mutable double _cache;         ///< last value of a shared node
+};
+
+/// Read one numeric member, following a chain of members and elements
+class EventFormula::Path : public EventFormula::Node{
+public:
+  /// One member along the path
+  struct Step{
+    const FieldInfo* field;
+    std::string prefix;  ///< canonical text of the path up to this step
+    int fixed;  ///< constant element of a vector, or -1
+    int dim;    ///< loop providing the element of a vector, or -1
+  };
+  std::vector<Step> steps;
+  bool size_query;  ///< return the length of the last vector instead
+
+  Path() : size_query(false) {}
+
+  /** Get the length of the vector looped over by dim, given the indices of
+      the outer loops.  Returns 0 if a constant index is out of range, and
+      -1 if the path does not loop over dim and all elements exist.
+  */
+  int Limit(const EventData* event, const int* index, int dim) const
+  {
+    const void* obj = event;
+    const size_t nsteps = steps.size() - (size_query ? 1 : 0);
+    for(size_t s=0; s<nsteps; ++s){
+      const Step& step = steps[s];
+      size_t element = 0;
+      if(step.field->is_vector){
+	const size_t n = step.field->Size(obj);
+	if(step.dim == dim)
+	  return n;
+	element = Element(step, index);
+	if(element >= n)
+	  return 0;
+      }
+      if(s+1 < steps.size())
+	obj = step.field->Object(obj, element);
+    }
+    return -1;
+  }
+
+  /// Add the vectors whose lengths decide the instances to loops
+  void AddLoops(std::set<std::string>& loops) const
+  {
+    const size_t nsteps = steps.size() - (size_query ? 1 : 0);
+    for(size_t s=0; s<nsteps; ++s)
+      if(steps[s].field->is_vector)
+	loops.insert(steps[s].prefix);
+  }
+
+protected:
+  double Eval(const Instance& inst) const
+  {
+    //Enumerate guarantees every element is in range
+    const void* obj = inst.event;
+    const size_t last = steps.size() - 1;
+    for(size_t s=0; s<last; ++s)
+      obj = steps[s].field->Object(obj, Element(steps[s], inst.index));
+    const Step& step = steps[last];
+    if(size_query)
+      return step.field->Size(obj);
+    return step.field->Value(obj, step.field->is_vector ?
+			     Element(step, inst.index) : 0);
+  }
+
+private:
+  static size_t Element(const Step& step, const int* index)
+  { return step.dim >= 0 ? index[step.dim] : step.fixed; }
+};
+
+namespace{
+  typedef EventFormula::Node Node;
+  typedef EventFormula::Instance Instance;
+
+  class ConstantNode : public Node{
+    double _val;
+  public:
+    ConstantNode(double val) : _val(val)
+    {
+      std::ostringstream s;
+      s.precision(17);
+      s<<val;
+      key = s.str();
+    }
+  protected:
+    double Eval(const Instance&) const { return _val; }
+  };
+
+  class NotNode : public Node{
+    const Node* _arg;
+  public:
+    NotNode(const Node* arg) : _arg(arg) { key = "!(" + arg->key + ")"; }
+  protected:
+    double Eval(const Instance& inst) const { return !_arg->Get(inst); }
+  };
+
+  class NegateNode : public Node{
+    const Node* _arg;
+  public:
+    NegateNode(const Node* arg) : _arg(arg) { key = "-(" + arg->key + ")"; }
+  protected:
+    double Eval(const Instance& inst) const { return -_arg->Get(inst); }
+  };
+
+  enum BINARY_OP { ADD, SUBTRACT, MULTIPLY, DIVIDE, MODULO, POWER,
+		   LESS, LESS_EQUAL, GREATER, GREATER_EQUAL, EQUAL, NOT_EQUAL,
+		   AND, OR };
+  const char* const op_names[] = { "+", "-", "*", "/", "%", "^",
+				   "<", "<=", ">", ">=", "==", "!=",
+				   "&&", "||" };
+
+  class BinaryNode : public Node{
+    BINARY_OP _op;
+    const Node* _left;
+    const Node* _right;
+  public:
+    BinaryNode(BINARY_OP op, const Node* left, const Node* right) :
+      _op(op), _left(left), _right(right)
+    { key = "(" + left->key + op_names[op] + right->key + ")"; }
+  protected:
+    double Eval(const Instance& inst) const
+    {
+      const double a = _left->Get(inst);
+      //short circuit like TFormula
+      if(_op == AND && !a)
+	return 0;
+      if(_op == OR && a)
+	return 1;
+      const double b = _right->Get(inst);
+      switch(_op){
+      case ADD: return a + b;
+      case SUBTRACT: return a - b;
+      case MULTIPLY: return a * b;
+      case DIVIDE: return b == 0 ? 0 : a / b; //TFormula returns 0 for x/0
+      case MODULO: {
+	//TFormula truncates both operands to integers
+	const Long64_t ia = (Long64_t)a, ib = (Long64_t)b;
+	return ib == 0 ? 0 : (double)(ia % ib);
+      }
+      case POWER: return std::pow(a, b);
+      case LESS: return a < b;
+      case LESS_EQUAL: return a <= b;
+      case GREATER: return a > b;
+      case GREATER_EQUAL: return a >= b;
+      case EQUAL: return a == b;
+      case NOT_EQUAL: return a != b;
+      case AND:
+      case OR: return b != 0;
+      }
+      return 0;
+    }
+  };
+
+  class Function1Node : public Node{
+    double (*_func)(double);
+    const Node* _arg;
+  public:
+    Function1Node(const Function1& f, const Node* arg) :
+      _func(f.func), _arg(arg)
+    { key = std::string(f.name) + "(" + arg->key + ")"; }
+  protected:
+    double Eval(const Instance& inst) const
+    { return _func(_arg->Get(inst)); }
+  };
+
+  class Function2Node : public Node{
+    double (*_func)(double, double);
+    const Node* _arg1;
+    const Node* _arg2;
+  public:
+    Function2Node(const Function2& f, const Node* arg1, const Node* arg2) :
+      _func(f.func), _arg1(arg1), _arg2(arg2)
+    { key = std::string(f.name) + "(" + arg1->key + "," + arg2->key + ")"; }
+  protected:
+    double Eval(const Instance& inst) const
+    { return _func(_arg1->Get(inst), _arg2->Get(inst)); }
+  };
+
+  enum REDUCTION { SUM, MINIMUM, MAXIMUM, LENGTH };
+  const char* const reduction_names[] = { "Sum$", "Min$", "Max$", "Length$" };
+
+  /// Sum$, Min$, Max$ or Length$ over all instances of a separate formula
+  class ReduceNode : public Node{
+    REDUCTION _type;
+    EventFormula* _arg;
+    mutable std::vector<double> _values;
+  public:
+    ReduceNode(REDUCTION type, EventFormula* arg, const std::string& argkey) :
+      _type(type), _arg(arg)
+    { key = std::string(reduction_names[type]) + "(" + argkey + ")"; }
+    ~ReduceNode(){ delete _arg; }
+  protected:
+    double Eval(const Instance& inst) const
+    {
+      const int n = _arg->Evaluate(inst.event, _values);
+      if(_type == LENGTH)
+	return n;
+      if(n == 0)
+	return 0;
+      double result = _values[0];
+      for(int i=1; i<n; ++i){
+	switch(_type){
+	case SUM: result += _values[i]; break;
+	case MINIMUM: result = Min(result, _values[i]); break;
+	case MAXIMUM: result = Max(result, _values[i]); break;
+	case LENGTH: break;
+	}
+      }
+      return result;
+    }
+  };
+
+  /// Find a function by name; aliases resolve to the first entry
+  template<class F> const F* FindFunction(const F* table,
+					  const std::string& name)
+  {
+    for(const F* f = table; f->name; ++f){
+      if(name == f->name){
+	for(const F* first = table; first != f; ++first)
+	  if(first->func == f->func)
+	    return first;
+	return f;
+      }
+    }
+    return 0;
+  }
+}
+
+/** Recursive descent parser for one term.  Every node is interned in the
+    formula, so identical subexpressions are built once; Parse functions
+    return 0 after setting the error if the expression is not valid.
+*/
+class EventFormula::Parser{
+public:
+  Parser(EventFormula* formula, const std::string& expr, size_t pos) :
+    _formula(formula), _expr(expr), _pos(pos) {}
+
+  /// Parse a full expression, stopping at the first unexpected character
+  Node* ParseExpression(){ return ParseOr(); }
+  /// Is everything up to the end parsed?
+  bool AtEnd(){ SkipSpace(); return _pos == _expr.size(); }
+  size_t GetPos() const { return _pos; }
+  const std::string& GetError() const { return _error; }
+  /// Paths used by the expression parsed
+  const std::vector<Path*>& GetPaths() const { return _paths; }
+
+  /// Set the error message, if it is the first, and return 0
+  Node* Fail(const std::string& msg)
+  {
+    if(_error.empty()){
+      std::ostringstream s;
+      s<<msg<<" at position "<<_pos<<" in \""<<_expr<<"\"";
+      _error = s.str();
+    }
+    return 0;
+  }
+
+private:
+  EventFormula* _formula;
+  const std::string& _expr;
+  size_t _pos;
+  std::vector<Path*> _paths;   ///< paths used so far
+  std::string _error;
+
+  /// Return the formula's copy of node if it has one, else adopt node
+  Node* Intern(Node* node)
+  {
+    std::map<std::string, Node*>::iterator it =
+      _formula->_nodes.find(node->key);
+    if(it != _formula->_nodes.end()){
+      delete node;
+      it->second->shared = true;
+      return it->second;
+    }
+    _formula->_nodes.insert(std::make_pair(node->key, node));
+    return node;
+  }
+
+  void SkipSpace()
+  {
+    while(_pos < _expr.size() && std::isspace(_expr[_pos]))
+      ++_pos;
+  }
+
+  /// Consume tok if it comes next
+  bool Accept(const char* tok)
+  {
+    SkipSpace();
+    const size_t len = std::char_traits<char>::length(tok);
+    if(_expr.compare(_pos, len, tok) != 0)
+      return false;
+    _pos += len;
+    return true;
+  }
+
+  /// Read a name, including :: and $, or return an empty string
+  std::string ReadName()
+  {
+    SkipSpace();
+    const size_t start = _pos;
+    while(_pos < _expr.size()){
+      const char c = _expr[_pos];
+      if(std::isalpha(c) || c == '_' || c == '$' ||
+	 (_pos > start && std::isdigit(c)))
+	++_pos;
+      else if(_pos > start && _expr.compare(_pos, 2, "::") == 0)
+	_pos += 2;
+      else
+	break;
+    }
+    return _expr.substr(start, _pos - start);
+  }
+
+  /// Apply a binary operator if the right side parsed
+  Node* Combine(BINARY_OP op, Node* left, Node* right)
+  {
+    return right ? Intern(new BinaryNode(op, left, right)) : 0;
+  }
+
+  Node* ParseOr()
+  {
+    Node* left = ParseAnd();
+    while(left && Accept("||"))
+      left = Combine(OR, left, ParseAnd());
+    return left;
+  }
+
+  Node* ParseAnd()
+  {
+    Node* left = ParseEquality();
+    while(left && Accept("&&"))
+      left = Combine(AND, left, ParseEquality());
+    return left;
+  }
+
+  Node* ParseEquality()
+  {
+    Node* left = ParseRelation();
+    while(left){
+      if(Accept("=="))
+	left = Combine(EQUAL, left, ParseRelation());
+      else if(Accept("!="))
+	left = Combine(NOT_EQUAL, left, ParseRelation());
+      else
+	break;
+    }
+    return left;
+  }
+
+  Node* ParseRelation()
+  {
+    Node* left = ParseSum();
+    while(left){
+      if(Accept("<="))
+	left = Combine(LESS_EQUAL, left, ParseSum());
+      else if(Accept(">="))
+	left = Combine(GREATER_EQUAL, left, ParseSum());
+      else if(Accept("<"))
+	left = Combine(LESS, left, ParseSum());
+      else if(Accept(">"))
+	left = Combine(GREATER, left, ParseSum());
+      else
+	break;
+    }
+    return left;
+  }
+
+  Node* ParseSum()
+  {
+    Node* left = ParseProduct();
+    while(left){
+      if(Accept("+"))
+	left = Combine(ADD, left, ParseProduct());
+      else if(Accept("-"))
+	left = Combine(SUBTRACT, left, ParseProduct());
+      else
+	break;
+    }
+    return left;
+  }
+
+  Node* ParseProduct()
+  {
+    Node* left = ParseUnary();
+    while(left){
+      if(Accept("*"))
+	left = Combine(MULTIPLY, left, ParseUnary());
+      else if(Accept("/"))
+	left = Combine(DIVIDE, left, ParseUnary());
+      else if(Accept("%"))
+	left = Combine(MODULO, left, ParseUnary());
+      else
+	break;
+    }
+    return left;
+  }
+
+  Node* ParseUnary()
+  {
+    if(Accept("-")){
+      Node* arg = ParseUnary();
+      return arg ? Intern(new NegateNode(arg)) : 0;
+    }
+    if(Accept("+"))
+      return ParseUnary();
+    //don't mistake != for a negation
+    SkipSpace();
+    if(_expr.compare(_pos, 1, "!") == 0 && _expr.compare(_pos, 2, "!=") != 0){
+      ++_pos;
+      Node* arg = ParseUnary();
+      return arg ? Intern(new NotNode(arg)) : 0;
+    }
+    return ParsePower();
+  }
+
+  Node* ParsePower()
+  {
+    Node* base = ParsePrimary();
+    if(base && Accept("^"))
+      return Combine(POWER, base, ParseUnary());
+    return base;
+  }
+
+  Node* ParsePrimary()
+  {
+    SkipSpace();
+    if(_pos == _expr.size())
+      return Fail("Unexpected end of expression");
+    if(Accept("(")){
+      Node* node = ParseOr();
+      if(node && !Accept(")"))
+	return Fail("Expected )");
+      return node;
+    }
+    const char c = _expr[_pos];
+    if(std::isdigit(c) || (c == '.' && _pos+1 < _expr.size() &&
+			   std::isdigit(_expr[_pos+1]))){
+      const char* start = _expr.c_str() + _pos;
+      char* end = 0;
+      const double val = std::strtod(start, &end);
+      _pos += end - start;
+      return Intern(new ConstantNode(val));
+    }
+    if(Accept("@"))
+      return ParsePath("", true);
+    const std::string name = ReadName();
+    if(name.empty())
+      return Fail(std::string("Unexpected character '") + c + "'");
+    if(Accept("("))
+      return ParseFunction(name);
+    return ParsePath(name, false);
+  }
+
+  /// Parse the arguments of name after the opening parenthesis
+  Node* ParseFunction(const std::string& name)
+  {
+    for(int r = SUM; r <= LENGTH; ++r){
+      if(name != reduction_names[r])
+	continue;
+      //the argument loops independently of the rest of the term
+      EventFormula* arg = new EventFormula;
+      Parser sub(arg, _expr, _pos);
+      Node* node = sub.ParseExpression();
+      _pos = sub.GetPos();
+      if(!node){
+	delete arg;
+	_error = sub.GetError();
+	return 0;
+      }
+      arg->AddNode(node, sub.GetPaths());
+      _formula->_branches.insert(arg->_branches.begin(), arg->_branches.end());
+      if(!Accept(")")){
+	delete arg;
+	return Fail("Expected ) after argument of " + name);
+      }
+      return Intern(new ReduceNode((REDUCTION)r, arg, node->key));
+    }
+
+    Node* arg1 = ParseOr();
+    if(!arg1)
+      return 0;
+    if(Accept(")")){
+      const Function1* f = FindFunction(functions1, name);
+      if(!f)
+	return Fail("Unknown function of one argument " + name);
+      return Intern(new Function1Node(*f, arg1));
+    }
+    if(!Accept(","))
+      return Fail("Expected , or ) in arguments of " + name);
+    Node* arg2 = ParseOr();
+    if(!arg2)
+      return 0;
+    if(!Accept(")"))
+      return Fail("Expected ) after arguments of " + name);
+    const Function2* f = FindFunction(functions2, name);
+    if(!f)
+      return Fail("Unknown function of two arguments " + name);
+    return Intern(new Function2Node(*f, arg1, arg2));
+  }
+
+  /** Parse a chain of members starting with name, or with the next name
+      if name is empty.  If size_query, the first member is a vector whose
+      length is wanted.
+  */
+  Node* ParsePath(std::string name, bool size_query)
+  {
+    if(name.empty())
+      name = ReadName();
+    //the tree's branch is called event, but it's optional
+    if(name == "event" && !size_query && Accept(".")){
+      size_query = Accept("@");
+      name = ReadName();
+    }
+    Path* path = new Path;
+    const ClassInfo* cls = &(GetDictionary().event);
+    std::string prefix;
+    std::string member;  //same without the elements, as in the tree
+    int dims = 0;
+    while(true){
+      const FieldInfo* field = cls->Find(name);
+      if(!field){
+	delete path;
+	return Fail("No member named \"" + name + "\" in " + cls->name);
+      }
+      Path::Step step;
+      step.field = field;
+      step.fixed = -1;
+      step.dim = -1;
+      prefix += (prefix.empty() ? "" : ".") + name;
+      member += (member.empty() ? "" : ".") + name;
+      _formula->_branches.insert(member);
+      if(size_query){
+	path->size_query = true;
+	if(!field->is_vector || !Accept(".") || !Accept("size") ||
+	   !Accept("(") || !Accept(")")){
+	  delete path;
+	  return Fail("Expected @" + name + ".size() of a vector");
+	}
+	step.prefix = prefix + "@size";
+	path->steps.push_back(step);
+	break;
+      }
+      if(field->is_vector){
+	std::ostringstream element;
+	if(Accept("[") && !Accept("]")){
+	  SkipSpace();
+	  const size_t start = _pos;
+	  while(_pos < _expr.size() && std::isdigit(_expr[_pos]))
+	    ++_pos;
+	  if(_pos == start || !Accept("]")){
+	    delete path;
+	    return Fail("Expected a constant index or [] after " + name);
+	  }
+	  step.fixed = std::atoi(_expr.c_str() + start);
+	  element<<"["<<step.fixed<<"]";
+	}
+	else{
+	  if(dims == MAX_DIMS){
+	    delete path;
+	    return Fail("Too many loops");
+	  }
+	  step.dim = dims++;
+	  element<<"[@"<<step.dim<<"]";
+	}
+	prefix += element.str();
+      }
+      step.prefix = prefix;
+      path->steps.push_back(step);
+      if(!field->type)
+	break;
+      if(!Accept(".")){
+	delete path;
+	return Fail("\"" + name + "\" is a " + field->type->name +
+		    "; select one of its members");
+      }
+      size_query = Accept("@");
+      name = ReadName();
+      cls = field->type;
+    }
+    path->key = prefix;
+    Path* interned = (Path*)Intern(path);
+    _paths.push_back(interned);
+    return interned;
+  }
+};
+
+EventFormula::EventFormula() : _ndims(0), _stamp(0)
+{}
+
+EventFormula::~EventFormula()
+{
+  Clear();
+}
+
+void EventFormula::Clear()
+{
+  for(std::map<std::string, Node*>::iterator it = _nodes.begin();
+      it != _nodes.end(); ++it)
+    delete it->second;
+  _nodes.clear();
+  _terms.clear();
+  _paths.clear();
+  _branches.clear();
+  _ndims = 0;
+  _error = "";
+}
+
+void EventFormula::AddNode(Node* node, const std::vector<Path*>& paths)
+{
+  _terms.push_back(node);
+  for(size_t i=0; i<paths.size(); ++i){
+    if(std::find(_paths.begin(), _paths.end(), paths[i]) != _paths.end())
+      continue;
+    _paths.push_back(paths[i]);
+    //paths loop over dims 0..n-1 in order, so the deepest tells how many
+    for(size_t s=0; s<paths[i]->steps.size(); ++s)
+      if(paths[i]->steps[s].dim >= _ndims)
+	_ndims = paths[i]->steps[s].dim + 1;
+  }
+}
+
+int EventFormula::AddTerm(const std::string& expr)
+{
+  Parser parser(this, expr, 0);
+  Node* node = parser.ParseExpression();
+  if(node && !parser.AtEnd())
+    node = parser.Fail("Unexpected character");
+  if(!node){
+    _error = parser.GetError();
+    return -1;
+  }
+  //an identical term is only evaluated once
+  std::vector<Node*>::iterator it = std::find(_terms.begin(), _terms.end(),
+					      node);
+  if(it != _terms.end())
+    return it - _terms.begin();
+  AddNode(node, parser.GetPaths());
+  return _terms.size() - 1;
+}
+
+void EventFormula::GetBranchNames(std::set<std::string>& names) const
+{
+  names.insert(_branches.begin(), _branches.end());
+}
+
+std::string EventFormula::GetLoopSignature() const
+{
+  std::set<std::string> loops;
+  for(size_t p=0; p<_paths.size(); ++p)
+    _paths[p]->AddLoops(loops);
+  std::string signature;
+  for(std::set<std::string>::iterator it = loops.begin(); it != loops.end();
+      ++it)
+    signature += *it + ";";
+  return signature;
+}
+
+void EventFormula::Enumerate(Instance& inst, int* index, int dim,
+			     std::vector<double>& values,
+			     int& ninstances) const
+{
+  if(dim == _ndims){
+    //skip the instance if any constant index is out of range
+    for(size_t p=0; p<_paths.size(); ++p)
+      if(_paths[p]->Limit(inst.event, index, MAX_DIMS) == 0)
+	return;
+    inst.stamp = ++_stamp;
+    for(size_t t=0; t<_terms.size(); ++t)
+      values.push_back(_terms[t]->Get(inst));
+    ++ninstances;
+    return;
+  }
+  //loop up to the shortest vector using this dimension
+  int n = -1;
+  for(size_t p=0; p<_paths.size(); ++p){
+    const int limit = _paths[p]->Limit(inst.event, index, dim);
+    if(limit >= 0 && (n < 0 || limit < n))
+      n = limit;
+  }
+  for(int i=0; i<n; ++i){
+    index[dim] = i;
+    Enumerate(inst, index, dim+1, values, ninstances);
+  }
+}
+
+int EventFormula::Evaluate(const EventData* event,
+			   std::vector<double>& values) const
+{
+  values.clear();
+  int ninstances = 0;
+  if(_terms.empty() || !event)
+    return 0;
+  int index[MAX_DIMS];
+  Instance inst;
+  inst.event = event;
+  inst.index = index;
+  inst.stamp = 0;
+  Enumerate(inst, index, 0, values, ninstances);
+  return ninstances;
+}
@@ -56,6 +56,8 @@ EventHandler::EventHandler() :
 		    "Fail to initialize if unable to  find calibration data");
   RegisterParameter("run_parallel", _run_parallel=false,
 		    "Do we process modules in series, or give them threads?");
+  RegisterParameter("event_pool_size", _event_pool_size=8,
+		    "Max number of processed events kept for reuse (0 disables)");
   config->AddCommandSwitch(' ',"enable","enable <module>",
 			   EnableModule(true),"module");
   config->AddCommandSwitch(' ',"disable","disable <module>",
@@ -117,6 +119,7 @@ int EventHandler::Initialize()
   Message(DEBUG)<<"EventHandler::Initialize() called with  "<<_modules.size()
 		<<" registered modules...\n";
   _is_initialized = true;
+  _event_pool.SetMaxSize(_event_pool_size > 0 ? _event_pool_size : 0);
   
   /*initialize the runinfo
     order of priority for metadata settings is: (higher numbers override)
@@ -197,6 +200,12 @@ int EventHandler::Initialize()
       _is_initialized = false;
       return 1;
     }
+    //a module may switch itself off without failing the whole run
+    if(!mod->enabled){
+      Message(DEBUG)<<"Module "<<mod->GetName()<<" disabled itself.\n";
+      enabled_modules.erase(mod->GetName());
+      continue;
+    }
     if(_run_parallel){
       //give this module an AsyncEventHandler
       AsyncEventHandler* ah = new AsyncEventHandler;
@@ -220,7 +229,7 @@ int EventHandler::Process(RawEventPtr raw)
     Message(ERROR)<<"Attempted to process empty event pointer.\n";
     return 1;
   }
-  EventPtr evt(new Event(raw));
+  EventPtr evt = _event_pool.GetEvent(raw);
   return Process(evt);
 }
 
@@ -276,10 +285,16 @@ int EventHandler::Finalize()
     }
   }
   int final_fail = 0;
+  std::vector<BaseModule*>::iterator it;
+  //let background work (e.g. RootWriter's queue) finish before any module
+  //writes its results at Finalize
+  for(it = _modules.begin(); it != _modules.end(); it++){
+    if((*it)->enabled)
+      final_fail += (*it)->FinishProcessing();
+  }
   Message(DEBUG)<<"Finalizing "<<_modules.size()<<" modules..."<<std::endl;
   //finalization should go in opposite order of initialization
   //but that messes up root file writing, so go in same order...                
-  std::vector<BaseModule*>::iterator it;
   for(it = _modules.begin(); it != _modules.end(); it++){
     BaseModule* mod = *it;
     if(mod->enabled){
@@ -289,6 +304,8 @@ int EventHandler::Finalize()
   }
   //reset the run info
   _runinfo.Init(true);
+  //release the memory held by recycled events between runs
+  _event_pool.Clear();
   Message(DEBUG)<<"Done finalizing modules.\n";
   if(final_fail)
     Message(WARNING)<<"Finalization returned error code "<<final_fail<<"\n";
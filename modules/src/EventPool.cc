@@ -0,0 +1,144 @@
+#include "EventPool.hh"
+#include <boost/weak_ptr.hpp>
+#include <vector>
+
+#ifndef SINGLETHREAD
+#include "boost/thread/mutex.hpp"
+#endif
+
+/// Released events, shared between the pool and the deleters of its events
+struct EventPool::Storage{
+  size_t max_size;                 ///< maximum number of events to keep
+  std::vector<Event*> available;   ///< released events ready for reuse
+  std::vector<Event*> held;        ///< released events whose data is shared
+#ifndef SINGLETHREAD
+  boost::mutex mutex;              ///< control access to available and held
+#endif
+
+  Storage(size_t max) : max_size(max) {}
+  ~Storage()
+  {
+    for(size_t i=0; i<available.size(); ++i)
+      delete available[i];
+    for(size_t i=0; i<held.size(); ++i)
+      delete held[i];
+  }
+  
+  /// Keep evt for reuse if there is room, otherwise delete it
+  void Store(Event* evt)
+  {
+#ifndef SINGLETHREAD
+    boost::mutex::scoped_lock lock(mutex);
+#endif
+    if(available.size() < max_size)
+      available.push_back(evt);
+    else
+      delete evt;
+  }
+  
+  /// Drop the raw data of the held events, decoding what their data still
+  /// needs from it on the calling thread, and store them
+  void ReleaseHeld()
+  {
+    std::vector<Event*> released;
+    {
+#ifndef SINGLETHREAD
+      boost::mutex::scoped_lock lock(mutex);
+#endif
+      released.swap(held);
+    }
+    for(size_t i=0; i<released.size(); ++i){
+      released[i]->Reset(RawEventPtr());
+      Store(released[i]);
+    }
+  }
+};
+
+/// Deleter for pooled EventPtrs; hands the event back instead of deleting
+class EventPool::Recycler{
+  boost::weak_ptr<Storage> _storage;
+public:
+  Recycler(boost::shared_ptr<Storage> storage) : _storage(storage) {}
+  void operator()(Event* evt)
+  {
+    boost::shared_ptr<Storage> storage = _storage.lock();
+    if(!storage){
+      delete evt;
+      return;
+    }
+    if(evt->IsDataShared()){
+      //the holder of the data may still decode waveforms from the raw
+      //event, so the processing thread releases it in GetEvent or Clear
+#ifndef SINGLETHREAD
+      boost::mutex::scoped_lock lock(storage->mutex);
+#endif
+      storage->held.push_back(evt);
+      return;
+    }
+    //drop the raw data now, and clear the processed data for reuse
+    evt->Reset(RawEventPtr());
+    storage->Store(evt);
+  }
+};
+
+EventPool::EventPool(size_t max_size) : _storage(new Storage(max_size))
+{}
+
+EventPool::~EventPool()
+{}
+
+EventPtr EventPool::GetEvent(RawEventPtr raw)
+{
+  _storage->ReleaseHeld();
+  Event* evt = 0;
+  {
+#ifndef SINGLETHREAD
+    boost::mutex::scoped_lock lock(_storage->mutex);
+#endif
+    if(!_storage->available.empty()){
+      evt = _storage->available.back();
+      _storage->available.pop_back();
+    }
+  }
+  if(evt)
+    evt->Reset(raw);
+  else
+    evt = new Event(raw);
+  return EventPtr(evt, Recycler(_storage));
+}
+
+void EventPool::SetMaxSize(size_t max_size)
+{
+#ifndef SINGLETHREAD
+  boost::mutex::scoped_lock lock(_storage->mutex);
+#endif
+  _storage->max_size = max_size;
+  while(_storage->available.size() > max_size){
+    delete _storage->available.back();
+    _storage->available.pop_back();
+  }
+}
+
+size_t EventPool::GetMaxSize() const
+{
+  return _storage->max_size;
+}
+
+size_t EventPool::GetNAvailable() const
+{
+#ifndef SINGLETHREAD
+  boost::mutex::scoped_lock lock(_storage->mutex);
+#endif
+  return _storage->available.size();
+}
+
+void EventPool::Clear()
+{
+  _storage->ReleaseHeld();
+#ifndef SINGLETHREAD
+  boost::mutex::scoped_lock lock(_storage->mutex);
+#endif
+  for(size_t i=0; i<_storage->available.size(); ++i)
+    delete _storage->available[i];
+  _storage->available.clear();
+}
@@ -0,0 +1,285 @@
+#include "FFTFilter.hh"
+#include "RealFFT.hh"
+#include "BaselineFinder.hh"
+#include "TFile.h"
+#include "TH1F.h"
+#include "TKey.h"
+#include "TList.h"
+#include <algorithm>
+#include <stdexcept>
+#include <cstdlib>
+#include <cmath>
+
+std::ostream& operator<<(std::ostream& out, const FFTFilter::FILTER_MODE& m)
+{
+  switch(m){
+  case FFTFilter::LOWPASS:
+    out<<"LOWPASS";
+    break;
+  case FFTFilter::MATCHED:
+    out<<"MATCHED";
+    break;
+  case FFTFilter::WIENER:
+    out<<"WIENER";
+    break;
+  case FFTFilter::DECONVOLVE:
+    out<<"DECONVOLVE";
+    break;
+  }
+  return out;
+}
+
+std::istream& operator>>(std::istream& in, FFTFilter::FILTER_MODE& m)
+{
+  std::string dummy;
+  in>>dummy;
+  if(dummy == "LOWPASS" || dummy == "lowpass")
+    m = FFTFilter::LOWPASS;
+  else if(dummy == "MATCHED" || dummy == "matched")
+    m = FFTFilter::MATCHED;
+  else if(dummy == "WIENER" || dummy == "wiener")
+    m = FFTFilter::WIENER;
+  else if(dummy == "DECONVOLVE" || dummy == "deconvolve")
+    m = FFTFilter::DECONVOLVE;
+  else{
+    throw std::invalid_argument(dummy+" is not a valid value for mode!");
+  }
+  return in;
+}
+
+FFTFilter::FFTFilter() :
+  ChannelModule(GetDefaultName(),
+		"Filter or deconvolve each channel's waveform using FFTs")
+{
+  AddDependency<BaselineFinder>();
+
+  RegisterParameter("mode", mode = LOWPASS,
+		    "Filter to apply: LOWPASS, MATCHED, WIENER, or DECONVOLVE");
+  RegisterParameter("cutoff_freq", cutoff_freq = 50,
+		    "Width in MHz of gaussian low pass applied in all modes; <=0 to disable");
+  RegisterParameter("noise_power", noise_power = 0.01,
+		    "Noise to signal power ratio for WIENER mode");
+  RegisterParameter("template_file",
+		    template_file = "auxiliary_files/shapes.root",
+		    "File containing template pulse shapes");
+  RegisterParameter("template_hist", template_hist = "pulse_template",
+		    "Base name of template histograms, suffixed by _<channel id>");
+}
+
+FFTFilter::~FFTFilter()
+{
+  Finalize();
+}
+
+int FFTFilter::Initialize()
+{
+  if(mode == LOWPASS && cutoff_freq <= 0){
+    Message(ERROR)<<"FFTFilter: LOWPASS mode requires a positive cutoff_freq"
+		  <<std::endl;
+    return 1;
+  }
+  if(UsesTemplate())
+    return LoadTemplates();
+  return 0;
+}
+
+int FFTFilter::Finalize()
+{
+  for(std::map<int, TH1F*>::iterator it = _templates.begin();
+      it != _templates.end(); ++it)
+    delete it->second;
+  _templates.clear();
+  for(std::map<int, RealFFT*>::iterator it = _plans.begin();
+      it != _plans.end(); ++it)
+    delete it->second;
+  _plans.clear();
+  _filters.clear();
+  _skipped.clear();
+  return 0;
+}
+
+
+int FFTFilter::LoadTemplates()
+{
+  TFile* f = new TFile(template_file.c_str());
+  if(f->IsZombie()){
+    Message(ERROR)<<"Unable to open template file: "<<template_file
+		  <<std::endl;
+    delete f;
+    return 1;
+  }
+
+  //take every <template_hist>_<channel id> in the file, in any order
+  const std::string prefix = template_hist + "_";
+  TIter next(f->GetListOfKeys());
+  while(TKey* key = (TKey*)next()){
+    const std::string name = key->GetName();
+    if(name.compare(0, prefix.size(), prefix) != 0)
+      continue;
+    const char* idstr = name.c_str() + prefix.size();
+    char* end = 0;
+    const long id = std::strtol(idstr, &end, 10);
+    if(end == idstr || *end != '\0' || _templates.count(id))
+      continue;
+    TObject* obj = key->ReadObj();
+    TH1F* hist = dynamic_cast<TH1F*>(obj);
+    if(!hist){
+      delete obj;
+      continue;
+    }
+    //Disassociate histograms from ROOT file
+    hist->SetDirectory(0);
+    _templates.insert(std::make_pair((int)id, hist));
+  }
+  f->Close();
+  delete f;
+
+  if(_templates.empty()){
+    Message(ERROR)<<"No histograms named "<<template_hist<<"_<channel> in "
+		  <<template_file<<std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+int FFTFilter::GetPadding(const ChannelData* chdata) const
+{
+  int pad = 0;
+  if(UsesTemplate()){
+    std::map<int, TH1F*>::const_iterator it =
+      _templates.find(chdata->channel_id);
+    if(it != _templates.end()){
+      const TH1F* hist = it->second;
+      const double width = hist->GetXaxis()->GetXmax() -
+	hist->GetXaxis()->GetXmin();
+      pad = (int)std::ceil(width * chdata->sample_rate);
+    }
+  }
+  if(cutoff_freq > 0){
+    //the gaussian's time domain sigma is 1/(2 pi cutoff); allow 4 sigma
+    const double sigma = chdata->sample_rate / (2.*M_PI*cutoff_freq);
+    pad = std::max(pad, (int)std::ceil(4.*sigma));
+  }
+  return pad;
+}
+
+RealFFT* FFTFilter::GetPlan(int size)
+{
+  std::map<int, RealFFT*>::iterator it = _plans.find(size);
+  if(it != _plans.end())
+    return it->second;
+  RealFFT* plan = new RealFFT(size);
+  _plans.insert(std::make_pair(size, plan));
+  return plan;
+}
+
+const std::vector<double>* FFTFilter::GetFilter(const ChannelData* chdata,
+						RealFFT* plan)
+{
+  const int n = plan->GetSize();
+  const int nbins = plan->GetNBins();
+  const FilterKey key(chdata->channel_id, n);
+  std::map<FilterKey, std::vector<double> >::iterator found =
+    _filters.find(key);
+  if(found != _filters.end())
+    return &(found->second);
+
+  //template spectrum; a unit impulse when no template is used
+  std::vector<double> shape(n, 0);
+  if(UsesTemplate()){
+    std::map<int, TH1F*>::iterator it = _templates.find(chdata->channel_id);
+    if(it == _templates.end()){
+      Message(WARNING)<<"FFTFilter: no template loaded for channel "
+		      <<chdata->channel_id<<"; it will not be filtered"
+		      <<std::endl;
+      return 0;
+    }
+    TH1F* hist = it->second;
+    const double tmin = hist->GetXaxis()->GetXmin();
+    const double tmax = hist->GetXaxis()->GetXmax();
+    //sample the template at the channel's rate, keeping t=0 at index 0
+    const int first = (int)std::ceil(tmin * chdata->sample_rate);
+    const int last = (int)std::floor(tmax * chdata->sample_rate);
+    double area = 0;
+    for(int samp = first; samp < last && samp - first < n; ++samp){
+      const double val = hist->Interpolate(samp / chdata->sample_rate);
+      shape[((samp % n) + n) % n] += val;
+      area += val;
+    }
+    if(area == 0){
+      Message(WARNING)<<"FFTFilter: template for channel "
+		      <<chdata->channel_id<<" has zero area; "
+		      <<"it will not be filtered"<<std::endl;
+      return 0;
+    }
+    for(int i=0; i<n; ++i)
+      shape[i] /= area;
+  }
+  else{
+    shape[0] = 1;
+  }
+  std::vector<double> response(2*nbins);
+  plan->Forward(&shape[0], &response[0]);
+
+  std::vector<double>& filter = _filters[key];
+  filter.resize(2*nbins);
+  for(int k=0; k<nbins; ++k){
+    const double hr = response[2*k], hi = response[2*k+1];
+    const double power = hr*hr + hi*hi;
+    double gain = 1./n;
+    if(cutoff_freq > 0){
+      const double freq = k * chdata->sample_rate / n;
+      gain *= std::exp(-0.5*freq*freq/(cutoff_freq*cutoff_freq));
+    }
+    switch(mode){
+    case LOWPASS:
+    case MATCHED:
+      break;
+    case WIENER:
+      gain /= power + noise_power;
+      break;
+    case DECONVOLVE:
+      gain = (power > 0 ? gain/power : 0);
+      break;
+    }
+    //all template modes multiply by the conjugate of the response
+    filter[2*k] = gain * hr;
+    filter[2*k+1] = -gain * hi;
+  }
+  return &filter;
+}
+
+int FFTFilter::Process(ChannelData* chdata)
+{
+  if(!chdata->baseline.found_baseline || chdata->subtracted_waveform.empty()
+     || _skipped.count(chdata->channel_id))
+    return 0;
+  const int nsamps = chdata->subtracted_waveform.size();
+  RealFFT* plan = GetPlan(RealFFT::GoodSize(nsamps + GetPadding(chdata)));
+  const std::vector<double>* filter = GetFilter(chdata, plan);
+  if(!filter){
+    //GetFilter has warned; don't try this channel again
+    _skipped.insert(chdata->channel_id);
+    return 0;
+  }
+
+  const int n = plan->GetSize();
+  const int nbins = plan->GetNBins();
+  const double* wave = chdata->GetBaselineSubtractedWaveform();
+  _padded.resize(n);
+  std::copy(wave, wave+nsamps, _padded.begin());
+  std::fill(_padded.begin()+nsamps, _padded.end(), 0.);
+  _spectrum.resize(2*nbins);
+  plan->Forward(&_padded[0], &_spectrum[0]);
+
+  const double* fil = &((*filter)[0]);
+  double* spec = &_spectrum[0];
+  for(int k=0; k<nbins; ++k){
+    const double xr = spec[2*k], xi = spec[2*k+1];
+    spec[2*k] = xr*fil[2*k] - xi*fil[2*k+1];
+    spec[2*k+1] = xr*fil[2*k+1] + xi*fil[2*k];
+  }
+  plan->Backward(&_spectrum[0], &_padded[0]);
+  chdata->filtered_waveform.assign(_padded.begin(), _padded.begin()+nsamps);
+  return 0;
+}
@@ -2,17 +2,18 @@
 #include "EventHandler.hh"
 #include "SumChannels.hh"
 #include "PulseFinder.hh"
-#include "TGraph.h"
+#include "PulseFitEngine.hh"
 #include "RootWriter.hh"
 #include "intarray.hh"
-#include "TF1.h"
+#include "boost/bind.hpp"
 #include <vector>
 #include <algorithm>
 #include <math.h>
 
 Fitter::Fitter():
   ChannelModule(GetDefaultName(), 
-		"Fit the pulse to the known scintillation shape")
+		"Fit the pulse to the known scintillation shape"),
+  _ntasks(0), _next_task(0)
 {
   AddDependency<PulseFinder>();
   ///@todo Provide helptext for Fitter parameters
@@ -21,6 +22,10 @@ Fitter::Fitter():
   RegisterParameter("end_fit", end_fit = 80000);
   RegisterParameter("slow_sample_rate", slow_sample_rate = 10);
   RegisterParameter("start_slow_sample_rate", start_slow_sample_rate = 500);
+  RegisterParameter("max_iterations", max_iterations = 100,
+		    "Maximum number of iterations for each fit");
+  RegisterParameter("num_threads", num_threads = 1,
+		    "Number of threads to fit the pulses of an event with");
 }
 
 Fitter::~Fitter()
@@ -30,76 +35,118 @@ Fitter::~Fitter()
 
 int Fitter::Initialize()
 {
+#ifdef SINGLETHREAD
+  if(num_threads > 1)
+    Message(WARNING)<<"Fitter: compiled without threads; "
+		    <<"fitting with 1 thread instead of "<<num_threads
+		    <<std::endl;
+#endif
+  _pool.Start(num_threads);
   return 0;
 }
 
+int Fitter::Process(EventPtr event)
+{
+  _ntasks = 0;
+  int returnval = ChannelModule::Process(event);
+  _next_task = 0;
+  //don't wake the other threads for a single pulse
+  if(_ntasks > 1)
+    _pool.Run(boost::bind(&Fitter::FitTasks, this));
+  else
+    FitTasks();
+  return returnval;
+}
+
 int Fitter::Process(ChannelData* chdata)
 {
-  if( chdata->pulses.size()==0) 
+  if( chdata->pulses.size()==0 || !chdata->baseline.found_baseline) 
     return 0;
   
   double* wave = chdata->GetWaveform();
   
   for(size_t j=0; j < chdata->pulses.size(); j++){
     Pulse& pulse = chdata->pulses[j];
-    if(!chdata->baseline.found_baseline || !pulse.found_start || 
-       !pulse.found_peak || pulse.peak_saturated)
-      return 0;
+    if(!pulse.found_start || !pulse.found_peak || pulse.peak_saturated)
+      continue;
     
     PulseFit& fit = pulse.fit;
     fit.start_index = std::max(pulse.start_index+start_fit,0);
     fit.end_index = std::min(pulse.start_index+end_fit, pulse.end_index);
     
-    int npts = pulse.start_index + start_slow_sample_rate - fit.start_index + 
-      (int)ceil((fit.end_index - pulse.start_index - start_slow_sample_rate)/slow_sample_rate) + 1;
-    int x[npts];
-    int y[npts];
-    
-    int counter = 0;
+    if(_ntasks == _tasks.size())
+      _tasks.resize(_ntasks+1);
+    FitTask& task = _tasks[_ntasks++];
+    task.pulse = &pulse;
+    task.baseline = chdata->baseline.mean;
+    task.x.clear();
+    task.y.clear();
     for(int samp=fit.start_index; samp< fit.end_index; samp++)
       {
 	if(samp < pulse.start_index + start_slow_sample_rate || 
 	   samp%slow_sample_rate == 0)
 	  {
-	    x[counter] = samp;
-	    y[counter] = (int)wave[samp];
-	    counter++;
+	    task.x.push_back(samp);
+	    task.y.push_back((int)wave[samp]);
 	  }
       }
-    TGraph graph(npts,x,y);
-    
-    
-    //perform the fit
-    
-    
-    TF1* func = fit.GetTF1();
-    
-    func->SetRange(fit.start_index, fit.end_index);
-    func->SetParameters(1.09 * pulse.peak_amplitude, 
-			0.3, 0.7, 160., 1., 12000., 
-			chdata->baseline.mean, pulse.start_index + 0.5, 7500);
-    func->SetParLimits(1, 0, 1);
-    func->FixParameter(2, 0.70);
-    func->FixParameter(6, chdata->baseline.mean);
-    
-    fit.fit_result = graph.Fit(func,"RWQN");
-    
-    if(fit.fit_result != 0){
-      func->SetParameter(2,0.8);
-      fit.fit_result = graph.Fit(func,"RWQN");
-    }
-    
-    fit.fit_done = true;
-    fit.StoreParams(func);
-    
-    delete func;
   }//end loop over pulses
   return 0;
 }
 
+void Fitter::FitTasks()
+{
+  while(true){
+    size_t next;
+    {
+#ifndef SINGLETHREAD
+      boost::mutex::scoped_lock lock(_task_mutex);
+#endif
+      next = _next_task++;
+    }
+    if(next >= _ntasks)
+      return;
+    FitPulse(_tasks[next]);
+  }
+}
+
+void Fitter::FitPulse(FitTask& task)
+{
+  Pulse& pulse = *(task.pulse);
+  PulseFit& fit = pulse.fit;
+  const double start[PulseFitEngine::NPARAMS] = 
+    { 1.09 * pulse.peak_amplitude, 0.3, 0.7, 160., 1., 12000., 
+      task.baseline, pulse.start_index + 0.5, 7500 };
+  const int npts = task.x.size();
+  
+  PulseFitEngine engine;
+  engine.SetMaxIterations(max_iterations);
+  engine.SetParameters(start);
+  engine.SetParLimits(1, 0, 1);
+  engine.FixParameter(2, 0.70);
+  engine.FixParameter(6, task.baseline);
+  
+  //perform the fit
+  fit.fit_result = npts ? engine.Fit(&task.x[0], &task.y[0], npts) :
+    PulseFitEngine::TOO_FEW_POINTS;
+  
+  if(fit.fit_result != 0 && npts){
+    engine.SetParameters(start);
+    engine.FixParameter(2, 0.8);
+    fit.fit_result = engine.Fit(&task.x[0], &task.y[0], npts);
+  }
+  
+  fit.fit_done = true;
+  engine.StoreParams(fit);
+  fit.range_low = fit.start_index;
+  fit.range_high = fit.end_index;
+}
+
 int Fitter::Finalize()
 {   
+  _pool.Stop();
+  _tasks.clear();
+  _ntasks = 0;
   return 0;
 }
 
-
@@ -14,6 +14,8 @@ Integrator::Integrator() :
   AddDependency<BaselineFinder>();
   RegisterParameter("threshold" , threshold = 0,
 		    "Assume samples less than threshold away from baseline are zero");
+  RegisterParameter("fuse_with_baseline", fuse_with_baseline = false,
+		    "Integrate in the same pass as the drifting baseline subtraction in BaselineFinder");
 }
 
 Integrator::~Integrator()
@@ -34,33 +36,30 @@ int Integrator::Process(ChannelData* chdata)
   if(!baseline.found_baseline)
     return 0;
   
-  //get the relevant variables
-  const double* wave = chdata->GetBaselineSubtractedWaveform();
-  
+  //BaselineFinder may already have integrated this channel
   const int nsamps = chdata->nsamps;
   std::vector<double>& integral = chdata->integral;
-  integral.resize(nsamps);
-  
-  //perform the integration
-  integral[0] = wave[0] ;
-  for(int samp = 1; samp < nsamps; samp++){
-    double onestep = wave[samp] ;
-    integral[samp] = integral[samp-1]
-      + ( std::abs(onestep) > threshold ? onestep : 0 );
+  if(!fuse_with_baseline || !chdata->integral_fused){
+    //get the relevant variables
+    const double* wave = chdata->GetBaselineSubtractedWaveform();
+    integral.resize(nsamps);
+    
+    //perform the integration
+    integral[0] = wave[0] ;
+    for(int samp = 1; samp < nsamps; samp++){
+      double onestep = wave[samp] ;
+      integral[samp] = integral[samp-1]
+	+ ( std::abs(onestep) > threshold ? onestep : 0 );
+    }
+    
+    //find the min/max
+    SetIntegralExtrema(chdata, 
+		       std::max_element(integral.begin(), integral.end())
+		       - integral.begin(),
+		       std::min_element(integral.begin(), integral.end())
+		       - integral.begin());
   }
   
-  //find the min/max
-  chdata->integral_max_index = std::max_element(integral.begin(), 
-						integral.end())
-    - integral.begin();
-  chdata->integral_min_index = std::min_element(integral.begin(),
-						integral.end())
-    - integral.begin();
-  chdata->integral_max = integral[chdata->integral_max_index];
-  chdata->integral_min = integral[chdata->integral_min_index];
-  chdata->integral_max_time = chdata->SampleToTime(chdata->integral_max_index);
-  chdata->integral_min_time = chdata->SampleToTime(chdata->integral_min_index);
-
   //baseline interpolation integral
   for(int i=0; i<(int)baseline.interpolations.size(); i++){
     Spe* pe = &baseline.interpolations[i];
@@ -68,3 +67,14 @@ int Integrator::Process(ChannelData* chdata)
   }
   return 0;
 }
+
+void Integrator::SetIntegralExtrema(ChannelData* chdata, int max_index,
+				    int min_index)
+{
+  chdata->integral_max_index = max_index;
+  chdata->integral_min_index = min_index;
+  chdata->integral_max = chdata->integral[max_index];
+  chdata->integral_min = chdata->integral[min_index];
+  chdata->integral_max_time = chdata->SampleToTime(max_index);
+  chdata->integral_min_time = chdata->SampleToTime(min_index);
+}
@@ -48,6 +48,44 @@ std::istream& operator>>(std::istream& in, PulseFinder::SEARCH_MODE& m)
   return in;
 }
 
+/// Is a sample below the discriminator value?
+class BelowValue{
+  double _value;
+public:
+  BelowValue(double value) : _value(value) {}
+  bool operator()(double x) const { return x < _value; }
+};
+
+/// Is a scaled sample not above the (negative) amplitude threshold?
+class NotAboveScaled{
+  double _thresh, _scale;
+public:
+  NotAboveScaled(double thresh, double scale) : 
+    _thresh(thresh), _scale(scale) {}
+  bool operator()(double x) const { return !(x/_scale > _thresh); }
+};
+
+/// Index of the first sample in [begin, end) passing pred, or end.
+/// Whole blocks are tested without branching so the common case, where
+/// nothing in the block passes, can be vectorised by the compiler.
+template<class Predicate>
+static int FindFirst(const double* wave, int begin, int end, Predicate pred)
+{
+  const int block = 16;
+  int samp = begin;
+  for( ; samp + block <= end; samp += block){
+    bool any = false;
+    for(int i=0; i<block; ++i)
+      any |= pred(wave[samp+i]);
+    if(any) 
+      break;
+  }
+  for( ; samp < end; ++samp){
+    if(pred(wave[samp]))
+      return samp;
+  }
+  return end;
+}
 
 PulseFinder::PulseFinder() : 
   BaseModule(GetDefaultName(), "Search for individual physical scintillation pulses within the hardware trigger")
@@ -166,15 +204,15 @@ int PulseFinder::Process(EventPtr evt)
 
 	//Start check for wheteher the start found is too far from the peak when the pulse is s1 ***************************
 	//(Messy code! Should eventually be moved to search functions)
-	double* subtracted = sum_ch->GetBaselineSubtractedWaveform();
 	double* integral = sum_ch->GetIntegralWaveform();
 	int ratio_samps = (int)(0.02*sum_ch->sample_rate);
 	for (size_t i = 0; i < start_index[ChannelData::CH_SUM].size();  i++)
 	{
 	    double pulse_integral = (sum_ch->integral[end_index[ChannelData::CH_SUM][i]] 
 				     - sum_ch->integral[start_index[ChannelData::CH_SUM][i]]);
-	    int peak_index = std::min_element(subtracted + start_index[ChannelData::CH_SUM][i], 
-					      subtracted + end_index[ChannelData::CH_SUM][i]) - subtracted;
+	    int peak_index = sum_ch->GetSubtractedQuery().ArgMin(
+		start_index[ChannelData::CH_SUM][i], 
+		end_index[ChannelData::CH_SUM][i]);
 	    
 	    double ratio1 = 0, ratio2 = 0;
 	    if (peak_index >= ratio_samps && 
@@ -245,15 +283,15 @@ int PulseFinder::Process(EventPtr evt)
 
 	    //Start check for wheteher the start found is too far from the peak when the pulse is s1 ***************************
 	    //(Messy code! Should eventually be moved to search functions)
-	    double* subtracted = chdata.GetBaselineSubtractedWaveform();
 	    double* integral = chdata.GetIntegralWaveform();
 	    int ratio_samps = (int)(0.02*chdata.sample_rate);
 	    for (size_t i = 0; i < start_index[chdata.channel_id].size();  i++)
 	    {
 		double pulse_integral = (chdata.integral[end_index[chdata.channel_id][i]] 
 					 - chdata.integral[start_index[chdata.channel_id][i]]);
-		int peak_index = std::min_element(subtracted + start_index[chdata.channel_id][i], 
-						  subtracted + end_index[chdata.channel_id][i]) - subtracted;
+		int peak_index = chdata.GetSubtractedQuery().ArgMin(
+		    start_index[chdata.channel_id][i], 
+		    end_index[chdata.channel_id][i]);
 		
 		double ratio1 = 0, ratio2 = 0;
 		if (peak_index >= ratio_samps && 
@@ -351,8 +389,7 @@ int PulseFinder::EvaluatePulse(Pulse& pulse, ChannelData* chdata,
   if(!chdata->baseline.found_baseline)
     return 1;
   double* subtracted = chdata->GetBaselineSubtractedWaveform();
-  int min_index = std::min_element(subtracted + start_index, 
-				   subtracted + end_index) - subtracted;
+  int min_index = chdata->GetSubtractedQuery().ArgMin(start_index, end_index);
   pulse.found_start = true;
   pulse.start_index = start_index;
   pulse.start_time = chdata->SampleToTime(pulse.start_index);
@@ -414,12 +451,11 @@ int PulseFinder::EvaluatePulse(Pulse& pulse, ChannelData* chdata,
     
   }
   pulse.npe = -pulse.integral/chdata->spe_mean;
-  //Check to see if peak is saturated
-  double* wave = chdata->GetWaveform();
-  if(wave[min_index] == 0){
+  //Check to see if peak is saturated; reads the raw samples if it can
+  if(chdata->GetSample(min_index) == 0){
     pulse.peak_saturated = true;
     int min_end_index = min_index + 1;
-    while (wave[min_end_index] == 0 && min_end_index < end_index)
+    while (chdata->GetSample(min_end_index) == 0 && min_end_index < end_index)
       {
 	min_end_index++;
       }
@@ -438,6 +474,13 @@ void PulseFinder::VarianceSearch(ChannelData* chdata,
   double* wave = chdata->GetWaveform();
   double start_baseline;
   bool found_start;
+  //count how many consecutive samples up to each one have dropped by
+  //more than the baseline variance, so each start test is a lookup
+  std::vector<int>& drop_run = _drop_run;
+  drop_run.assign(std::max(chdata->nsamps, 1), 0);
+  for(int samp = 0; samp < chdata->nsamps-1; samp++)
+    drop_run[samp] = ( wave[samp]-wave[samp+1] < baseline.variance ? 0 : 
+		       (samp > 0 ? drop_run[samp-1] : 0) + 1 );
   for(index = start_window; index < chdata->nsamps; index++)
     {
       if(start_index.size() > 5)
@@ -448,15 +491,7 @@ void PulseFinder::VarianceSearch(ChannelData* chdata,
       //pulse must decrease by more than baseline variance for start_window 
       //consecutive samples, and be less than start_baseline-minvariance*var at end
       
-      found_start = true;
-      for(int samp=index-start_window; samp < index; samp++)
-	{
-	  if( wave[samp]-wave[samp+1] < baseline.variance )
-	    {
-	      found_start = false;
-	      break;
-	    }
-	}
+      found_start = (start_window <= 0 || drop_run[index-1] >= start_window);
       if (start_index.size() == 0)
 	start_baseline = baseline.mean;
       else
@@ -498,9 +533,11 @@ void PulseFinder::DiscriminatorSearch( ChannelData* chdata,
   if(discriminator_relative)
     wave = chdata->GetBaselineSubtractedWaveform();
 
-  for(int index = discriminator_start_add; 
-      index < chdata->nsamps - discriminator_end_add ; index++){
-    if(wave[index] < check_val){
+  const int last = chdata->nsamps - discriminator_end_add;
+  for(int index = discriminator_start_add; index < last; index++){
+    //skip ahead to the next sample over threshold
+    index = FindFirst(wave, index, last, BelowValue(check_val));
+    if(index < last){
       start_index.push_back( index - discriminator_start_add );
       while(++index < chdata->nsamps-discriminator_end_add-1 && 
 	    wave[index] < check_val && 
@@ -547,6 +584,13 @@ void PulseFinder::IntegralSearch( ChannelData* chdata,
   // expected arrival of photons
   bool in_pulse = false;
   while ( ++samp < chdata->nsamps){
+    if(!in_pulse){
+      //outside of pulses, only samples over amplitude threshold matter
+      samp = FindFirst(wave, samp, chdata->nsamps,
+		       NotAboveScaled(-amplitude_start_threshold,scale_factor));
+      if(samp >= chdata->nsamps)
+	break;
+    }
     int lookback_samps = std::min(samp,
 				  (int)(lookback_time*chdata->sample_rate));
     double int_thresh = integral_start_threshold;
@@ -620,18 +664,22 @@ void PulseFinder::CurvatureSearch( ChannelData* chdata,
 
   int df = down_sample_factor;
   int n = chdata->nsamps/df;
-  std::vector<double> sm(n);
+  //reuse the scratch buffers between calls
+  std::vector<double>& sm = _smoothed;
+  sm.resize(n);
   for(int i=0; i<n; i++){
     sm[i] = integral[i*df];
   }
 
-  std::vector<double> diff(n);
+  std::vector<double>& diff = _diff;
+  diff.assign(n, 0);
   diff[0]= sm[1];
   for (int i=1; i<n-1; i++){
     diff[i] = sm[i+1]-sm[i-1];
   }
 
-  std::vector<double> curve(n);
+  std::vector<double>& curve = _curve;
+  curve.assign(n, 0);
   curve[0] = diff[1];
   for (int i=1; i<n-1; i++){
     curve[i] = diff[i+1]-diff[i-1];
@@ -14,6 +14,8 @@ void PulseFit::Clear()
 {
   fit_done = false;
   fit_result = -1;
+  chi2 = -1;
+  ndf = 0;
   start_index = -1;
   end_index = -1;
   range_low = -1;
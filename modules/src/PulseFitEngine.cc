@@ -0,0 +1,268 @@
+#include "PulseFitEngine.hh"
+#include "PulseFit.hh"
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+namespace{
+  /// One exponential term of the model and its derivatives
+  struct Term{
+    double g;    ///< exp(s^2/2a^2 - u/a) * (1 + erf((u a - s^2)/(sqrt2 s a)))
+    double ga;   ///< dg/da
+    double gu;   ///< dg/du
+    double gs;   ///< dg/ds
+  };
+
+  /// Evaluate a term for decay time a, time since t0 u, and jitter s.
+  /// gauss is 2/sqrt(pi) exp(-u^2/2s^2), shared by all terms.
+  void EvalTerm(double a, double u, double s, double gauss, Term& t)
+  {
+    const double z = (u*a - s*s) / (M_SQRT2*s*a);
+    const double c = erfc(-z);  // 1 + erf(z), without the cancellation
+    const double e = s*s/(2*a*a) - u/a;
+    if(c <= 0)
+      t.g = 0;
+    else if(e < 700)
+      t.g = std::exp(e) * c;
+    else
+      t.g = std::exp(e + std::log(c));
+    //the derivative of erf brings exp(-z^2), which cancels with exp(e)
+    t.gu = -t.g/a + gauss/(M_SQRT2*s);
+    t.ga = t.g*(u - s*s/a)/(a*a) + gauss*s/(M_SQRT2*a*a);
+    t.gs = t.g*s/(a*a) - gauss*(u/(s*s) + 1./a)/M_SQRT2;
+  }
+
+  /// Combination of terms for one scintillation component with lifetime
+  /// tau, S = (g_tau-g_rc)/(rc-tau) - (g_tau-g_decay)/(decay-tau)
+  struct Component{
+    double S, dtau, drc, ddecay, du, ds;
+    Component(const Term& tau, const Term& rc, const Term& decay,
+	      double tau_val, double rc_val, double decay_val)
+    {
+      const double ir = 1./(rc_val - tau_val);
+      const double id = 1./(decay_val - tau_val);
+      const double nr = tau.g - rc.g;
+      const double nd = tau.g - decay.g;
+      S = nr*ir - nd*id;
+      dtau = tau.ga*ir + nr*ir*ir - tau.ga*id - nd*id*id;
+      drc = -rc.ga*ir - nr*ir*ir;
+      ddecay = decay.ga*id + nd*id*id;
+      du = (tau.gu - rc.gu)*ir - (tau.gu - decay.gu)*id;
+      ds = (tau.gs - rc.gs)*ir - (tau.gs - decay.gs)*id;
+    }
+  };
+
+  bool IsFinite(double x)
+  {
+    return x == x && std::fabs(x) <= std::numeric_limits<double>::max();
+  }
+
+  /// Solve the symmetric positive definite system a*x = b in place in b.
+  /// a is n*n row-major and is overwritten. Returns false if not positive.
+  bool CholeskySolve(double* a, double* b, int n)
+  {
+    for(int i=0; i<n; ++i){
+      for(int j=0; j<=i; ++j){
+	double sum = a[i*n+j];
+	for(int k=0; k<j; ++k)
+	  sum -= a[i*n+k]*a[j*n+k];
+	if(i == j){
+	  if(!(sum > 0))
+	    return false;
+	  a[i*n+i] = std::sqrt(sum);
+	}
+	else
+	  a[i*n+j] = sum / a[j*n+j];
+      }
+    }
+    for(int i=0; i<n; ++i){
+      double sum = b[i];
+      for(int k=0; k<i; ++k)
+	sum -= a[i*n+k]*b[k];
+      b[i] = sum / a[i*n+i];
+    }
+    for(int i=n-1; i>=0; --i){
+      double sum = b[i];
+      for(int k=i+1; k<n; ++k)
+	sum -= a[k*n+i]*b[k];
+      b[i] = sum / a[i*n+i];
+    }
+    return true;
+  }
+}
+
+PulseFitEngine::PulseFitEngine() :
+  _max_iterations(100), _chi2(0), _ndf(0)
+{
+  for(int i=0; i<NPARAMS; ++i){
+    _par[i] = 0;
+    _low[i] = -std::numeric_limits<double>::max();
+    _high[i] = std::numeric_limits<double>::max();
+    _fixed[i] = false;
+  }
+}
+
+void PulseFitEngine::SetParameters(const double* par)
+{
+  for(int i=0; i<NPARAMS; ++i)
+    _par[i] = par[i];
+}
+
+double PulseFitEngine::Eval(double t, const double* par, double* grad)
+{
+  const double amplitude = par[0], c1 = par[1], tau1 = par[2], tau2 = par[3];
+  const double sigma = par[4], decay = par[5], baseline = par[6];
+  const double t0 = par[7], rc = par[8];
+  const double u = t - t0;
+  const double gauss = M_2_SQRTPI * std::exp(-u*u/(2*sigma*sigma));
+
+  Term g1, g2, grc, gdecay;
+  EvalTerm(tau1, u, sigma, gauss, g1);
+  EvalTerm(tau2, u, sigma, gauss, g2);
+  EvalTerm(rc, u, sigma, gauss, grc);
+  EvalTerm(decay, u, sigma, gauss, gdecay);
+  const Component fast(g1, grc, gdecay, tau1, rc, decay);
+  const Component slow(g2, grc, gdecay, tau2, rc, decay);
+
+  const double k = rc*decay/(2*(rc - decay));
+  const double mix = c1*fast.S + (1-c1)*slow.S;
+  if(grad){
+    const double ak = amplitude*k;
+    const double dk_drc = -decay*decay/(2*(rc-decay)*(rc-decay));
+    const double dk_ddecay = rc*rc/(2*(rc-decay)*(rc-decay));
+    grad[0] = -k*mix;
+    grad[1] = -ak*(fast.S - slow.S);
+    grad[2] = -ak*c1*fast.dtau;
+    grad[3] = -ak*(1-c1)*slow.dtau;
+    grad[4] = -ak*(c1*fast.ds + (1-c1)*slow.ds);
+    grad[5] = -amplitude*(dk_ddecay*mix +
+			  k*(c1*fast.ddecay + (1-c1)*slow.ddecay));
+    grad[6] = 1;
+    grad[7] = ak*(c1*fast.du + (1-c1)*slow.du);
+    grad[8] = -amplitude*(dk_drc*mix + k*(c1*fast.drc + (1-c1)*slow.drc));
+  }
+  return baseline - amplitude*k*mix;
+}
+
+double PulseFitEngine::Chi2(const double* x, const double* y, int npts,
+			    const double* par)
+{
+  double chi2 = 0;
+  for(int i=0; i<npts; ++i){
+    const double r = y[i] - Eval(x[i], par);
+    chi2 += r*r;
+  }
+  return chi2;
+}
+
+int PulseFitEngine::Fit(const double* x, const double* y, int npts)
+{
+  int free_index[NPARAMS];
+  int nfree = 0;
+  for(int i=0; i<NPARAMS; ++i){
+    if(_par[i] < _low[i]) _par[i] = _low[i];
+    if(_par[i] > _high[i]) _par[i] = _high[i];
+    if(!_fixed[i])
+      free_index[nfree++] = i;
+  }
+  _ndf = npts - nfree;
+  _chi2 = Chi2(x, y, npts, _par);
+  if(_ndf <= 0)
+    return TOO_FEW_POINTS;
+  if(!IsFinite(_chi2))
+    return DIVERGED;
+
+  double lambda = 1.e-3;
+  double grad[NPARAMS];
+  double jtj[NPARAMS*NPARAMS], jtr[NPARAMS];
+  double system[NPARAMS*NPARAMS], step[NPARAMS], trial[NPARAMS];
+  for(int iteration=0; iteration < _max_iterations; ++iteration){
+    //normal equations from the analytic jacobian
+    for(int a=0; a<nfree; ++a){
+      jtr[a] = 0;
+      for(int b=0; b<=a; ++b)
+	jtj[a*nfree+b] = 0;
+    }
+    for(int i=0; i<npts; ++i){
+      const double r = y[i] - Eval(x[i], _par, grad);
+      for(int a=0; a<nfree; ++a){
+	const double ga = grad[free_index[a]];
+	jtr[a] += ga*r;
+	for(int b=0; b<=a; ++b)
+	  jtj[a*nfree+b] += ga*grad[free_index[b]];
+      }
+    }
+    for(int a=0; a<nfree; ++a)
+      for(int b=0; b<a; ++b)
+	jtj[b*nfree+a] = jtj[a*nfree+b];
+
+    //Marquardt damping scales with the curvature of each parameter, but
+    //is floored so a parameter the model barely depends on is still damped
+    double max_diag = 0;
+    for(int a=0; a<nfree; ++a)
+      max_diag = std::max(max_diag, jtj[a*nfree+a]);
+    if(!(max_diag > 0) || !IsFinite(max_diag))
+      return SINGULAR;
+    const double diag_floor = 1.e-9*max_diag;
+    
+    //raise the damping until a step lowers chi2
+    bool improved = false, solved = false;
+    double new_chi2 = _chi2;
+    while(!improved && lambda < 1.e12){
+      for(int a=0; a<nfree*nfree; ++a)
+	system[a] = jtj[a];
+      for(int a=0; a<nfree; ++a){
+	system[a*nfree+a] += lambda*std::max(jtj[a*nfree+a], diag_floor);
+	step[a] = jtr[a];
+      }
+      if(CholeskySolve(system, step, nfree)){
+	solved = true;
+	for(int i=0; i<NPARAMS; ++i)
+	  trial[i] = _par[i];
+	for(int a=0; a<nfree; ++a){
+	  const int i = free_index[a];
+	  trial[i] = std::max(_low[i], std::min(_high[i], _par[i] + step[a]));
+	}
+	new_chi2 = Chi2(x, y, npts, trial);
+	improved = IsFinite(new_chi2) && new_chi2 <= _chi2;
+      }
+      lambda *= (improved ? 0.1 : 10.);
+    }
+    //the normal equations could not be solved at any damping
+    if(!solved)
+      return SINGULAR;
+    //no step lowers chi2 at any damping: we are at the minimum
+    if(!improved)
+      return CONVERGED;
+
+    bool small_step = true;
+    for(int a=0; a<nfree; ++a){
+      const int i = free_index[a];
+      if(std::fabs(trial[i] - _par[i]) > 1.e-8*(std::fabs(_par[i]) + 1.e-8))
+	small_step = false;
+      _par[i] = trial[i];
+    }
+    const double decrease = _chi2 - new_chi2;
+    _chi2 = new_chi2;
+    if(small_step || decrease <= 1.e-10*_chi2)
+      return CONVERGED;
+    if(lambda < 1.e-12)
+      lambda = 1.e-12;
+  }
+  return MAX_ITERATIONS;
+}
+
+void PulseFitEngine::StoreParams(PulseFit& fit) const
+{
+  fit.amplitude = _par[0];
+  fit.c1 = _par[1];
+  fit.tau1 = _par[2];
+  fit.tau2 = _par[3];
+  fit.sigma = _par[4];
+  fit.decay = _par[5];
+  fit.baseline = _par[6];
+  fit.t0 = _par[7];
+  fit.rc = _par[8];
+  fit.chi2 = _chi2;
+  fit.ndf = _ndf;
+}
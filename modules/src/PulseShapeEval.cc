@@ -46,26 +46,56 @@ int PulseShapeEval::Initialize()
 
 int PulseShapeEval::Finalize() 
 { 
-    std::map<int, TH1F*>::iterator mapit_gatti = gatti_weights.begin();
-    std::map<int, TH1F*>::iterator mapit_ll_ele = ll_ele_weights.begin();
-    std::map<int, TH1F*>::iterator mapit_ll_nuc = ll_nuc_weights.begin();
-    std::map<int, TH1F*>::iterator mapit_ll_r = ll_r_weights.begin();
+    shape_tables.clear();
+    return 0; 
+}
 
-    for(; mapit_gatti != gatti_weights.end(); mapit_gatti++)
-	delete mapit_gatti->second;
-    for(; mapit_ll_ele != ll_ele_weights.end(); mapit_ll_ele++)
-	delete mapit_ll_ele->second;
-    for(; mapit_ll_nuc != ll_nuc_weights.end(); mapit_ll_nuc++)
-	delete mapit_ll_nuc->second;
-    for(; mapit_ll_r != ll_r_weights.end(); mapit_ll_r++)
-	delete mapit_ll_r->second;
-    
-    gatti_weights.clear();
-    ll_ele_weights.clear();
-    ll_nuc_weights.clear();
-    ll_r_weights.clear();
+void PulseShapeEval::ShapeTable::SetSampleRate(double rate)
+{
+    //A sample d samples after the peak is in bin i if
+    //edges[i] <= d/rate < edges[i+1]. Samples within rounding error of an
+    //edge go to the later bin, so every sample is counted exactly once.
+    const double tolerance = 1.e-6;
+    sample_rate = rate;
+    const int n_bins = GetNBins();
+    bin_begin.resize(n_bins);
+    bin_end.resize(n_bins);
+    for (int i = 0; i < n_bins; i++)
+    {
+	bin_begin[i] = (int)std::ceil(edges[i] * rate - tolerance);
+	bin_end[i] = (int)std::ceil(edges[i+1] * rate - tolerance);
+    }
+}
 
-    return 0; 
+bool PulseShapeEval::LoadTable(TFile* f, const std::string& suffix,
+			       ShapeTable& table)
+{
+    const std::string names[4] = { gatti_weights_hist + suffix,
+				   ll_ele_weights_hist + suffix,
+				   ll_nuc_weights_hist + suffix,
+				   ll_r_weights_hist + suffix };
+    TH1F* hists[4];
+    for (int w = 0; w < 4; w++)
+    {
+	hists[w] = (TH1F*) f->Get(names[w].c_str());
+	if (! hists[w])
+	    return false;
+    }
+
+    //ASSUMPTIONS
+    // All weight histograms have the same binning
+    const int n_bins = hists[0]->GetNbinsX();
+    table.edges.resize(n_bins + 1);
+    for (int i = 1; i <= n_bins + 1; i++)
+	table.edges[i-1] = hists[0]->GetBinLowEdge(i);
+    
+    //Flatten the weights so each bin's four weights are adjacent
+    table.weights.resize(4 * n_bins);
+    for (int i = 1; i <= n_bins; i++)
+	for (int w = 0; w < 4; w++)
+	    table.weights[4*(i-1) + w] = hists[w]->GetBinContent(i);
+    table.sample_rate = -1;
+    return true;
 }
 
 int PulseShapeEval::LoadWeights()
@@ -82,77 +112,18 @@ int PulseShapeEval::LoadWeights()
     //Loop over and find weights for all real channels
     for (int i = 0; i < 50; i++)
     {
-	std::ostringstream gatti_name, ll_ele_name, ll_nuc_name, ll_r_name;
-	gatti_name<<gatti_weights_hist<<"_"<<i;
-	ll_ele_name<<ll_ele_weights_hist<<"_"<<i;
-	ll_nuc_name<<ll_nuc_weights_hist<<"_"<<i;
-	ll_r_name<<ll_r_weights_hist<<"_"<<i;
-
-	if (! f->Get(gatti_name.str().c_str()) || 
-	    ! f->Get(ll_ele_name.str().c_str()) || 
-	    ! f->Get(ll_nuc_name.str().c_str()) || 
-	    ! f->Get(ll_r_name.str().c_str()))
-	{
+	std::ostringstream suffix;
+	suffix<<"_"<<i;
+	ShapeTable table;
+	if (! LoadTable(f, suffix.str(), table))
 	    break;
-	}
-
-	//ASSUMPTIONS
-	// All weight histograms have the same binning
-	
-	//Load histograms of weights
-	TH1F* gatti_weights_temp = (TH1F*) f->Get(gatti_name.str().c_str())->Clone();
-	TH1F* ll_ele_weights_temp = (TH1F*) f->Get(ll_ele_name.str().c_str())->Clone();
-	TH1F* ll_nuc_weights_temp = (TH1F*) f->Get(ll_nuc_name.str().c_str())->Clone();
-	TH1F* ll_r_weights_temp = (TH1F*) f->Get(ll_r_name.str().c_str())->Clone();
-	
-	//Disassociate histograms from ROOT file - stupid ROOT !
-	gatti_weights_temp->SetDirectory(0);
-	ll_ele_weights_temp->SetDirectory(0);
-	ll_nuc_weights_temp->SetDirectory(0);
-	ll_r_weights_temp->SetDirectory(0);
-
-	gatti_weights.insert(std::make_pair(i, gatti_weights_temp));
-	ll_ele_weights.insert(std::make_pair(i, ll_ele_weights_temp));
-	ll_nuc_weights.insert(std::make_pair(i, ll_nuc_weights_temp));
-	ll_r_weights.insert(std::make_pair(i, ll_r_weights_temp));
+	shape_tables[i] = table;
     }
 
     //Load weights for SUM channel
-    std::ostringstream gatti_name, ll_ele_name, ll_nuc_name, ll_r_name;
-    gatti_name<<gatti_weights_hist<<"_-2";
-    ll_ele_name<<ll_ele_weights_hist<<"_-2";
-    ll_nuc_name<<ll_nuc_weights_hist<<"_-2";
-    ll_r_name<<ll_r_weights_hist<<"_-2";
-
-    if (f->Get(gatti_name.str().c_str()) && 
-	f->Get(ll_ele_name.str().c_str()) && 
-	f->Get(ll_nuc_name.str().c_str()) && 
-	f->Get(ll_r_name.str().c_str()))
-    {
-	//Load histograms of weights
-	TH1F* gatti_weights_temp = (TH1F*) f->Get(gatti_name.str().c_str())->Clone();
-	TH1F* ll_ele_weights_temp = (TH1F*) f->Get(ll_ele_name.str().c_str())->Clone();
-	TH1F* ll_nuc_weights_temp = (TH1F*) f->Get(ll_nuc_name.str().c_str())->Clone();
-	TH1F* ll_r_weights_temp = (TH1F*) f->Get(ll_r_name.str().c_str())->Clone();
-	
-	//Disassociate histograms from ROOT file - stupid ROOT !
-	gatti_weights_temp->SetDirectory(0);
-	ll_ele_weights_temp->SetDirectory(0);
-	ll_nuc_weights_temp->SetDirectory(0);
-	ll_r_weights_temp->SetDirectory(0);
-
-	gatti_weights.insert(std::make_pair(-2, gatti_weights_temp));
-	ll_ele_weights.insert(std::make_pair(-2, ll_ele_weights_temp));
-	ll_nuc_weights.insert(std::make_pair(-2, ll_nuc_weights_temp));
-	ll_r_weights.insert(std::make_pair(-2, ll_r_weights_temp));
-
-
-	//Create histogram for binning data
-	event_shape = (TH1F*)(gatti_weights_temp->Clone());
-	event_shape->SetDirectory(0);
-	event_shape->Reset();
-
-    }    
+    ShapeTable table;
+    if (LoadTable(f, "_-2", table))
+	shape_tables[ChannelData::CH_SUM] = table;
 
     f->Close();
 
@@ -168,7 +139,7 @@ int PulseShapeEval::Process(EventPtr evt)
     data->gatti = 0;
     data->ll_r = 0;
     
-    if (gatti_weights.size() < data->channels.size())
+    if (shape_tables.size() < data->channels.size())
     {
 	Message(ERROR)<<"PulseShapeEval.cc: Size of weights file less than number of channels"
 		      <<std::endl;
@@ -182,7 +153,9 @@ int PulseShapeEval::Process(EventPtr evt)
 	if(_skip_channels.find(chdata.channel_id) != _skip_channels.end())
 	    continue;
 
-	if (gatti_weights.find(chdata.channel_id) == gatti_weights.end())
+	std::map<int, ShapeTable>::iterator table_it = 
+	    shape_tables.find(chdata.channel_id);
+	if (table_it == shape_tables.end())
 	{
 	    Message(ERROR)<<"PulseShapeEval.cc: Weights file for channel "
 			  <<chdata.channel_id<<" not loaded"
@@ -194,16 +167,19 @@ int PulseShapeEval::Process(EventPtr evt)
 	    continue;
 	
 	const double* wave = chdata.GetBaselineSubtractedWaveform();
-	int n_bins = gatti_weights[chdata.channel_id]->GetNbinsX();
+	ShapeTable& table = table_it->second;
+	if (table.sample_rate != chdata.sample_rate)
+	    table.SetSampleRate(chdata.sample_rate);
+	const int n_bins = table.GetNBins();
+	const int* bin_begin = &(table.bin_begin[0]);
+	const int* bin_end = &(table.bin_end[0]);
+	const double* weights = &(table.weights[0]);
+	event_shape.resize(n_bins);
+	double* shape = &(event_shape[0]);
 
 	for (size_t pulse_num = 0; pulse_num < chdata.pulses.size(); pulse_num++)
 	{
-	    chdata.pulses[pulse_num].gatti = 0;
-	    chdata.pulses[pulse_num].ll_ele = 0;
-	    chdata.pulses[pulse_num].ll_nuc = 0;
-	    chdata.pulses[pulse_num].ll_r = 0;
-	    
-	    Pulse pulse;
+	    const Pulse* pulse = 0;
 	    	    
 	    if (data->pulses_aligned == true)
 	    {
@@ -213,60 +189,49 @@ int PulseShapeEval::Process(EventPtr evt)
 		    return -1;
 		}
 		//Align everything by the corresponding pulse on the sum channel
-		pulse = sumch->pulses[pulse_num];
+		pulse = &(sumch->pulses[pulse_num]);
 	    }
 	    else
 	    {
-		pulse = chdata.pulses[pulse_num];
+		pulse = &(chdata.pulses[pulse_num]);
 	    }
 
-	    int pulse_index = pulse.start_index;
-	    event_shape->Reset();
+	    //Sample of this channel at the peak time; bin offsets are from here
+	    const int peak_samp = (int)std::floor(pulse->peak_time * 
+						  chdata.sample_rate + 
+						  chdata.trigger_index + 0.5);
+	    //Samples before the start of the pulse are never included
+	    const int first_samp = std::max(pulse->start_index, 0);
 	    
-	    for(int i = 1; i <= n_bins; i++)
+	    //Get event pulse shape
+	    double pulse_integral = 0;
+	    for (int i = 0; i < n_bins; i++)
 	    {
-		//Get event pulse shape
-		double t0 = event_shape->GetBinLowEdge(i);
-		double t1 = event_shape->GetBinLowEdge(i+1);
+		const int begin = std::max(peak_samp + bin_begin[i], first_samp);
+		const int end = std::min(peak_samp + bin_end[i], chdata.nsamps);
 		double z = 0;
-		
-		if (chdata.TimeToSample(pulse.peak_time + t1) < 0 ||
-		    chdata.TimeToSample(pulse.peak_time + t0) >= chdata.nsamps)
-		{
-		    event_shape->SetBinContent(i, 0);
-		}
-		else
-		{
-		    while (chdata.SampleToTime(pulse_index) < pulse.peak_time + t0)
-			pulse_index++;
-		    
-		    /*
-		      if (pulse_num == 0)
-		      Message(INFO)<<"Bin: "<<i<<" "
-		      <<chdata.SampleToTime(pulse_index)<<" "
-		      <<pulse.peak_time + t0<<" "
-		      <<pulse.peak_time + t1<<" "
-		      <<std::endl;
-		    */    
-		    while (chdata.SampleToTime(pulse_index) > pulse.peak_time + t0 &&
-			   chdata.SampleToTime(pulse_index) < pulse.peak_time + t1 &&
-			   pulse_index < chdata.nsamps)
-		    {
-			z = z - wave[pulse_index];
-			pulse_index++;
-		    }
-		    event_shape->SetBinContent(i, z);
-		}
-		
+		for (int samp = begin; samp < end; samp++)
+		    z -= wave[samp];
+		shape[i] = z;
+		pulse_integral += z;
+	    }
+	    
 	    //Calculate pulse shape parameters
-		chdata.pulses[pulse_num].gatti += gatti_weights[chdata.channel_id]->GetBinContent(i) * event_shape->GetBinContent(i);
-		chdata.pulses[pulse_num].ll_ele += ll_ele_weights[chdata.channel_id]->GetBinContent(i) * event_shape->GetBinContent(i);
-		chdata.pulses[pulse_num].ll_nuc += ll_nuc_weights[chdata.channel_id]->GetBinContent(i) * event_shape->GetBinContent(i);
-		chdata.pulses[pulse_num].ll_r += ll_r_weights[chdata.channel_id]->GetBinContent(i) * event_shape->GetBinContent(i);
-	    }// end loop over time bins
+	    double sums[4] = { 0, 0, 0, 0 };
+	    for (int i = 0; i < n_bins; i++)
+	    {
+		const double* w = weights + 4*i;
+		sums[0] += w[0] * shape[i];
+		sums[1] += w[1] * shape[i];
+		sums[2] += w[2] * shape[i];
+		sums[3] += w[3] * shape[i];
+	    }
+	    chdata.pulses[pulse_num].gatti = sums[0];
+	    chdata.pulses[pulse_num].ll_ele = sums[1];
+	    chdata.pulses[pulse_num].ll_nuc = sums[2];
+	    chdata.pulses[pulse_num].ll_r = sums[3];
 	
 	    //Scale by integral of pulse
-	    double pulse_integral = event_shape->Integral();
 	    chdata.pulses[pulse_num].pulse_shape_int = pulse_integral;
 	    if (pulse_integral != 0)
 	    {
@@ -0,0 +1,109 @@
+#include "RealFFT.hh"
+#include <cmath>
+#include <stdexcept>
+
+RealFFT::RealFFT(int n) : _n(n), _half(n/2)
+{
+  if(n < 4 || (n & (n-1)))
+    throw std::invalid_argument("RealFFT length must be a power of 2 >= 4");
+
+  int bits = 0;
+  while( (1<<bits) < _half ) ++bits;
+  _bitrev.resize(_half);
+  for(int k=0; k<_half; ++k){
+    int r = 0;
+    for(int b=0; b<bits; ++b)
+      if(k & (1<<b)) r |= 1<<(bits-1-b);
+    _bitrev[k] = r;
+  }
+
+  _twiddle.resize(_half);
+  for(int k=0; k<_half/2; ++k){
+    const double phase = -2.*M_PI*k/_half;
+    _twiddle[2*k] = std::cos(phase);
+    _twiddle[2*k+1] = std::sin(phase);
+  }
+
+  _split.resize(2*(_half+1));
+  for(int k=0; k<=_half; ++k){
+    const double phase = -2.*M_PI*k/_n;
+    _split[2*k] = std::cos(phase);
+    _split[2*k+1] = std::sin(phase);
+  }
+  _work.resize(2*_half);
+}
+
+int RealFFT::GoodSize(int n)
+{
+  int size = 4;
+  while(size < n) size <<= 1;
+  return size;
+}
+
+void RealFFT::Transform(bool inverse)
+{
+  //iterative radix 2 butterflies on bit reversed input
+  double* a = &_work[0];
+  const double sign = inverse ? -1 : 1;
+  for(int len=2; len<=_half; len<<=1){
+    const int step = _half/len;
+    const int span = len/2;
+    for(int i=0; i<_half; i+=len){
+      for(int j=0; j<span; ++j){
+	const double wr = _twiddle[2*j*step];
+	const double wi = sign*_twiddle[2*j*step+1];
+	double* u = a + 2*(i+j);
+	double* v = a + 2*(i+j+span);
+	const double tr = v[0]*wr - v[1]*wi;
+	const double ti = v[0]*wi + v[1]*wr;
+	v[0] = u[0] - tr;
+	v[1] = u[1] - ti;
+	u[0] += tr;
+	u[1] += ti;
+      }
+    }
+  }
+}
+
+void RealFFT::Forward(const double* in, double* spectrum)
+{
+  //pack even samples as real and odd samples as imaginary parts
+  for(int k=0; k<_half; ++k){
+    _work[2*_bitrev[k]] = in[2*k];
+    _work[2*_bitrev[k]+1] = in[2*k+1];
+  }
+  Transform(false);
+  //separate the even and odd transforms and combine them
+  for(int k=0; k<=_half; ++k){
+    const int a = (k == _half ? 0 : k);
+    const int b = (k == 0 ? 0 : _half-k);
+    const double zr = _work[2*a], zi = _work[2*a+1];
+    const double cr = _work[2*b], ci = -_work[2*b+1];
+    const double er = 0.5*(zr + cr), ei = 0.5*(zi + ci);
+    const double or_ = 0.5*(zi - ci), oi = -0.5*(zr - cr);
+    const double wr = _split[2*k], wi = _split[2*k+1];
+    spectrum[2*k] = er + wr*or_ - wi*oi;
+    spectrum[2*k+1] = ei + wr*oi + wi*or_;
+  }
+}
+
+void RealFFT::Backward(const double* spectrum, double* out)
+{
+  //rebuild the packed even/odd transform from the half spectrum
+  for(int k=0; k<_half; ++k){
+    const double xr = spectrum[2*k], xi = spectrum[2*k+1];
+    const double cr = spectrum[2*(_half-k)], ci = -spectrum[2*(_half-k)+1];
+    const double er = xr + cr, ei = xi + ci;
+    const double dr = xr - cr, di = xi - ci;
+    const double wr = _split[2*k], wi = _split[2*k+1];
+    //multiply the odd part by i*conj(w)
+    const double tr = wr*dr + wi*di, ti = wr*di - wi*dr;
+    _work[2*_bitrev[k]] = er - ti;
+    _work[2*_bitrev[k]+1] = ei + tr;
+  }
+  Transform(true);
+  for(int k=0; k<_half; ++k){
+    out[2*k] = _work[2*k];
+    out[2*k+1] = _work[2*k+1];
+  }
+}
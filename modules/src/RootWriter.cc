@@ -11,14 +11,74 @@
 
 #include "TFile.h"
 #include "TTree.h"
+#include "RVersion.h"
+#if ROOT_VERSION_CODE < ROOT_VERSION(6,0,0)
+#include "TThread.h"
+#endif
+#ifndef SINGLETHREAD
+#include "boost/thread.hpp"
+#include "boost/bind.hpp"
+#endif
 #include <string>
 #include <sstream>
 
+namespace{
+  /// A member of a class which a profile does not store
+  struct DroppedMember{
+    const char* classname;
+    const char* member;
+  };
+  
+  /// Large or rarely used members dropped by the pulses profile
+  const DroppedMember pulses_dropped[] = {
+    {"EventData", "generic"},
+    {"ChannelData", "generic"},
+    {"ChannelData", "single_pe"},
+    {"ChannelData", "unspikes"},
+    {"Baseline", "interpolations"},
+    {"Pulse", "f_param"},
+    {0, 0}
+  };
+  
+  /// Members dropped by the summary profile in addition to the above
+  const DroppedMember summary_dropped[] = {
+    {"EventData", "sum_of_int"},
+    {"EventData", "roi_sum_of_int"},
+    {"ChannelData", "pulses"},
+    {0, 0}
+  };
+  
+  /// Set whether a member of a class is streamed; false if it is unknown
+  bool SetPersistent(const char* classname, const char* member, bool persist)
+  {
+    TClass* cl = gROOT->GetClass(classname);
+    if(!cl){
+      Message(ERROR)<<"ROOT doesn't know about any class "<<classname<<"\n";
+      return false;
+    }
+    TDataMember* mem = cl->GetDataMember(member);
+    if(!mem){
+      Message(ERROR)<<"Class "<<classname<<" has no member named "
+		    <<member<<"\n";
+      return false;
+    }
+    //kWriteDelete shares its bit with TDataMember's persistence flag
+    mem->SetBit(TObject::kWriteDelete, persist);
+    return true;
+  }
+  
+  void SetPersistent(const DroppedMember* list, bool persist)
+  {
+    for( ; list->classname; ++list)
+      SetPersistent(list->classname, list->member, persist);
+  }
+}
+
 
 RootWriter::RootWriter() : 
   BaseModule("RootWriter","Save processed data into a ROOT tree"), 
   _filename(), _mode(), _outfile(0), _tree(0), 
-  enabler(this), disabler(this)
+  enabler(this), disabler(this), _stop_writer(false)
 {
   //default initialize filename
   /*
@@ -42,6 +102,24 @@ RootWriter::RootWriter() :
 		    "Allows the user to enable writing a certain branch");
   RegisterParameter("disable_branch", disabler,
 		    "Allows the user to disable writing a certain branch");
+  RegisterParameter("compression_algorithm", _compression_algorithm = 0,
+		    "ROOT compression algorithm: 0 for the global default, "
+		    "1 zlib, 2 lzma, 4 lz4 (ROOT 6)");
+  RegisterParameter("compression_level", _compression_level = -1,
+		    "ROOT compression level from 0 (none) to 9; -1 for the "
+		    "TFile default");
+  RegisterParameter("basket_size", _basket_size = 32000,
+		    "Buffer size in bytes of each branch of the tree");
+  RegisterParameter("auto_flush", _auto_flush = -30000000,
+		    "Flush baskets every N entries if >0, every -N bytes if <0");
+  RegisterParameter("queue_size", _queue_size = 16,
+		    "Events queued for the writer thread; 0 to fill directly");
+  RegisterParameter("imt_threads", _imt_threads = 0,
+		    "Threads compressing baskets with ROOT implicit MT (ROOT>=6.8)");
+  RegisterParameter("profile", _profile = "full",
+		    "Members to store: full, pulses, or summary");
+  RegisterParameter("split_level", _split_level = 99,
+		    "Split level of the event branch; 99 gives one leaf per member");
   ConfigHandler* config = ConfigHandler::GetInstance();
   config->
     AddCommandSwitch(' ',"rootfile","Set output ROOT filename to <file>",
@@ -63,15 +141,24 @@ RootWriter::~RootWriter()
   }
 }
 
-int RootWriter::Initialize()
+std::string RootWriter::GetOutputPath() const
 {
+  std::string path = _filename;
   //append the .root suffix if necessary
-  if( _filename.find(".root") == std::string::npos)
-    _filename.append(".root");
+  if( path.find(".root") == std::string::npos)
+    path.append(".root");
   //add the directory prefix if not specified
-  if( _filename.find("/") == std::string::npos)
-    _filename.insert(0, _directory + "/");
+  if( path.find("/") == std::string::npos)
+    path.insert(0, _directory + "/");
+  return path;
+}
+
+int RootWriter::Initialize()
+{
+  _filename = GetOutputPath();
   
+  if(ApplyProfile())
+    return 1;
   Message(INFO)<<"Saving output to file "<<_filename<<std::endl;
   _outfile = new TFile(_filename.c_str(), _mode.c_str());
   if(!_outfile || !_outfile->IsOpen() || _outfile->IsZombie()){
@@ -79,15 +166,48 @@ int RootWriter::Initialize()
     enabled = false;
     return 1;
   }
+  if(_compression_algorithm > 0)
+    _outfile->SetCompressionAlgorithm(_compression_algorithm);
+  if(_compression_level >= 0)
+    _outfile->SetCompressionLevel(_compression_level);
   _tree = new TTree("Events","Processed data for each event");
   EventData* ptr = new EventData;
-  _tree->Branch(EventData::GetBranchName(),&ptr);
+  _tree->Branch(EventData::GetBranchName(),&ptr, _basket_size, _split_level);
   delete ptr;
+  _tree->SetAutoFlush(_auto_flush);
+  if(_imt_threads > 0){
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,8,0) && defined(R__USE_IMT)
+    ROOT::EnableImplicitMT(_imt_threads);
+    _tree->SetImplicitMT(true);
+#else
+    Message(WARNING)<<"RootWriter: ROOT has no implicit multithreading; "
+		    <<"ignoring imt_threads.\n";
+#endif
+  }
   runinfo* rinfo = EventHandler::GetInstance()->GetRunInfo();
   if(rinfo){
+    rinfo->SetMetadata("rootwriter_profile", _profile);
     _tree->GetUserInfo()->AddFirst(rinfo);
   }
   SaveConfig();
+  
+  _stop_writer = false;
+#ifndef SINGLETHREAD
+  if(_queue_size > 0){
+    //ROOT must know other threads exist before they fill trees
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,0,0)
+    ROOT::EnableThreadSafety();
+#else
+    TThread::Initialize();
+#endif
+    _writer.reset(new boost::thread(boost::bind(&RootWriter::WriteQueue,
+						 this)));
+  }
+#else
+  if(_queue_size > 0)
+    Message(WARNING)<<"RootWriter: compiled without threads; "
+		    <<"filling the tree directly.\n";
+#endif
   return 0;
 }
 
@@ -112,13 +232,68 @@ void RootWriter::SaveConfig()
     
 }
 
-int RootWriter::Process(EventPtr event)
+void RootWriter::FillTree(EventPtr event)
 {
   EventDataPtr data = event->GetEventData();
   EventData* ptr = data.get();
   _tree->SetBranchAddress(EventData::GetBranchName(), &ptr );
   _tree->Fill();
-  //_tree->Write();
+}
+
+int RootWriter::Process(EventPtr event)
+{
+#ifndef SINGLETHREAD
+  if(_writer){
+    boost::mutex::scoped_lock lock(_queue_mutex);
+    while(_queue.size() >= (size_t)_queue_size)
+      _queue_drained.wait(lock);
+    _queue.push_back(event);
+    _queue_filled.notify_one();
+    return 0;
+  }
+#endif
+  FillTree(event);
+  return 0;
+}
+
+void RootWriter::WriteQueue()
+{
+#ifndef SINGLETHREAD
+  while(true){
+    EventPtr event;
+    {
+      boost::mutex::scoped_lock lock(_queue_mutex);
+      while(_queue.empty() && !_stop_writer)
+	_queue_filled.wait(lock);
+      if(_queue.empty())
+	return;
+      event = _queue.front();
+      _queue.pop_front();
+      _queue_drained.notify_one();
+    }
+    FillTree(event);
+  }
+#endif
+}
+
+void RootWriter::StopWriter()
+{
+#ifndef SINGLETHREAD
+  if(!_writer)
+    return;
+  {
+    boost::mutex::scoped_lock lock(_queue_mutex);
+    _stop_writer = true;
+    _queue_filled.notify_one();
+  }
+  _writer->join();
+  _writer.reset();
+#endif
+}
+
+int RootWriter::FinishProcessing()
+{
+  StopWriter();
   return 0;
 }
 
@@ -144,6 +319,8 @@ TTree* RootWriter::BuildMetadataTree(runinfo* info)
 
 int RootWriter::Finalize()
 {
+  //normally the EventHandler has already stopped the writer
+  StopWriter();
   if(_tree){
     _tree->SetEntries();
     if(_tree->GetEntries()>0 && _outfile && _outfile->IsOpen()){
@@ -172,22 +349,40 @@ int RootWriter::Finalize()
   return 0;
 }
     
-void RootWriter::EnableBranch(const char* classname, const char* branchname,
-			      bool enable)
+int RootWriter::ApplyProfile()
 {
-  TClass* cl = gROOT->GetClass(classname);
-  if(!cl){
-    Message(ERROR)<<"ROOT doesn't know about any class "<<classname<<"\n";
-    return;
+  if(_profile == "full"){
+    SetPersistent(pulses_dropped, true);
+    SetPersistent(summary_dropped, true);
   }
-  TDataMember* mem = cl->GetDataMember(branchname);
-  if(!mem){
-    Message(ERROR)<<"Class "<<classname<<" has no member named "
-		  <<branchname<<"\n";
-    return;
+  else if(_profile == "pulses"){
+    SetPersistent(pulses_dropped, false);
+    SetPersistent(summary_dropped, true);
   }
-  mem->SetBit(TObject::kWriteDelete, enable);
-  
+  else if(_profile == "summary"){
+    SetPersistent(pulses_dropped, false);
+    SetPersistent(summary_dropped, false);
+  }
+  else{
+    Message(ERROR)<<"Unknown RootWriter profile "<<_profile
+		  <<"; use full, pulses, or summary.\n";
+    return 1;
+  }
+  //individual settings from the config file take precedence
+  for(std::map<std::string, bool>::iterator it = _branch_overrides.begin();
+      it != _branch_overrides.end(); ++it){
+    const size_t pos = it->first.find('.');
+    SetPersistent(it->first.substr(0,pos).c_str(),
+		  it->first.substr(pos+1).c_str(), it->second);
+  }
+  return 0;
+}
+    
+void RootWriter::EnableBranch(const char* classname, const char* branchname,
+			      bool enable)
+{
+  if(SetPersistent(classname, branchname, enable))
+    _branch_overrides[std::string(classname) + "." + branchname] = enable;
 }
 
 void RootWriter::DisableBranch(const char* classname, const char* branchname) 
@@ -0,0 +1,317 @@
+#include "SampleUnpacker.hh"
+#include <limits.h>
+#include <string.h>
+
+//runtime dispatch needs gcc's target attribute and cpu detection builtins
+#if defined(__GNUC__) && !defined(__clang__) &&				\
+  (defined(__x86_64__) || defined(__i386__)) &&				\
+  (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define SAMPLEUNPACKER_X86
+#include <immintrin.h>
+#endif
+
+namespace{
+  enum INSTRUCTION_SET { SCALAR=0, SSE41, AVX2 };
+
+  INSTRUCTION_SET DetectInstructionSet()
+  {
+#ifdef SAMPLEUNPACKER_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+      return AVX2;
+    if(__builtin_cpu_supports("sse4.1"))
+      return SSE41;
+#endif
+    return SCALAR;
+  }
+
+  INSTRUCTION_SET GetBestInstructionSet()
+  {
+    static const INSTRUCTION_SET best = DetectInstructionSet();
+    return best;
+  }
+
+  /// Update the running extrema with value v at index i
+  inline void Accumulate(SampleExtrema& ext, double v, int i)
+  {
+    if(ext.min_index < 0 || v < ext.minimum){
+      ext.minimum = v;
+      ext.min_index = i;
+    }
+    if(ext.max_index < 0 || v > ext.maximum){
+      ext.maximum = v;
+      ext.max_index = i;
+    }
+  }
+
+  /// Plain loop over samples [start, n), continuing the extrema in ext
+  template<class Sample>
+  void UnpackScalar(const Sample* src, int start, int n, double* dest,
+		    bool invert, double range, SampleExtrema& ext)
+  {
+    for(int i=start; i<n; ++i){
+      double v = src[i];
+      if(invert) v = range - v;
+      if(dest) dest[i] = v;
+      Accumulate(ext, v, i);
+    }
+  }
+
+  /// Plain loop adding scaled samples [start, n) to dest
+  template<class Sample>
+  void AddScaledScalar(const Sample* src, int start, int n, double* dest,
+		       double scale)
+  {
+    for(int i=start; i<n; ++i)
+      dest[i] += src[i]*scale;
+  }
+
+#ifdef SAMPLEUNPACKER_X86
+  /// Merge per-lane extrema, preferring the earliest index on ties
+  void ReduceLanes(const int32_t* vmin, const int32_t* imin,
+		   const int32_t* vmax, const int32_t* imax, int lanes,
+		   SampleExtrema& ext)
+  {
+    for(int lane=0; lane<lanes; ++lane){
+      if(ext.min_index < 0 || vmin[lane] < ext.minimum ||
+	 (vmin[lane] == ext.minimum && imin[lane] < ext.min_index)){
+	ext.minimum = vmin[lane];
+	ext.min_index = imin[lane];
+      }
+      if(ext.max_index < 0 || vmax[lane] > ext.maximum ||
+	 (vmax[lane] == ext.maximum && imax[lane] < ext.max_index)){
+	ext.maximum = vmax[lane];
+	ext.max_index = imax[lane];
+      }
+    }
+  }
+
+  /// SSE4.1 kernel; handles the first multiple of 4 samples, returns count
+  template<class Sample> __attribute__((target("sse4.1")))
+  int UnpackSSE41(const Sample* src, int n, double* dest,
+		  bool invert, int32_t range, SampleExtrema& ext)
+  {
+    const int nvec = n - n%4;
+    if(nvec == 0)
+      return 0;
+    const __m128i base = _mm_set1_epi32(range);
+    const __m128i step = _mm_set1_epi32(4);
+    __m128i idx = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i vmin = _mm_set1_epi32(INT_MAX), imin = _mm_setzero_si128();
+    __m128i vmax = _mm_set1_epi32(INT_MIN), imax = _mm_setzero_si128();
+    for(int i=0; i<nvec; i+=4){
+      __m128i v;
+      if(sizeof(Sample) == 1){
+	int32_t word;
+	memcpy(&word, src+i, 4);
+	v = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(word));
+      }
+      else
+	v = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)(src+i)));
+      if(invert) v = _mm_sub_epi32(base, v);
+      if(dest){
+	_mm_storeu_pd(dest+i, _mm_cvtepi32_pd(v));
+	_mm_storeu_pd(dest+i+2, _mm_cvtepi32_pd(_mm_unpackhi_epi64(v, v)));
+      }
+      //strict comparisons keep the first occurrence in each lane
+      imin = _mm_blendv_epi8(imin, idx, _mm_cmplt_epi32(v, vmin));
+      vmin = _mm_min_epi32(vmin, v);
+      imax = _mm_blendv_epi8(imax, idx, _mm_cmpgt_epi32(v, vmax));
+      vmax = _mm_max_epi32(vmax, v);
+      idx = _mm_add_epi32(idx, step);
+    }
+    int32_t lanes[4][4];
+    _mm_storeu_si128((__m128i*)lanes[0], vmin);
+    _mm_storeu_si128((__m128i*)lanes[1], imin);
+    _mm_storeu_si128((__m128i*)lanes[2], vmax);
+    _mm_storeu_si128((__m128i*)lanes[3], imax);
+    ReduceLanes(lanes[0], lanes[1], lanes[2], lanes[3], 4, ext);
+    return nvec;
+  }
+
+  /// AVX2 kernel; handles the first multiple of 8 samples, returns count
+  template<class Sample> __attribute__((target("avx2")))
+  int UnpackAVX2(const Sample* src, int n, double* dest,
+		 bool invert, int32_t range, SampleExtrema& ext)
+  {
+    const int nvec = n - n%8;
+    if(nvec == 0)
+      return 0;
+    const __m256i base = _mm256_set1_epi32(range);
+    const __m256i step = _mm256_set1_epi32(8);
+    __m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i vmin = _mm256_set1_epi32(INT_MAX), imin = _mm256_setzero_si256();
+    __m256i vmax = _mm256_set1_epi32(INT_MIN), imax = _mm256_setzero_si256();
+    for(int i=0; i<nvec; i+=8){
+      __m256i v;
+      if(sizeof(Sample) == 1)
+	v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src+i)));
+      else
+	v = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src+i)));
+      if(invert) v = _mm256_sub_epi32(base, v);
+      if(dest){
+	_mm256_storeu_pd(dest+i,
+			 _mm256_cvtepi32_pd(_mm256_castsi256_si128(v)));
+	_mm256_storeu_pd(dest+i+4,
+			 _mm256_cvtepi32_pd(_mm256_extracti128_si256(v, 1)));
+      }
+      //strict comparisons keep the first occurrence in each lane
+      imin = _mm256_blendv_epi8(imin, idx, _mm256_cmpgt_epi32(vmin, v));
+      vmin = _mm256_min_epi32(vmin, v);
+      imax = _mm256_blendv_epi8(imax, idx, _mm256_cmpgt_epi32(v, vmax));
+      vmax = _mm256_max_epi32(vmax, v);
+      idx = _mm256_add_epi32(idx, step);
+    }
+    int32_t lanes[4][8];
+    _mm256_storeu_si256((__m256i*)lanes[0], vmin);
+    _mm256_storeu_si256((__m256i*)lanes[1], imin);
+    _mm256_storeu_si256((__m256i*)lanes[2], vmax);
+    _mm256_storeu_si256((__m256i*)lanes[3], imax);
+    ReduceLanes(lanes[0], lanes[1], lanes[2], lanes[3], 8, ext);
+    return nvec;
+  }
+
+  /// Convert 4 samples starting at src to double
+  template<class Sample> __attribute__((target("avx2")))
+  inline __m256d Load4AVX2(const Sample* src)
+  {
+    if(sizeof(Sample) == 1){
+      int32_t word;
+      memcpy(&word, src, 4);
+      return _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(word)));
+    }
+    return _mm256_cvtepi32_pd(
+	     _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)src)));
+  }
+
+  /// AVX2 add-scaled kernel; handles the first multiple of 4, returns count
+  template<class Sample> __attribute__((target("avx2")))
+  int AddScaledAVX2(const Sample* src, int n, double* dest, double scale)
+  {
+    const int nvec = n - n%4;
+    const __m256d vscale = _mm256_set1_pd(scale);
+    for(int i=0; i<nvec; i+=4){
+      const __m256d v = _mm256_mul_pd(Load4AVX2(src+i), vscale);
+      _mm256_storeu_pd(dest+i, _mm256_add_pd(_mm256_loadu_pd(dest+i), v));
+    }
+    return nvec;
+  }
+
+  /// AVX2 add-scaled kernel for samples already converted to double
+  __attribute__((target("avx2")))
+  int AddScaledAVX2(const double* src, int n, double* dest, double scale)
+  {
+    const int nvec = n - n%4;
+    const __m256d vscale = _mm256_set1_pd(scale);
+    for(int i=0; i<nvec; i+=4){
+      const __m256d v = _mm256_mul_pd(_mm256_loadu_pd(src+i), vscale);
+      _mm256_storeu_pd(dest+i, _mm256_add_pd(_mm256_loadu_pd(dest+i), v));
+    }
+    return nvec;
+  }
+#endif
+
+  /// Dispatch weighted accumulation to the best available kernel
+  template<class Sample>
+  void AddScaledDispatch(const Sample* src, int n, double* dest, double scale)
+  {
+    int done = 0;
+#ifdef SAMPLEUNPACKER_X86
+    if(GetBestInstructionSet() == AVX2)
+      done = AddScaledAVX2(src, n, dest, scale);
+#endif
+    AddScaledScalar(src, done, n, dest, scale);
+  }
+
+  /// Dispatch 8 and 16 bit samples to the best available kernel
+  template<class Sample>
+  SampleExtrema UnpackNarrow(const Sample* src, int n, double* dest,
+			     bool invert, double range)
+  {
+    SampleExtrema ext;
+    int done = 0;
+#ifdef SAMPLEUNPACKER_X86
+    //samples and their inversions always fit in 32 bit lanes
+    switch(GetBestInstructionSet()){
+    case AVX2:
+      done = UnpackAVX2(src, n, dest, invert, (int32_t)range, ext);
+      break;
+    case SSE41:
+      done = UnpackSSE41(src, n, dest, invert, (int32_t)range, ext);
+      break;
+    default:
+      break;
+    }
+#endif
+    UnpackScalar(src, done, n, dest, invert, range, ext);
+    return ext;
+  }
+}
+
+SampleExtrema SampleUnpacker::Unpack(const uint8_t* src, int n, double* dest,
+				     bool invert, double range)
+{
+  return UnpackNarrow(src, n, dest, invert, range);
+}
+
+SampleExtrema SampleUnpacker::Unpack(const uint16_t* src, int n, double* dest,
+				     bool invert, double range)
+{
+  return UnpackNarrow(src, n, dest, invert, range);
+}
+
+SampleExtrema SampleUnpacker::Unpack(const uint32_t* src, int n, double* dest,
+				     bool invert, double range)
+{
+  SampleExtrema ext;
+  UnpackScalar(src, 0, n, dest, invert, range, ext);
+  return ext;
+}
+
+SampleExtrema SampleUnpacker::UnpackPacked10(const uint32_t* begin,
+					     const uint32_t* end, double* dest,
+					     bool invert, double range)
+{
+  SampleExtrema ext;
+  int samp = 0;
+  for(const uint32_t* ptr = begin; ptr < end; ++ptr){
+    uint32_t word = *ptr;
+    //the number of samples in this word is in the top 2 bits
+    const int ns = (word>>30)&3;
+    for(int i=0; i<ns; ++i, ++samp){
+      double v = word & 0x3ff;
+      word >>= 10;
+      if(invert) v = range - v;
+      if(dest) dest[samp] = v;
+      Accumulate(ext, v, samp);
+    }
+  }
+  return ext;
+}
+
+void SampleUnpacker::AddScaled(const uint8_t* src, int n, double* dest,
+			       double scale)
+{
+  AddScaledDispatch(src, n, dest, scale);
+}
+
+void SampleUnpacker::AddScaled(const uint16_t* src, int n, double* dest,
+			       double scale)
+{
+  AddScaledDispatch(src, n, dest, scale);
+}
+
+void SampleUnpacker::AddScaled(const double* src, int n, double* dest,
+			       double scale)
+{
+  AddScaledDispatch(src, n, dest, scale);
+}
+
+const char* SampleUnpacker::GetInstructionSet()
+{
+  switch(GetBestInstructionSet()){
+  case AVX2:  return "avx2";
+  case SSE41: return "sse4.1";
+  default:    return "scalar";
+  }
+}
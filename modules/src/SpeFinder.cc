@@ -4,8 +4,52 @@
 #include "RootWriter.hh"
 //#include "S1S2Evaluation.hh"
 #include "BaselineFinder.hh"
+#include "Spe.hh"
+#include "runinfo.hh"
+#include "VDatabaseInterface.hh"
+#include "TFile.h"
+#include "TH1F.h"
 #include <vector>
 #include <numeric>
+#include <algorithm>
+#include <sstream>
+#include <cstring>
+#include <cmath>
+
+namespace{
+  /// Bin of x in a spectrum from 0 to xmax, with underflow and overflow
+  int FindBin(double x, double xmax, int nbins)
+  {
+    if(x < 0)
+      return 0;
+    if(x >= xmax)
+      return nbins+1;
+    return 1 + (int)(x/xmax*nbins);
+  }
+
+  /// Write an online spectrum to the current directory as a TH1F
+  void WriteSpectrum(const std::string& base, int channel_id,
+		     const std::vector<double>& counts, double xmax,
+		     long entries)
+  {
+    std::ostringstream name;
+    name<<base<<"_ch"<<channel_id;
+    const int nbins = counts.size() - 2;
+    TH1F hist(name.str().c_str(), name.str().c_str(), nbins, 0, xmax);
+    for(int bin=0; bin<nbins+2; ++bin)
+      hist.SetBinContent(bin, counts[bin]);
+    hist.SetEntries(entries);
+    hist.Write();
+  }
+
+  void SetChannelValue(runinfo* info, int channel_id, const std::string& key,
+		       double val)
+  {
+    std::ostringstream s;
+    s<<val;
+    info->SetChannelMetadata(channel_id, key, s.str());
+  }
+}
 
 SpeFinder::SpeFinder():
   ChannelModule(GetDefaultName(), "Search for single photoelectrons in the tails of pulses identified by PulseFinder")
@@ -32,6 +76,16 @@ SpeFinder::SpeFinder():
                     "Maximum number of photons to find per event before exit");
   RegisterParameter("debug",debug=false,
                     "If true, more steps will be printed to standard output");
+  RegisterParameter("hist_bins", hist_bins=200,
+                    "Number of bins in the online integral and amplitude spectra");
+  RegisterParameter("integral_max", integral_max=1000,
+                    "Upper edge of the online integral spectrum [counts*samples]");
+  RegisterParameter("amplitude_max", amplitude_max=100,
+                    "Upper edge of the online amplitude spectrum [counts]");
+  RegisterParameter("min_entries", min_entries=100,
+                    "Minimum number of photons found to report a channel's gain");
+  RegisterParameter("write_database", write_database=false,
+                    "Store each channel's mean integral in the database at Finalize");
 }
 
 SpeFinder::~SpeFinder()
@@ -41,12 +95,92 @@ SpeFinder::~SpeFinder()
 
 int SpeFinder::Initialize()
 {
+  if(hist_bins <= 0 || integral_max <= 0 || amplitude_max <= 0){
+    Message(ERROR)<<"SpeFinder: hist_bins, integral_max and amplitude_max "
+                  <<"must be positive"<<std::endl;
+    return 1;
+  }
+  _stats.clear();
   return 0;
 }
 
 int SpeFinder::Finalize()
 {
-  return 0;
+  int status = 0;
+  if(!_stats.empty())
+    status = StoreStats();
+  _stats.clear();
+  return status;
+}
+
+SpeFinder::SpeStats& SpeFinder::GetStats(int channel_id)
+{
+  std::map<int, SpeStats>::iterator it = _stats.find(channel_id);
+  if(it != _stats.end())
+    return it->second;
+  SpeStats& stats = _stats[channel_id];
+  stats.integral_hist.assign(hist_bins+2, 0);
+  stats.amplitude_hist.assign(hist_bins+2, 0);
+  return stats;
+}
+
+void SpeFinder::Fill(SpeStats& stats, const Spe& spe) const
+{
+  ++stats.nfound;
+  //Welford's update stays accurate however many photons are found
+  const double delta = spe.integral - stats.mean;
+  stats.mean += delta / stats.nfound;
+  stats.sumsq += delta * (spe.integral - stats.mean);
+  stats.integral_hist[FindBin(spe.integral, integral_max, hist_bins)] += 1;
+  stats.amplitude_hist[FindBin(spe.amplitude, amplitude_max, hist_bins)] += 1;
+}
+
+int SpeFinder::StoreStats()
+{
+  runinfo* info = EventHandler::GetInstance()->GetRunInfo();
+  VDatabaseInterface* db = 0;
+  if(write_database){
+    db = EventHandler::GetInstance()->GetDatabaseInterface();
+    if(!db)
+      Message(ERROR)<<"SpeFinder: write_database is set, but no database "
+                    <<"is configured!"<<std::endl;
+  }
+  const bool write_hists = gFile && gFile->IsOpen();
+  int status = 0;
+  std::map<int, SpeStats>::iterator it = _stats.begin();
+  for( ; it != _stats.end(); ++it){
+    const int id = it->first;
+    const SpeStats& stats = it->second;
+    const double sigma =
+      (stats.nfound > 1 ? std::sqrt(stats.sumsq/(stats.nfound-1)) : 0);
+    const double occupancy =
+      (stats.nsearched > 0 ? (double)stats.nfound/stats.nsearched : 0);
+    Message(INFO)<<"SpeFinder: channel "<<id<<" has "<<stats.nfound
+                 <<" photoelectrons in "<<stats.nsearched
+                 <<" waveforms, mean integral "<<stats.mean<<" +/- "
+                 <<sigma<<std::endl;
+    if(write_hists){
+      WriteSpectrum("spe_integral", id, stats.integral_hist, integral_max,
+                    stats.nfound);
+      WriteSpectrum("spe_amplitude", id, stats.amplitude_hist, amplitude_max,
+                    stats.nfound);
+    }
+    if(stats.nfound < min_entries)
+      continue;
+    if(info){
+      SetChannelValue(info, id, "spe_finder_mean", stats.mean);
+      SetChannelValue(info, id, "spe_finder_sigma", sigma);
+      SetChannelValue(info, id, "spe_finder_entries", stats.nfound);
+      SetChannelValue(info, id, "spe_finder_occupancy", occupancy);
+      if(db && info->runid >= 0 &&
+         db->StoreChannelinfo(info->runid, id, stats.mean, occupancy)){
+        Message(ERROR)<<"SpeFinder: unable to store the gain of channel "
+                      <<id<<" in the database"<<std::endl;
+        status = 1;
+      }
+    }
+  }
+  return status;
 }
 
 int SpeFinder::Process(ChannelData* chdata)
@@ -86,7 +220,28 @@ int SpeFinder::Process(ChannelData* chdata)
   int nsamps = chdata->nsamps-3;
   //chdata->TimeToSample(curr_ev_data->s1_end_time); to end of s1
   double* wave = chdata->GetBaselineSubtractedWaveform();
-  double start_wave=wave[winscan];
+  //the local baseline needs winphe_bef samples before the pulse
+  const int first = std::max(winscan, winphe_bef);
+  SpeStats& stats = GetStats(chdata->channel_id);
+  ++stats.nsearched;
+  if(first >= nsamps)
+    return 0;
+  if(debug){
+    for(int samp = std::max(first, chdata->TimeToSample(debug_start));
+        samp < nsamps && chdata->SampleToTime(samp) <= debug_end; ++samp)
+      Message(DEBUG2)<<"At "<<chdata->SampleToTime(samp)
+                    <<"us the amplitude is "<<wave[samp]<<std::endl;
+  }
+  double start_wave=wave[first];
+
+  /* flag every sample where the waveform drops by rough_threshold over
+     2 samples in one branch-free pass, so the search below only visits
+     those and the pulses following them */
+  _candidates.resize(nsamps);
+  char* candidate = &_candidates[0];
+  const double threshold = rough_threshold;
+  for(int samp = first; samp < nsamps; ++samp)
+    candidate[samp] = (wave[samp] - wave[samp+2] >= threshold);
   //previous is the sample index of the last located pulse
   int previous=0;
   /* search starting at search_start_time and go until the end of the trigger
@@ -94,17 +249,21 @@ int SpeFinder::Process(ChannelData* chdata)
   bool secondary_pulse = false;
   bool prev_sec_pulse = false;
   double prev_loc_bl = 0;
-  for(int test_sample = winscan; test_sample < nsamps; test_sample++){
+  for(int test_sample = first; test_sample < nsamps; test_sample++){
     prev_sec_pulse = secondary_pulse;
+    if(!secondary_pulse){
+      //jump to the next flagged sample
+      const char* next = (const char*)
+        std::memchr(candidate+test_sample, 1, nsamps-test_sample);
+      if(!next)
+        break;
+      test_sample = next - candidate;
+    }
     double current_time=chdata->SampleToTime(test_sample);
-    if(current_time>=debug_start && current_time<=debug_end)
-      Message(DEBUG2)<<"At "<<current_time<<"us the amplitude is "
-                    <<wave[test_sample]<<std::endl;
-    if(( wave[test_sample] - wave[test_sample+2] >= rough_threshold &&
-         ( ( (wave[test_sample+1]-wave[test_sample])/
-             (wave[test_sample+2]-wave[test_sample]) >= 0) ||
-           ( (wave[test_sample+3]-wave[test_sample])/
-             (wave[test_sample+2]-wave[test_sample]) >= 0) ) ) ||
+    if(( ( (wave[test_sample+1]-wave[test_sample])/
+           (wave[test_sample+2]-wave[test_sample]) >= 0) ||
+         ( (wave[test_sample+3]-wave[test_sample])/
+           (wave[test_sample+2]-wave[test_sample]) >= 0) ) ||
        secondary_pulse) {
 
       const int samp = test_sample;
@@ -120,7 +279,7 @@ int SpeFinder::Process(ChannelData* chdata)
         /*this is the first peak, and we haven't searched the area behind
           look back and make sure there are no peaks in the pre area*/
         bool pre_peak_found = false;
-        for(int presample = samp - (winphe+winphe_bef);
+        for(int presample = std::max(samp - (winphe+winphe_bef), 0);
             presample < samp; presample++){
           if( (wave[presample] - wave[presample+2] >= fine_threshold) &&
               (wave[presample+1] <= wave[presample] ) &&
@@ -239,6 +398,7 @@ int SpeFinder::Process(ChannelData* chdata)
         found_spe.length += post_window;
 
       chdata->single_pe.push_back(found_spe);
+      Fill(stats, found_spe);
       ++n_peaks_found;
       Message(DEBUG2)<<"Found good one: "<<current_time<<", end point: "
                     <<chdata->SampleToTime(end_sample)<<std::endl
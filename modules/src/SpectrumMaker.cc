@@ -11,20 +11,14 @@
 #include "TCanvas.h"
 #include "TH1D.h"
 #include "TH2D.h"
-#include "TTree.h"
-#include "TBranch.h"
-#include "TTreeFormula.h"
 #include "TClass.h"
 #include "TList.h"
 #include "TClassMenuItem.h"
-#include "TTreeFormulaManager.h"
-#include "TTreePlayer.h"
 #include "RVersion.h"
 
 SpectrumMaker::SpectrumMaker(const std::string& name) : 
   BaseModule(name, "Histogram variables from data") ,
-  _histo(0), _canvas(0), _tree(0), _branch(0) , _graphix(0)
-  //, _xform(0), _yform(0), _cutform(0)
+  _histo(0), _pending(0), _canvas(0), _xterm(-1), _yterm(-1), _cutterm(-1), _graphix(0)
 {
   RegisterParameter("xvar", _xvar = "", "Variable to plot on x axis");
   RegisterParameter("nbinsx",_nbinsx = 200, "Number of bins in the x axis");
@@ -62,6 +56,18 @@ int SpectrumMaker::Initialize()
     return 1;
   }
   
+  //compile the expressions together so their loops run in step
+  _formula.Clear();
+  _xterm = _formula.AddTerm(_xvar);
+  _yterm = (_xterm < 0 || _yvar.empty()) ? -1 : _formula.AddTerm(_yvar);
+  _cutterm = (_xterm < 0 || _cut.empty()) ? -1 : _formula.AddTerm(_cut);
+  if(_xterm < 0 || (!_yvar.empty() && _yterm < 0) || 
+     (!_cut.empty() && _cutterm < 0)){
+    Message(ERROR)<<GetName()<<": "<<_formula.GetError()<<"; disabling.\n";
+    enabled = false;
+    return 0;
+  }
+  
   _graphix = EventHandler::GetInstance()->GetModule<RootGraphix>();
   
   if(_yvar == ""){
@@ -80,6 +86,9 @@ int SpectrumMaker::Initialize()
 #else
   _histo->SetCanExtend(0);
 #endif
+  //filled by a SpectrumManager without holding the graphix lock
+  _pending = (TH1*)(_histo->Clone((GetName()+"_pending").c_str()));
+  _pending->SetDirectory(0);
   
   //add Reset to the histogram's popup title
   if(std::string(_histo->Class()->GetMenuList()->First()->GetTitle()) != 
@@ -100,96 +109,64 @@ int SpectrumMaker::Initialize()
     _histo->Draw( _yvar.empty() ? "" : "colz");
   }
   
-  _tree = new TTree((GetName()+"tree").c_str(),"");
-  
-  
-  EventData* ptr = new EventData;
-  _branch = _tree->Branch(EventData::GetBranchName(),&ptr);
-  _tree->SetDirectory(0);
-  _tree->SetCircular(1);
-  
-  /*
-  _xform = new TTreeFormula((GetName()+"xform").c_str(),_xvar.c_str(),_tree);
-  //_xform->SetQuickLoad(true);
-  if(!_yvar.empty()){
-    _yform = new TTreeFormula((GetName()+"yform").c_str(),_yvar.c_str(),_tree);
-    //_yform->SetQuickLoad(true);
-  }
-  
-  if(!_cut.empty()){
-    _cutform = new TTreeFormula((GetName()+"cutform").c_str(),_cut.c_str(),
-				_tree);
-    //_cutform->SetQuickLoad(true);
-  }
-  */
-  _branch->ResetAddress();
-  delete ptr;
-       
-  
-  _draw_cmd = _yvar;
-  if(!_yvar.empty())
-    _draw_cmd += " : ";
-  _draw_cmd += _xvar;
-  
-  _draw_cmd += " >>+";
-  _draw_cmd += _histo->GetName();
   return 0;
 }
 
 int SpectrumMaker::Finalize()
 {
+  if(_pending){
+    if(_histo)
+      _histo->Add(_pending);
+    delete _pending;
+    _pending = 0;
+  }
   if( gFile && gFile->IsOpen() && _histo)
     _histo->Write();
   if(_histo) delete _histo;
   _histo = 0;
   // RootGraphix will delete the canvas
   _canvas = 0;
-  delete _tree;
-  _tree = 0;
-  _branch = 0;
-  /*
-  delete _xform;
-  _xform = 0;
-  delete _yform;
-  _yform = 0;
-  delete _cutform;
-  _cutform = 0;
-  */
+  _formula.Clear();
   return 0;
 }
 
 int SpectrumMaker::Process(EventPtr evt)
 {
-  RootGraphix::Lock glock = _graphix->AcquireLock();
   EventDataPtr data = evt->GetEventData();
-  EventData* ptr = data.get();
-  _branch->SetAddress( &ptr );
-  _tree->Fill();
-  _branch->ResetAddress();
-  _tree->Draw(_draw_cmd.c_str(), _cut.c_str(),"goff",1,0);
-  //std::cerr<<s->GetOption()<<" "<<s->GetAction()<<" "<<s->GetCleanElist()<<" "<<s->GetDimension()<<" "<<s->GetMultiplicity()<<" "<<s->GetNfill()<<" "<<s->GetSelectedRows()<<" "<<std::endl;
-  /*
-  for(int i=0; i<_xform->GetNdata(); ++i){
-    if(_cutform){
-      if(_cutform->GetNdata() <= i)
-	break;
-      if(_cutform->EvalInstance(i)==0)
-	continue;
-    }
-    double xval = _xform->EvalInstance(i);
-    if(_yform){
-      if(_yform->GetNdata() <= i)
-	break;
-      double yval = _yform->EvalInstance(i);
-      ((TH2D*)(_histo))->Fill(xval,yval);
-    }
+  //evaluate outside the graphics lock; only filling needs it
+  const int ninstances = _formula.Evaluate(data.get(), _values);
+  const int nterms = _formula.GetNTerms();
+  RootGraphix::Lock glock = _graphix->AcquireLock();
+  for(int i=0; i<ninstances; ++i){
+    const double* vals = &(_values[i*nterms]);
+    const double weight = (_cutterm < 0 ? 1 : vals[_cutterm]);
+    if(weight == 0)
+      continue;
+    if(_yterm >= 0)
+      ((TH2D*)(_histo))->Fill(vals[_xterm], vals[_yterm], weight);
     else
-      _histo->Fill(xval);
+      _histo->Fill(vals[_xterm], weight);
   }
-  */
   
   if(_canvas)
     _canvas->Modified();
-  _branch->SetAddress(0);
   return 0;
 }
+
+void SpectrumMaker::FillPending(double x, double y, double weight)
+{
+  if(_yterm >= 0)
+    ((TH2D*)(_pending))->Fill(x, y, weight);
+  else
+    _pending->Fill(x, weight);
+}
+
+void SpectrumMaker::MergePending()
+{
+  if(!_pending || _pending->GetEntries() == 0)
+    return;
+  _histo->Add(_pending);
+  _pending->Reset();
+  if(_canvas)
+    _canvas->Modified();
+}
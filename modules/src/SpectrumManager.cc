@@ -0,0 +1,152 @@
+#include "SpectrumManager.hh"
+#include "SpectrumMaker.hh"
+#include "EventFormula.hh"
+#include "EventHandler.hh"
+#include "RootGraphix.hh"
+#include "boost/bind.hpp"
+#include <algorithm>
+
+SpectrumManager::SpectrumManager(const std::string& name) :
+  BaseModule(name, "Evaluate the expressions of all spectra together"),
+  _graphix(0), _unmerged(0), _event(0), _next_group(0)
+{
+  RegisterParameter("num_threads", num_threads = 1,
+		    "Number of threads to evaluate the spectra with");
+  RegisterParameter("merge_interval", merge_interval = 10,
+		    "Number of events between updates of the displayed spectra");
+}
+
+SpectrumManager::~SpectrumManager()
+{
+  Finalize();
+}
+
+int SpectrumManager::AddToGroup(SpectrumMaker* spec)
+{
+  const std::string& xvar = spec->GetXVar();
+  const std::string& yvar = spec->GetYVar();
+  const std::string& cut = spec->GetCut();
+  
+  //compile alone first to find which loops the expressions run over
+  EventFormula alone;
+  if(alone.AddTerm(xvar) < 0 || (!yvar.empty() && alone.AddTerm(yvar) < 0) ||
+     (!cut.empty() && alone.AddTerm(cut) < 0)){
+    Message(ERROR)<<GetName()<<": "<<spec->GetName()<<": "<<alone.GetError()
+		  <<std::endl;
+    return 1;
+  }
+  const std::string signature = alone.GetLoopSignature();
+  
+  size_t g = 0;
+  while(g < _groups.size() && _groups[g].signature != signature)
+    ++g;
+  if(g == _groups.size()){
+    _groups.push_back(Group());
+    _groups.back().signature = signature;
+    _groups.back().formula = new EventFormula;
+  }
+  Group& group = _groups[g];
+  Member member;
+  member.spectrum = spec;
+  member.xterm = group.formula->AddTerm(xvar);
+  member.yterm = yvar.empty() ? -1 : group.formula->AddTerm(yvar);
+  member.cutterm = cut.empty() ? -1 : group.formula->AddTerm(cut);
+  group.members.push_back(member);
+  return 0;
+}
+
+int SpectrumManager::Initialize()
+{
+  if(num_threads < 1 || merge_interval < 1){
+    Message(ERROR)<<GetName()<<": num_threads and merge_interval must be "
+		  <<"at least 1"<<std::endl;
+    return 1;
+  }
+#ifdef SINGLETHREAD
+  if(num_threads > 1)
+    Message(WARNING)<<GetName()<<": compiled without threads; "
+		    <<"evaluating with 1 thread instead of "<<num_threads
+		    <<std::endl;
+#endif
+  _graphix = EventHandler::GetInstance()->GetModule<RootGraphix>();
+  _unmerged = 0;
+  for(size_t i=0; i<_spectra.size(); ++i){
+    if(_spectra[i]->enabled && AddToGroup(_spectra[i]))
+      return 1;
+  }
+  size_t nterms = 0;
+  for(size_t g=0; g<_groups.size(); ++g)
+    nterms += _groups[g].formula->GetNTerms();
+  Message(DEBUG)<<GetName()<<": "<<_spectra.size()<<" spectra evaluated as "
+		<<nterms<<" distinct terms in "<<_groups.size()<<" groups\n";
+  //no point in more threads than groups
+  _pool.Start(std::min(num_threads, (int)_groups.size()));
+  return 0;
+}
+
+int SpectrumManager::Finalize()
+{
+  _pool.Stop();
+  //each spectrum merges its remaining entries when it is finalized
+  for(size_t g=0; g<_groups.size(); ++g)
+    delete _groups[g].formula;
+  _groups.clear();
+  return 0;
+}
+
+void SpectrumManager::ProcessGroup(Group& group)
+{
+  const int ninstances = group.formula->Evaluate(_event, group.values);
+  const int nterms = group.formula->GetNTerms();
+  for(int i=0; i<ninstances; ++i){
+    const double* vals = &(group.values[i*nterms]);
+    for(size_t m=0; m<group.members.size(); ++m){
+      const Member& member = group.members[m];
+      const double weight = (member.cutterm < 0 ? 1 : vals[member.cutterm]);
+      if(weight == 0)
+	continue;
+      member.spectrum->FillPending(vals[member.xterm], 
+				   member.yterm < 0 ? 0 : vals[member.yterm],
+				   weight);
+    }
+  }
+}
+
+void SpectrumManager::ProcessGroups()
+{
+  while(true){
+    size_t next;
+    {
+#ifndef SINGLETHREAD
+      boost::mutex::scoped_lock lock(_group_mutex);
+#endif
+      next = _next_group++;
+    }
+    if(next >= _groups.size())
+      return;
+    ProcessGroup(_groups[next]);
+  }
+}
+
+void SpectrumManager::MergeAll()
+{
+  RootGraphix::Lock glock;
+  if(_graphix)
+    glock = _graphix->AcquireLock();
+  for(size_t g=0; g<_groups.size(); ++g)
+    for(size_t m=0; m<_groups[g].members.size(); ++m)
+      _groups[g].members[m].spectrum->MergePending();
+  _unmerged = 0;
+}
+
+int SpectrumManager::Process(EventPtr evt)
+{
+  EventDataPtr data = evt->GetEventData();
+  _event = data.get();
+  _next_group = 0;
+  _pool.Run(boost::bind(&SpectrumManager::ProcessGroups, this));
+  _event = 0;
+  if(++_unmerged >= merge_interval)
+    MergeAll();
+  return 0;
+}
@@ -1,13 +1,19 @@
 #include "SumChannels.hh"
 #include "ConvertData.hh"
 #include "EventHandler.hh"
+#include "SampleUnpacker.hh"
 #include <algorithm>
+#include <cmath>
 #include "RootWriter.hh"
 
 SumChannels::SumChannels() :
   BaseModule(GetDefaultName(),"Create a virtual channel whose waveform is the sum of all other channels in the event")
 {
   AddDependency<ConvertData>();
+  RegisterParameter("channel_gains", channel_gains,
+		    "Map of channel id to extra weight in the sum; default 1");
+  RegisterParameter("channel_time_offsets", channel_time_offsets,
+		    "Map of channel id to delay in us removed before summing");
 }
 
 SumChannels::~SumChannels()
@@ -25,83 +31,95 @@ int SumChannels::Finalize()
   return 0;
 }
 
-class add_with_scaling{
-  double _scale_factor;
-public:
-  add_with_scaling(double scale_factor) : _scale_factor(scale_factor) {}
-  double operator()(double x, double y) { return x + y*_scale_factor; }
-};
-
 int SumChannels::Process(EventPtr event)
 {
-  ChannelData sumdata;
-  sumdata.channel_id = ChannelData::CH_SUM;
-  sumdata.label = "sum";
-  sumdata.sample_bits = 32;
-  int n_channels_summed = 0;
   EventDataPtr data = event->GetEventData();
   if (data->channels.size() < 2)
     //No point in summing channels
     return 0;
   
-  for(size_t i=0; i<data->channels.size(); i++){
+  //find the channels to sum and the window where they all have data
+  const size_t nchans = data->channels.size();
+  _summed.clear();
+  _aligned.clear();
+  int presamps = 0, postsamps = 0;
+  for(size_t i=0; i<nchans; i++){
     const ChannelData& chdata = data->channels[i];
     if( _skip_channels.find( chdata.channel_id) != _skip_channels.end() ||
 	chdata.channel_id < 0 ){
       // we told it to skip this channel
       continue;
     }
-    if(n_channels_summed == 0){
-      sumdata.sample_rate = chdata.sample_rate;
-      sumdata.trigger_index = chdata.trigger_index;
-      sumdata.nsamps = chdata.nsamps;
-      
-      sumdata.waveform.resize(chdata.nsamps);
-      
-    }
-    
-    //line up the waveforms of the channels
-    const int presamps = std::min(sumdata.trigger_index, chdata.trigger_index);
-    const int postsamps = std::min(sumdata.nsamps - sumdata.trigger_index,
-				   chdata.nsamps - chdata.trigger_index);
+    int trigger = chdata.trigger_index;
+    std::map<int,double>::const_iterator offset = 
+      channel_time_offsets.find(chdata.channel_id);
+    if(offset != channel_time_offsets.end())
+      trigger += (int)std::floor(offset->second*chdata.sample_rate + 0.5);
+    if(_summed.empty() || trigger < presamps)
+      presamps = trigger;
+    if(_summed.empty() || chdata.nsamps - trigger < postsamps)
+      postsamps = chdata.nsamps - trigger;
+    _summed.push_back(i);
+    _aligned.push_back(trigger);
+  }
+  if(_summed.empty())
+    return 0;
+  
+  //build the sum in place; references to other channels are only safe after
+  ChannelData& sumdata = data->AddChannel();
+  const ChannelData& first = data->channels[_summed[0]];
+  sumdata.channel_id = ChannelData::CH_SUM;
+  sumdata.label = "sum";
+  sumdata.sample_bits = 32;
+  sumdata.sample_rate = first.sample_rate;
+  sumdata.trigger_index = presamps;
+  sumdata.nsamps = std::max(presamps+postsamps, 0);
+  //the channels share no samples, so there is nothing to add
+  if(sumdata.nsamps == 0)
+    return 0;
+  sumdata.waveform.assign(sumdata.nsamps, 0.);
+  double* sum = sumdata.GetWaveform();
+  
+  for(size_t j=0; j<_summed.size(); j++){
+    ChannelData& chdata = data->channels[_summed[j]];
     //load the scale factor from the calibration database
-    double scale_factor = 1./chdata.spe_mean;;
+    double scale_factor = 1./chdata.spe_mean;
+    std::map<int,double>::const_iterator gain = 
+      channel_gains.find(chdata.channel_id);
+    if(gain != channel_gains.end())
+      scale_factor *= gain->second;
     
-    //sum the two channels into a temporary vector
-    std::vector<double> tempsum(presamps+postsamps);
-    std::vector<double>::const_iterator sumit = sumdata.waveform.begin();
-    std::vector<double>::const_iterator chit = chdata.waveform.begin();
-    //sum from trigger_index - presamps to trigger_index+postsamps
-    std::transform(sumit+sumdata.trigger_index-presamps,
-		   sumit+sumdata.trigger_index+postsamps, 
-		   chit+chdata.trigger_index-presamps,
-		   tempsum.begin(),
-		   add_with_scaling(scale_factor));
-    //copy the temporary into the sumdata waveform vector
-    sumdata.waveform.assign(tempsum.begin(), tempsum.end());
-       
-    //reset the historical channel_start and end pointers
-    sumdata.trigger_index = presamps;
-    sumdata.nsamps = presamps+postsamps;
-    sumdata.channel_start = (char*)(sumdata.GetWaveform());
-    sumdata.channel_end = (char*)( sumdata.GetWaveform() + chdata.nsamps );
-    n_channels_summed++;
+    //sum from the aligned trigger - presamps to trigger + postsamps,
+    //reading plain integer samples directly from the raw buffer
+    const int chstart = _aligned[j] - presamps;
+    const int nsum = sumdata.nsamps;
+    switch(chdata.native_sample_bytes){
+    case 1:
+      SampleUnpacker::AddScaled((const uint8_t*)chdata.channel_start + 
+				chstart, nsum, sum, scale_factor);
+      break;
+    case 2:
+      SampleUnpacker::AddScaled((const uint16_t*)chdata.channel_start + 
+				chstart, nsum, sum, scale_factor);
+      break;
+    default:
+      SampleUnpacker::AddScaled(chdata.GetWaveform() + chstart, nsum, sum,
+				scale_factor);
+    }
     // the sum is "saturated" if any single channel is
     if(chdata.saturated) sumdata.saturated = true;
   } //end loop over channels
-  if (n_channels_summed > 0){
-    //find the max and min of the channel
-    double* wave = sumdata.GetWaveform();
-    double* max_samp = std::max_element(wave, wave+sumdata.nsamps);
-    double* min_samp = std::min_element(wave, wave+sumdata.nsamps);
-    //data is saturated if it hit 0 or maximum range
-    sumdata.maximum = *max_samp;
-    sumdata.minimum = *min_samp;
-    sumdata.max_time = sumdata.SampleToTime(max_samp - wave);
-    sumdata.min_time = sumdata.SampleToTime(min_samp - wave);
-    data->channels.push_back(sumdata);
-  }
-  return 0;
   
+  //reset the historical channel_start and end pointers
+  sumdata.channel_start = (char*)(sum);
+  sumdata.channel_end = (char*)(sum + sumdata.nsamps);
+  //find the max and min of the channel
+  double* max_samp = std::max_element(sum, sum+sumdata.nsamps);
+  double* min_samp = std::min_element(sum, sum+sumdata.nsamps);
+  //data is saturated if it hit 0 or maximum range
+  sumdata.maximum = *max_samp;
+  sumdata.minimum = *min_samp;
+  sumdata.max_time = sumdata.SampleToTime(max_samp - sum);
+  sumdata.min_time = sumdata.SampleToTime(min_samp - sum);
+  return 0;
 }
-
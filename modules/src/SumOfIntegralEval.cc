@@ -121,7 +121,9 @@ int SumOfIntegralEval::Process(EventPtr evt)
 		break;
 	    }
 
-	    Pulse pulse = chdata.pulses[pulse_num];
+	    //read the pulse in place rather than copying it
+	    const Pulse& pulse = chdata.pulses[pulse_num];
+	    const double npe = pulse.npe;
 	    
 	    if (sum_of_int.start_index < 0)
 	    {
@@ -139,25 +141,28 @@ int SumOfIntegralEval::Process(EventPtr evt)
 	    }
 
 	    sum_of_int.saturated = (sum_of_int.saturated || pulse.peak_saturated);
-	    sum_of_int.npe += pulse.npe;
-	    for (int fp = 0; fp < (int)pulse.f_param.size(); fp++)
+	    sum_of_int.npe += npe;
+	    const size_t nfparams = std::min(pulse.f_param.size(), 
+					     sum_of_int.f_param.size());
+	    for (size_t fp = 0; fp < nfparams; fp++)
 	    {
-		sum_of_int.f_param.at(fp) += pulse.f_param.at(fp)*pulse.npe;
+		sum_of_int.f_param[fp] += pulse.f_param[fp]*npe;
 	    }
-	    sum_of_int.f90 += pulse.f90*pulse.npe;
+	    sum_of_int.f90 += pulse.f90*npe;
 	    sum_of_int.fixed_npe1 += -pulse.fixed_int1/chdata.spe_mean;
 	    sum_of_int.fixed_npe2 += -pulse.fixed_int2/chdata.spe_mean;
-	    if (sum_of_int.max_chan_npe < pulse.npe)
+	    if (sum_of_int.max_chan_npe < npe)
 	    {
 		sum_of_int.max_chan = chdata.channel_id;
-		sum_of_int.max_chan_npe = pulse.npe;
+		sum_of_int.max_chan_npe = npe;
 	    }
 
-	    sum_of_int.gatti += pulse.gatti*pulse.pulse_shape_int;
-	    sum_of_int.ll_ele += pulse.ll_ele*pulse.pulse_shape_int;
-	    sum_of_int.ll_nuc += pulse.ll_nuc*pulse.pulse_shape_int;
-	    sum_of_int.ll_r += pulse.ll_r*pulse.pulse_shape_int;
-	    total_pulse_shape_int += pulse.pulse_shape_int;
+	    const double shape_int = pulse.pulse_shape_int;
+	    sum_of_int.gatti += pulse.gatti*shape_int;
+	    sum_of_int.ll_ele += pulse.ll_ele*shape_int;
+	    sum_of_int.ll_nuc += pulse.ll_nuc*shape_int;
+	    sum_of_int.ll_r += pulse.ll_r*shape_int;
+	    total_pulse_shape_int += shape_int;
 
 	} // end loop over channels
 
@@ -0,0 +1,96 @@
+#include "WindowQuery.hh"
+
+namespace{
+  /// Is sample a a better minimum than b? Earlier samples win ties
+  struct FirstMin{
+    static bool Better(const double* wave, int a, int b)
+    { return wave[a] < wave[b] || (wave[a] == wave[b] && a < b); }
+  };
+  /// Is sample a a better maximum than b? Earlier samples win ties
+  struct FirstMax{
+    static bool Better(const double* wave, int a, int b)
+    { return wave[a] > wave[b] || (wave[a] == wave[b] && a < b); }
+  };
+}
+
+template<class Compare>
+void WindowQuery::BuildTable(std::vector<int>& table)
+{
+  int levels = 1;
+  while( (1<<levels) <= _nblocks ) ++levels;
+  table.resize(levels * _nblocks);
+  //level 0 holds the extremum of each block
+  for(int block=0; block<_nblocks; ++block){
+    int best = block*BLOCK;
+    for(int samp = best+1; samp < (block+1)*BLOCK; ++samp){
+      if(Compare::Better(_wave, samp, best))
+	best = samp;
+    }
+    table[block] = best;
+  }
+  //each higher level combines two runs from the level below
+  for(int level=1; level<levels; ++level){
+    const int half = 1<<(level-1);
+    const int* below = &table[(level-1)*_nblocks];
+    int* here = &table[level*_nblocks];
+    for(int block=0; block + 2*half <= _nblocks; ++block){
+      const int a = below[block], b = below[block+half];
+      here[block] = Compare::Better(_wave, b, a) ? b : a;
+    }
+  }
+}
+
+void WindowQuery::Build(const double* wave, int nsamps)
+{
+  _wave = wave;
+  _nsamps = nsamps;
+  _nblocks = nsamps / BLOCK;
+  BuildTable<FirstMin>(_min_table);
+  BuildTable<FirstMax>(_max_table);
+}
+
+template<class Compare>
+int WindowQuery::Query(int begin, int end, const std::vector<int>& table) const
+{
+  if(begin >= end)
+    return end;
+  const int first_block = (begin + BLOCK - 1) / BLOCK;
+  const int last_block = end / BLOCK;
+  int best = begin;
+  if(first_block >= last_block){
+    //no whole blocks; just scan the window
+    for(int samp = begin+1; samp < end; ++samp){
+      if(Compare::Better(_wave, samp, best))
+	best = samp;
+    }
+    return best;
+  }
+  //partial block at the start
+  for(int samp = begin+1; samp < first_block*BLOCK; ++samp){
+    if(Compare::Better(_wave, samp, best))
+      best = samp;
+  }
+  //whole blocks from two overlapping power-of-two runs
+  int level = 0;
+  while( (2<<level) <= last_block - first_block ) ++level;
+  const int* row = &table[level*_nblocks];
+  int a = row[first_block], b = row[last_block - (1<<level)];
+  if(Compare::Better(_wave, b, a)) a = b;
+  if(Compare::Better(_wave, a, best)) best = a;
+  //partial block at the end
+  for(int samp = last_block*BLOCK; samp < end; ++samp){
+    if(Compare::Better(_wave, samp, best))
+      best = samp;
+  }
+  return best;
+}
+
+int WindowQuery::ArgMin(int begin, int end) const
+{
+  return Query<FirstMin>(begin, end, _min_table);
+}
+
+int WindowQuery::ArgMax(int begin, int end) const
+{
+  return Query<FirstMax>(begin, end, _max_table);
+}
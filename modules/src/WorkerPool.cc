@@ -0,0 +1,97 @@
+#include "WorkerPool.hh"
+#ifndef SINGLETHREAD
+#include "boost/bind.hpp"
+#endif
+
+#ifndef SINGLETHREAD
+
+WorkerPool::WorkerPool() : _generation(0), _busy(0), _stop(false)
+{}
+
+WorkerPool::~WorkerPool()
+{
+  Stop();
+}
+
+void WorkerPool::Start(int nthreads)
+{
+  Stop();
+  boost::mutex::scoped_lock lock(_mutex);
+  _stop = false;
+  for(int i=1; i<nthreads; i++){
+    //pass the current generation so a Run() that comes before the
+    //helper first takes the lock is not missed
+    _threads.push_back(boost::shared_ptr<boost::thread>(
+      new boost::thread(boost::bind(&WorkerPool::HelperLoop, this,
+				    _generation))));
+  }
+}
+
+void WorkerPool::Stop()
+{
+  if(_threads.empty())
+    return;
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    _stop = true;
+  }
+  _job_ready.notify_all();
+  for(size_t i=0; i<_threads.size(); i++)
+    _threads[i]->join();
+  _threads.clear();
+  _job = Job();
+}
+
+int WorkerPool::GetNThreads() const
+{
+  return _threads.size() + 1;
+}
+
+void WorkerPool::Run(const Job& job)
+{
+  if(_threads.empty()){
+    job();
+    return;
+  }
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    _job = job;
+    _busy = _threads.size();
+    ++_generation;
+  }
+  _job_ready.notify_all();
+  job();
+  boost::mutex::scoped_lock lock(_mutex);
+  while(_busy > 0)
+    _job_done.wait(lock);
+}
+
+void WorkerPool::HelperLoop(unsigned long generation)
+{
+  while(true){
+    Job job;
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      while(!_stop && _generation == generation)
+	_job_ready.wait(lock);
+      if(_stop)
+	return;
+      generation = _generation;
+      job = _job;
+    }
+    job();
+    boost::mutex::scoped_lock lock(_mutex);
+    if(--_busy == 0)
+      _job_done.notify_all();
+  }
+}
+
+#else
+
+WorkerPool::WorkerPool() {}
+WorkerPool::~WorkerPool() {}
+void WorkerPool::Start(int) {}
+void WorkerPool::Stop() {}
+int WorkerPool::GetNThreads() const { return 1; }
+
+#endif
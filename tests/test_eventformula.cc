@@ -0,0 +1,236 @@
+/** @file test_eventformula.cc
+    @brief Unit tests of the EventFormula expression evaluator
+    
+    Evaluates expressions on a small hand-filled EventData and compares
+    them with the values TTree::Draw would give for the same expressions.
+*/
+
+#include "EventFormula.hh"
+#include "EventData.hh"
+#include <iostream>
+#include <sstream>
+#include <cmath>
+
+namespace {
+  int failures = 0;
+  
+  /// Three channels; channel c has c+1 pulses and two regions
+  void FillEvent(EventData& event)
+  {
+    event.event_id = 7;
+    event.s1_full = 12.5;
+    for(int c=0; c<3; c++){
+      event.channels.push_back(ChannelData());
+      ChannelData& ch = event.channels.back();
+      ch.channel_id = c;
+      ch.baseline.mean = 100 + c;
+      for(int p=0; p<=c; p++){
+	Pulse pulse;
+	pulse.npe = 10*c + p;
+	pulse.integral = -(10*c + p);
+	pulse.fit.chi2 = 0.5*p;
+	ch.pulses.push_back(pulse);
+      }
+      Roi roi;
+      roi.integral = -5*c;
+      ch.regions.push_back(roi);
+      roi.integral = -100 - c;
+      ch.regions.push_back(roi);
+    }
+  }
+  
+  std::string Format(const std::vector<double>& values)
+  {
+    std::ostringstream s;
+    for(size_t i=0; i<values.size(); i++)
+      s<<(i ? " " : "")<<values[i];
+    return s.str();
+  }
+  
+  /// Compile the terms together and compare every value of every instance
+  void CheckValues(const EventData& event, const std::string& term1,
+		   const std::string& term2, const std::string& expected)
+  {
+    EventFormula formula;
+    const std::string label = term1 + (term2.empty() ? "" : " : " + term2);
+    if(formula.AddTerm(term1) < 0 || 
+       (!term2.empty() && formula.AddTerm(term2) < 0)){
+      std::cerr<<"  FAIL "<<label<<": "<<formula.GetError()<<"\n";
+      failures++;
+      return;
+    }
+    std::vector<double> values;
+    formula.Evaluate(&event, values);
+    if(Format(values) != expected){
+      std::cerr<<"  FAIL "<<label<<": got \""<<Format(values)
+	       <<"\", expected \""<<expected<<"\"\n";
+      failures++;
+    }
+  }
+  
+  void CheckValues(const EventData& event, const std::string& term,
+		   const std::string& expected)
+  {
+    CheckValues(event, term, "", expected);
+  }
+  
+  /// The term must not compile, with an error mentioning message
+  void CheckError(const std::string& term, const std::string& message)
+  {
+    EventFormula formula;
+    if(formula.AddTerm(term) >= 0){
+      std::cerr<<"  FAIL "<<term<<": compiled, expected an error\n";
+      failures++;
+    }
+    else if(formula.GetError().find(message) == std::string::npos){
+      std::cerr<<"  FAIL "<<term<<": error \""<<formula.GetError()
+	       <<"\" does not mention \""<<message<<"\"\n";
+      failures++;
+    }
+  }
+  
+  void CheckSignature(const std::string& term, const std::string& expected)
+  {
+    EventFormula formula;
+    formula.AddTerm(term);
+    if(formula.GetLoopSignature() != expected){
+      std::cerr<<"  FAIL signature of "<<term<<": got \""
+	       <<formula.GetLoopSignature()<<"\", expected \""
+	       <<expected<<"\"\n";
+      failures++;
+    }
+  }
+  
+  void TestOperators(const EventData& event)
+  {
+    CheckValues(event, "s1_full*2+event.event_id", "32");
+    CheckValues(event, "1+2*3-4/2", "5");
+    CheckValues(event, "2^3^2", "512");
+    CheckValues(event, "-2%3 + 7%4", "1");
+    //% truncates its operands to integers, as TFormula does
+    CheckValues(event, "7.9%2.5 + 10*(-7.5%2)", "-9");
+    CheckValues(event, "s1_full%5", "2");
+    CheckValues(event, "5/0", "0");
+    CheckValues(event, "!(1<2) + (3>=3) + (2<=1) + (4>3) + (1==1) + (1!=1)",
+		"3");
+    CheckValues(event, "(1 && 0) + (1 || 0) + (0 || 0) + !0", "2");
+    CheckValues(event, "- -3", "3");
+  }
+  
+  void TestFunctions(const EventData& event)
+  {
+    CheckValues(event, "sqrt(16) + abs(-2) + TMath::Abs(-3)", "9");
+    CheckValues(event, "pow(2,10) - TMath::Power(2,3)", "1016");
+    CheckValues(event, "max(1,4) + TMath::Min(2,-1) + floor(2.5) + ceil(2.5)",
+		"8");
+    CheckValues(event, "fmod(7,4) + exp(0) + log(1) + cos(0)", "5");
+    CheckValues(event, "TMath::Abs(channels[2].pulses[1].integral)", "21");
+  }
+  
+  void TestLoops(const EventData& event)
+  {
+    //constant indices, in and out of range
+    CheckValues(event, "-channels[0].regions[1].integral", "100");
+    CheckValues(event, "-channels[5].regions[1].integral", "");
+    CheckValues(event, "channels[1].baseline.mean + "
+		"channels[1].pulses[1].fit.chi2", "101.5");
+    //implicit and explicit loops
+    CheckValues(event, "channels.channel_id", "0 1 2");
+    CheckValues(event, "channels[].pulses[].npe", "0 10 11 20 21 22");
+    CheckValues(event, "channels.pulses.npe", "0 10 11 20 21 22");
+    //every term of a formula loops in step
+    CheckValues(event, "channels.channel_id", "channels.channel_id!=1",
+		"0 1 1 0 2 1");
+    CheckValues(event, "channels.pulses.npe", 
+		"channels.channel_id>0 && channels.pulses.npe<21",
+		"0 0 10 1 11 1 20 1 21 0 22 0");
+    CheckValues(event, "channels.pulses[0].npe + channels.regions.integral",
+		"0 -100 5 -91 10 -82");
+    //sizes
+    CheckValues(event, "@channels.size()", "3");
+    CheckValues(event, "channels.@pulses.size()", "1 2 3");
+    //reductions
+    CheckValues(event, "Sum$(channels.pulses.npe)", "84");
+    CheckValues(event, "Max$(channels.pulses.npe) - "
+		"Min$(channels.pulses.npe)", "22");
+    CheckValues(event, "Length$(channels.pulses.npe)", "6");
+    CheckValues(event, "Sum$(channels.pulses.npe) / channels.channel_id",
+		"0 84 42");
+  }
+  
+  void TestGrouping(const EventData& event)
+  {
+    //identical terms are compiled once
+    EventFormula formula;
+    const int a = formula.AddTerm("channels.pulses.npe*2");
+    const int b = formula.AddTerm("channels.pulses.npe * 2");
+    const int c = formula.AddTerm("sqrt(channels.pulses.npe*2) + "
+				  "channels.pulses.npe*2");
+    if(a != 0 || b != 0 || c != 1 || formula.GetNTerms() != 2){
+      std::cerr<<"  FAIL duplicate terms got indices "<<a<<" "<<b<<" "<<c
+	       <<"\n";
+      failures++;
+    }
+    std::vector<double> values;
+    if(formula.Evaluate(&event, values) != 6 || values.size() != 12 ||
+       values[2] != 20 || std::fabs(values[3] - (std::sqrt(20.)+20)) > 1e-12){
+      std::cerr<<"  FAIL shared subexpressions: "<<Format(values)<<"\n";
+      failures++;
+    }
+    
+    //formulas with the same signature loop the same way
+    CheckSignature("channels.pulses.npe", 
+		   "channels[@0];channels[@0].pulses[@1];");
+    CheckSignature("channels.pulses.integral > channels.pulses.npe",
+		   "channels[@0];channels[@0].pulses[@1];");
+    CheckSignature("channels[0].regions[1].integral + @channels.size()",
+		   "channels[0];channels[0].regions[1];");
+    CheckSignature("channels.@pulses.size()", "channels[@0];");
+    CheckSignature("Sum$(channels.pulses.npe)", "");
+    CheckValues(event, "channels.pulses.npe", "channels.pulses.integral",
+		"0 0 10 -10 11 -11 20 -20 21 -21 22 -22");
+    
+    //branches needed to read the terms
+    EventFormula branches;
+    branches.AddTerm("-channels.regions[0].integral");
+    branches.AddTerm("Sum$(channels.pulses.fit.chi2) + s1_full");
+    std::set<std::string> names;
+    branches.GetBranchNames(names);
+    std::string list;
+    for(std::set<std::string>::iterator it = names.begin(); 
+	it != names.end(); ++it)
+      list += *it + " ";
+    if(list != "channels channels.pulses channels.pulses.fit "
+       "channels.pulses.fit.chi2 channels.regions channels.regions.integral "
+       "s1_full "){
+      std::cerr<<"  FAIL branch names: "<<list<<"\n";
+      failures++;
+    }
+  }
+  
+  void TestErrors()
+  {
+    CheckError("channels.pulses", "\"pulses\" is a Pulse; select one of its members");
+    CheckError("channels.foo", "No member named \"foo\" in ChannelData");
+    CheckError("sqrt(2", "Expected , or ) in arguments of sqrt");
+    CheckError("1 2", "Unexpected character at position 2");
+    CheckError("Length$(channels.pulses)", "select one of its members");
+  }
+}
+
+int main()
+{
+  EventData event;
+  FillEvent(event);
+  TestOperators(event);
+  TestFunctions(event);
+  TestLoops(event);
+  TestGrouping(event);
+  TestErrors();
+  if(failures){
+    std::cerr<<"test_eventformula: "<<failures<<" failures\n";
+    return 1;
+  }
+  std::cout<<"test_eventformula: OK\n";
+  return 0;
+}
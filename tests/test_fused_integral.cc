@@ -0,0 +1,145 @@
+/** @file test_fused_integral.cc
+    @brief Check that fusing the integration into BaselineFinder changes nothing
+    
+    Runs BaselineFinder and Integrator over the same synthetic channel twice,
+    once with Integrator::fuse_with_baseline off and once with it on, and 
+    requires the subtracted waveform, integral and derived quantities to be
+    identical.
+*/
+
+#include "EventHandler.hh"
+#include "BaselineFinder.hh"
+#include "Integrator.hh"
+#include "ChannelData.hh"
+#include <iostream>
+#include <sstream>
+#include <cmath>
+
+namespace {
+  int failures = 0;
+  
+  template<class T> void Compare(const char* what, const T& a, const T& b)
+  {
+    if(!(a == b)){
+      std::cerr<<"  MISMATCH in "<<what<<": "<<a<<" != "<<b<<"\n";
+      failures++;
+    }
+  }
+  
+  void CompareVectors(const char* what, const std::vector<double>& a,
+		      const std::vector<double>& b)
+  {
+    Compare((std::string(what)+".size()").c_str(), a.size(), b.size());
+    for(size_t i=0; i<a.size() && i<b.size(); i++){
+      if(a[i] != b[i]){
+	std::cerr<<"  MISMATCH in "<<what<<"["<<i<<"]: "
+		 <<a[i]<<" != "<<b[i]<<"\n";
+	failures++;
+	return;
+      }
+    }
+  }
+  
+  /// A noisy baseline near 3800 counts with a few negative pulses
+  void FillChannel(ChannelData& ch)
+  {
+    ch.channel_id = 0;
+    ch.nsamps = 4000;
+    ch.sample_bits = 12;
+    ch.sample_rate = 250;
+    ch.trigger_index = 500;
+    ch.native_sample_bytes = 0;
+    ch.waveform.resize(ch.nsamps);
+    unsigned int seed = 12345;
+    for(int i=0; i<ch.nsamps; i++){
+      seed = seed*1103515245u + 12345u;
+      double noise = (int)((seed>>16)%5) - 2;
+      double drift = 3*std::sin(i/700.);
+      ch.waveform[i] = 3800 + std::floor(drift) + noise;
+    }
+    const int starts[] = { 520, 1200, 1230, 2900 };
+    const double heights[] = { 400, 60, 25, 150 };
+    for(int p=0; p<4; p++){
+      for(int i=starts[p]; i<ch.nsamps && i<starts[p]+200; i++)
+	ch.waveform[i] -= std::floor(heights[p]*std::exp(-(i-starts[p])/40.));
+    }
+  }
+  
+  void Configure(BaseModule* mod, const std::string& config)
+  {
+    std::istringstream in(config);
+    mod->ReadFrom(in);
+  }
+  
+  int Run(BaselineFinder* finder, Integrator* integrator, ChannelData& ch)
+  {
+    if(finder->Initialize() || integrator->Initialize())
+      return 1;
+    if(finder->Process(&ch) || integrator->Process(&ch))
+      return 1;
+    return 0;
+  }
+}
+
+int main()
+{
+  EventHandler* handler = EventHandler::GetInstance();
+  BaselineFinder* finder = handler->AddModule<BaselineFinder>();
+  Integrator* integrator = handler->AddModule<Integrator>();
+  Configure(finder, "drifting_params ( save_interpolations true )");
+  
+  const char* thresholds[] = { "0", "1.5" };
+  for(int t=0; t<2; t++){
+    std::cout<<"  threshold "<<thresholds[t]<<"\n";
+    ChannelData separate, fused;
+    FillChannel(separate);
+    FillChannel(fused);
+    
+    Configure(integrator, std::string("fuse_with_baseline false threshold ")+
+	      thresholds[t]);
+    if(Run(finder, integrator, separate)){
+      std::cerr<<"  separate pass failed\n";
+      return 1;
+    }
+    Configure(integrator, "fuse_with_baseline true");
+    if(Run(finder, integrator, fused)){
+      std::cerr<<"  fused pass failed\n";
+      return 1;
+    }
+    
+    Compare("found_baseline", separate.baseline.found_baseline,
+	    fused.baseline.found_baseline);
+    if(!separate.baseline.found_baseline){
+      std::cerr<<"  no baseline found in the synthetic waveform\n";
+      return 1;
+    }
+    Compare("separate.integral_fused", separate.integral_fused, false);
+    Compare("fused.integral_fused", fused.integral_fused, true);
+    CompareVectors("subtracted_waveform", separate.subtracted_waveform,
+		   fused.subtracted_waveform);
+    CompareVectors("integral", separate.integral, fused.integral);
+    Compare("integral_max", separate.integral_max, fused.integral_max);
+    Compare("integral_min", separate.integral_min, fused.integral_min);
+    Compare("integral_max_index", separate.integral_max_index, 
+	    fused.integral_max_index);
+    Compare("integral_min_index", separate.integral_min_index, 
+	    fused.integral_min_index);
+    Compare("integral_max_time", separate.integral_max_time, 
+	    fused.integral_max_time);
+    Compare("integral_min_time", separate.integral_min_time, 
+	    fused.integral_min_time);
+    
+    const std::vector<Spe>& a = separate.baseline.interpolations;
+    const std::vector<Spe>& b = fused.baseline.interpolations;
+    Compare("interpolations.size()", a.size(), b.size());
+    for(size_t i=0; i<a.size() && i<b.size(); i++)
+      Compare("interpolation integral", a[i].integral, b[i].integral);
+  }
+  
+  if(failures){
+    std::cerr<<"test_fused_integral: "<<failures<<" mismatches\n";
+    return 1;
+  }
+  std::cout<<"test_fused_integral: OK\n";
+  return 0;
+}
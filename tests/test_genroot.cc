@@ -0,0 +1,234 @@
+/** @file test_genroot.cc
+    @brief Check that genroot --jobs gives the same output as a single job
+
+    Writes a small raw file of events without data blocks, processes it with
+    bin/genroot using one job and using three, and compares the Events trees
+    and the run info of the two outputs.  A gzip-compressed copy of the file
+    must fall back to a single job and give the same output as well.
+*/
+
+#include "Reader.hh"
+#include "EventData.hh"
+#include "runinfo.hh"
+#include "TFile.h"
+#include "TTree.h"
+#include "TList.h"
+#include <zlib.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace {
+  int failures = 0;
+  const int nevents = 30;
+  const uint32_t run_id = 42;
+  const char* genroot = "bin/genroot";
+
+  uint32_t Timestamp(uint32_t id){ return 1000 + 3*id + id%4; }
+
+  /// Write nevents events with no data blocks into a raw file, compressed
+  /// if compress is set
+  int WriteRawFile(const std::string& filename, bool compress)
+  {
+    std::string data;
+    Reader::global_header ghead;
+    ghead.file_size = 0;
+    ghead.start_time = Timestamp(0);
+    ghead.end_time = Timestamp(nevents-1);
+    ghead.run_id = run_id;
+    ghead.file_index = 0;
+    ghead.nevents = nevents;
+    ghead.event_id_min = 0;
+    ghead.event_id_max = nevents-1;
+    data.append((const char*)&ghead, sizeof(ghead));
+    for(int id=0; id<nevents; ++id){
+      Reader::event_header ehead;
+      ehead.event_id = id;
+      ehead.timestamp = Timestamp(id);
+      ehead.nblocks = 0;
+      data.append((const char*)&ehead, sizeof(ehead));
+    }
+    if(!compress){
+      std::ofstream out(filename.c_str(), std::ios::binary);
+      out.write(data.data(), data.size());
+      return !out.good();
+    }
+    gzFile out = gzopen(filename.c_str(), "wb");
+    if(!out)
+      return 1;
+    gzwrite(out, data.data(), data.size());
+    return gzclose(out) != Z_OK;
+  }
+
+  /// The DAQ configuration saved with a run; no boards are needed
+  int WriteSavedConfig(const std::string& filename)
+  {
+    std::ofstream cfg(filename.c_str());
+    cfg<<"V172X_Params ( )\n";
+    return !cfg.good();
+  }
+
+  /// Only unpack the headers and write them out
+  int WriteConfig(const std::string& filename)
+  {
+    std::ofstream cfg(filename.c_str());
+    cfg<<"modules (\n";
+    const char* disabled[] = { "SumChannels", "BaselineFinder", "Integrator",
+			       "PulseFinder", "EvalRois", "S1S2Evaluation",
+			       "eTrainFinder", "SpeFinder", "PulseShapeEval",
+			       "SumOfIntegralEval", "AverageWaveforms" };
+    for(size_t i=0; i<sizeof(disabled)/sizeof(disabled[0]); ++i)
+      cfg<<"  "<<disabled[i]<<" ( enabled false )\n";
+    cfg<<"  ConvertData ( enabled true )\n"
+       <<"  RootWriter ( enabled true )\n"
+       <<")\n";
+    return !cfg.good();
+  }
+
+  int RunGenroot(const std::string& cfg, const std::string& input,
+		 const std::string& output, int njobs)
+  {
+    std::ostringstream cmd;
+    cmd<<genroot<<" --cfg "<<cfg<<" --rootfile "<<output<<" --jobs "<<njobs
+       <<" "<<input<<" > "<<output<<".log 2>&1";
+    if(std::system(cmd.str().c_str()) != 0){
+      std::cerr<<"  FAIL "<<cmd.str()<<"\n";
+      failures++;
+      return 1;
+    }
+    return 0;
+  }
+
+  /// Does the log genroot wrote for output contain text?
+  bool LogContains(const std::string& output, const std::string& text)
+  {
+    std::ifstream log((output + ".log").c_str());
+    std::string line;
+    while(std::getline(log, line)){
+      if(line.find(text) != std::string::npos)
+	return true;
+    }
+    return false;
+  }
+
+  template<class T>
+  bool Compare(const char* label, const char* what, const T& a, const T& b)
+  {
+    if(a == b)
+      return true;
+    std::cerr<<"  FAIL "<<label<<": "<<what<<" "<<a<<" != "<<b<<"\n";
+    failures++;
+    return false;
+  }
+
+  /// Compare the Events entries and run info of two genroot outputs
+  void CompareOutputs(const char* label, const std::string& expected_file,
+		      const std::string& found_file)
+  {
+    TFile expected(expected_file.c_str());
+    TFile found(found_file.c_str());
+    TTree* expected_tree = (TTree*)(expected.Get("Events"));
+    TTree* found_tree = (TTree*)(found.Get("Events"));
+    if(!expected_tree || !found_tree){
+      std::cerr<<"  FAIL "<<label<<": no Events tree\n";
+      failures++;
+      return;
+    }
+    if(!Compare(label, "entries", expected_tree->GetEntries(),
+		found_tree->GetEntries()))
+      return;
+    Compare(label, "entries", expected_tree->GetEntries(), (Long64_t)nevents);
+
+    EventData* a = 0;
+    EventData* b = 0;
+    expected_tree->SetBranchAddress(EventData::GetBranchName(), &a);
+    found_tree->SetBranchAddress(EventData::GetBranchName(), &b);
+    for(Long64_t i=0; i<expected_tree->GetEntries(); ++i){
+      expected_tree->GetEntry(i);
+      found_tree->GetEntry(i);
+      if(!Compare(label, "event_id", a->event_id, b->event_id) ||
+	 !Compare(label, "run_id", a->run_id, b->run_id) ||
+	 !Compare(label, "timestamp", a->timestamp, b->timestamp) ||
+	 !Compare(label, "event_time", a->event_time, b->event_time) ||
+	 !Compare(label, "dt", a->dt, b->dt) ||
+	 !Compare(label, "nchans", a->nchans, b->nchans))
+	break;
+    }
+
+    runinfo* ia = (runinfo*)(expected_tree->GetUserInfo()->At(0));
+    runinfo* ib = (runinfo*)(found_tree->GetUserInfo()->At(0));
+    if(!ia || !ib){
+      std::cerr<<"  FAIL "<<label<<": no run info\n";
+      failures++;
+    }
+    else{
+      Compare(label, "runid", ia->runid, ib->runid);
+      Compare(label, "starttime", ia->starttime, ib->starttime);
+      Compare(label, "endtime", ia->endtime, ib->endtime);
+      Compare(label, "events", ia->events, ib->events);
+      Compare(label, "triggers", ia->triggers, ib->triggers);
+      Compare(label, "metadata size", ia->metadata.size(),
+	      ib->metadata.size());
+      for(runinfo::stringmap::const_iterator it = ia->metadata.begin();
+	  it != ia->metadata.end(); ++it){
+	runinfo::stringmap::const_iterator match = 
+	  ib->metadata.find(it->first);
+	Compare(label, it->first.c_str(), it->second,
+		match == ib->metadata.end() ? std::string("(missing)") :
+		match->second);
+      }
+    }
+    expected_tree->ResetBranchAddresses();
+    found_tree->ResetBranchAddresses();
+    delete a;
+    delete b;
+  }
+}
+
+int main()
+{
+  if(access(genroot, X_OK) != 0){
+    std::cerr<<"test_genroot: "<<genroot<<" has not been built\n";
+    return 1;
+  }
+  std::ostringstream dirstream;
+  dirstream<<"/tmp/test_genroot_"<<getpid();
+  const std::string dir = dirstream.str();
+  mkdir(dir.c_str(), 0755);
+  const std::string raw = dir + "/run.out";
+  const std::string gzraw = dir + "/rungz.out.gz";
+  const std::string cfg = dir + "/test_genroot.cfg";
+  //Reader looks for the saved DAQ configuration next to the raw file
+  if(WriteRawFile(raw, false) || WriteRawFile(gzraw, true) ||
+     WriteConfig(cfg) || WriteSavedConfig(dir + "/run.cfg") ||
+     WriteSavedConfig(dir + "/rungz.cfg")){
+    std::cerr<<"test_genroot: unable to write the input files in "<<dir<<"\n";
+    return 1;
+  }
+
+  const std::string single = dir + "/single.root";
+  const std::string parallel = dir + "/parallel.root";
+  const std::string compressed = dir + "/compressed.root";
+  if(!RunGenroot(cfg, raw, single, 1) && !RunGenroot(cfg, raw, parallel, 3))
+    CompareOutputs("--jobs 3", single, parallel);
+  if(!RunGenroot(cfg, gzraw, compressed, 3)){
+    if(!LogContains(compressed, "processing with a single job")){
+      std::cerr<<"  FAIL compressed --jobs 3 was not run as a single job\n";
+      failures++;
+    }
+    CompareOutputs("compressed --jobs 3", single, compressed);
+  }
+
+  if(failures){
+    std::cerr<<"test_genroot: "<<failures<<" failures; output is left in "
+	     <<dir<<"\n";
+    return 1;
+  }
+  std::system(("rm -rf " + dir).c_str());
+  std::cout<<"test_genroot: OK\n";
+  return 0;
+}
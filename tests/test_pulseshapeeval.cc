@@ -0,0 +1,225 @@
+/** @file test_pulseshapeeval.cc
+    @brief Compare the PulseShapeEval bin contents with the original binning
+
+    The pulse shape used to be built by walking the samples through a TH1F
+    with the binning of the sum channel's weights.  This repeats that
+    algorithm here and checks that PulseShapeEval puts the same samples in
+    each bin when no sample lies exactly on a bin edge.  The bin contents are
+    read back one at a time by giving each weight histogram a single
+    non-zero bin.  When samples do lie on the edges, each must be counted
+    once, in the later bin; the original walk dropped such bins entirely.
+*/
+
+#include "PulseShapeEval.hh"
+#include "EventHandler.hh"
+#include "Event.hh"
+#include "EventData.hh"
+#include "TFile.h"
+#include "TH1F.h"
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <cstdio>
+#include <cmath>
+#include <unistd.h>
+
+namespace {
+  int failures = 0;
+  const int nsamps = 400;
+  const double sample_rate = 250;
+  const int trigger_index = 100;
+
+  /// Integer samples, so the single precision TH1F below is exact
+  void FillChannel(ChannelData& ch)
+  {
+    ch.channel_id = 0;
+    ch.nsamps = nsamps;
+    ch.sample_rate = sample_rate;
+    ch.trigger_index = trigger_index;
+    ch.baseline.found_baseline = true;
+    ch.baseline.saturated = false;
+    ch.subtracted_waveform.resize(nsamps);
+    unsigned int seed = 4321;
+    for(int i=0; i<nsamps; i++){
+      seed = seed*1103515245u + 12345u;
+      ch.subtracted_waveform[i] = -(int)((seed>>16)%200) + 20;
+    }
+    //pulses well inside, clipped by their start, and running off the end
+    const int peaks[] = { 150, 104, 230, 395, 3 };
+    const int starts[] = { 140, 100, 228, 390, 0 };
+    for(int p=0; p<5; p++){
+      Pulse pulse;
+      pulse.start_index = starts[p];
+      pulse.peak_index = peaks[p];
+      pulse.peak_time = ch.SampleToTime(peaks[p]);
+      ch.pulses.push_back(pulse);
+    }
+  }
+
+  /// The pulse shape as the original TH1F walk built it
+  std::vector<double> OriginalShape(ChannelData& ch, const Pulse& pulse,
+				    const std::vector<double>& edges)
+  {
+    const int n_bins = (int)edges.size() - 1;
+    TH1F event_shape("event_shape", "event_shape", n_bins, &(edges[0]));
+    event_shape.SetDirectory(0);
+    const double* wave = &(ch.subtracted_waveform[0]);
+    int pulse_index = pulse.start_index;
+    for(int i = 1; i <= n_bins; i++){
+      double t0 = event_shape.GetBinLowEdge(i);
+      double t1 = event_shape.GetBinLowEdge(i+1);
+      double z = 0;
+      if (ch.TimeToSample(pulse.peak_time + t1) < 0 ||
+	  ch.TimeToSample(pulse.peak_time + t0) >= ch.nsamps){
+	event_shape.SetBinContent(i, 0);
+      }
+      else{
+	while (ch.SampleToTime(pulse_index) < pulse.peak_time + t0)
+	  pulse_index++;
+	while (ch.SampleToTime(pulse_index) > pulse.peak_time + t0 &&
+	       ch.SampleToTime(pulse_index) < pulse.peak_time + t1 &&
+	       pulse_index < ch.nsamps){
+	  z = z - wave[pulse_index];
+	  pulse_index++;
+	}
+	event_shape.SetBinContent(i, z);
+      }
+    }
+    std::vector<double> shape(n_bins);
+    for(int i = 1; i <= n_bins; i++)
+      shape[i-1] = event_shape.GetBinContent(i);
+    return shape;
+  }
+
+  /// Each sample from the first edge to the last in exactly one bin,
+  /// for edges that fall on whole samples from the peak
+  std::vector<double> EdgeShape(ChannelData& ch, const Pulse& pulse,
+				const std::vector<double>& edges)
+  {
+    const int n_bins = (int)edges.size() - 1;
+    std::vector<double> shape(n_bins, 0);
+    for(int i = 0; i < n_bins; i++){
+      const int begin = pulse.peak_index + 
+	(int)std::floor(edges[i]*sample_rate + 0.5);
+      const int end = pulse.peak_index + 
+	(int)std::floor(edges[i+1]*sample_rate + 0.5);
+      for(int samp = begin; samp < end; samp++){
+	if(samp >= pulse.start_index && samp >= 0 && samp < ch.nsamps)
+	  shape[i] -= ch.subtracted_waveform[samp];
+      }
+    }
+    return shape;
+  }
+
+  /// Write the four weight histograms for channel 0 and the sum channel,
+  /// each with a single unit weight, at bins first .. first+3
+  int WriteShapes(const std::string& filename,
+		  const std::vector<double>& edges, int first)
+  {
+    TFile f(filename.c_str(), "RECREATE");
+    if(!f.IsOpen())
+      return 1;
+    const char* names[4] = { "gatti_weights", "ll_ele_weights",
+			     "ll_nuc_weights", "ll_r_weights" };
+    const char* suffixes[2] = { "_0", "_-2" };
+    const int n_bins = (int)edges.size() - 1;
+    for(int s=0; s<2; s++){
+      for(int w=0; w<4; w++){
+	std::string name = std::string(names[w]) + suffixes[s];
+	TH1F hist(name.c_str(), name.c_str(), n_bins, &(edges[0]));
+	if(first + w < n_bins)
+	  hist.SetBinContent(first + w + 1, 1);
+	hist.Write();
+      }
+    }
+    f.Close();
+    return 0;
+  }
+
+  void Configure(BaseModule* mod, const std::string& config)
+  {
+    std::istringstream in(config);
+    mod->ReadFrom(in);
+  }
+
+  /// Compare PulseShapeEval's bin contents with the expected shapes
+  void CheckBins(const char* label, PulseShapeEval* shapeeval,
+		 const std::vector<double>& edges, bool on_edges)
+  {
+    std::ostringstream filename;
+    filename<<"/tmp/test_pulseshapeeval_"<<getpid()<<".root";
+    Configure(shapeeval, "pulse_shape_file " + filename.str());
+    const int n_bins = (int)edges.size() - 1;
+    for(int first = 0; first < n_bins; first += 4){
+      if(WriteShapes(filename.str(), edges, first) ||
+	 shapeeval->Initialize()){
+	std::cerr<<"  FAIL "<<label<<": unable to load "<<filename.str()<<"\n";
+	failures++;
+	return;
+      }
+      EventPtr evt(new Event(RawEventPtr()));
+      EventDataPtr data = evt->GetEventData();
+      data->channels.push_back(ChannelData());
+      ChannelData& ch = data->channels.back();
+      FillChannel(ch);
+      if(shapeeval->Process(evt)){
+	std::cerr<<"  FAIL "<<label<<": Process returned an error\n";
+	failures++;
+	return;
+      }
+      shapeeval->Finalize();
+
+      for(size_t p=0; p<ch.pulses.size(); p++){
+	const Pulse& pulse = ch.pulses[p];
+	std::vector<double> expected = on_edges ?
+	  EdgeShape(ch, pulse, edges) : OriginalShape(ch, pulse, edges);
+	double integral = 0;
+	for(int i=0; i<n_bins; i++)
+	  integral += expected[i];
+	if(pulse.pulse_shape_int != integral){
+	  std::cerr<<"  FAIL "<<label<<": pulse "<<p<<" integral "
+		   <<pulse.pulse_shape_int<<", expected "<<integral<<"\n";
+	  failures++;
+	}
+	const double found[4] = { pulse.gatti, pulse.ll_ele,
+				  pulse.ll_nuc, pulse.ll_r };
+	for(int w=0; w<4 && first + w < n_bins; w++){
+	  double bin = expected[first + w];
+	  if(integral != 0)
+	    bin = bin / integral;
+	  if(found[w] != bin){
+	    std::cerr<<"  FAIL "<<label<<": pulse "<<p<<" bin "<<first + w
+		     <<" has "<<found[w]<<", expected "<<bin<<"\n";
+	    failures++;
+	  }
+	}
+      }
+    }
+    std::remove(filename.str().c_str());
+  }
+}
+
+int main()
+{
+  EventHandler* handler = EventHandler::GetInstance();
+  PulseShapeEval* shapeeval = handler->AddModule<PulseShapeEval>();
+
+  //edges never a whole number of samples (4 ns) from the peak
+  std::vector<double> edges;
+  for(int i=0; i<=12; i++)
+    edges.push_back(-0.0502 + i*0.0301);
+  CheckBins("between samples", shapeeval, edges, false);
+
+  //every edge on a sample
+  edges.clear();
+  for(int i=0; i<=12; i++)
+    edges.push_back(-0.04 + i*0.008);
+  CheckBins("on samples", shapeeval, edges, true);
+
+  if(failures){
+    std::cerr<<"test_pulseshapeeval: "<<failures<<" failures\n";
+    return 1;
+  }
+  std::cout<<"test_pulseshapeeval: OK\n";
+  return 0;
+}
@@ -0,0 +1,168 @@
+/** @file test_spectrumcache.cc
+    @brief Check that SpectrumCache replaces a cached entry when refilled
+
+    Fills a spectrum from a small Events tree into a fresh cache, spoils the
+    cached copy, then refills.  The refill must overwrite the spoiled entry,
+    so that loading the cache again gives the spectra of the tree.
+*/
+
+#include "SpectrumCache.hh"
+#include "FitTH1F.hh"
+#include "EventData.hh"
+#include "TFile.h"
+#include "TTree.h"
+#include "TDirectory.h"
+#include "TList.h"
+#include "TH1D.h"
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+#include <map>
+#include <unistd.h>
+
+namespace {
+  int failures = 0;
+  const int nevents = 50;
+  const int nchannels = 2;
+  const int nbins = 20;
+  const double xmin = 0, xmax = 100;
+
+  /// Integral of region 0 of channel ch in event evt
+  double Integral(int evt, int ch){ return -((evt*(3+ch)) % 97 + 0.5); }
+
+  int WriteInput(const std::string& filename)
+  {
+    TFile f(filename.c_str(), "RECREATE");
+    if(!f.IsOpen())
+      return 1;
+    TTree tree("Events", "Events");
+    EventData* event = new EventData;
+    tree.Branch(EventData::GetBranchName(), &event);
+    for(int evt=0; evt<nevents; evt++){
+      event->Clear();
+      event->event_id = evt;
+      for(int ch=0; ch<nchannels; ch++){
+	event->channels.push_back(ChannelData());
+	event->channels.back().channel_id = ch;
+	Roi roi;
+	roi.integral = Integral(evt, ch);
+	event->channels.back().regions.push_back(roi);
+      }
+      tree.Fill();
+    }
+    tree.Write();
+    f.Close();
+    delete event;
+    return 0;
+  }
+
+  /// Compare the spectra of cache with the values written by WriteInput
+  void CheckSpectra(const char* label, const SpectrumCache& cache)
+  {
+    const std::map<int, FitTH1F*>& spectra = cache.GetSpectra(0);
+    if((int)spectra.size() != nchannels){
+      std::cerr<<"  FAIL "<<label<<": "<<spectra.size()<<" channels, "
+	       <<"expected "<<nchannels<<"\n";
+      failures++;
+      return;
+    }
+    for(int ch=0; ch<nchannels; ch++){
+      TH1D expected("expected", "expected", nbins, xmin, xmax);
+      expected.SetDirectory(0);
+      for(int evt=0; evt<nevents; evt++)
+	expected.Fill(-Integral(evt, ch));
+      std::map<int, FitTH1F*>::const_iterator it = spectra.find(ch);
+      if(it == spectra.end()){
+	std::cerr<<"  FAIL "<<label<<": no spectrum for channel "<<ch<<"\n";
+	failures++;
+	return;
+      }
+      const FitTH1F* hist = it->second;
+      for(int bin=0; bin<=nbins+1; bin++){
+	if(hist->GetBinContent(bin) != expected.GetBinContent(bin)){
+	  std::cerr<<"  FAIL "<<label<<": channel "<<ch<<" bin "<<bin
+		   <<" has "<<hist->GetBinContent(bin)<<", expected "
+		   <<expected.GetBinContent(bin)<<"\n";
+	  failures++;
+	  return;
+	}
+      }
+    }
+  }
+
+  /// Overwrite the cached spectrum of channel 0 with an empty one
+  int SpoilCache(const std::string& cachefile)
+  {
+    TFile f(cachefile.c_str(), "UPDATE");
+    TDirectory* dir = 0;
+    TIter next(f.GetListOfKeys());
+    while(TObject* key = next()){
+      std::string name = key->GetName();
+      if(name.compare(0, 8, "spectra_") == 0)
+	dir = f.GetDirectory(name.c_str());
+    }
+    if(!dir)
+      return 1;
+    FitTH1F empty("spoiled", "spoiled", nbins, xmin, xmax);
+    dir->WriteTObject(&empty, "ch0", "Overwrite");
+    f.Close();
+    return 0;
+  }
+
+  void AddSpectrum(SpectrumCache& cache)
+  {
+    cache.AddSpectrum("integral", "-channels.regions[0].integral", "",
+		      nbins, xmin, xmax);
+  }
+}
+
+int main()
+{
+  std::ostringstream base;
+  base<<"/tmp/test_spectrumcache_"<<getpid();
+  const std::string input = base.str() + ".root";
+  const std::string cachefile = base.str() + ".spectra.root";
+  if(WriteInput(input)){
+    std::cerr<<"test_spectrumcache: unable to write "<<input<<"\n";
+    return 1;
+  }
+
+  SpectrumCache filled(input.c_str());
+  AddSpectrum(filled);
+  if(filled.Fill() || filled.GetEntries() != nevents){
+    std::cerr<<"  FAIL filling from "<<input<<"\n";
+    failures++;
+  }
+  CheckSpectra("filled", filled);
+
+  if(SpoilCache(cachefile)){
+    std::cerr<<"  FAIL no cached entry in "<<cachefile<<"\n";
+    failures++;
+  }
+
+  SpectrumCache refilled(input.c_str());
+  AddSpectrum(refilled);
+  if(refilled.Fill(true)){
+    std::cerr<<"  FAIL refilling from "<<input<<"\n";
+    failures++;
+  }
+  CheckSpectra("refilled", refilled);
+
+  //this one is read from the cache, which the refill must have replaced
+  SpectrumCache loaded(input.c_str());
+  AddSpectrum(loaded);
+  if(loaded.Fill()){
+    std::cerr<<"  FAIL loading "<<cachefile<<"\n";
+    failures++;
+  }
+  CheckSpectra("loaded", loaded);
+
+  std::remove(input.c_str());
+  std::remove(cachefile.c_str());
+  if(failures){
+    std::cerr<<"test_spectrumcache: "<<failures<<" failures\n";
+    return 1;
+  }
+  std::cout<<"test_spectrumcache: OK\n";
+  return 0;
+}
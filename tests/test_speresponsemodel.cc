@@ -0,0 +1,88 @@
+/** @file test_speresponsemodel.cc
+    @brief Check SPEResponseModel against FitOverROI::SPEFunc
+    
+    The model caches the shapes of the single pe response between calls,
+    so it is evaluated along a random walk of the parameters which, like a
+    minimiser, changes one parameter at a time.  Every bin must agree with
+    SPEFunc to rounding, and Chi2 with the chi-square TH1::Fit computes.
+*/
+
+#include "SPEResponseModel.hh"
+#include "FitOverROI.hh"
+#include "TH1D.h"
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+
+using namespace FitOverROI;
+
+int main()
+{
+  const double xmin = -30, xmax = 180;
+  TH1D spe("spe", "spe", 240, -40, 200);
+  int nchi2bins = 0;
+  for(int bin=1; bin<=240; bin++){
+    //some empty bins, which Chi2 must skip
+    const double content = (bin%7 == 0 ? 0 : 100 + bin);
+    spe.SetBinContent(bin, content);
+    spe.SetBinError(bin, std::sqrt(content));
+    const double x = spe.GetBinCenter(bin);
+    if(content > 0 && x >= xmin && x <= xmax)
+      nchi2bins++;
+  }
+  
+  SPEResponseModel model(&spe, xmin, xmax);
+  int failures = 0;
+  if(model.GetNChi2Bins() != nchi2bins){
+    std::cerr<<"  FAIL "<<model.GetNChi2Bins()<<" bins in Chi2, expected "
+	     <<nchi2bins<<"\n";
+    failures++;
+  }
+  
+  double params[NPAR] = { 5e5, 0.8, 90, 30, 40, 0.2, 8, 1.5 };
+  double maxrel = 0, maxchi2rel = 0;
+  std::srand(1);
+  for(int step=0; step<200; step++){
+    if(step > 0){
+      const int par = std::rand() % NPAR;
+      params[par] *= 1 + 0.1*(std::rand()/(double)RAND_MAX - 0.5);
+    }
+    const std::vector<double>& values = model.Evaluate(params);
+    const std::vector<double>& x = model.GetX();
+    if((int)values.size() != model.GetNBins() || x.size() != values.size()){
+      std::cerr<<"  FAIL inconsistent number of bins\n";
+      return 1;
+    }
+    double chi2 = 0;
+    for(int i=0; i<model.GetNBins(); i++){
+      double xi = x[i];
+      const double expected = SPEFunc(&xi, params);
+      const double rel = std::fabs(values[i] - expected) / 
+	(std::fabs(expected) + 1e-300);
+      if(rel > maxrel)
+	maxrel = rel;
+      const int bin = spe.FindBin(xi);
+      if(spe.GetBinError(bin) > 0){
+	const double r = (spe.GetBinContent(bin) - expected) / 
+	  spe.GetBinError(bin);
+	chi2 += r*r;
+      }
+    }
+    const double chi2rel = std::fabs(model.Chi2(params) - chi2) / chi2;
+    if(chi2rel > maxchi2rel)
+      maxchi2rel = chi2rel;
+  }
+  
+  std::cout<<"  largest relative difference from SPEFunc "<<maxrel
+	   <<", from the chi-square "<<maxchi2rel<<"\n";
+  if(maxrel > 1e-12 || maxchi2rel > 1e-12){
+    std::cerr<<"  FAIL model differs from SPEFunc\n";
+    failures++;
+  }
+  if(failures){
+    std::cerr<<"test_speresponsemodel: "<<failures<<" failures\n";
+    return 1;
+  }
+  std::cout<<"test_speresponsemodel: OK\n";
+  return 0;
+}